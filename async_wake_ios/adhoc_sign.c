@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "adhoc_sign.h"
+#include "codesign.h"
+#include "sha256.h"
+
+// from <mach-o/loader.h>, which isn't there on Linux
+#define AS_MH_MAGIC_64 0xfeedfacf
+#define AS_MH_EXECUTE 0x2
+#define AS_CPU_TYPE_ARM64 0x0100000c
+#define AS_LC_SEGMENT_64 0x19
+#define AS_LC_CODE_SIGNATURE 0x1d
+#define AS_MACH_HEADER_64_SIZE 0x20
+#define AS_SEGMENT_COMMAND_64_SIZE 72
+#define AS_SECTION_64_SIZE 80
+#define AS_LINKEDIT_DATA_COMMAND_SIZE 16
+#define AS_SEGMENT_ALIGN 0x4000
+
+// from osfmk/kern/cs_blobs.h
+#define AS_CSMAGIC_REQUIREMENTS 0xfade0c01
+#define AS_CS_ADHOC 0x2
+#define AS_CS_EXECSEG_MAIN_BINARY 0x1
+#define AS_CD_VERSION 0x20400  // the first with the exec segment fields, which iOS 11 wants
+#define AS_CD_HEADER_SIZE 0x58
+#define AS_HASH_SIZE 32
+
+// below this many pages per thread it's quicker to hash them all on one
+#define AS_MIN_PAGES_PER_THREAD 256
+#define AS_PAGES_PER_BATCH 32
+
+struct layout {
+  uint32_t ncmds;
+  uint32_t sizeofcmds;
+  uint32_t filetype;
+  uint32_t linkedit_cmd;    // offset of the __LINKEDIT segment command
+  uint64_t linkedit_fileoff;
+  uint32_t signature_cmd;   // offset of LC_CODE_SIGNATURE, 0 to add one
+  uint64_t text_fileoff;
+  uint64_t text_filesize;
+
+  uint64_t code_limit;      // everything before the signature, which is what gets hashed
+  uint32_t ident_len;
+  uint32_t n_special_slots;
+  uint32_t n_code_slots;
+  uint32_t cd_len;
+  uint32_t n_blobs;
+  uint32_t sig_len;
+  uint64_t out_size;
+};
+
+struct hash_job {
+  const uint8_t* code;
+  uint64_t code_limit;
+  uint32_t first;
+  uint32_t last;
+  uint8_t* hashes;          // the CodeDirectory's code slots
+};
+
+static uint32_t le32(const uint8_t* p) {
+  return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+static uint64_t le64(const uint8_t* p) {
+  return ((uint64_t)le32(p + 4) << 32) | le32(p);
+}
+
+static void put_le32(uint8_t* p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static void put_le64(uint8_t* p, uint64_t v) {
+  put_le32(p, (uint32_t)v);
+  put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static void put_be32(uint8_t* p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static void put_be64(uint8_t* p, uint64_t v) {
+  put_be32(p, (uint32_t)(v >> 32));
+  put_be32(p + 4, (uint32_t)v);
+}
+
+static uint64_t align(uint64_t v, uint64_t a) {
+  return (v + a - 1) & ~(a - 1);
+}
+
+static int plan(const uint8_t* macho, size_t size, const struct adhoc_sign_options* opts, struct layout* l) {
+  memset(l, 0, sizeof(*l));
+  if (opts->identifier == NULL || size < AS_MACH_HEADER_64_SIZE) {
+    return 1;
+  }
+  if (le32(macho) != AS_MH_MAGIC_64 || le32(macho + 4) != AS_CPU_TYPE_ARM64) {
+    printf("[-]\tonly thin arm64 Mach-Os can be signed\n");
+    return 1;
+  }
+  l->filetype = le32(macho + 0xc);
+  l->ncmds = le32(macho + 0x10);
+  l->sizeofcmds = le32(macho + 0x14);
+  if ((uint64_t)AS_MACH_HEADER_64_SIZE + l->sizeofcmds > size) {
+    return 1;
+  }
+
+  // the first section's data, a new load command has to fit before it
+  uint64_t first_data = size;
+  uint64_t linkedit_filesize = 0;
+  uint32_t off = AS_MACH_HEADER_64_SIZE;
+  uint32_t end = AS_MACH_HEADER_64_SIZE + l->sizeofcmds;
+  for (uint32_t i = 0; i < l->ncmds; i++) {
+    if (end - off < 8) {
+      return 1;
+    }
+    uint32_t cmd = le32(macho + off);
+    uint32_t cmdsize = le32(macho + off + 4);
+    if (cmdsize < 8 || cmdsize > end - off) {
+      return 1;
+    }
+    if (cmd == AS_LC_SEGMENT_64) {
+      if (cmdsize < AS_SEGMENT_COMMAND_64_SIZE) {
+        return 1;
+      }
+      const char* name = (const char*)macho + off + 8;
+      uint64_t fileoff = le64(macho + off + 40);
+      uint64_t filesize = le64(macho + off + 48);
+      uint32_t nsects = le32(macho + off + 64);
+      if (nsects > (cmdsize - AS_SEGMENT_COMMAND_64_SIZE) / AS_SECTION_64_SIZE) {
+        return 1;
+      }
+      for (uint32_t s = 0; s < nsects; s++) {
+        uint32_t sect_offset = le32(macho + off + AS_SEGMENT_COMMAND_64_SIZE + s * AS_SECTION_64_SIZE + 48);
+        if (sect_offset != 0 && sect_offset < first_data) {
+          first_data = sect_offset;
+        }
+      }
+      if (!strncmp(name, "__TEXT", 16)) {
+        l->text_fileoff = fileoff;
+        l->text_filesize = filesize;
+      } else if (!strncmp(name, "__LINKEDIT", 16)) {
+        l->linkedit_cmd = off;
+        l->linkedit_fileoff = fileoff;
+        linkedit_filesize = filesize;
+      }
+    } else if (cmd == AS_LC_CODE_SIGNATURE) {
+      if (cmdsize < AS_LINKEDIT_DATA_COMMAND_SIZE) {
+        return 1;
+      }
+      l->signature_cmd = off;
+    }
+    off += cmdsize;
+  }
+  if (l->linkedit_cmd == 0 || l->linkedit_fileoff > size) {
+    printf("[-]\tno __LINKEDIT to put the signature in\n");
+    return 1;
+  }
+
+  if (l->signature_cmd != 0) {
+    // the old signature gets replaced, everything before it is kept as is
+    l->code_limit = le32(macho + l->signature_cmd + 8);
+    if (l->code_limit < l->linkedit_fileoff || l->code_limit > size) {
+      printf("[-]\tthe existing signature isn't in __LINKEDIT\n");
+      return 1;
+    }
+  } else {
+    if (l->linkedit_fileoff + linkedit_filesize < size) {
+      printf("[-]\tthere's data after __LINKEDIT\n");
+      return 1;
+    }
+    if ((uint64_t)end + AS_LINKEDIT_DATA_COMMAND_SIZE > first_data) {
+      printf("[-]\tno room for LC_CODE_SIGNATURE after the load commands\n");
+      return 1;
+    }
+    l->code_limit = align(l->linkedit_fileoff + linkedit_filesize, 16);
+  }
+  if (l->code_limit > UINT32_MAX) {
+    return 1;
+  }
+
+  l->ident_len = (uint32_t)strlen(opts->identifier) + 1;
+  l->n_special_slots = opts->entitlements ? CS_SLOT_ENTITLEMENTS : CS_SLOT_REQUIREMENTS;
+  l->n_code_slots = (uint32_t)((l->code_limit + (1 << ADHOC_SIGN_PAGE_SHIFT) - 1) >> ADHOC_SIGN_PAGE_SHIFT);
+  l->cd_len = AS_CD_HEADER_SIZE + l->ident_len + (l->n_special_slots + l->n_code_slots) * AS_HASH_SIZE;
+  l->n_blobs = opts->entitlements ? 4 : 3;
+  uint64_t sig_len = 12 + l->n_blobs * 8 + l->cd_len + 12 + 8;
+  if (opts->entitlements) {
+    sig_len += 8 + opts->entitlements_len;
+  }
+  sig_len = align(sig_len, 16);
+  if (sig_len > UINT32_MAX) {
+    return 1;
+  }
+  l->sig_len = (uint32_t)sig_len;
+  l->out_size = l->code_limit + l->sig_len;
+  return 0;
+}
+
+size_t adhoc_sign_size(const uint8_t* macho, size_t size, const struct adhoc_sign_options* opts) {
+  struct layout l;
+  return plan(macho, size, opts, &l) ? 0 : (size_t)l.out_size;
+}
+
+static void* hash_pages(void* arg) {
+  struct hash_job* job = arg;
+  struct sha256_message msgs[AS_PAGES_PER_BATCH];
+  for (uint32_t page = job->first; page < job->last; ) {
+    uint32_t n = 0;
+    uint32_t batch_start = page;
+    for (; n < AS_PAGES_PER_BATCH && page < job->last; n++, page++) {
+      uint64_t offset = (uint64_t)page << ADHOC_SIGN_PAGE_SHIFT;
+      uint64_t len = job->code_limit - offset;
+      msgs[n].data = job->code + offset;
+      msgs[n].len = len < (1 << ADHOC_SIGN_PAGE_SHIFT) ? len : (1 << ADHOC_SIGN_PAGE_SHIFT);
+    }
+    sha256_multi(msgs, n, (BYTE (*)[SHA256_BLOCK_SIZE])(job->hashes + (size_t)batch_start * AS_HASH_SIZE));
+  }
+  return NULL;
+}
+
+static void hash_code(const uint8_t* code, uint64_t code_limit, uint32_t n_pages, uint8_t* hashes, int threads) {
+  if (threads <= 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = ncpu > 0 ? (int)ncpu : 1;
+  }
+  if ((uint32_t)threads > n_pages / AS_MIN_PAGES_PER_THREAD) {
+    threads = n_pages / AS_MIN_PAGES_PER_THREAD;
+  }
+  if (threads < 1) {
+    threads = 1;
+  }
+  // picks the back end before there are threads to race over it
+  sha256_multi_backend();
+
+  struct hash_job* jobs = calloc(threads, sizeof(struct hash_job));
+  pthread_t* tids = calloc(threads, sizeof(pthread_t));
+  if (jobs == NULL || tids == NULL) {
+    free(jobs);
+    free(tids);
+    // all of it on this thread then, which needs nothing allocated
+    struct hash_job whole = {code, code_limit, 0, n_pages, hashes};
+    hash_pages(&whole);
+    return;
+  }
+  uint32_t per_thread = (n_pages + threads - 1) / threads;
+  for (int i = 0; i < threads; i++) {
+    jobs[i].code = code;
+    jobs[i].code_limit = code_limit;
+    jobs[i].first = i * per_thread < n_pages ? i * per_thread : n_pages;
+    jobs[i].last = jobs[i].first + per_thread < n_pages ? jobs[i].first + per_thread : n_pages;
+    jobs[i].hashes = hashes;
+  }
+  // this thread takes the first share rather than sitting in pthread_join
+  int started = 1;
+  for (int i = 1; i < threads; i++, started++) {
+    if (pthread_create(&tids[i], NULL, hash_pages, &jobs[i]) != 0) {
+      break;
+    }
+  }
+  hash_pages(&jobs[0]);
+  for (int i = started; i < threads; i++) {
+    hash_pages(&jobs[i]);
+  }
+  for (int i = 1; i < started; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  free(tids);
+  free(jobs);
+}
+
+static void sha256(const uint8_t* data, size_t len, uint8_t* hash) {
+  SHA256_CTX ctx;
+  sha256_init(&ctx);
+  sha256_update(&ctx, data, len);
+  sha256_final(&ctx, hash);
+}
+
+int adhoc_sign(const uint8_t* macho, size_t size, const struct adhoc_sign_options* opts, uint8_t* out, size_t out_size) {
+  struct layout l;
+  if (plan(macho, size, opts, &l) || out_size != l.out_size) {
+    return 1;
+  }
+  uint64_t keep = size < l.code_limit ? size : l.code_limit;
+  memcpy(out, macho, keep);
+  memset(out + keep, 0, out_size - keep);
+
+  // load commands first, they're part of the first page's hash
+  uint32_t sig_cmd = l.signature_cmd;
+  if (sig_cmd == 0) {
+    sig_cmd = AS_MACH_HEADER_64_SIZE + l.sizeofcmds;
+    put_le32(out + sig_cmd, AS_LC_CODE_SIGNATURE);
+    put_le32(out + sig_cmd + 4, AS_LINKEDIT_DATA_COMMAND_SIZE);
+    put_le32(out + 0x10, l.ncmds + 1);
+    put_le32(out + 0x14, l.sizeofcmds + AS_LINKEDIT_DATA_COMMAND_SIZE);
+  }
+  put_le32(out + sig_cmd + 8, (uint32_t)l.code_limit);
+  put_le32(out + sig_cmd + 12, l.sig_len);
+  uint64_t linkedit_filesize = l.out_size - l.linkedit_fileoff;
+  put_le64(out + l.linkedit_cmd + 32, align(linkedit_filesize, AS_SEGMENT_ALIGN));
+  put_le64(out + l.linkedit_cmd + 48, linkedit_filesize);
+
+  uint8_t* sig = out + l.code_limit;
+  uint32_t offset = 12 + l.n_blobs * 8;
+  uint32_t cd_offset = offset;
+  uint32_t req_offset = cd_offset + l.cd_len;
+  uint32_t ent_offset = req_offset + 12;
+  uint32_t cms_offset = ent_offset + (opts->entitlements ? 8 + (uint32_t)opts->entitlements_len : 0);
+
+  put_be32(sig, CS_MAGIC_EMBEDDED_SIGNATURE);
+  put_be32(sig + 4, l.sig_len);
+  put_be32(sig + 8, l.n_blobs);
+  uint8_t* index = sig + 12;
+  put_be32(index, CS_SLOT_CODEDIRECTORY);
+  put_be32(index + 4, cd_offset);
+  put_be32(index + 8, CS_SLOT_REQUIREMENTS);
+  put_be32(index + 12, req_offset);
+  index += 16;
+  if (opts->entitlements) {
+    put_be32(index, CS_SLOT_ENTITLEMENTS);
+    put_be32(index + 4, ent_offset);
+    index += 8;
+  }
+  put_be32(index, CS_SLOT_SIGNATURESLOT);
+  put_be32(index + 4, cms_offset);
+
+  uint8_t* req = sig + req_offset;
+  put_be32(req, AS_CSMAGIC_REQUIREMENTS);
+  put_be32(req + 4, 12);
+  put_be32(req + 8, 0);
+  if (opts->entitlements) {
+    uint8_t* ent = sig + ent_offset;
+    put_be32(ent, CS_MAGIC_EMBEDDED_ENTITLEMENTS);
+    put_be32(ent + 4, 8 + (uint32_t)opts->entitlements_len);
+    memcpy(ent + 8, opts->entitlements, opts->entitlements_len);
+  }
+  uint8_t* cms = sig + cms_offset;
+  put_be32(cms, CS_MAGIC_BLOBWRAPPER);
+  put_be32(cms + 4, 8);
+
+  uint8_t* cd = sig + cd_offset;
+  uint32_t hash_offset = AS_CD_HEADER_SIZE + l.ident_len + l.n_special_slots * AS_HASH_SIZE;
+  put_be32(cd, CS_MAGIC_CODEDIRECTORY);
+  put_be32(cd + 0x04, l.cd_len);
+  put_be32(cd + 0x08, AS_CD_VERSION);
+  put_be32(cd + 0x0c, AS_CS_ADHOC);
+  put_be32(cd + 0x10, hash_offset);
+  put_be32(cd + 0x14, AS_CD_HEADER_SIZE);
+  put_be32(cd + 0x18, l.n_special_slots);
+  put_be32(cd + 0x1c, l.n_code_slots);
+  put_be32(cd + 0x20, (uint32_t)l.code_limit);
+  cd[0x24] = AS_HASH_SIZE;
+  cd[0x25] = CS_HASH_TYPE_SHA256;
+  cd[0x27] = ADHOC_SIGN_PAGE_SHIFT;
+  put_be64(cd + 0x40, l.text_fileoff);
+  put_be64(cd + 0x48, l.text_filesize);
+  put_be64(cd + 0x50, l.filetype == AS_MH_EXECUTE ? AS_CS_EXECSEG_MAIN_BINARY : 0);
+  memcpy(cd + AS_CD_HEADER_SIZE, opts->identifier, l.ident_len);
+
+  // special slots count backwards from the code hashes, the ones that aren't there stay zero
+  uint8_t* hashes = cd + hash_offset;
+  sha256(req, 12, hashes - CS_SLOT_REQUIREMENTS * AS_HASH_SIZE);
+  if (opts->entitlements) {
+    sha256(sig + ent_offset, 8 + opts->entitlements_len, hashes - CS_SLOT_ENTITLEMENTS * AS_HASH_SIZE);
+  }
+  hash_code(out, l.code_limit, l.n_code_slots, hashes, opts->threads);
+  return 0;
+}
+
+int adhoc_sign_file(const char* path, const struct adhoc_sign_options* opts) {
+  int fd = open(path, O_RDWR);
+  if (fd == -1) {
+    printf("[-]\tcan't open %s\n", path);
+    return 1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < AS_MACH_HEADER_64_SIZE) {
+    printf("[-]\t%s is too small to be a Mach-O\n", path);
+    close(fd);
+    return 1;
+  }
+  size_t size = (size_t)st.st_size;
+  uint8_t* macho = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (macho == MAP_FAILED) {
+    printf("[-]\tcan't map %s\n", path);
+    close(fd);
+    return 1;
+  }
+  struct layout l;
+  if (plan(macho, size, opts, &l)) {
+    printf("[-]\tcan't sign %s\n", path);
+    munmap(macho, size);
+    close(fd);
+    return 1;
+  }
+  uint8_t* out = malloc(l.out_size);
+  int err = out == NULL || adhoc_sign(macho, size, opts, out, l.out_size);
+  munmap(macho, size);
+
+  // everything between the load commands and the old signature is unchanged
+  if (!err) {
+    size_t header_len = AS_MACH_HEADER_64_SIZE + le32(out + 0x14);
+    uint64_t tail = size < l.code_limit ? size : l.code_limit;
+    err = pwrite(fd, out, header_len, 0) != (ssize_t)header_len ||
+          pwrite(fd, out + tail, l.out_size - tail, (off_t)tail) != (ssize_t)(l.out_size - tail) ||
+          ftruncate(fd, (off_t)l.out_size) != 0;
+    if (err) {
+      printf("[-]\tcouldn't write the signature to %s\n", path);
+    }
+  }
+  free(out);
+  close(fd);
+  return err;
+}
@@ -0,0 +1,39 @@
+#ifndef adhoc_sign_h
+#define adhoc_sign_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ Ad-hoc signs a thin arm64 Mach-O, what `jtool --sign` and `ldid -S` do, so nothing has to be signed
+ out of tree any more.
+
+ Builds a SuperBlob with a SHA-256 CodeDirectory, an empty requirements set, the entitlements if
+ there are any and an empty CMS wrapper. An existing signature is replaced, otherwise LC_CODE_SIGNATURE
+ is added in the padding after the load commands. Either way the signature goes at the end of
+ __LINKEDIT, which grows to cover it, and nothing before it moves.
+
+ The code pages are hashed by several threads at once, each batching its pages through sha256_multi,
+ so signing a big binary costs about as long as hashing it. Doesn't need the Mach-O headers so it
+ builds and runs on Linux too.
+ */
+
+#define ADHOC_SIGN_PAGE_SHIFT 12
+
+struct adhoc_sign_options {
+  const char* identifier;         // required, usually the binary's name
+  const uint8_t* entitlements;    // an XML plist, NULL for no entitlements
+  size_t entitlements_len;
+  int threads;                    // 0 for one per CPU
+};
+
+// how big the signed binary will be, 0 if it can't be signed
+size_t adhoc_sign_size(const uint8_t* macho, size_t size, const struct adhoc_sign_options* opts);
+
+// signs macho into out, which has to be adhoc_sign_size() bytes, returns 0 on success
+int adhoc_sign(const uint8_t* macho, size_t size, const struct adhoc_sign_options* opts, uint8_t* out, size_t out_size);
+
+// signs a file in place, only the load commands and the end of the file are written
+int adhoc_sign_file(const char* path, const struct adhoc_sign_options* opts);
+
+#endif
@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "cdhash_cache.h"
+#include "codesign.h"
+
+#define CDHASH_CACHE_FILE_MAGIC 0x43484443  // "CDHC"
+#define CDHASH_CACHE_FILE_VERSION 1
+
+struct cdhash_cache_file_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;
+  uint32_t entry_size;
+};
+
+struct cdhash_cache amfid_cdhash_cache = CDHASH_CACHE_INITIALIZER;
+
+static void make_key(const struct stat* st, struct cdhash_cache_key* key) {
+  memset(key, 0, sizeof(*key));
+  key->dev = (uint64_t)st->st_dev;
+  key->ino = (uint64_t)st->st_ino;
+  key->size = (uint64_t)st->st_size;
+#ifdef __APPLE__
+  key->mtime_sec = st->st_mtimespec.tv_sec;
+  key->mtime_nsec = st->st_mtimespec.tv_nsec;
+#else
+  key->mtime_sec = st->st_mtim.tv_sec;
+  key->mtime_nsec = st->st_mtim.tv_nsec;
+#endif
+}
+
+static uint32_t set_index(struct cdhash_cache* cache, const struct cdhash_cache_key* key) {
+  uint64_t h = key->ino * 0x9e3779b97f4a7c15ULL;
+  h ^= key->dev + (h << 6) + (h >> 2);
+  h ^= (uint64_t)key->mtime_sec * 0xff51afd7ed558ccdULL;
+  h ^= key->size;
+  h ^= h >> 33;
+  return (uint32_t)h & (cache->n_sets - 1);
+}
+
+static int allocate_locked(struct cdhash_cache* cache, uint32_t capacity) {
+  uint32_t n_sets = 1;
+  while (n_sets * CDHASH_CACHE_WAYS < capacity) {
+    n_sets *= 2;
+  }
+  struct cdhash_cache_entry* entries = calloc(n_sets * CDHASH_CACHE_WAYS, sizeof(struct cdhash_cache_entry));
+  if (entries == NULL) {
+    return 1;
+  }
+  free(cache->entries);
+  cache->entries = entries;
+  cache->n_sets = n_sets;
+  cache->count = 0;
+  cache->clock = 0;
+  return 0;
+}
+
+static void insert_locked(struct cdhash_cache* cache, const struct cdhash_cache_key* key, const uint8_t* hash) {
+  struct cdhash_cache_entry* set = &cache->entries[set_index(cache, key) * CDHASH_CACHE_WAYS];
+  struct cdhash_cache_entry* victim = &set[0];
+  for (int i = 0; i < CDHASH_CACHE_WAYS; i++) {
+    if (set[i].last_used != 0 && memcmp(&set[i].key, key, sizeof(*key)) == 0) {
+      victim = &set[i];
+      break;
+    }
+    if (set[i].last_used < victim->last_used) {
+      victim = &set[i];
+    }
+  }
+  if (victim->last_used == 0) {
+    cache->count++;
+  } else if (memcmp(&victim->key, key, sizeof(*key)) != 0) {
+    cache->evictions++;
+  }
+  victim->key = *key;
+  victim->last_used = ++cache->clock;
+  memcpy(victim->hash, hash, CDHASH_CACHE_HASH_SIZE);
+}
+
+static int load_locked(struct cdhash_cache* cache) {
+  int fd = open(cache->path, O_RDONLY);
+  if (fd == -1) {
+    return 1;
+  }
+  struct cdhash_cache_file_header hdr;
+  if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != CDHASH_CACHE_FILE_MAGIC ||
+      hdr.version != CDHASH_CACHE_FILE_VERSION || hdr.entry_size != sizeof(struct cdhash_cache_entry)) {
+    printf("[-]\tignoring stale cdhash cache %s\n", cache->path);
+    close(fd);
+    return 1;
+  }
+  // oldest first, so the replacement order carries over
+  struct cdhash_cache_entry e;
+  uint32_t loaded = 0;
+  for (uint32_t i = 0; i < hdr.count; i++) {
+    if (read(fd, &e, sizeof(e)) != sizeof(e)) {
+      break;
+    }
+    insert_locked(cache, &e.key, e.hash);
+    loaded++;
+  }
+  close(fd);
+  printf("[+]\tloaded %d cdhashes from %s\n", loaded, cache->path);
+  return 0;
+}
+
+static int compare_last_used(const void* a, const void* b) {
+  const struct cdhash_cache_entry* ea = a;
+  const struct cdhash_cache_entry* eb = b;
+  return (ea->last_used > eb->last_used) - (ea->last_used < eb->last_used);
+}
+
+static int save_locked(struct cdhash_cache* cache) {
+  if (cache->path == NULL || cache->entries == NULL) {
+    return 0;
+  }
+  struct cdhash_cache_entry* live = malloc((cache->count + 1) * sizeof(struct cdhash_cache_entry));
+  if (live == NULL) {
+    return 1;
+  }
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < cache->n_sets * CDHASH_CACHE_WAYS; i++) {
+    if (cache->entries[i].last_used != 0) {
+      live[n++] = cache->entries[i];
+    }
+  }
+  qsort(live, n, sizeof(struct cdhash_cache_entry), compare_last_used);
+
+  // write a new file and rename it over the old one so a crash never leaves half a cache behind
+  char tmp[0x400];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", cache->path);
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1) {
+    free(live);
+    return 1;
+  }
+  struct cdhash_cache_file_header hdr = {CDHASH_CACHE_FILE_MAGIC, CDHASH_CACHE_FILE_VERSION, n, sizeof(struct cdhash_cache_entry)};
+  size_t len = n * sizeof(struct cdhash_cache_entry);
+  int err = write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || write(fd, live, len) != (ssize_t)len;
+  close(fd);
+  free(live);
+  if (err || rename(tmp, cache->path) != 0) {
+    unlink(tmp);
+    return 1;
+  }
+  cache->dirty = 0;
+  return 0;
+}
+
+static int flush_locked(struct cdhash_cache* cache) {
+  if (cache->dirty == 0) {
+    return 0;
+  }
+  int err = save_locked(cache);
+  if (err) {
+    printf("[-]\tcouldn't save the cdhash cache to %s\n", cache->path);
+  }
+  return err;
+}
+
+int cdhash_cache_init(struct cdhash_cache* cache, uint32_t capacity, const char* path) {
+  pthread_mutex_lock(&cache->lock);
+  free(cache->path);
+  cache->path = path ? strdup(path) : NULL;
+  int err = allocate_locked(cache, capacity ? capacity : CDHASH_CACHE_DEFAULT_CAPACITY);
+  if (!err && cache->path != NULL) {
+    load_locked(cache);
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return err;
+}
+
+void cdhash_cache_free(struct cdhash_cache* cache) {
+  pthread_mutex_lock(&cache->lock);
+  flush_locked(cache);
+  free(cache->entries);
+  free(cache->path);
+  cache->entries = NULL;
+  cache->path = NULL;
+  cache->n_sets = 0;
+  cache->count = 0;
+  cache->dirty = 0;
+  pthread_mutex_unlock(&cache->lock);
+}
+
+int cdhash_cache_lookup(struct cdhash_cache* cache, const struct stat* st, uint8_t* hash) {
+  struct cdhash_cache_key key;
+  make_key(st, &key);
+
+  int hit = 0;
+  pthread_mutex_lock(&cache->lock);
+  if (cache->entries != NULL) {
+    struct cdhash_cache_entry* set = &cache->entries[set_index(cache, &key) * CDHASH_CACHE_WAYS];
+    for (int i = 0; i < CDHASH_CACHE_WAYS; i++) {
+      if (set[i].last_used != 0 && memcmp(&set[i].key, &key, sizeof(key)) == 0) {
+        set[i].last_used = ++cache->clock;
+        memcpy(hash, set[i].hash, CDHASH_CACHE_HASH_SIZE);
+        hit = 1;
+        break;
+      }
+    }
+  }
+  if (hit) {
+    cache->hits++;
+  } else {
+    cache->misses++;
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return hit;
+}
+
+void cdhash_cache_insert(struct cdhash_cache* cache, const struct stat* st, const uint8_t* hash) {
+  struct cdhash_cache_key key;
+  make_key(st, &key);
+
+  pthread_mutex_lock(&cache->lock);
+  if (cache->entries == NULL && allocate_locked(cache, CDHASH_CACHE_DEFAULT_CAPACITY)) {
+    pthread_mutex_unlock(&cache->lock);
+    return;
+  }
+  insert_locked(cache, &key, hash);
+  // the whole file gets rewritten, so not for every one
+  if (cache->path != NULL && ++cache->dirty >= CDHASH_CACHE_SAVE_BATCH) {
+    flush_locked(cache);
+  }
+  pthread_mutex_unlock(&cache->lock);
+}
+
+int cdhash_cache_hash_file(struct cdhash_cache* cache, const char* path, uint8_t* hash, int* cached) {
+  // the same binaries get exec'd over and over, a stat is enough to know we've hashed this one
+  struct stat st;
+  *cached = !stat(path, &st) && cdhash_cache_lookup(cache, &st, hash);
+  if (*cached) {
+    return 0;
+  }
+
+  // only the signature gets mapped, the rest of the binary is never read
+  struct cs_file cs;
+  if (cs_file_open(&cs, path)) {
+    printf("[-]\tno code signature for [%s]\n", path);
+    return 1;
+  }
+  printf("[+]\tfound LC_CODE_SIGNATURE blob at offset +0x%llx\n", (unsigned long long)(cs.slice_offset + cs.sig_offset));
+  if (cs_has_cms_signature(cs.sig, cs.sig_size)) {
+    // amfid still asks us for the cdhash, it's the same calculation either way
+    printf("[i]\tthis one has a real CMS signature, not just an ad-hoc one\n");
+  }
+
+  struct cs_code_directory cd;
+  int err = 1;
+  if (cs_best_code_directory(cs.sig, cs.sig_size, &cd)) {
+    printf("[-]\tno valid code directory in [%s]\n", path);
+  } else {
+    printf("[+]\tfound code directory, slot 0x%x, hash type %d, length=0x%x\n", cd.slot, cd.hash_type, cd.length);
+    memset(hash, 0, CDHASH_CACHE_HASH_SIZE);
+    err = cs_cdhash(&cd, hash);
+    if (err) {
+      printf("[-]\tcan't compute hash type %d\n", cd.hash_type);
+    } else {
+      cdhash_cache_insert(cache, &cs.st, hash);
+    }
+  }
+  cs_file_close(&cs);
+  return err;
+}
+
+int cdhash_cache_save(struct cdhash_cache* cache) {
+  pthread_mutex_lock(&cache->lock);
+  int err = save_locked(cache);
+  pthread_mutex_unlock(&cache->lock);
+  return err;
+}
+
+int cdhash_cache_flush(struct cdhash_cache* cache) {
+  pthread_mutex_lock(&cache->lock);
+  int err = flush_locked(cache);
+  pthread_mutex_unlock(&cache->lock);
+  return err;
+}
+
+void cdhash_cache_report(struct cdhash_cache* cache) {
+  pthread_mutex_lock(&cache->lock);
+  uint64_t lookups = cache->hits + cache->misses;
+  printf("[+]\tcdhash cache: %llu hits, %llu misses (%.1f%% hit rate), %u/%u entries, %llu evictions\n",
+         (unsigned long long)cache->hits, (unsigned long long)cache->misses,
+         lookups ? 100.0 * cache->hits / lookups : 0.0,
+         cache->count, cache->n_sets * CDHASH_CACHE_WAYS, (unsigned long long)cache->evictions);
+  pthread_mutex_unlock(&cache->lock);
+}
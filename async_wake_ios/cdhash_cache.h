@@ -0,0 +1,77 @@
+#ifndef cdhash_cache_h
+#define cdhash_cache_h
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/*
+ amfid asks about the same few binaries over and over (everything in /jailbreak/bin gets exec'd
+ constantly) so remember the cdhash of each file, keyed by its identity and modification time.
+ A hit costs a stat() instead of a map, parse and SHA-256 of the signature.
+
+ Fixed size and 4-way set associative with LRU replacement in each set, so it never grows past
+ what init asked for. Optionally saved to a file so a restarted nerfbat starts warm, every
+ CDHASH_CACHE_SAVE_BATCH inserts and whenever it's flushed or freed rather than on every insert.
+ */
+
+#define CDHASH_CACHE_HASH_SIZE 32
+#define CDHASH_CACHE_WAYS 4
+#define CDHASH_CACHE_DEFAULT_CAPACITY 1024
+#define CDHASH_CACHE_SAVE_BATCH 32
+
+struct cdhash_cache_key {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+};
+
+struct cdhash_cache_entry {
+  struct cdhash_cache_key key;
+  uint32_t last_used;  // 0 for an empty way
+  uint32_t pad;
+  uint8_t hash[CDHASH_CACHE_HASH_SIZE];
+};
+
+struct cdhash_cache {
+  pthread_mutex_t lock;
+  struct cdhash_cache_entry* entries;  // n_sets * CDHASH_CACHE_WAYS
+  uint32_t n_sets;
+  uint32_t clock;
+  uint32_t count;
+  char* path;                          // where to persist, NULL to keep it in memory
+  uint32_t dirty;                      // inserts since it was last saved
+
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+};
+
+#define CDHASH_CACHE_INITIALIZER { .lock = PTHREAD_MUTEX_INITIALIZER }
+
+// the cache used by the amfid exception handler, sized with the default capacity on first use
+// unless cdhash_cache_init is called first
+extern struct cdhash_cache amfid_cdhash_cache;
+
+// capacity is rounded up to a power of two, if path exists its entries are loaded
+int cdhash_cache_init(struct cdhash_cache* cache, uint32_t capacity, const char* path);
+// saves anything not saved yet first
+void cdhash_cache_free(struct cdhash_cache* cache);
+
+// 1 and the hash if st matches a cached file
+int cdhash_cache_lookup(struct cdhash_cache* cache, const struct stat* st, uint8_t* hash);
+void cdhash_cache_insert(struct cdhash_cache* cache, const struct stat* st, const uint8_t* hash);
+
+// what amfid wants for path, the cdhash of the CodeDirectory the kernel will use zero padded out to
+// CDHASH_CACHE_HASH_SIZE. Comes from the cache if the file hasn't changed, otherwise it's computed and
+// inserted. 0 on success, cached is set if it was a hit
+int cdhash_cache_hash_file(struct cdhash_cache* cache, const char* path, uint8_t* hash, int* cached);
+
+int cdhash_cache_save(struct cdhash_cache* cache);
+// saves it only if there's been an insert since the last time
+int cdhash_cache_flush(struct cdhash_cache* cache);
+void cdhash_cache_report(struct cdhash_cache* cache);
+
+#endif
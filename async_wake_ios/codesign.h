@@ -0,0 +1,123 @@
+#ifndef codesign_h
+#define codesign_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+/*
+ Finds and parses a Mach-O's embedded code signature without reading the binary.
+
+ The header and load commands are mapped just long enough to find LC_CODE_SIGNATURE, then only the
+ pages holding the signature stay mapped. Nothing is copied and nothing else in the file is touched,
+ so the cost depends on the size of the signature rather than the binary. Universal binaries are
+ handled by picking their arm64 slice.
+
+ The parsing functions work on plain buffers, bounds check everything against the length they're
+ given and never allocate, so they're safe to call from the amfid handler on untrusted files and
+ easy to fuzz. Doesn't need the Mach-O headers so it builds on Linux too.
+ */
+
+// from osfmk/kern/cs_blobs.h, renamed so they can't clash with it
+#define CS_MAGIC_CODEDIRECTORY 0xfade0c02
+#define CS_MAGIC_EMBEDDED_SIGNATURE 0xfade0cc0
+#define CS_MAGIC_EMBEDDED_ENTITLEMENTS 0xfade7171
+#define CS_MAGIC_BLOBWRAPPER 0xfade0b01
+
+#define CS_SLOT_CODEDIRECTORY 0
+#define CS_SLOT_REQUIREMENTS 2
+#define CS_SLOT_ENTITLEMENTS 5
+#define CS_SLOT_ALTERNATE_CODEDIRECTORIES 0x1000
+#define CS_SLOT_ALTERNATE_CODEDIRECTORY_MAX 5
+#define CS_SLOT_SIGNATURESLOT 0x10000
+
+#define CS_HASH_TYPE_SHA1 1
+#define CS_HASH_TYPE_SHA256 2
+#define CS_HASH_TYPE_SHA256_TRUNCATED 3
+#define CS_HASH_TYPE_SHA384 4
+
+#define CS_CDHASH_LEN 20
+#define CS_HASH_MAX_SIZE 48
+
+// the most CodeDirectories a signature can have, the primary and the alternates
+#define CS_MAX_CODE_DIRECTORIES (1 + CS_SLOT_ALTERNATE_CODEDIRECTORY_MAX)
+
+// a validated CodeDirectory, every offset in it has been checked against its length
+struct cs_code_directory {
+  const uint8_t* blob;
+  uint32_t length;
+  uint32_t slot;          // CS_SLOT_CODEDIRECTORY or one of the alternates
+  uint32_t version;
+  uint32_t flags;
+  uint32_t hash_offset;
+  uint32_t n_special_slots;
+  uint32_t n_code_slots;
+  uint64_t code_limit;    // codeLimit64 if it's set
+  uint8_t hash_size;
+  uint8_t hash_type;
+  uint8_t page_shift;     // 0 means one hash for the whole of code_limit
+  const char* identifier;
+};
+
+struct cs_file {
+  const uint8_t* sig;     // the embedded signature SuperBlob
+  uint32_t sig_offset;    // its offset from the start of the slice, from LC_CODE_SIGNATURE
+  uint32_t sig_size;
+  uint64_t slice_offset;  // where the Mach-O starts, non-zero for universal binaries
+  uint64_t slice_size;
+  uint64_t file_size;
+  struct stat st;         // of the file that was actually mapped, for caching what was derived from it
+
+  void* map;              // page aligned mapping holding sig
+  size_t map_size;
+};
+
+// 0 on success, 1 if the file can't be opened, has no 64-bit arm64 Mach-O or isn't signed
+int cs_file_open(struct cs_file* cs, const char* path);
+void cs_file_close(struct cs_file* cs);
+
+// the arm64 slice of a universal binary from its first bytes, or the whole file for a thin one
+int cs_find_slice(const uint8_t* buf, size_t buf_size, uint64_t file_size, uint64_t* offset, uint64_t* size);
+
+// LC_CODE_SIGNATURE from a mapped header and load commands, checked against the slice size
+int cs_find_signature(const uint8_t* macho, size_t size, uint64_t slice_size, uint32_t* dataoff, uint32_t* datasize);
+
+// a blob from the SuperBlob's index, NULL if there isn't a well formed one in that slot
+const uint8_t* cs_find_blob(const uint8_t* sig, uint32_t sig_size, uint32_t slot, uint32_t* length);
+
+int cs_parse_code_directory(const uint8_t* blob, uint32_t length, struct cs_code_directory* cd);
+
+// the primary and alternate CodeDirectories, returns how many there are
+int cs_code_directories(const uint8_t* sig, uint32_t sig_size, struct cs_code_directory* cds, int max);
+
+// the one the kernel uses: SHA-384, then SHA-256, then truncated SHA-256, then SHA-1
+int cs_best_code_directory(const uint8_t* sig, uint32_t sig_size, struct cs_code_directory* cd);
+
+// hash with a CodeDirectory's hash type, returns the hash size or 0 for types we can't compute
+int cs_hash(uint8_t hash_type, const void* data, size_t len, uint8_t* out);
+
+// the cdhash is the hash of the whole CodeDirectory blob truncated to 20 bytes
+int cs_cdhash(const struct cs_code_directory* cd, uint8_t* cdhash);
+
+// whether there's a real CMS signature, ad-hoc signers leave an empty wrapper or nothing at all
+int cs_has_cms_signature(const uint8_t* sig, uint32_t sig_size);
+
+// the most bad pages a verify remembers, it keeps counting past that
+#define CS_VERIFY_MAX_BAD_PAGES 16
+
+struct cs_verify_result {
+  uint32_t n_pages;         // how many pages the CodeDirectory covers
+  uint32_t pages_checked;
+  uint32_t n_bad;           // pages that didn't match their slot, or weren't there to read
+  uint32_t bad_pages[CS_VERIFY_MAX_BAD_PAGES];
+  uint64_t bytes_read;
+};
+
+// reads the code a chunk at a time and checks each page against its hash slot, stopping at the first
+// bad one unless all_pages is set. Pages cut off by the end of the file are bad. 0 if every page matched
+int cs_verify_pages(int fd, uint64_t slice_offset, const struct cs_code_directory* cd, int all_pages, struct cs_verify_result* result);
+
+// the same against the CodeDirectory the kernel would use, a file with no readable signature fails
+int cs_verify_file(const char* path, int all_pages, struct cs_verify_result* result);
+
+#endif
@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "dir_listing.h"
+
+struct dir_entry {
+  const char* name;         // readdir's, or our own copy once it's in the heap
+  int is_dir;
+  int is_reg;
+  uint64_t size;
+  int64_t mtime;
+};
+
+struct dir_list {
+  DIR* dir;
+  struct dir_list_options opts;
+  char* path;
+  int need_stat;            // sizes and times are wanted, not just what each entry is
+  size_t skipped;           // of offset, unsorted
+  size_t sent;
+  int more;                 // there are entries past this page
+
+  // sorted, the first offset+limit entries seen. A max heap while reading so the last of them is
+  // on top, then in order
+  struct dir_entry* heap;
+  size_t heap_len;
+  size_t heap_size;
+  size_t keep;
+  int read_all;
+};
+
+static const char* sort_names[] = {"", "name", "size", "mtime"};
+
+static int word_is(const char* s, size_t len, const char* word) {
+  return strlen(word) == len && memcmp(s, word, len) == 0;
+}
+
+void dir_list_parse_query(const char* query, struct dir_list_options* opts) {
+  memset(opts, 0, sizeof(*opts));
+  while (*query) {
+    const char* end = strchr(query, '&');
+    size_t len = end ? (size_t)(end - query) : strlen(query);
+    const char* eq = memchr(query, '=', len);
+    if (eq) {
+      size_t key_len = eq - query;
+      const char* value = eq + 1;
+      size_t value_len = query + len - value;
+      if (word_is(query, key_len, "format")) {
+        opts->format = word_is(value, value_len, "json") ? DIR_LIST_JSON : DIR_LIST_HTML;
+      } else if (word_is(query, key_len, "sort")) {
+        for (int i = DIR_LIST_BY_NAME; i <= DIR_LIST_BY_MTIME; i++) {
+          if (word_is(value, value_len, sort_names[i])) {
+            opts->sort = i;
+          }
+        }
+      } else if (word_is(query, key_len, "order")) {
+        opts->descending = word_is(value, value_len, "desc");
+      } else if (word_is(query, key_len, "offset")) {
+        opts->offset = strtoull(value, NULL, 10);
+      } else if (word_is(query, key_len, "limit")) {
+        opts->limit = strtoull(value, NULL, 10);
+      }
+    }
+    query += len + (end != NULL);
+  }
+}
+
+// the next entry to list, . and .. aren't worth putting in JSON
+static struct dirent* next_entry(struct dir_list* list) {
+  struct dirent* ent;
+  while ((ent = readdir(list->dir)) != NULL) {
+    if (list->opts.format != DIR_LIST_JSON || (strcmp(ent->d_name, ".") && strcmp(ent->d_name, ".."))) {
+      return ent;
+    }
+  }
+  return NULL;
+}
+
+static void entry_info(struct dir_list* list, struct dirent* ent, struct dir_entry* e) {
+  memset(e, 0, sizeof(*e));
+  e->name = ent->d_name;
+  if (!list->need_stat && ent->d_type != DT_UNKNOWN && ent->d_type != DT_LNK) {
+    e->is_dir = ent->d_type == DT_DIR;
+    e->is_reg = ent->d_type == DT_REG;
+    return;
+  }
+  // links are listed as what they point to, a dangling one as nothing in particular
+  struct stat st;
+  if (fstatat(dirfd(list->dir), ent->d_name, &st, 0) == 0) {
+    e->is_dir = S_ISDIR(st.st_mode);
+    e->is_reg = S_ISREG(st.st_mode);
+    e->size = st.st_size;
+    e->mtime = st.st_mtime;
+  }
+}
+
+// a run of s, HTML or JSON escaped
+static void write_escaped(struct http_conn* conn, const char* s, int json) {
+  const char* run = s;
+  for (; *s; s++) {
+    const char* with = NULL;
+    char u[8];
+    if (json) {
+      if (*s == '"' || *s == '\\') {
+        with = *s == '"' ? "\\\"" : "\\\\";
+      } else if ((unsigned char)*s < 0x20) {
+        snprintf(u, sizeof(u), "\\u%04x", *s);
+        with = u;
+      }
+    } else {
+      switch (*s) {
+        case '&': with = "&amp;"; break;
+        case '<': with = "&lt;"; break;
+        case '>': with = "&gt;"; break;
+        case '"': with = "&quot;"; break;
+      }
+    }
+    if (with) {
+      http_write(conn, run, s - run);
+      http_write(conn, with, strlen(with));
+      run = s + 1;
+    }
+  }
+  http_write(conn, run, s - run);
+}
+
+// percent encoded for an href, ws decodes it again
+static void write_url(struct http_conn* conn, const char* s) {
+  static const char hex[] = "0123456789ABCDEF";
+  const char* run = s;
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || strchr("/-._~", c)) {
+      continue;
+    }
+    char enc[3] = {'%', hex[c >> 4], hex[c & 15]};
+    http_write(conn, run, s - run);
+    http_write(conn, enc, 3);
+    run = s + 1;
+  }
+  http_write(conn, run, s - run);
+}
+
+static void write_entry(struct http_conn* conn, struct dir_list* list, const struct dir_entry* e) {
+  if (list->opts.format == DIR_LIST_JSON) {
+    http_printf(conn, "%s{\"name\":\"", list->sent ? "," : "");
+    write_escaped(conn, e->name, 1);
+    http_printf(conn, "\",\"type\":\"%s\",\"size\":%llu,\"mtime\":%lld}", e->is_dir ? "dir" : e->is_reg ? "file" : "other",
+                (unsigned long long)e->size, (long long)e->mtime);
+  } else {
+    http_write(conn, "<a href=\"", 9);
+    write_url(conn, list->path);
+    write_url(conn, e->name);
+    http_write(conn, e->is_dir ? "/\">" : "\">", e->is_dir ? 3 : 2);
+    write_escaped(conn, e->name, 0);
+    http_printf(conn, "%s</a><br>\n", e->is_dir ? "/" : "");
+  }
+  list->sent++;
+}
+
+static int finish(struct http_conn* conn, struct dir_list* list) {
+  if (list->opts.format == DIR_LIST_JSON) {
+    http_printf(conn, "],\"more\":%s}", list->more ? "true" : "false");
+    return 1;
+  }
+  if (list->more) {
+    http_printf(conn, "<br><a href=\"?offset=%zu&amp;limit=%zu%s%s%s\">next page</a><br>\n",
+                list->opts.offset + list->sent, list->opts.limit, list->opts.sort ? "&amp;sort=" : "",
+                sort_names[list->opts.sort], list->opts.descending ? "&amp;order=desc" : "");
+  }
+  http_printf(conn, "<html>");
+  return 1;
+}
+
+static int compare_entries(const struct dir_list* list, const struct dir_entry* a, const struct dir_entry* b) {
+  int r = 0;
+  if (list->opts.sort == DIR_LIST_BY_SIZE) {
+    r = (a->size > b->size) - (a->size < b->size);
+  } else if (list->opts.sort == DIR_LIST_BY_MTIME) {
+    r = (a->mtime > b->mtime) - (a->mtime < b->mtime);
+  }
+  if (r == 0) {
+    r = strcmp(a->name, b->name);
+  }
+  return list->opts.descending ? -r : r;
+}
+
+static void sift_down(struct dir_list* list, size_t i, size_t len) {
+  struct dir_entry* heap = list->heap;
+  for (;;) {
+    size_t top = i;
+    size_t left = 2 * i + 1;
+    if (left < len && compare_entries(list, &heap[left], &heap[top]) > 0) {
+      top = left;
+    }
+    if (left + 1 < len && compare_entries(list, &heap[left + 1], &heap[top]) > 0) {
+      top = left + 1;
+    }
+    if (top == i) {
+      return;
+    }
+    struct dir_entry tmp = heap[i];
+    heap[i] = heap[top];
+    heap[top] = tmp;
+    i = top;
+  }
+}
+
+// keeps e if it's one of the first keep in order so far
+static void heap_add(struct dir_list* list, struct dir_entry* e) {
+  struct dir_entry* heap = list->heap;
+  if (list->heap_len == list->keep) {
+    list->more = 1;
+    if (list->keep == 0 || compare_entries(list, e, &heap[0]) >= 0) {
+      return;
+    }
+    char* name = strdup(e->name);
+    if (name == NULL) {
+      return;
+    }
+    free((char*)heap[0].name);
+    heap[0] = *e;
+    heap[0].name = name;
+    sift_down(list, 0, list->heap_len);
+    return;
+  }
+  if (list->heap_len == list->heap_size) {
+    size_t size = list->heap_size ? list->heap_size * 2 : 256;
+    size = size < list->keep ? size : list->keep;
+    if ((heap = realloc(list->heap, size * sizeof(*heap))) == NULL) {
+      return;
+    }
+    list->heap = heap;
+    list->heap_size = size;
+  }
+  char* name = strdup(e->name);
+  if (name == NULL) {
+    return;
+  }
+  size_t i = list->heap_len++;
+  heap[i] = *e;
+  heap[i].name = name;
+  while (i > 0 && compare_entries(list, &heap[i], &heap[(i - 1) / 2]) > 0) {
+    struct dir_entry tmp = heap[i];
+    heap[i] = heap[(i - 1) / 2];
+    heap[(i - 1) / 2] = tmp;
+    i = (i - 1) / 2;
+  }
+}
+
+static int produce_unsorted(struct http_conn* conn, struct dir_list* list) {
+  for (int n = 0; n < DIR_LIST_BATCH;) {
+    struct dirent* ent = next_entry(list);
+    if (ent == NULL) {
+      return finish(conn, list);
+    }
+    if (list->opts.limit && list->sent == list->opts.limit) {
+      list->more = 1;
+      return finish(conn, list);
+    }
+    if (list->skipped < list->opts.offset) {
+      list->skipped++;
+      continue;
+    }
+    struct dir_entry e;
+    entry_info(list, ent, &e);
+    write_entry(conn, list, &e);
+    n++;
+  }
+  return 0;
+}
+
+static int produce_sorted(struct http_conn* conn, struct dir_list* list) {
+  // all of it in one go, coming back for more without having written anything would just be
+  // another trip through the worker queues
+  if (!list->read_all) {
+    struct dirent* ent;
+    while ((ent = next_entry(list)) != NULL) {
+      struct dir_entry e;
+      entry_info(list, ent, &e);
+      heap_add(list, &e);
+    }
+    // heapsort the rest of the way, the biggest goes to the end each time
+    for (size_t end = list->heap_len; end > 1; end--) {
+      struct dir_entry tmp = list->heap[0];
+      list->heap[0] = list->heap[end - 1];
+      list->heap[end - 1] = tmp;
+      sift_down(list, 0, end - 1);
+    }
+    list->read_all = 1;
+  }
+  for (int n = 0; n < DIR_LIST_BATCH; n++) {
+    size_t i = list->opts.offset + list->sent;
+    if (i >= list->heap_len) {
+      return finish(conn, list);
+    }
+    write_entry(conn, list, &list->heap[i]);
+  }
+  return 0;
+}
+
+static int produce(struct http_conn* conn, void* state) {
+  struct dir_list* list = state;
+  return list->opts.sort == DIR_LIST_UNSORTED ? produce_unsorted(conn, list) : produce_sorted(conn, list);
+}
+
+static void release(void* state) {
+  struct dir_list* list = state;
+  closedir(list->dir);
+  for (size_t i = 0; i < list->heap_len; i++) {
+    free((char*)list->heap[i].name);
+  }
+  free(list->heap);
+  free(list->path);
+  free(list);
+}
+
+struct dir_list* dir_list_open(const char* path, const struct dir_list_options* opts) {
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) {
+    return NULL;
+  }
+  DIR* dir = fdopendir(fd);
+  if (dir == NULL) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return NULL;
+  }
+  struct dir_list* list = calloc(1, sizeof(*list));
+  char* path_copy = strdup(path);
+  if (list == NULL || path_copy == NULL) {
+    free(list);
+    free(path_copy);
+    closedir(dir);
+    errno = ENOMEM;
+    return NULL;
+  }
+  list->dir = dir;
+  list->path = path_copy;
+  list->opts = *opts;
+  list->need_stat = opts->format == DIR_LIST_JSON || opts->sort == DIR_LIST_BY_SIZE || opts->sort == DIR_LIST_BY_MTIME;
+  if (opts->sort != DIR_LIST_UNSORTED) {
+    if (list->opts.limit == 0) {
+      list->opts.limit = DIR_LIST_SORTED_LIMIT;
+    }
+    list->keep = list->opts.offset + list->opts.limit;
+  }
+  return list;
+}
+
+void dir_list_stream(struct http_conn* conn, struct dir_list* list) {
+  if (list->opts.format == DIR_LIST_JSON) {
+    http_write(conn, "{\"path\":\"", 9);
+    write_escaped(conn, list->path, 1);
+    http_printf(conn, "\",\"offset\":%zu,\"entries\":[", list->opts.offset);
+  }
+  http_stream(conn, produce, release, list);
+}
@@ -0,0 +1,59 @@
+#ifndef dir_listing_h
+#define dir_listing_h
+
+#include <stddef.h>
+
+#include "http_server.h"
+
+/*
+ Directory listings for ws, streamed out through http_stream a batch of entries at a time so a
+ directory with tens of thousands of files (the caches under /var/mobile) is one pass over it with
+ nothing held but the DIR. Entries are looked at relative to the directory's fd, d_type says what
+ most of them are and only the ones it can't (or symlinks, which count as what they point to) get an
+ fstatat, unless sizes and times are wanted.
+
+ Either the HTML ws has always served, or JSON for scripts. Pages come from ?offset= and ?limit=,
+ order from ?sort=name|size|mtime and ?order=desc. Sorting can't be done in one pass without keeping
+ what's been seen, so a sorted page keeps the first offset+limit entries in a heap and nothing else,
+ and limit defaults to DIR_LIST_SORTED_LIMIT when there's sorting. The whole directory is read in the
+ first producer call for that, which then writes the first batch like any other.
+
+ The directory is opened before anything's written so one that can't be gets a proper status.
+ */
+
+#define DIR_LIST_BATCH 64             // entries written per producer call
+#define DIR_LIST_SORTED_LIMIT 1000
+
+enum dir_list_format {
+  DIR_LIST_HTML,
+  DIR_LIST_JSON,
+};
+
+enum dir_list_sort {
+  DIR_LIST_UNSORTED,  // whatever order readdir gives
+  DIR_LIST_BY_NAME,
+  DIR_LIST_BY_SIZE,
+  DIR_LIST_BY_MTIME,
+};
+
+struct dir_list_options {
+  enum dir_list_format format;
+  enum dir_list_sort sort;
+  int descending;
+  size_t offset;
+  size_t limit;             // 0 for no limit
+};
+
+// format, sort, order, offset and limit from a query string, anything else in it is ignored
+void dir_list_parse_query(const char* query, struct dir_list_options* opts);
+
+struct dir_list;
+
+// path opened for listing, NULL with errno set if it can't be
+struct dir_list* dir_list_open(const char* path, const struct dir_list_options* opts);
+// streams list's entries out of conn, which http_begin has been called on, and frees it once
+// they're done. HTML goes after whatever's already been written, links are path + name. JSON is
+// the whole body
+void dir_list_stream(struct http_conn* conn, struct dir_list* list);
+
+#endif
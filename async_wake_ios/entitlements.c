@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "entitlements.h"
+#include "codesign.h"
+
+static const char pretty_header[] =
+  "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+  "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+  "<plist version=\"1.0\">\n"
+  "<dict>\n";
+static const char pretty_footer[] = "</dict>\n</plist>\n";
+static const char compact_header[] = "<plist version=\"1.0\"><dict>";
+static const char compact_footer[] = "</dict></plist>";
+
+struct span {
+  const char* p;
+  size_t len;
+};
+
+struct cursor {
+  const char* p;
+  const char* end;
+};
+
+// writes what fits and keeps counting past cap, so a pass with cap 0 is just a size calculation
+struct writer {
+  char* buf;
+  size_t cap;
+  size_t len;
+};
+
+static void put(struct writer* w, const char* s, size_t n) {
+  if (w->buf != NULL && w->len + n <= w->cap) {
+    memcpy(w->buf + w->len, s, n);
+  }
+  w->len += n;
+}
+
+static void put_str(struct writer* w, const char* s) {
+  put(w, s, strlen(s));
+}
+
+static uint32_t be32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put_be32(uint8_t* p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static const char* find(const char* p, const char* end, const char* s) {
+  size_t n = strlen(s);
+  for (; (size_t)(end - p) >= n; p++) {
+    if (*p == *s && !memcmp(p, s, n)) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+static int starts_with(const struct cursor* c, const char* s) {
+  size_t n = strlen(s);
+  return (size_t)(c->end - c->p) >= n && !memcmp(c->p, s, n);
+}
+
+// whitespace and comments
+static void skip_space(struct cursor* c) {
+  for (;;) {
+    while (c->p < c->end && isspace((unsigned char)*c->p)) {
+      c->p++;
+    }
+    if (!starts_with(c, "<!--")) {
+      return;
+    }
+    const char* close = find(c->p + 4, c->end, "-->");
+    c->p = close ? close + 3 : c->end;
+  }
+}
+
+// past one element, <x/> or <x>...</x> with whatever's nested in it
+static int skip_element(struct cursor* c) {
+  int depth = 0;
+  do {
+    const char* lt = memchr(c->p, '<', c->end - c->p);
+    if (lt == NULL) {
+      return 1;
+    }
+    c->p = lt;
+    const char* close_marker = starts_with(c, "<!--") ? "-->" : starts_with(c, "<![CDATA[") ? "]]>" : NULL;
+    if (close_marker) {
+      const char* close = find(c->p, c->end, close_marker);
+      if (close == NULL) {
+        return 1;
+      }
+      c->p = close + 3;
+      continue;
+    }
+    const char* gt = memchr(c->p, '>', c->end - c->p);
+    if (gt == NULL) {
+      return 1;
+    }
+    if (c->p[1] == '/') {
+      depth--;
+    } else if (gt[-1] != '/') {
+      depth++;
+    }
+    c->p = gt + 1;
+  } while (depth > 0);
+  return depth < 0;
+}
+
+// the next <key>/value pair, 0 at the end of the dict or fragment, -1 if it's malformed
+static int next_entry(struct cursor* c, struct span* key, struct span* value) {
+  skip_space(c);
+  if (c->p == c->end || starts_with(c, "</dict>")) {
+    return 0;
+  }
+  if (!starts_with(c, "<key>")) {
+    return -1;
+  }
+  key->p = c->p + 5;
+  const char* close = find(key->p, c->end, "</key>");
+  if (close == NULL) {
+    return -1;
+  }
+  key->len = close - key->p;
+  c->p = close + 6;
+
+  skip_space(c);
+  if (c->end - c->p < 2 || c->p[0] != '<' || c->p[1] == '/') {
+    return -1;
+  }
+  value->p = c->p;
+  if (skip_element(c)) {
+    return -1;
+  }
+  value->len = c->p - value->p;
+  return 1;
+}
+
+// just inside the top level <dict>, 1 if it's an empty <dict/>
+static int enter_dict(struct cursor* c) {
+  const char* dict = find(c->p, c->end, "<dict");
+  if (dict == NULL) {
+    return -1;
+  }
+  const char* gt = memchr(dict, '>', c->end - dict);
+  if (gt == NULL) {
+    return -1;
+  }
+  c->p = gt + 1;
+  return gt[-1] == '/';
+}
+
+static int has_key(const char* fragment, size_t len, const struct span* key) {
+  struct cursor c = {fragment, fragment + len};
+  struct span k, v;
+  while (next_entry(&c, &k, &v) > 0) {
+    if (k.len == key->len && !memcmp(k.p, key->p, k.len)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void put_entry(struct writer* w, enum ent_layout layout, const struct span* key, const struct span* value) {
+  int pretty = layout == ENT_LAYOUT_MERGED;
+  put_str(w, pretty ? "\t<key>" : "<key>");
+  put(w, key->p, key->len);
+  put_str(w, pretty ? "</key>\n\t" : "</key>");
+  put(w, value->p, value->len);
+  if (pretty) {
+    put_str(w, "\n");
+  }
+}
+
+size_t ent_merge(const char* old, size_t old_len, const char* additions, size_t add_len, enum ent_layout layout,
+                 char* out, size_t cap) {
+  struct writer w = {out, cap, 0};
+  struct span key, value;
+  int r;
+  put_str(&w, layout == ENT_LAYOUT_MERGED ? pretty_header : compact_header);
+
+  if (old != NULL && layout != ENT_LAYOUT_REPLACED) {
+    struct cursor c = {old, old + old_len};
+    r = enter_dict(&c);
+    if (r < 0) {
+      return 0;
+    }
+    if (r == 0) {
+      while ((r = next_entry(&c, &key, &value)) > 0) {
+        // a new value for a key replaces the old one
+        if (!has_key(additions, add_len, &key)) {
+          put_entry(&w, layout, &key, &value);
+        }
+      }
+      if (r < 0) {
+        return 0;
+      }
+    }
+  }
+
+  struct cursor c = {additions, additions + add_len};
+  while ((r = next_entry(&c, &key, &value)) > 0) {
+    put_entry(&w, layout, &key, &value);
+  }
+  if (r < 0) {
+    return 0;
+  }
+
+  put_str(&w, layout == ENT_LAYOUT_MERGED ? pretty_footer : compact_footer);
+  return w.len;
+}
+
+uint32_t ent_rewrite_blob(const uint8_t* old, uint32_t old_size, const char* additions, size_t add_len,
+                          uint8_t* out, uint32_t cap, enum ent_layout* layout) {
+  *layout = ENT_LAYOUT_NONE;
+  if (old_size < 8 || cap < 8 || be32(old) != CS_MAGIC_EMBEDDED_ENTITLEMENTS) {
+    return 0;
+  }
+  uint32_t len = be32(old + 4);
+  if (len < 8 || len > old_size) {
+    return 0;
+  }
+  // anything after a NUL is padding from an earlier rewrite
+  const char* xml = (const char*)old + 8;
+  const char* nul = memchr(xml, 0, len - 8);
+  size_t xml_len = nul ? (size_t)(nul - xml) : len - 8;
+
+  // size every layout first so the blob is written once, with the first one that fits
+  for (enum ent_layout l = ENT_LAYOUT_MERGED; l < ENT_LAYOUT_NONE; l++) {
+    size_t need = ent_merge(xml, xml_len, additions, add_len, l, NULL, 0);
+    if (need == 0) {
+      return 0;
+    }
+    if (need > cap - 8) {
+      continue;
+    }
+    ent_merge(xml, xml_len, additions, add_len, l, (char*)out + 8, cap - 8);
+    put_be32(out, CS_MAGIC_EMBEDDED_ENTITLEMENTS);
+    put_be32(out + 4, 8 + (uint32_t)need);
+    memset(out + 8 + need, 0, cap - 8 - need);
+    *layout = l;
+    return 8 + (uint32_t)need;
+  }
+  return 0;
+}
+
+int ent_rehash_special_slot(uint8_t* cd, uint32_t cd_size, const uint8_t* old_blob, uint32_t old_len,
+                            const uint8_t* new_blob, uint32_t new_len, uint32_t* slot_offset, uint32_t* slot_size,
+                            int* old_matched) {
+  struct cs_code_directory parsed;
+  if (cs_parse_code_directory(cd, cd_size, &parsed) || parsed.n_special_slots < CS_SLOT_ENTITLEMENTS) {
+    return 1;
+  }
+  // parsing checked the special slots all fit below hash_offset
+  uint32_t offset = parsed.hash_offset - CS_SLOT_ENTITLEMENTS * parsed.hash_size;
+  uint8_t hash[CS_HASH_MAX_SIZE];
+  if (cs_hash(parsed.hash_type, old_blob, old_len, hash) == 0) {
+    return 1;
+  }
+  *old_matched = !memcmp(hash, cd + offset, parsed.hash_size);
+  cs_hash(parsed.hash_type, new_blob, new_len, hash);
+  memcpy(cd + offset, hash, parsed.hash_size);
+  *slot_offset = offset;
+  *slot_size = parsed.hash_size;
+  return 0;
+}
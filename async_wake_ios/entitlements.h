@@ -0,0 +1,46 @@
+#ifndef entitlements_h
+#define entitlements_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ Rewrites an entitlements blob in place in the space the kernel already gave it.
+
+ The existing XML plist is scanned once, the new <key>/value pairs are merged into its dictionary (a
+ new key replaces an old one with the same name) and the result is serialized straight into a buffer
+ the caller provides. Values are copied verbatim so nested arrays and dicts survive. The exact size
+ is known before anything is written and nothing is allocated.
+
+ The special slot for the entitlements is found through the parsed CodeDirectory rather than assumed,
+ so the hash can be rewritten with whatever type and size the CodeDirectory uses.
+ */
+
+// tried in order until one fits in the blob
+enum ent_layout {
+  ENT_LAYOUT_MERGED,          // old and new keys, indented like Xcode writes it
+  ENT_LAYOUT_MERGED_COMPACT,  // old and new keys, no header or whitespace
+  ENT_LAYOUT_REPLACED,        // only the new keys, compact
+  ENT_LAYOUT_NONE,
+};
+
+// merges additions (a list of <key>/value pairs) into the dictionary of the plist in old, old can be
+// NULL for an empty one. Returns the exact length the result needs, it's only written if that's <= cap.
+// 0 if either can't be parsed
+size_t ent_merge(const char* old, size_t old_len, const char* additions, size_t add_len, enum ent_layout layout,
+                 char* out, size_t cap);
+
+// builds a new entitlements blob in out from old (a whole blob, header included) with additions merged
+// in, using the first layout that fits in cap. The rest of cap is zeroed. Returns the new blob's length
+// and the layout used, 0 if nothing fits
+uint32_t ent_rewrite_blob(const uint8_t* old, uint32_t old_size, const char* additions, size_t add_len,
+                          uint8_t* out, uint32_t cap, enum ent_layout* layout);
+
+// rehashes the entitlements special slot of the CodeDirectory in cd for new_blob. slot_offset and
+// slot_size say which bytes of cd changed so only they need writing back. old_matched is set if the
+// slot held the hash of old_blob, which is a check the right slot was found
+int ent_rehash_special_slot(uint8_t* cd, uint32_t cd_size, const uint8_t* old_blob, uint32_t old_len,
+                            const uint8_t* new_blob, uint32_t new_len, uint32_t* slot_offset, uint32_t* slot_size,
+                            int* old_matched);
+
+#endif
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "find_offsets.h"
+
+/*
+ The kernelcache up to iOS 11 still has the kernel's exported symbols, and plenty of the
+ exported KPI are trivial accessors. For example in 15B202 on the iPhone 6s:
+
+ _proc_ucred:
+   LDR             X0, [X0,#0x100]
+   RET
+
+ _task_set_platform_binary:
+   ...
+   LDR             W8, [X19,#0x3A0]
+   ORR             W8, W8, #0x400
+   STR             W8, [X19,#0x3A0]
+
+ Matching those shapes gives the field offsets without having to reverse anything by hand.
+ Anything which can't be found keeps the value from the table in symbols.c.
+ */
+
+enum accessor_shape {
+  LOAD_FROM_ARG0,     // first load based on x0 (or a register x0 got copied to)
+  ADD_TO_ARG0,        // add xd, x0, #imm, returning the address of an embedded field
+  READ_MODIFY_WRITE,  // load and a store back to the same [xn, #imm] with xn derived from x0
+};
+
+struct accessor {
+  enum kstruct_offset offset;
+  const char* name;
+  const char* symbol;
+  enum accessor_shape shape;
+};
+
+static struct accessor accessors[] = {
+  {KSTRUCT_OFFSET_TASK_VM_MAP,        "task.map",          "_get_task_map",                LOAD_FROM_ARG0},
+  {KSTRUCT_OFFSET_TASK_ITK_SPACE,     "task.itk_space",    "_get_task_ipcspace",           LOAD_FROM_ARG0},
+  {KSTRUCT_OFFSET_TASK_BSD_INFO,      "task.bsd_info",     "_get_bsdtask_info",            LOAD_FROM_ARG0},
+  {KSTRUCT_OFFSET_TASK_T_FLAGS,       "task.t_flags",      "_task_set_platform_binary",    READ_MODIFY_WRITE},
+  {KSTRUCT_OFFSET_PROC_PID,           "proc.p_pid",        "_proc_pid",                    LOAD_FROM_ARG0},
+  {KSTRUCT_OFFSET_PROC_TASK,          "proc.task",         "_proc_task",                   LOAD_FROM_ARG0},
+  {KSTRUCT_OFFSET_PROC_UCRED,         "proc.p_ucred",      "_proc_ucred",                  LOAD_FROM_ARG0},
+  {KSTRUCT_OFFSET_PROC_TEXTVP,        "proc.p_textvp",     "_proc_getexecutablevnode",     LOAD_FROM_ARG0},
+  {KSTRUCT_OFFSET_PROC_P_COMM,        "proc.p_comm",       "_proc_name_address",           ADD_TO_ARG0},
+  {KSTRUCT_OFFSET_PROC_P_CSFLAGS,     "proc.p_csflags",    "_cs_restricted",               LOAD_FROM_ARG0},
+  {KSTRUCT_OFFSET_UCRED_CR_UID,       "ucred.cr_uid",      "_kauth_cred_getuid",           LOAD_FROM_ARG0},
+  {KSTRUCT_OFFSET_VNODE_V_MOUNT,      "vnode.v_mount",     "_vnode_mount",                 LOAD_FROM_ARG0},
+  {KSTRUCT_OFFSET_MOUNT_MNT_FLAG,     "mount.mnt_flag",    "_vfs_flags",                   LOAD_FROM_ARG0},
+};
+
+#define MAX_ACCESSOR_INSNS 64
+
+// x0 and any register it gets copied in to
+static int is_arg0(uint32_t arg0_regs, int reg) {
+  return (arg0_regs >> reg) & 1;
+}
+
+static int match_accessor(struct kernel_image* img, uint64_t fn, enum accessor_shape shape, uint32_t* imm_out) {
+  uint32_t arg0_regs = 1; // x0
+
+  // remember the loads for the read-modify-write case
+  int load_rn[MAX_ACCESSOR_INSNS];
+  uint32_t load_imm[MAX_ACCESSOR_INSNS];
+  int n_loads = 0;
+
+  for (int i = 0; i < MAX_ACCESSOR_INSNS; i++) {
+    uint64_t pc = fn + (i*4);
+    uint32_t* p = kimg_ptr(img, pc, 4);
+    if (p == NULL) {
+      return 0;
+    }
+    uint32_t insn = *p;
+
+    int rd, rn, rt, rm, is_load;
+    uint32_t imm;
+
+    if (arm64_is_ret(insn)) {
+      return 0;
+    }
+
+    if (arm64_decode_mov_reg(insn, &rd, &rm)) {
+      if (is_arg0(arg0_regs, rm)) {
+        arg0_regs |= (1u << rd);
+      } else {
+        arg0_regs &= ~(1u << rd);
+      }
+      continue;
+    }
+
+    if (arm64_decode_add_imm(insn, &rd, &rn, &imm)) {
+      if (shape == ADD_TO_ARG0 && is_arg0(arg0_regs, rn) && rn != 31 && imm != 0) {
+        *imm_out = imm;
+        return 1;
+      }
+      arg0_regs &= ~(1u << rd);
+      continue;
+    }
+
+    if (arm64_decode_ldst_imm(insn, &is_load, &rt, &rn, &imm)) {
+      if (rn == 31) {
+        // stack spill in the prologue
+        continue;
+      }
+      if (is_load && is_arg0(arg0_regs, rn)) {
+        if (shape == LOAD_FROM_ARG0) {
+          *imm_out = imm;
+          return 1;
+        }
+        load_rn[n_loads] = rn;
+        load_imm[n_loads] = imm;
+        n_loads++;
+      }
+      if (!is_load && shape == READ_MODIFY_WRITE) {
+        for (int j = 0; j < n_loads; j++) {
+          if (load_rn[j] == rn && load_imm[j] == imm) {
+            *imm_out = imm;
+            return 1;
+          }
+        }
+      }
+      if (is_load) {
+        arg0_regs &= ~(1u << rt);
+      }
+      continue;
+    }
+
+    // a call clobbers x0 but x19-x28 survive it
+    uint64_t target;
+    if (arm64_decode_bl(insn, pc, &target)) {
+      arg0_regs &= ~0x3ffffULL;
+    }
+  }
+  return 0;
+}
+
+int find_struct_offsets(struct kernel_image* img, int* offsets) {
+  if (kimg_header(img) == NULL) {
+    printf("no kernel image to derive offsets from\n");
+    return 0;
+  }
+
+  int found = 0;
+  for (int i = 0; i < sizeof(accessors)/sizeof(accessors[0]); i++) {
+    struct accessor* a = &accessors[i];
+    uint64_t fn = kimg_find_symbol(img, a->symbol);
+    if (fn == 0) {
+      printf("  %-16s %s not found, keeping 0x%x\n", a->name, a->symbol, offsets[a->offset]);
+      continue;
+    }
+
+    uint32_t imm = 0;
+    if (!match_accessor(img, fn, a->shape, &imm) || imm >= 0x1000) {
+      printf("  %-16s %s at 0x%llx didn't match, keeping 0x%x\n", a->name, a->symbol, fn, offsets[a->offset]);
+      continue;
+    }
+
+    if (imm != offsets[a->offset]) {
+      printf("  %-16s 0x%x (was 0x%x)\n", a->name, imm, offsets[a->offset]);
+    } else {
+      printf("  %-16s 0x%x\n", a->name, imm);
+    }
+    offsets[a->offset] = imm;
+    found++;
+  }
+  return found;
+}
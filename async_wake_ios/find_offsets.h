@@ -0,0 +1,12 @@
+#ifndef find_offsets_h
+#define find_offsets_h
+
+#include "kernel_image.h"
+#include "symbols.h"
+
+// recover struct offsets from the load/store immediates of small kernel accessor functions
+// offsets is indexed by enum kstruct_offset, only entries which could be derived are overwritten
+// returns the number of offsets derived
+int find_struct_offsets(struct kernel_image* img, int* offsets);
+
+#endif
@@ -0,0 +1,136 @@
+#include <string.h>
+
+#include "hexdump.h"
+
+#define NOTE_SIZE 0x100
+#define STREAM_BUF 0x4000
+
+static const char pairs[513] =
+    "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+size_t hexdump_hex(char* out, const void* data, size_t len) {
+  const uint8_t* p = data;
+  for (size_t i = 0; i < len; i++) {
+    memcpy(out + 2 * i, pairs + 2 * p[i], 2);
+  }
+  return HEXDUMP_HEX_SIZE(len);
+}
+
+size_t hexdump_escaped(char* out, const void* data, size_t len) {
+  const uint8_t* p = data;
+  for (size_t i = 0; i < len; i++) {
+    out[4 * i] = '\\';
+    out[4 * i + 1] = 'x';
+    memcpy(out + 4 * i + 2, pairs + 2 * p[i], 2);
+  }
+  return HEXDUMP_ESCAPED_SIZE(len);
+}
+
+// all 16 digits
+static char* put_hex64(char* out, uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    memcpy(out + 2 * i, pairs + 2 * ((value >> (56 - 8 * i)) & 0xff), 2);
+  }
+  return out + 16;
+}
+
+// like %0*llx with "0x" in front
+static char* put_hex(char* out, uint64_t value, int min_digits) {
+  int digits = 1;
+  while (digits < 16 && (value >> (4 * digits)) != 0) {
+    digits++;
+  }
+  digits = digits < min_digits ? min_digits : digits;
+  char all[16];
+  put_hex64(all, value);
+  *out++ = '0';
+  *out++ = 'x';
+  memcpy(out, all + 16 - digits, digits);
+  return out + digits;
+}
+
+static char* put(char* out, const char* s) {
+  size_t len = strlen(s);
+  memcpy(out, s, len);
+  return out + len;
+}
+
+size_t hexdump_line(char* out, enum hexdump_format format, const char* link, uint64_t base, uint64_t offset,
+                    uint64_t value, const char* note) {
+  char* p = out;
+  note = note ? note : "";
+  link = link ? link : "";
+  if (format == HEXDUMP_HTML) {
+    // <br>[<a href=link0xaddr>0xbase + 0xoff</a>]\t<a href=link0xvalue>0x%016llx</a>\tnote</ br>
+    p = put(p, "<br>[<a href=");
+    p = put(p, link);
+    p = put_hex(p, base + offset, 1);
+    *p++ = '>';
+    p = put_hex(p, base, 1);
+    p = put(p, " + ");
+    p = put_hex(p, offset, 2);
+    p = put(p, "</a>]\t<a href=");
+    p = put(p, link);
+    p = put_hex(p, value, 1);
+    p = put(p, ">0x");
+    p = put_hex64(p, value);
+    p = put(p, "</a>\t");
+    p = put(p, note);
+    p = put(p, "</ br>\n");
+  } else {
+    *p++ = '[';
+    p = put_hex(p, base, 1);
+    p = put(p, " + ");
+    p = put_hex(p, offset, 2);
+    p = put(p, "]\t0x");
+    p = put_hex64(p, value);
+    *p++ = '\t';
+    p = put(p, note);
+    *p++ = '\n';
+  }
+  return p - out;
+}
+
+void hexdump_stream(const struct hexdump_options* opts, const void* data, size_t len, hexdump_sink sink, void* ctx) {
+  char buf[STREAM_BUF];
+  size_t used = 0;
+  const uint8_t* p = data;
+  if (opts->format == HEXDUMP_ESCAPED) {
+    for (size_t done = 0; done < len;) {
+      size_t n = len - done < STREAM_BUF / 4 ? len - done : STREAM_BUF / 4;
+      sink(ctx, buf, hexdump_escaped(buf, p + done, n));
+      done += n;
+    }
+    return;
+  }
+
+  size_t line_max = HEXDUMP_LINE_MAX + 2 * (opts->link ? strlen(opts->link) : 0) + NOTE_SIZE;
+  if (line_max > sizeof(buf)) {
+    return;
+  }
+  for (size_t off = 0; off + 8 <= len; off += 8) {
+    uint64_t value;
+    char note[NOTE_SIZE];
+    memcpy(&value, p + off, sizeof(value));
+    note[0] = 0;
+    if (opts->annotate) {
+      opts->annotate(opts->annotate_ctx, value, note, sizeof(note));
+      note[sizeof(note) - 1] = 0;
+    }
+    if (used + line_max > sizeof(buf)) {
+      sink(ctx, buf, used);
+      used = 0;
+    }
+    used += hexdump_line(buf + used, opts->format, opts->link, opts->base, off, value, note);
+  }
+  if (used) {
+    sink(ctx, buf, used);
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef hexdump_h
+#define hexdump_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ Hex formatting for dump_pointer, dump_pointer_html and cat. Bytes turn into digits through a
+ table of all 256 pairs, a couple of stores per byte and no printf, so dumping is as fast as the
+ memory it's reading. Everything writes into a buffer the caller gives it, sized with the macros
+ below, or a piece at a time to a sink with hexdump_stream.
+
+ The qword formats are the ones dump_pointer has always printed, one line per 8 bytes with the
+ address, the value and a note (the kernel symbol it points into), and in HTML with both linked so
+ pointers can be followed.
+ */
+
+#define HEXDUMP_HEX_SIZE(len) (2 * (size_t)(len))
+#define HEXDUMP_ESCAPED_SIZE(len) (4 * (size_t)(len))
+// a qword line, not counting the note or the link (which is there twice)
+#define HEXDUMP_LINE_MAX 160
+
+enum hexdump_format {
+  HEXDUMP_ESCAPED,  // \x41\x42, to paste into C
+  HEXDUMP_TEXT,     // [0xaddr + 0x08]\t0x0011223344556677\tnote
+  HEXDUMP_HTML,     // the same with the address and value links to link + 0x...
+};
+
+struct hexdump_options {
+  enum hexdump_format format;
+  uint64_t base;            // where the data came from, for the qword lines
+  const char* link;         // HTML, e.g. "/dump_ptr="
+  // fills in a qword's note, NULL for none
+  void (*annotate)(void* ctx, uint64_t value, char* note, size_t size);
+  void* annotate_ctx;
+};
+
+typedef void (*hexdump_sink)(void* ctx, const char* data, size_t len);
+
+// lowercase digits, two per byte. Returns how many were written, nothing's NUL terminated
+size_t hexdump_hex(char* out, const void* data, size_t len);
+size_t hexdump_escaped(char* out, const void* data, size_t len);
+// the line for the qword at base + offset. out needs HEXDUMP_LINE_MAX + 2 * strlen(link) + strlen(note)
+size_t hexdump_line(char* out, enum hexdump_format format, const char* link, uint64_t base, uint64_t offset,
+                    uint64_t value, const char* note);
+
+// all of data in opts->format, in pieces of up to a few K. The qword formats leave out a partial
+// qword at the end
+void hexdump_stream(const struct hexdump_options* opts, const void* data, size_t len, hexdump_sink sink, void* ctx);
+
+#endif
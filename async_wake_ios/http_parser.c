@@ -0,0 +1,225 @@
+#include <string.h>
+#include <strings.h>
+
+#include "http_parser.h"
+
+// RFC 7230's tchar, what methods and header names are made of
+static int is_token(unsigned char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+         (c && strchr("!#$%&'*+-.^_`|~", c));
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c |= 0x20;
+  return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+int http_percent_decode(char* s) {
+  char* out = s;
+  for (char* p = s; *p; p++) {
+    if (*p != '%') {
+      *out++ = *p;
+      continue;
+    }
+    int hi = hex_value(p[1]);
+    int lo = hi < 0 ? -1 : hex_value(p[2]);
+    if (lo < 0 || (hi | lo) == 0) {
+      return -1;
+    }
+    *out++ = (char)(hi << 4 | lo);
+    p += 2;
+  }
+  *out = 0;
+  return 0;
+}
+
+void http_normalize_path(char* path) {
+  char* out = path;
+  char* p = path;
+  while (*p == '/') {
+    char* seg = p + 1;
+    char* end = seg + strcspn(seg, "/");
+    size_t len = end - seg;
+    p = end;
+    if (len == 2 && seg[0] == '.' && seg[1] == '.') {
+      // back to the / before the last segment, which the next one writes over
+      while (out > path && *--out != '/') {
+      }
+    } else if (len > 1 || (len == 1 && seg[0] != '.')) {
+      *out++ = '/';
+      memmove(out, seg, len);
+      out += len;
+      continue;
+    }
+    // ., .. and empty segments leave a directory behind them at the end
+    if (*end == 0) {
+      *out++ = '/';
+    }
+  }
+  if (out == path) {
+    *out++ = '/';
+  }
+  *out = 0;
+}
+
+void http_parser_init(struct http_parser* parser, const struct http_parser_limits* limits) {
+  memset(parser, 0, offsetof(struct http_parser, fields));
+  if (limits) {
+    parser->limits = *limits;
+  }
+  if (parser->limits.max_request_line == 0) {
+    parser->limits.max_request_line = HTTP_DEFAULT_MAX_REQUEST_LINE;
+  }
+  if (parser->limits.max_header_line == 0) {
+    parser->limits.max_header_line = HTTP_DEFAULT_MAX_HEADER_LINE;
+  }
+  if (parser->limits.max_headers <= 0 || parser->limits.max_headers > HTTP_MAX_HEADERS) {
+    parser->limits.max_headers = HTTP_MAX_HEADERS;
+  }
+  parser->req.query = "";
+  parser->req.fields = parser->fields;
+}
+
+// METHOD SP origin-form SP HTTP/1.x, NUL terminated where the line ended
+static int request_line(struct http_parser* parser, char* line) {
+  struct http_request* req = &parser->req;
+  char* p = line;
+  while (is_token(*p)) {
+    p++;
+  }
+  if (p == line || *p != ' ') {
+    return 400;
+  }
+  *p++ = 0;
+  req->method = line;
+
+  char* target = p;
+  while ((unsigned char)*p > ' ' && *p != 0x7f) {
+    p++;
+  }
+  if (*target != '/' || *p != ' ') {
+    return 400;
+  }
+  *p++ = 0;
+
+  if (strncmp(p, "HTTP/", 5) || p[5] < '0' || p[5] > '9' || p[6] != '.' || p[7] < '0' || p[7] > '9' || p[8]) {
+    return 400;
+  }
+  if (p[5] != '1') {
+    return 505;
+  }
+  req->minor_version = p[7] - '0';
+
+  char* query = strchr(target, '?');
+  if (query) {
+    *query = 0;
+    req->query = query + 1;
+  }
+  // decoded first so %2e%2e gets taken out like .. does
+  if (http_percent_decode(target) != 0) {
+    return 400;
+  }
+  http_normalize_path(target);
+  req->path = target;
+  return 0;
+}
+
+// name: value, offsets from the start of the headers
+static int header_line(struct http_parser* parser, const char* headers, const char* line, size_t len) {
+  struct http_request* req = &parser->req;
+  const char* p = line;
+  const char* end = line + len;
+  while (p < end && is_token(*p)) {
+    p++;
+  }
+  // no name, whitespace before the colon, or a folded line carrying on the last one
+  if (p == line || p == end || *p != ':') {
+    return 400;
+  }
+  if (req->n_fields == parser->limits.max_headers) {
+    return 431;
+  }
+  const char* value = p + 1;
+  while (value < end && (*value == ' ' || *value == '\t')) {
+    value++;
+  }
+  while (end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+    end--;
+  }
+  struct http_field* f = &parser->fields[req->n_fields++];
+  f->name = line - headers;
+  f->name_len = p - line;
+  f->value = value - headers;
+  f->value_len = end - value;
+  return 0;
+}
+
+int http_parse(struct http_parser* parser, char* buf, size_t len) {
+  struct http_request* req = &parser->req;
+  for (;;) {
+    size_t max = parser->in_headers ? parser->limits.max_header_line : parser->limits.max_request_line;
+    char* nl = parser->scanned < len ? memchr(buf + parser->scanned, '\n', len - parser->scanned) : NULL;
+    if (nl == NULL) {
+      parser->scanned = len;
+      // a CR could still be coming off the end of it
+      if (len - parser->line > max + 1) {
+        return parser->in_headers ? 431 : 414;
+      }
+      return HTTP_PARSE_MORE;
+    }
+
+    char* line = buf + parser->line;
+    size_t n = nl - line;
+    if (n > 0 && line[n - 1] == '\r') {
+      n--;
+    }
+    parser->line = parser->scanned = nl + 1 - buf;
+    if (n > max) {
+      return parser->in_headers ? 431 : 414;
+    }
+
+    if (!parser->in_headers) {
+      // blank lines ahead of a request are let through, RFC 7230 3.5
+      if (n == 0) {
+        continue;
+      }
+      line[n] = 0;
+      int status = request_line(parser, line);
+      if (status) {
+        return status;
+      }
+      parser->in_headers = 1;
+      req->headers = buf + parser->line;
+      continue;
+    }
+
+    if (n == 0) {
+      req->headers_len = line - req->headers;
+      parser->head_len = parser->line;
+      return HTTP_PARSE_DONE;
+    }
+    // the field offsets are 16 bits
+    if ((size_t)(line + n - req->headers) > UINT16_MAX) {
+      return 431;
+    }
+    int status = header_line(parser, req->headers, line, n);
+    if (status) {
+      return status;
+    }
+  }
+}
+
+const char* http_parser_header(const struct http_request* req, const char* name, size_t* len) {
+  size_t name_len = strlen(name);
+  for (int i = 0; i < req->n_fields; i++) {
+    const struct http_field* f = &req->fields[i];
+    if (f->name_len == name_len && !strncasecmp(req->headers + f->name, name, name_len)) {
+      *len = f->value_len;
+      return req->headers + f->value;
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,77 @@
+#ifndef http_parser_h
+#define http_parser_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ The request head parser behind http_server. It works on the connection's own buffer and picks up
+ where it left off each time more arrives, so a head that trickles in a few bytes at a time is
+ looked at once, not rescanned from the start on every read, and one that's never going to fit
+ (a request line or header over the limits, too many headers, a bad method or version) is turned
+ away as soon as it shows up rather than once the buffer is full.
+
+ Nothing is copied out. The request line is cut up in place with NULs, the path is percent
+ decoded in place (decoding never makes it longer) and then has its dot segments and doubled
+ slashes taken out, so what a handler sees can't climb out of wherever it's rooted. Header lines
+ stay where they are and get indexed by offset as they're parsed.
+ */
+
+#define HTTP_MAX_HEADERS 64
+#define HTTP_DEFAULT_MAX_REQUEST_LINE 4096
+#define HTTP_DEFAULT_MAX_HEADER_LINE 4096
+
+#define HTTP_PARSE_MORE 0         // not a whole head yet
+#define HTTP_PARSE_DONE 1
+// anything else is the status to answer with, 400, 414, 431 or 505
+
+struct http_field {
+  uint16_t name;            // offsets into the request's headers
+  uint16_t name_len;
+  uint16_t value;           // without the whitespace either side
+  uint16_t value_len;
+};
+
+struct http_request {
+  const char* method;
+  char* path;               // percent decoded and normalized, always starts with /
+  const char* query;        // what came after the ?, as sent, "" if nothing did
+  int minor_version;        // HTTP/1.x
+  int keep_alive;           // what the client asked for
+  const char* headers;      // the raw header lines
+  size_t headers_len;
+  const struct http_field* fields;
+  int n_fields;
+};
+
+struct http_parser_limits {
+  size_t max_request_line;  // 0 for HTTP_DEFAULT_MAX_REQUEST_LINE
+  size_t max_header_line;   // 0 for HTTP_DEFAULT_MAX_HEADER_LINE
+  int max_headers;          // 0 for (or at most) HTTP_MAX_HEADERS
+};
+
+struct http_parser {
+  struct http_parser_limits limits;
+  int in_headers;
+  size_t line;              // where the line being looked for starts
+  size_t scanned;           // how far that's been searched for its \n
+  size_t head_len;          // once it's DONE, how much of the buffer the head was
+  struct http_request req;
+  struct http_field fields[HTTP_MAX_HEADERS];
+};
+
+// ready for a new head at the start of the buffer
+void http_parser_init(struct http_parser* parser, const struct http_parser_limits* limits);
+// buf holds len bytes of which the earlier calls have seen some. buf can't move between calls,
+// and once it's DONE parser->req points into it. Bytes after the head (a pipelined request) are
+// left alone
+int http_parse(struct http_parser* parser, char* buf, size_t len);
+
+// in place, the value of a header or NULL
+const char* http_parser_header(const struct http_request* req, const char* name, size_t* len);
+// decodes %XX in place, -1 for a bad escape or one that's a NUL
+int http_percent_decode(char* s);
+// takes out . and .. segments and empty ones in place, keeping a trailing slash. path starts with /
+void http_normalize_path(char* path);
+
+#endif
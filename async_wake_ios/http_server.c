@@ -0,0 +1,1628 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef __APPLE__
+#include <sys/event.h>
+#else
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#endif
+
+#include "http_server.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0  // SO_NOSIGPIPE is set on each socket instead
+#endif
+
+#define WANT_READ 1
+#define WANT_WRITE 2
+#define GOT_ERROR 4
+#define MAX_EVENTS 64
+#define NO_LENGTH ((uint64_t)-1)
+#define BOUNDARY "ws-byteranges-7d1f3a"
+#define MAX_IOV 64
+#define POOL_MAX 64               // free buffers kept around, 1M
+#define WORK_HANDLER 1
+#define WORK_PRODUCE 2
+
+enum conn_state {
+  CONN_READING,
+  CONN_WRITING,
+  CONN_WORKING,             // a worker has it, or it's waiting for one
+  CONN_CLOSED,
+};
+
+struct out_segment {
+  const char* data;         // NULL for a range of body_fd
+  uint64_t offset;
+  uint64_t len;
+};
+
+// what http_write goes into, a chunk each when the body is chunked. http_write_file's ones hold
+// a range of a file instead of data
+struct http_buf {
+  struct http_buf* next;
+  size_t len;
+  int fd;
+  uint64_t offset;
+  char prefix[20];          // the chunk size line
+  size_t prefix_len;
+  char data[HTTP_BUF_SIZE];
+};
+
+struct http_conn {
+  struct http_server* server;
+  struct http_conn* prev;
+  struct http_conn* next;
+  int fd;
+  enum conn_state state;
+  int waiting_for;          // WANT_READ or WANT_WRITE, what the poller is watching
+  time_t last_active;
+
+  int keep_alive;
+  int head_only;
+  int minor_version;
+  int responded;
+  int status;
+  size_t request_len;       // the head being answered, dropped from in once the response is sent
+  size_t in_len;
+
+  // the response is a list of pieces of out, body_owned and body_fd sent in order
+  struct out_segment segs[2 * HTTP_MAX_RANGES + 2];
+  int n_segs;
+  int seg;
+  uint64_t seg_sent;
+  size_t out_len;
+  char* body_owned;
+  int body_fd;
+  int no_sendfile;
+  char* file_buf;           // only if sendfile can't be used, what's been read of file_buf_fd and not sent
+  int file_buf_fd;
+  uint64_t file_buf_offset;
+  size_t file_buf_len;
+
+  // http_begin's body, sent after the segments once the handler returns and the headers are known
+  int writer;
+  int chunked;
+  char content_type[64];
+  struct http_buf* wbuf_head;
+  struct http_buf* wbuf_tail;
+  uint64_t wbuf_sent;       // of the head one, chunk framing included
+  uint64_t written;
+  uint64_t length;          // http_set_length's, NO_LENGTH if there wasn't one
+  char extra[256];          // http_add_header's lines
+  size_t extra_len;
+  http_producer produce;
+  void (*release)(void* state);
+  void* produce_state;
+
+  // what sending this response has cost so far
+  uint64_t resp_bytes;
+  uint32_t resp_syscalls;
+
+  // http_defer's, while it's CONN_WORKING only the worker running it touches the connection
+  http_handler deferred;
+  void* deferred_ctx;
+  int endpoint;             // -1 unless it's deferred, the slot's held until the response is sent
+  int work;                 // what the worker's to do, WORK_HANDLER or WORK_PRODUCE
+  uint64_t work_us;
+  struct http_conn* next_waiting;
+
+  struct http_parser parser;
+
+  // last so a new connection only has to clear what's above
+  char in[HTTP_MAX_REQUEST];
+  char out[HTTP_OUT_SIZE];
+};
+
+// Vyukov's bounded queue, every cell has a sequence number saying whose turn it is, so pushing and
+// popping are a compare and swap each with any number of threads on either end
+struct ring_cell {
+  atomic_size_t seq;
+  struct http_conn* conn;
+};
+
+struct ring {
+  struct ring_cell* cells;
+  size_t mask;
+  atomic_size_t head;       // next to push
+  atomic_size_t tail;       // next to pop
+};
+
+struct endpoint {
+  char name[32];
+  int limit;
+  int active;
+  int waiting;
+  int max_waiting;
+  uint64_t requests;
+  uint64_t worker_us;
+  struct http_conn* wait_head;
+  struct http_conn* wait_tail;
+};
+
+struct http_server {
+  struct http_server_options opts;
+  int listen_fd;
+  int poll_fd;
+  int wake[2];
+  atomic_int stop;
+  int n_conns;
+  struct http_conn* conns;
+  struct http_conn* closed;  // freed after each batch of events, a later event might still name them
+  struct http_buf* pool;
+  int pool_count;
+  struct http_stats stats;
+
+  // the workers. jobs has a cell for every connection and a connection is only ever on one of
+  // the queues once, so neither can fill up
+  struct endpoint endpoints[HTTP_MAX_ENDPOINTS];
+  int n_endpoints;
+  pthread_t* workers;
+  int n_workers;
+  struct ring jobs;
+  struct ring done;
+  atomic_int queued;
+  atomic_int idle_workers;
+  atomic_int workers_stop;
+  atomic_int wake_pending;
+  pthread_mutex_t work_lock;
+  pthread_cond_t work_cond;
+};
+
+// the pool's only for the loop's thread, a worker's buffers come from malloc and go into the pool
+// once the loop's sent them
+static __thread int on_worker;
+
+struct poll_event {
+  void* udata;
+  int events;
+};
+
+#ifdef __APPLE__
+static int poll_create(void) {
+  return kqueue();
+}
+
+static int poll_watch(int poll_fd, int fd, void* udata, int want) {
+  struct kevent changes[2];
+  EV_SET(&changes[0], fd, EVFILT_READ, EV_ADD | (want & WANT_READ ? EV_ENABLE : EV_DISABLE), 0, 0, udata);
+  EV_SET(&changes[1], fd, EVFILT_WRITE, EV_ADD | (want & WANT_WRITE ? EV_ENABLE : EV_DISABLE), 0, 0, udata);
+  return kevent(poll_fd, changes, 2, NULL, 0, NULL);
+}
+
+// nothing at all while a worker has it
+static int poll_unwatch(int poll_fd, int fd, void* udata) {
+  return poll_watch(poll_fd, fd, udata, 0);
+}
+
+static int poll_wait(int poll_fd, struct poll_event* events, int max, int timeout_ms) {
+  struct kevent kev[MAX_EVENTS];
+  struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+  int n = kevent(poll_fd, NULL, 0, kev, max < MAX_EVENTS ? max : MAX_EVENTS, &timeout);
+  for (int i = 0; i < n; i++) {
+    events[i].udata = kev[i].udata;
+    events[i].events = kev[i].filter == EVFILT_WRITE ? WANT_WRITE : WANT_READ;
+    if (kev[i].flags & EV_ERROR) {
+      events[i].events |= GOT_ERROR;
+    }
+  }
+  return n;
+}
+#else
+static int poll_create(void) {
+  return epoll_create1(EPOLL_CLOEXEC);
+}
+
+// the first call for an fd adds it
+static int poll_watch(int poll_fd, int fd, void* udata, int want) {
+  struct epoll_event ev = {0};
+  ev.events = (want & WANT_READ ? EPOLLIN : 0) | (want & WANT_WRITE ? EPOLLOUT : 0);
+  ev.data.ptr = udata;
+  if (epoll_ctl(poll_fd, EPOLL_CTL_MOD, fd, &ev) == 0) {
+    return 0;
+  }
+  return errno == ENOENT ? epoll_ctl(poll_fd, EPOLL_CTL_ADD, fd, &ev) : -1;
+}
+
+// epoll reports hangups whatever it's asked for, so it's taken out altogether
+static int poll_unwatch(int poll_fd, int fd, void* udata) {
+  (void)udata;
+  return epoll_ctl(poll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static int poll_wait(int poll_fd, struct poll_event* events, int max, int timeout_ms) {
+  struct epoll_event ev[MAX_EVENTS];
+  int n = epoll_wait(poll_fd, ev, max < MAX_EVENTS ? max : MAX_EVENTS, timeout_ms);
+  for (int i = 0; i < n; i++) {
+    events[i].udata = ev[i].data.ptr;
+    events[i].events = (ev[i].events & (EPOLLIN | EPOLLHUP) ? WANT_READ : 0) | (ev[i].events & EPOLLOUT ? WANT_WRITE : 0) |
+                       (ev[i].events & EPOLLERR ? GOT_ERROR : 0);
+  }
+  return n;
+}
+#endif
+
+static const char* status_text(int status) {
+  switch (status) {
+    case 200: return "OK";
+    case 206: return "Partial Content";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 414: return "URI Too Long";
+    case 416: return "Range Not Satisfiable";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 505: return "HTTP Version Not Supported";
+    default: return "Unknown";
+  }
+}
+
+static int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags == -1 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void conn_watch(struct http_conn* conn, int want) {
+  if (conn->waiting_for != want) {
+    poll_watch(conn->server->poll_fd, conn->fd, conn, want);
+    conn->waiting_for = want;
+  }
+}
+
+static void conn_unwatch(struct http_conn* conn) {
+  poll_unwatch(conn->server->poll_fd, conn->fd, conn);
+  conn->waiting_for = -1;
+}
+
+static struct http_buf* buf_get(struct http_server* server) {
+  struct http_buf* buf = on_worker ? NULL : server->pool;
+  if (buf) {
+    server->pool = buf->next;
+    server->pool_count--;
+  } else if ((buf = malloc(sizeof(*buf))) == NULL) {
+    return NULL;
+  }
+  buf->next = NULL;
+  buf->len = 0;
+  buf->fd = -1;
+  buf->prefix_len = 0;
+  return buf;
+}
+
+static void buf_put(struct http_server* server, struct http_buf* buf) {
+  if (buf->fd != -1) {
+    close(buf->fd);
+  }
+  if (!on_worker && server->pool_count < POOL_MAX) {
+    buf->next = server->pool;
+    server->pool = buf;
+    server->pool_count++;
+  } else {
+    free(buf);
+  }
+}
+
+static void conn_reset_response(struct http_conn* conn) {
+  while (conn->wbuf_head) {
+    struct http_buf* next = conn->wbuf_head->next;
+    buf_put(conn->server, conn->wbuf_head);
+    conn->wbuf_head = next;
+  }
+  conn->wbuf_tail = NULL;
+  conn->wbuf_sent = 0;
+  conn->written = 0;
+  conn->length = NO_LENGTH;
+  conn->extra_len = 0;
+  conn->writer = conn->chunked = 0;
+  if (conn->release) {
+    conn->release(conn->produce_state);
+  }
+  conn->produce = NULL;
+  conn->release = NULL;
+  conn->produce_state = NULL;
+  free(conn->body_owned);
+  free(conn->file_buf);
+  if (conn->body_fd != -1) {
+    close(conn->body_fd);
+  }
+  conn->n_segs = conn->seg = 0;
+  conn->seg_sent = 0;
+  conn->out_len = 0;
+  conn->body_owned = conn->file_buf = NULL;
+  conn->file_buf_len = 0;
+  conn->file_buf_fd = -1;
+  conn->body_fd = -1;
+  conn->responded = 0;
+  conn->resp_bytes = 0;
+  conn->resp_syscalls = 0;
+}
+
+static void endpoint_release(struct http_conn* conn);
+
+static void conn_close(struct http_conn* conn) {
+  if (conn->state == CONN_CLOSED) {
+    return;
+  }
+  struct http_server* server = conn->server;
+  endpoint_release(conn);
+  conn_reset_response(conn);
+  close(conn->fd);
+  conn->state = CONN_CLOSED;
+  if (conn->prev) {
+    conn->prev->next = conn->next;
+  } else {
+    server->conns = conn->next;
+  }
+  if (conn->next) {
+    conn->next->prev = conn->prev;
+  }
+  conn->next = server->closed;
+  server->closed = conn;
+  server->n_conns--;
+}
+
+// queues len bytes just written at the end of out, as part of the last segment if that ends there
+static void out_commit(struct http_conn* conn, size_t len) {
+  struct out_segment* last = conn->n_segs ? &conn->segs[conn->n_segs - 1] : NULL;
+  if (last && last->data && last->data + last->len == conn->out + conn->out_len) {
+    last->len += len;
+  } else {
+    conn->segs[conn->n_segs++] = (struct out_segment){conn->out + conn->out_len, 0, len};
+  }
+  conn->out_len += len;
+}
+
+static void out_printf(struct http_conn* conn, const char* fmt, ...) {
+  size_t room = sizeof(conn->out) - conn->out_len;
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(conn->out + conn->out_len, room, fmt, ap);
+  va_end(ap);
+  out_commit(conn, n < 0 ? 0 : (size_t)n < room ? (size_t)n : room - 1);
+}
+
+static void add_segment(struct http_conn* conn, const char* data, uint64_t offset, uint64_t len) {
+  if (len > 0) {
+    conn->segs[conn->n_segs++] = (struct out_segment){data, offset, len};
+  }
+}
+
+// the status line and headers into out, the body goes after them. extra is more header lines
+static void write_headers(struct http_conn* conn, int status, const char* content_type, uint64_t len,
+                          const char* extra) {
+  conn->status = status;
+  out_printf(conn, "HTTP/1.1 %d %s\r\n", status, status_text(status));
+  if (content_type) {
+    out_printf(conn, "Content-Type: %s\r\n", content_type);
+  }
+  if (len != NO_LENGTH) {
+    out_printf(conn, "Content-Length: %llu\r\n", (unsigned long long)len);
+  }
+  out_printf(conn, "%sConnection: %s\r\n\r\n", extra ? extra : "", conn->keep_alive ? "keep-alive" : "close");
+}
+
+static void start_response(struct http_conn* conn, int status, const char* content_type, uint64_t len,
+                           const char* extra) {
+  conn_reset_response(conn);
+  conn->responded = 1;
+  write_headers(conn, status, content_type, len, extra);
+}
+
+void http_respond(struct http_conn* conn, int status, const char* content_type, const void* body, size_t len) {
+  start_response(conn, status, content_type ? content_type : "text/html", len, NULL);
+  if (conn->head_only || len == 0) {
+    return;
+  }
+  if (len <= sizeof(conn->out) - conn->out_len) {
+    memcpy(conn->out + conn->out_len, body, len);
+    out_commit(conn, len);
+    return;
+  }
+  conn->body_owned = malloc(len);
+  if (conn->body_owned == NULL) {
+    conn->keep_alive = 0;
+    start_response(conn, 500, "text/plain", 0, NULL);
+    return;
+  }
+  memcpy(conn->body_owned, body, len);
+  add_segment(conn, conn->body_owned, 0, len);
+}
+
+void http_respond_owned(struct http_conn* conn, int status, const char* content_type, char* body, size_t len) {
+  start_response(conn, status, content_type ? content_type : "text/html", len, NULL);
+  conn->body_owned = body;
+  if (!conn->head_only) {
+    add_segment(conn, body, 0, len);
+  }
+}
+
+void http_respond_fd(struct http_conn* conn, int status, const char* content_type, int fd, uint64_t size) {
+  off_t offset = lseek(fd, 0, SEEK_CUR);
+  start_response(conn, status, content_type ? content_type : "text/html", size, NULL);
+  conn->body_fd = fd;
+  if (!conn->head_only) {
+    add_segment(conn, NULL, offset < 0 ? 0 : offset, size);
+  }
+}
+
+void http_begin(struct http_conn* conn, int status, const char* content_type) {
+  conn_reset_response(conn);
+  conn->responded = 1;
+  conn->writer = 1;
+  conn->status = status;
+  snprintf(conn->content_type, sizeof(conn->content_type), "%s", content_type ? content_type : "text/html");
+}
+
+void http_set_length(struct http_conn* conn, uint64_t len) {
+  conn->length = len;
+}
+
+void http_add_header(struct http_conn* conn, const char* name, const char* value) {
+  size_t room = sizeof(conn->extra) - conn->extra_len;
+  int n = snprintf(conn->extra + conn->extra_len, room, "%s: %s\r\n", name, value);
+  if (n > 0 && (size_t)n < room) {
+    conn->extra_len += n;
+  } else {
+    conn->extra[conn->extra_len] = 0;
+  }
+}
+
+void http_write(struct http_conn* conn, const void* data, size_t len) {
+  const char* p = data;
+  conn->written += len;
+  if (!conn->writer || conn->head_only) {
+    return;
+  }
+  while (len > 0) {
+    struct http_buf* tail = conn->wbuf_tail;
+    if (tail == NULL || tail->fd != -1 || tail->len == sizeof(tail->data)) {
+      if ((tail = buf_get(conn->server)) == NULL) {
+        // nothing sensible to send now, hang up once what's queued is gone
+        conn->keep_alive = 0;
+        return;
+      }
+      if (conn->wbuf_tail) {
+        conn->wbuf_tail->next = tail;
+      } else {
+        conn->wbuf_head = tail;
+      }
+      conn->wbuf_tail = tail;
+    }
+    size_t n = sizeof(tail->data) - tail->len < len ? sizeof(tail->data) - tail->len : len;
+    memcpy(tail->data + tail->len, p, n);
+    tail->len += n;
+    p += n;
+    len -= n;
+  }
+}
+
+void http_write_file(struct http_conn* conn, int fd, uint64_t offset, uint64_t len) {
+  conn->written += len;
+  struct http_buf* buf = NULL;
+  if (!conn->writer || conn->head_only || len == 0 || (buf = buf_get(conn->server)) == NULL) {
+    if (conn->writer && !conn->head_only && len) {
+      conn->keep_alive = 0;
+    }
+    close(fd);
+    return;
+  }
+  buf->fd = fd;
+  buf->offset = offset;
+  buf->len = len;
+  if (conn->wbuf_tail) {
+    conn->wbuf_tail->next = buf;
+  } else {
+    conn->wbuf_head = buf;
+  }
+  conn->wbuf_tail = buf;
+}
+
+void http_printf(struct http_conn* conn, const char* fmt, ...) {
+  char small[512];
+  va_list ap, ap2;
+  va_start(ap, fmt);
+  va_copy(ap2, ap);
+  int n = vsnprintf(small, sizeof(small), fmt, ap);
+  va_end(ap);
+  if (n >= (int)sizeof(small)) {
+    char* big = malloc(n + 1);
+    if (big) {
+      vsnprintf(big, n + 1, fmt, ap2);
+      http_write(conn, big, n);
+      free(big);
+    }
+  } else if (n > 0) {
+    http_write(conn, small, n);
+  }
+  va_end(ap2);
+}
+
+void http_stream(struct http_conn* conn, http_producer produce, void (*release)(void* state), void* state) {
+  conn->produce = produce;
+  conn->release = release;
+  conn->produce_state = state;
+}
+
+// once the handler's returned, what it wrote is all there is or the producer takes it from here
+static void finish_writer(struct http_conn* conn) {
+  uint64_t len = conn->length != NO_LENGTH ? conn->length : conn->written;
+  char extra[sizeof(conn->extra) + 32];
+  snprintf(extra, sizeof(extra), "%s", conn->extra_len ? conn->extra : "");
+  if (conn->produce && conn->length == NO_LENGTH) {
+    len = NO_LENGTH;
+    if (conn->minor_version >= 1) {
+      conn->chunked = 1;
+      snprintf(extra, sizeof(extra), "%sTransfer-Encoding: chunked\r\n", conn->extra_len ? conn->extra : "");
+    } else {
+      // 1.0 doesn't know chunks, the end of the body is the end of the connection
+      conn->keep_alive = 0;
+    }
+  }
+  if (conn->produce && conn->head_only) {
+    conn->release(conn->produce_state);
+    conn->produce = NULL;
+    conn->release = NULL;
+  }
+  write_headers(conn, conn->status, conn->content_type, len, extra);
+}
+
+// the next producer call's output, or the last chunk if it's finished
+static void run_producer(struct http_conn* conn) {
+  if (conn->produce(conn, conn->produce_state) == 0) {
+    return;
+  }
+  conn->release(conn->produce_state);
+  conn->produce = NULL;
+  conn->release = NULL;
+  if (conn->chunked) {
+    // an empty buffer is framed as the zero length chunk that ends the body
+    struct http_buf* last = buf_get(conn->server);
+    if (last == NULL) {
+      conn->keep_alive = 0;
+      return;
+    }
+    if (conn->wbuf_tail) {
+      conn->wbuf_tail->next = last;
+    } else {
+      conn->wbuf_head = last;
+    }
+    conn->wbuf_tail = last;
+  }
+}
+
+static const char* months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+static void http_date(time_t t, char* buf, size_t size) {
+  static const char* days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  snprintf(buf, size, "%s, %02d %s %04d %02d:%02d:%02d GMT", days[tm.tm_wday], tm.tm_mday, months[tm.tm_mon],
+           tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+// a header value copied out and NUL terminated, NULL if it isn't there or doesn't fit
+static const char* header_copy(const struct http_request* req, const char* name, char* buf, size_t size) {
+  size_t len;
+  const char* value = http_header(req, name, &len);
+  if (value == NULL || len >= size) {
+    return NULL;
+  }
+  memcpy(buf, value, len);
+  buf[len] = 0;
+  return buf;
+}
+
+// IMF-fixdate, the only one anything sends now. -1 if it's something else
+static time_t parse_http_date(const char* s) {
+  struct tm tm = {0};
+  char month[4];
+  if (sscanf(s, "%*3s, %d %3s %d %d:%d:%d GMT", &tm.tm_mday, month, &tm.tm_year, &tm.tm_hour, &tm.tm_min,
+             &tm.tm_sec) != 6) {
+    return -1;
+  }
+  tm.tm_mon = -1;
+  for (int i = 0; i < 12; i++) {
+    if (!strcmp(month, months[i])) {
+      tm.tm_mon = i;
+    }
+  }
+  if (tm.tm_mon < 0) {
+    return -1;
+  }
+  tm.tm_year -= 1900;
+  return timegm(&tm);
+}
+
+// If-None-Match wins over If-Modified-Since when there are both
+static int not_modified(const struct http_request* req, const char* etag, time_t mtime) {
+  char buf[512];
+  if (header_copy(req, "If-None-Match", buf, sizeof(buf))) {
+    return strstr(buf, etag) != NULL || !strcmp(buf, "*");
+  }
+  if (header_copy(req, "If-Modified-Since", buf, sizeof(buf))) {
+    time_t since = parse_http_date(buf);
+    return since != -1 && mtime <= since;
+  }
+  return 0;
+}
+
+struct byte_range {
+  uint64_t first;
+  uint64_t last;
+};
+
+// 0 to ignore the Range header and send everything, -1 if none of it can be satisfied, otherwise how
+// many ranges there are
+static int parse_ranges(const struct http_request* req, const char* etag, time_t mtime, uint64_t size,
+                        struct byte_range* ranges) {
+  char buf[512];
+  if (!header_copy(req, "Range", buf, sizeof(buf)) || strncmp(buf, "bytes=", 6)) {
+    return 0;
+  }
+  // If-Range says only send part of it if it's still the same file
+  char if_range[128];
+  if (header_copy(req, "If-Range", if_range, sizeof(if_range))) {
+    if (if_range[0] == '"' ? strcmp(if_range, etag) != 0 : parse_http_date(if_range) != mtime) {
+      return 0;
+    }
+  }
+
+  int n = 0;
+  char* p = buf + 6;
+  for (;;) {
+    char* end;
+    uint64_t first, last;
+    while (*p == ' ') {
+      p++;
+    }
+    if (*p == '-') {
+      // the last so many bytes
+      uint64_t suffix = strtoull(p + 1, &end, 10);
+      if (end == p + 1) {
+        return 0;
+      }
+      first = suffix < size ? size - suffix : 0;
+      last = size - 1;
+      if (suffix == 0) {
+        first = size;
+      }
+    } else {
+      first = strtoull(p, &end, 10);
+      if (end == p || *end != '-') {
+        return 0;
+      }
+      p = end + 1;
+      last = strtoull(p, &end, 10);
+      if (end == p) {
+        last = size - 1;
+      } else if (last < first) {
+        return 0;
+      } else if (last >= size) {
+        last = size - 1;
+      }
+    }
+    // past the end ones are left out, it's only an error if they all are
+    if (first < size) {
+      if (n == HTTP_MAX_RANGES) {
+        // too many to be worth it, they get the lot
+        return 0;
+      }
+      ranges[n].first = first;
+      ranges[n].last = last;
+      n++;
+    }
+    p = end;
+    while (*p == ' ') {
+      p++;
+    }
+    if (*p == 0) {
+      break;
+    }
+    if (*p != ',') {
+      return 0;
+    }
+    p++;
+  }
+  return n ? n : -1;
+}
+
+int http_range(const struct http_request* req, uint64_t size, uint64_t* first, uint64_t* last) {
+  struct byte_range ranges[HTTP_MAX_RANGES];
+  size_t len;
+  // there's nothing to compare an If-Range with, so whatever it was it's changed
+  if (http_header(req, "If-Range", &len)) {
+    return 0;
+  }
+  int n = parse_ranges(req, "", 0, size, ranges);
+  if (n == 1) {
+    *first = ranges[0].first;
+    *last = ranges[0].last;
+  }
+  return n > 1 ? 0 : n;
+}
+
+static int part_header(char* buf, size_t size, const char* content_type, const struct byte_range* r, uint64_t total) {
+  return snprintf(buf, size, "\r\n--" BOUNDARY "\r\nContent-Type: %s\r\nContent-Range: bytes %llu-%llu/%llu\r\n\r\n",
+                  content_type, (unsigned long long)r->first, (unsigned long long)r->last,
+                  (unsigned long long)total);
+}
+
+void http_respond_file(struct http_conn* conn, const struct http_request* req, int fd, const char* content_type) {
+  struct stat st;
+  if (fstat(fd, &st)) {
+    close(fd);
+    conn->keep_alive = 0;
+    start_response(conn, 500, "text/plain", 0, NULL);
+    return;
+  }
+  uint64_t size = st.st_size;
+  char etag[64];
+  char modified[40];
+  char validators[256];
+  snprintf(etag, sizeof(etag), "\"%llx-%llx-%llx\"", (unsigned long long)st.st_ino, (unsigned long long)size,
+           (unsigned long long)st.st_mtime);
+  http_date(st.st_mtime, modified, sizeof(modified));
+  snprintf(validators, sizeof(validators), "ETag: %s\r\nLast-Modified: %s\r\nAccept-Ranges: bytes\r\n", etag, modified);
+  content_type = content_type ? content_type : "application/octet-stream";
+
+  if (not_modified(req, etag, st.st_mtime)) {
+    close(fd);
+    start_response(conn, 304, NULL, NO_LENGTH, validators);
+    return;
+  }
+
+  struct byte_range ranges[HTTP_MAX_RANGES];
+  int n = parse_ranges(req, etag, st.st_mtime, size, ranges);
+  if (n < 0) {
+    close(fd);
+    char extra[64];
+    snprintf(extra, sizeof(extra), "Content-Range: bytes */%llu\r\n", (unsigned long long)size);
+    start_response(conn, 416, "text/plain", 0, extra);
+    return;
+  }
+  if (n == 0) {
+    start_response(conn, 200, content_type, size, validators);
+    conn->body_fd = fd;
+    if (!conn->head_only) {
+      add_segment(conn, NULL, 0, size);
+    }
+    return;
+  }
+  if (n == 1) {
+    char extra[sizeof(validators) + 64];
+    snprintf(extra, sizeof(extra), "%sContent-Range: bytes %llu-%llu/%llu\r\n", validators,
+             (unsigned long long)ranges[0].first, (unsigned long long)ranges[0].last, (unsigned long long)size);
+    start_response(conn, 206, content_type, ranges[0].last - ranges[0].first + 1, extra);
+    conn->body_fd = fd;
+    if (!conn->head_only) {
+      add_segment(conn, NULL, ranges[0].first, ranges[0].last - ranges[0].first + 1);
+    }
+    return;
+  }
+
+  // multipart/byteranges, each part's header goes into out between the pieces of the file
+  uint64_t len = strlen("\r\n--" BOUNDARY "--\r\n");
+  for (int i = 0; i < n; i++) {
+    len += part_header(NULL, 0, content_type, &ranges[i], size) + ranges[i].last - ranges[i].first + 1;
+  }
+  start_response(conn, 206, "multipart/byteranges; boundary=" BOUNDARY, len, validators);
+  conn->body_fd = fd;
+  if (conn->head_only) {
+    return;
+  }
+  for (int i = 0; i < n; i++) {
+    char header[256];
+    part_header(header, sizeof(header), content_type, &ranges[i], size);
+    out_printf(conn, "%s", header);
+    add_segment(conn, NULL, ranges[i].first, ranges[i].last - ranges[i].first + 1);
+  }
+  out_printf(conn, "\r\n--" BOUNDARY "--\r\n");
+}
+
+struct http_server* http_conn_server(struct http_conn* conn) {
+  return conn->server;
+}
+
+const char* http_header(const struct http_request* req, const char* name, size_t* len) {
+  return http_parser_header(req, name, len);
+}
+
+static int header_has_token(const struct http_request* req, const char* name, const char* token) {
+  size_t len;
+  const char* value = http_header(req, name, &len);
+  size_t token_len = strlen(token);
+  for (size_t i = 0; value != NULL && i + token_len <= len; i++) {
+    if (!strncasecmp(value + i, token, token_len)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void conn_error(struct http_conn* conn, int status) {
+  conn->keep_alive = 0;
+  http_respond(conn, status, "text/plain", status_text(status), strlen(status_text(status)));
+}
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int ring_init(struct ring* ring, size_t min_size) {
+  size_t size = 1;
+  while (size < min_size) {
+    size <<= 1;
+  }
+  ring->cells = calloc(size, sizeof(*ring->cells));
+  if (ring->cells == NULL) {
+    return -1;
+  }
+  for (size_t i = 0; i < size; i++) {
+    atomic_init(&ring->cells[i].seq, i);
+  }
+  ring->mask = size - 1;
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  return 0;
+}
+
+static int ring_push(struct ring* ring, struct http_conn* conn) {
+  size_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  for (;;) {
+    struct ring_cell* cell = &ring->cells[pos & ring->mask];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1, memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        cell->conn = conn;
+        atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+        return 0;
+      }
+    } else if (diff < 0) {
+      return -1;
+    } else {
+      pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    }
+  }
+}
+
+static struct http_conn* ring_pop(struct ring* ring) {
+  size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  for (;;) {
+    struct ring_cell* cell = &ring->cells[pos & ring->mask];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1, memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        struct http_conn* conn = cell->conn;
+        atomic_store_explicit(&cell->seq, pos + ring->mask + 1, memory_order_release);
+        return conn;
+      }
+    } else if (diff < 0) {
+      return NULL;
+    } else {
+      pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    }
+  }
+}
+
+// what's left of a request once the handler's returned, wherever it ran
+static void finish_handler(struct http_conn* conn) {
+  if (!conn->responded) {
+    conn_error(conn, 500);
+  } else if (conn->writer) {
+    finish_writer(conn);
+  }
+}
+
+static void* worker_main(void* arg) {
+  struct http_server* server = arg;
+  on_worker = 1;
+  for (;;) {
+    struct http_conn* conn = ring_pop(&server->jobs);
+    if (conn == NULL) {
+      // idle is counted before looking again, so a push either gets seen here or sees us idle
+      pthread_mutex_lock(&server->work_lock);
+      atomic_fetch_add(&server->idle_workers, 1);
+      atomic_thread_fence(memory_order_seq_cst);
+      while ((conn = ring_pop(&server->jobs)) == NULL && !atomic_load(&server->workers_stop)) {
+        pthread_cond_wait(&server->work_cond, &server->work_lock);
+      }
+      atomic_fetch_sub(&server->idle_workers, 1);
+      pthread_mutex_unlock(&server->work_lock);
+      if (conn == NULL) {
+        return NULL;
+      }
+    }
+    atomic_fetch_sub(&server->queued, 1);
+
+    uint64_t start = now_us();
+    if (conn->work == WORK_HANDLER) {
+      conn->deferred(conn, &conn->parser.req, conn->deferred_ctx);
+      finish_handler(conn);
+    } else {
+      run_producer(conn);
+    }
+    conn->work_us += now_us() - start;
+
+    ring_push(&server->done, conn);
+    if (atomic_exchange(&server->wake_pending, 1) == 0) {
+      write(server->wake[1], "", 1);
+    }
+  }
+}
+
+// off the loop and on to a worker, it comes back through work_done
+static void work_submit(struct http_conn* conn, int work) {
+  struct http_server* server = conn->server;
+  conn->work = work;
+  conn->state = CONN_WORKING;
+  conn_unwatch(conn);
+  uint32_t depth = atomic_fetch_add(&server->queued, 1) + 1;
+  if (depth > server->stats.max_queue_depth) {
+    server->stats.max_queue_depth = depth;
+  }
+  ring_push(&server->jobs, conn);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load(&server->idle_workers)) {
+    pthread_mutex_lock(&server->work_lock);
+    pthread_cond_signal(&server->work_cond);
+    pthread_mutex_unlock(&server->work_lock);
+  }
+}
+
+static void endpoint_admit(struct http_server* server, struct endpoint* ep) {
+  while (ep->wait_head && ep->active < ep->limit && !atomic_load(&server->workers_stop)) {
+    struct http_conn* conn = ep->wait_head;
+    ep->wait_head = conn->next_waiting;
+    if (ep->wait_head == NULL) {
+      ep->wait_tail = NULL;
+    }
+    ep->waiting--;
+    ep->active++;
+    work_submit(conn, WORK_HANDLER);
+  }
+}
+
+// its response is sent or it's gone, the next in line can have the slot
+static void endpoint_release(struct http_conn* conn) {
+  if (conn->endpoint < 0) {
+    return;
+  }
+  struct endpoint* ep = &conn->server->endpoints[conn->endpoint];
+  conn->endpoint = -1;
+  ep->active--;
+  ep->worker_us += conn->work_us;
+  conn->work_us = 0;
+  endpoint_admit(conn->server, ep);
+}
+
+static void conn_write(struct http_conn* conn);
+
+// whatever the workers have finished with goes out
+static void work_done(struct http_server* server) {
+  struct http_conn* conn;
+  while ((conn = ring_pop(&server->done)) != NULL) {
+    conn->state = CONN_WRITING;
+    conn_write(conn);
+  }
+}
+
+void http_defer(struct http_conn* conn, int endpoint, http_handler handler, void* ctx) {
+  struct http_server* server = conn->server;
+  if (endpoint < 0 || endpoint >= server->n_endpoints || server->n_workers == 0) {
+    handler(conn, &conn->parser.req, ctx);
+    return;
+  }
+  conn->deferred = handler;
+  conn->deferred_ctx = ctx;
+  conn->endpoint = endpoint;
+}
+
+int http_server_endpoint(struct http_server* server, const char* name, int max_concurrent) {
+  if (server->n_endpoints == HTTP_MAX_ENDPOINTS) {
+    return -1;
+  }
+  struct endpoint* ep = &server->endpoints[server->n_endpoints];
+  memset(ep, 0, sizeof(*ep));
+  snprintf(ep->name, sizeof(ep->name), "%s", name);
+  ep->limit = max_concurrent > 0 ? max_concurrent : 1;
+  return server->n_endpoints++;
+}
+
+int http_endpoint_stats(struct http_server* server, int endpoint, struct http_endpoint_stats* stats) {
+  if (endpoint < 0 || endpoint >= server->n_endpoints) {
+    return -1;
+  }
+  struct endpoint* ep = &server->endpoints[endpoint];
+  stats->name = ep->name;
+  stats->limit = ep->limit;
+  stats->active = ep->active;
+  stats->waiting = ep->waiting;
+  stats->max_waiting = ep->max_waiting;
+  stats->requests = ep->requests;
+  stats->worker_us = ep->worker_us;
+  return 0;
+}
+
+// the head http_parse has finished with, calls the handler and leaves a response queued up
+static void conn_dispatch(struct http_conn* conn) {
+  struct http_server* server = conn->server;
+  struct http_request* req = &conn->parser.req;
+  conn->request_len = conn->parser.head_len;
+  conn->keep_alive = 0;
+  conn->head_only = 0;
+
+  // 1.1 stays open unless it's told otherwise, 1.0 closes unless it asks
+  if (req->minor_version >= 1) {
+    req->keep_alive = !header_has_token(req, "Connection", "close");
+  } else {
+    req->keep_alive = header_has_token(req, "Connection", "keep-alive");
+  }
+  conn->keep_alive = req->keep_alive;
+  conn->minor_version = req->minor_version;
+  if (!strcmp(req->method, "HEAD")) {
+    conn->head_only = 1;
+  } else if (strcmp(req->method, "GET")) {
+    // nothing here takes a body, and without reading it there's no finding the next request
+    conn_error(conn, 501);
+    return;
+  }
+  if (!server->opts.quiet) {
+    printf("%s %s\n", req->method, req->path);
+  }
+
+  conn->deferred = NULL;
+  server->opts.handler(conn, req, server->opts.ctx);
+  if (conn->deferred == NULL) {
+    finish_handler(conn);
+    return;
+  }
+
+  // to a worker when there's a slot for it, otherwise to the back of the line
+  struct endpoint* ep = &server->endpoints[conn->endpoint];
+  ep->requests++;
+  server->stats.deferred++;
+  if (ep->active < ep->limit) {
+    ep->active++;
+    work_submit(conn, WORK_HANDLER);
+    return;
+  }
+  conn->state = CONN_WORKING;
+  conn_unwatch(conn);
+  conn->next_waiting = NULL;
+  if (ep->wait_tail) {
+    ep->wait_tail->next_waiting = conn;
+  } else {
+    ep->wait_head = conn;
+  }
+  ep->wait_tail = conn;
+  if (++ep->waiting > ep->max_waiting) {
+    ep->max_waiting = ep->waiting;
+  }
+}
+
+static void conn_process(struct http_conn* conn);
+
+// some of a range of fd straight from the file to the socket, or through a big buffer where
+// sendfile isn't there or won't take this file. 0 if the file ended early
+static ssize_t send_file(struct http_conn* conn, int fd, uint64_t offset, uint64_t len) {
+  if (!conn->no_sendfile && !conn->server->opts.no_sendfile) {
+#ifdef __APPLE__
+    off_t sent = len;
+    int r = sendfile(fd, conn->fd, offset, &sent, NULL, 0);
+    if (r == 0 || (sent > 0 && (errno == EAGAIN || errno == EINTR))) {
+      return sent;
+    }
+#else
+    off_t off = offset;
+    ssize_t r = sendfile(conn->fd, fd, &off, len < 0x40000000 ? len : 0x40000000);
+    if (r >= 0) {
+      return r;
+    }
+#endif
+    if (errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP && errno != ENOTSUP) {
+      return -1;
+    }
+    conn->no_sendfile = 1;
+  }
+
+  if (fd != conn->file_buf_fd || offset < conn->file_buf_offset ||
+      offset >= conn->file_buf_offset + conn->file_buf_len) {
+    if (conn->file_buf == NULL && (conn->file_buf = malloc(HTTP_FILE_BUFFER)) == NULL) {
+      return -1;
+    }
+    ssize_t n = pread(fd, conn->file_buf, len < HTTP_FILE_BUFFER ? len : HTTP_FILE_BUFFER, offset);
+    if (n <= 0) {
+      return n;
+    }
+    conn->file_buf_fd = fd;
+    conn->file_buf_offset = offset;
+    conn->file_buf_len = n;
+  }
+  size_t have = conn->file_buf_offset + conn->file_buf_len - offset;
+  return send(conn->fd, conn->file_buf + (offset - conn->file_buf_offset), have < len ? have : len, MSG_NOSIGNAL);
+}
+
+// fills in a writer buffer's chunk size line if it needs one, and returns how much of it there
+// is to send with the framing
+static uint64_t buf_frame(struct http_conn* conn, struct http_buf* buf) {
+  if (!conn->chunked) {
+    return buf->len;
+  }
+  if (buf->prefix_len == 0) {
+    buf->prefix_len = snprintf(buf->prefix, sizeof(buf->prefix), "%zx\r\n", buf->len);
+  }
+  return buf->prefix_len + buf->len + 2;
+}
+
+static int add_iov(struct iovec* iov, int n_iov, const char* data, uint64_t len, uint64_t* skip) {
+  if (*skip >= len) {
+    *skip -= len;
+    return n_iov;
+  }
+  iov[n_iov].iov_base = (char*)data + *skip;
+  iov[n_iov].iov_len = len - *skip;
+  *skip = 0;
+  return n_iov + 1;
+}
+
+// the memory segments up to the first file one, then the writer's buffers once the segments are done
+static int fill_iov(struct http_conn* conn, struct iovec* iov) {
+  int n_iov = 0;
+  int i = conn->seg;
+  uint64_t skip = conn->seg_sent;
+  for (; i < conn->n_segs && conn->segs[i].data && n_iov < MAX_IOV; i++) {
+    n_iov = add_iov(iov, n_iov, conn->segs[i].data, conn->segs[i].len, &skip);
+  }
+  if (i < conn->n_segs) {
+    return n_iov;
+  }
+  skip = conn->wbuf_sent;
+  for (struct http_buf* buf = conn->wbuf_head; buf && n_iov + 3 <= MAX_IOV; buf = buf->next) {
+    buf_frame(conn, buf);
+    if (conn->chunked) {
+      n_iov = add_iov(iov, n_iov, buf->prefix, buf->prefix_len, &skip);
+    }
+    if (buf->fd != -1) {
+      // the file itself goes with sendfile once everything before it's gone
+      if (skip < buf->len) {
+        break;
+      }
+      skip -= buf->len;
+    } else {
+      n_iov = add_iov(iov, n_iov, buf->data, buf->len, &skip);
+    }
+    if (conn->chunked) {
+      n_iov = add_iov(iov, n_iov, "\r\n", 2, &skip);
+    }
+  }
+  return n_iov;
+}
+
+// n bytes have gone, moves past them and gives finished buffers back to the pool
+static void consume(struct http_conn* conn, uint64_t n) {
+  while (conn->seg < conn->n_segs) {
+    uint64_t left = conn->segs[conn->seg].len - conn->seg_sent;
+    if (n < left) {
+      conn->seg_sent += n;
+      return;
+    }
+    n -= left;
+    conn->seg++;
+    conn->seg_sent = 0;
+  }
+  while (conn->wbuf_head) {
+    struct http_buf* buf = conn->wbuf_head;
+    uint64_t left = buf_frame(conn, buf) - conn->wbuf_sent;
+    if (n < left) {
+      conn->wbuf_sent += n;
+      return;
+    }
+    n -= left;
+    conn->wbuf_sent = 0;
+    conn->wbuf_head = buf->next;
+    if (buf->fd == conn->file_buf_fd) {
+      conn->file_buf_fd = -1;  // the number's about to be free for something else
+    }
+    if (conn->wbuf_head == NULL) {
+      conn->wbuf_tail = NULL;
+    }
+    buf_put(conn->server, buf);
+  }
+}
+
+// sends as much of the response as the socket takes, everything queued in memory goes in one
+// writev (sendmsg, for MSG_NOSIGNAL) at a time
+static void conn_write(struct http_conn* conn) {
+  for (;;) {
+    struct iovec iov[MAX_IOV];
+    consume(conn, 0);  // past anything empty, so a file segment at the front really is next
+    int n_iov = fill_iov(conn, iov);
+    ssize_t n;
+    if (n_iov > 0) {
+      struct msghdr msg = {0};
+      msg.msg_iov = iov;
+      msg.msg_iovlen = n_iov;
+      n = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+    } else if (conn->seg < conn->n_segs) {
+      struct out_segment* seg = &conn->segs[conn->seg];
+      n = send_file(conn, conn->body_fd, seg->offset + conn->seg_sent, seg->len - conn->seg_sent);
+      if (n == 0) {
+        // the file got shorter, the Content-Length can't be honoured
+        conn_close(conn);
+        return;
+      }
+    } else if (conn->wbuf_head) {
+      // fill_iov stopped at the start of, or part way through, a file of http_write_file's
+      struct http_buf* buf = conn->wbuf_head;
+      uint64_t done = conn->wbuf_sent - (conn->chunked ? buf->prefix_len : 0);
+      n = send_file(conn, buf->fd, buf->offset + done, buf->len - done);
+      if (n == 0) {
+        // shorter than promised, there's no telling the client other than hanging up
+        conn_close(conn);
+        return;
+      }
+    } else if (conn->produce && conn->endpoint >= 0) {
+      // a deferred response's producer blocks like its handler did
+      work_submit(conn, WORK_PRODUCE);
+      return;
+    } else if (conn->produce) {
+      run_producer(conn);
+      continue;
+    } else {
+      break;
+    }
+    conn->resp_syscalls++;
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        conn_watch(conn, WANT_WRITE);
+        return;
+      }
+      conn_close(conn);
+      return;
+    }
+    conn->last_active = time(NULL);
+    conn->resp_bytes += n;
+    consume(conn, n);
+  }
+
+  if (conn->length != NO_LENGTH && conn->written != conn->length && !conn->head_only) {
+    // the body didn't come to what the headers promised, the client can't find where the next one starts
+    conn->keep_alive = 0;
+  }
+  struct http_server* server = conn->server;
+  server->stats.responses++;
+  server->stats.bytes += conn->resp_bytes;
+  server->stats.syscalls += conn->resp_syscalls;
+  if (!server->opts.quiet) {
+    printf("%d, %llu bytes in %u syscalls\n", conn->status, (unsigned long long)conn->resp_bytes,
+           conn->resp_syscalls);
+  }
+
+  // done, on to the next request or hang up
+  endpoint_release(conn);
+  conn_reset_response(conn);
+  if (!conn->keep_alive) {
+    conn_close(conn);
+    return;
+  }
+  memmove(conn->in, conn->in + conn->request_len, conn->in_len - conn->request_len);
+  conn->in_len -= conn->request_len;
+  conn->request_len = 0;
+  http_parser_init(&conn->parser, &server->opts.limits);
+  conn->state = CONN_READING;
+  conn_watch(conn, WANT_READ);
+  conn_process(conn);
+}
+
+// answers a request if a whole one has arrived, pipelined ones are taken one at a time. The parser
+// carries on from wherever it got to on the last read
+static void conn_process(struct http_conn* conn) {
+  if (conn->state != CONN_READING) {
+    return;
+  }
+  int parsed = http_parse(&conn->parser, conn->in, conn->in_len);
+  if (parsed == HTTP_PARSE_MORE && conn->in_len == sizeof(conn->in)) {
+    parsed = 431;
+  }
+  if (parsed == HTTP_PARSE_MORE) {
+    return;
+  } else if (parsed == HTTP_PARSE_DONE) {
+    conn_dispatch(conn);
+    if (conn->state == CONN_WORKING) {
+      return;
+    }
+  } else {
+    conn->request_len = conn->in_len;
+    conn_error(conn, parsed);
+  }
+  conn->state = CONN_WRITING;
+  conn_write(conn);
+}
+
+static void conn_read(struct http_conn* conn) {
+  while (conn->in_len < sizeof(conn->in)) {
+    ssize_t n = recv(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len, 0);
+    if (n > 0) {
+      conn->in_len += n;
+      conn->last_active = time(NULL);
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      break;
+    }
+    conn_close(conn);
+    return;
+  }
+  conn_process(conn);
+}
+
+static void accept_connections(struct http_server* server) {
+  for (;;) {
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+        printf("[-]\taccept() error %d\n", errno);
+      }
+      return;
+    }
+    struct http_conn* conn = server->n_conns < server->opts.max_connections ? malloc(sizeof(*conn)) : NULL;
+    if (conn == NULL) {
+      // full up, the client can try again
+      close(fd);
+      continue;
+    }
+    int one = 1;
+    set_nonblocking(fd);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    memset(conn, 0, offsetof(struct http_conn, in));
+    conn->server = server;
+    conn->fd = fd;
+    conn->body_fd = -1;
+    conn->file_buf_fd = -1;
+    conn->length = NO_LENGTH;
+    conn->endpoint = -1;
+    conn->state = CONN_READING;
+    http_parser_init(&conn->parser, &server->opts.limits);
+    conn->last_active = time(NULL);
+    conn->next = server->conns;
+    if (server->conns) {
+      server->conns->prev = conn;
+    }
+    server->conns = conn;
+    server->n_conns++;
+    conn->waiting_for = 0;
+    conn_watch(conn, WANT_READ);
+  }
+}
+
+// a client that's gone quiet, mid request or between them, gives its slot back
+static void close_idle(struct http_server* server, time_t now) {
+  struct http_conn* conn = server->conns;
+  while (conn) {
+    struct http_conn* next = conn->next;
+    if (conn->state != CONN_WORKING && now - conn->last_active > server->opts.idle_timeout) {
+      conn_close(conn);
+    }
+    conn = next;
+  }
+}
+
+static void free_closed(struct http_server* server) {
+  while (server->closed) {
+    struct http_conn* next = server->closed->next;
+    free(server->closed);
+    server->closed = next;
+  }
+}
+
+struct http_server* http_server_create(const struct http_server_options* opts) {
+#ifndef SO_NOSIGPIPE
+  // MSG_NOSIGNAL only covers send and sendmsg. Left alone, a download that's abandoned partway through
+  // kills the whole process. Only if nobody's put their own handler in
+  struct sigaction old;
+  if (sigaction(SIGPIPE, NULL, &old) == 0 && old.sa_handler == SIG_DFL) {
+    signal(SIGPIPE, SIG_IGN);
+  }
+#endif
+  struct addrinfo hints, *res, *p;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  if (getaddrinfo(NULL, opts->port, &hints, &res) != 0) {
+    printf("[-]\tgetaddrinfo() error\n");
+    return NULL;
+  }
+  int fd = -1;
+  for (p = res; p != NULL; p = p->ai_next) {
+    fd = socket(p->ai_family, p->ai_socktype, 0);
+    if (fd == -1) {
+      continue;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, p->ai_addr, p->ai_addrlen) == 0) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if (fd == -1 || listen(fd, SOMAXCONN) != 0 || set_nonblocking(fd)) {
+    printf("[-]\tsocket(), bind() or listen() error on port %s\n", opts->port);
+    if (fd != -1) {
+      close(fd);
+    }
+    return NULL;
+  }
+
+  struct http_server* server = calloc(1, sizeof(*server));
+  server->opts = *opts;
+  if (server->opts.max_connections <= 0) {
+    server->opts.max_connections = HTTP_DEFAULT_MAX_CONNECTIONS;
+  }
+  if (server->opts.idle_timeout <= 0) {
+    server->opts.idle_timeout = HTTP_DEFAULT_IDLE_TIMEOUT;
+  }
+  if (server->opts.workers <= 0) {
+    server->opts.workers = HTTP_DEFAULT_WORKERS;
+  }
+  server->listen_fd = fd;
+  server->wake[0] = server->wake[1] = -1;
+  pthread_mutex_init(&server->work_lock, NULL);
+  pthread_cond_init(&server->work_cond, NULL);
+  server->poll_fd = poll_create();
+  if (server->poll_fd == -1 || pipe(server->wake) || set_nonblocking(server->wake[0]) ||
+      poll_watch(server->poll_fd, fd, &server->listen_fd, WANT_READ) ||
+      poll_watch(server->poll_fd, server->wake[0], server->wake, WANT_READ)) {
+    printf("[-]\tcan't set up the event loop\n");
+    http_server_free(server);
+    return NULL;
+  }
+
+  server->workers = calloc(server->opts.workers, sizeof(pthread_t));
+  if (server->workers == NULL || ring_init(&server->jobs, server->opts.max_connections) ||
+      ring_init(&server->done, server->opts.max_connections)) {
+    printf("[-]\tno memory for the workers\n");
+    http_server_free(server);
+    return NULL;
+  }
+  while (server->n_workers < server->opts.workers &&
+         pthread_create(&server->workers[server->n_workers], NULL, worker_main, server) == 0) {
+    server->n_workers++;
+  }
+  if (server->n_workers < server->opts.workers) {
+    // deferred requests just run on the loop if there are none at all
+    printf("[-]\tonly started %d of %d workers\n", server->n_workers, server->opts.workers);
+  }
+  return server;
+}
+
+int http_server_port(struct http_server* server) {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  if (getsockname(server->listen_fd, (struct sockaddr*)&addr, &len)) {
+    return -1;
+  }
+  return ntohs(addr.sin_port);
+}
+
+int http_server_run(struct http_server* server) {
+  struct poll_event events[MAX_EVENTS];
+  time_t last_sweep = time(NULL);
+  while (!atomic_load(&server->stop)) {
+    int n = poll_wait(server->poll_fd, events, MAX_EVENTS, 1000);
+    if (n < 0 && errno != EINTR) {
+      printf("[-]\tevent loop error %d\n", errno);
+      return 1;
+    }
+    for (int i = 0; i < n && !atomic_load(&server->stop); i++) {
+      if (events[i].udata == &server->listen_fd) {
+        accept_connections(server);
+      } else if (events[i].udata == server->wake) {
+        char buf[16];
+        while (read(server->wake[0], buf, sizeof(buf)) > 0) {
+        }
+        atomic_exchange(&server->wake_pending, 0);
+        work_done(server);
+      } else {
+        struct http_conn* conn = events[i].udata;
+        if (conn->state == CONN_CLOSED || conn->state == CONN_WORKING) {
+          continue;
+        }
+        if (events[i].events & GOT_ERROR) {
+          conn_close(conn);
+        } else if (conn->state == CONN_WRITING && (events[i].events & WANT_WRITE)) {
+          conn_write(conn);
+        } else if (conn->state == CONN_READING && (events[i].events & WANT_READ)) {
+          conn_read(conn);
+        }
+      }
+    }
+    free_closed(server);
+
+    time_t now = time(NULL);
+    if (now != last_sweep) {
+      close_idle(server, now);
+      free_closed(server);
+      last_sweep = now;
+    }
+  }
+  return 0;
+}
+
+void http_server_stop(struct http_server* server) {
+  atomic_store(&server->stop, 1);
+  if (server->wake[1] != -1) {
+    write(server->wake[1], "", 1);
+  }
+}
+
+void http_server_free(struct http_server* server) {
+  // the workers finish what they're on first, it's their connections being closed
+  atomic_store(&server->workers_stop, 1);
+  pthread_mutex_lock(&server->work_lock);
+  pthread_cond_broadcast(&server->work_cond);
+  pthread_mutex_unlock(&server->work_lock);
+  for (int i = 0; i < server->n_workers; i++) {
+    pthread_join(server->workers[i], NULL);
+  }
+  free(server->workers);
+  free(server->jobs.cells);
+  free(server->done.cells);
+  pthread_mutex_destroy(&server->work_lock);
+  pthread_cond_destroy(&server->work_cond);
+  while (server->conns) {
+    conn_close(server->conns);
+  }
+  free_closed(server);
+  while (server->pool) {
+    struct http_buf* next = server->pool->next;
+    free(server->pool);
+    server->pool = next;
+  }
+  close(server->listen_fd);
+  if (server->poll_fd != -1) {
+    close(server->poll_fd);
+  }
+  if (server->wake[0] != -1) {
+    close(server->wake[0]);
+    close(server->wake[1]);
+  }
+  free(server);
+}
+
+void http_server_stats(struct http_server* server, struct http_stats* stats) {
+  *stats = server->stats;
+  stats->queue_depth = atomic_load(&server->queued);
+}
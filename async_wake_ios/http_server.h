@@ -0,0 +1,147 @@
+#ifndef http_server_h
+#define http_server_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "http_parser.h"
+
+/*
+ A small HTTP/1.1 server for ws, one thread and an event loop (kqueue on iOS and macOS, epoll on
+ Linux) so a slow client only holds up itself.
+
+ Every connection is a little state machine: reading a request, writing the response, then back to
+ reading if it's keep-alive or closed if it isn't. Everything a connection holds is bounded, a
+ request head has to fit in HTTP_MAX_REQUEST, headers and small bodies go out of a fixed buffer and
+ files go with sendfile, so memory is capped by max_connections.
+
+ Files are served the way download tools expect, with an ETag and Last-Modified to answer
+ conditional GETs with 304s and Range requests (several ranges at once too) so big ones like
+ /tmp/kernel_dump can be resumed or pulled in parallel.
+
+ Pages that get built up bit by bit go through a writer instead: http_begin, then any number of
+ http_write/http_printf into pooled HTTP_BUF_SIZE buffers, which go out together with writev once
+ the handler returns. A body too big to build up front can be handed to http_stream, a producer
+ that gets called whenever the socket has room and goes out chunked (or close delimited to
+ HTTP/1.0 clients). Bytes and syscalls are counted per response, see http_server_stats.
+
+ Request heads are parsed as they arrive by http_parser.c, within the limits in the options.
+ Requests are handed to a handler which has to answer each one with exactly one of the
+ http_respond* calls or http_begin before it returns, or hand it to http_defer.
+
+ Anything that blocks (stat'ing a big directory, reading kernel memory) would hold up every other
+ client if it ran on the loop, so those go to a fixed pool of worker threads with http_defer. The
+ loop puts the connection on a bounded lock-free queue, a worker runs the handler (and later
+ whatever producer it streams with) into the connection's buffers, and hands it back on a second
+ queue for the loop to send. Each endpoint registered with http_server_endpoint has a cap on how
+ many of its responses are under way at once, the rest wait their turn in order. While a worker
+ has a connection nothing else touches it. Doesn't need anything from iOS so it builds and runs on
+ Linux too.
+ */
+
+#define HTTP_MAX_REQUEST 8192
+#define HTTP_OUT_SIZE 0x4000
+#define HTTP_DEFAULT_MAX_CONNECTIONS 256
+#define HTTP_DEFAULT_IDLE_TIMEOUT 30
+#define HTTP_MAX_RANGES 16          // more than that in one request and the whole file is sent
+#define HTTP_FILE_BUFFER 0x40000    // what a file goes through when sendfile can't be used
+#define HTTP_BUF_SIZE 0x4000        // one of the writer's pooled buffers
+#define HTTP_DEFAULT_WORKERS 4
+#define HTTP_MAX_ENDPOINTS 16
+
+struct http_server;
+struct http_conn;
+
+
+typedef void (*http_handler)(struct http_conn* conn, struct http_request* req, void* ctx);
+// writes the next piece of a streamed body, returns 1 once there's nothing more. Each call should
+// write something unless it's returning 1
+typedef int (*http_producer)(struct http_conn* conn, void* state);
+
+struct http_stats {
+  uint64_t responses;
+  uint64_t bytes;           // everything sent, headers and all
+  uint64_t syscalls;        // writev, send and sendfile calls it took
+  uint64_t deferred;        // requests handed to http_defer
+  uint32_t queue_depth;     // jobs waiting for a worker to pick them up, right now
+  uint32_t max_queue_depth;
+};
+
+struct http_endpoint_stats {
+  const char* name;
+  int limit;
+  int active;               // responses under way, on a worker or being sent
+  int waiting;              // for one of those to finish
+  int max_waiting;
+  uint64_t requests;
+  uint64_t worker_us;       // time spent on the workers
+};
+
+struct http_server_options {
+  const char* port;         // "0" picks a free one, see http_server_port
+  http_handler handler;
+  void* ctx;
+  int max_connections;      // 0 for HTTP_DEFAULT_MAX_CONNECTIONS
+  int idle_timeout;         // seconds, 0 for HTTP_DEFAULT_IDLE_TIMEOUT
+  int quiet;                // no per-request logging
+  int no_sendfile;          // copy files through a buffer even where sendfile works, for benchmarking
+  struct http_parser_limits limits;  // zeroes for the defaults, the whole head has to fit in HTTP_MAX_REQUEST
+  int workers;              // threads for http_defer, 0 for HTTP_DEFAULT_WORKERS
+};
+
+struct http_server* http_server_create(const struct http_server_options* opts);
+int http_server_port(struct http_server* server);
+// runs the loop until http_server_stop, returns 0 on a clean stop
+int http_server_run(struct http_server* server);
+// from a handler or any other thread
+void http_server_stop(struct http_server* server);
+void http_server_free(struct http_server* server);
+// totals since the server was created, only meaningful from the server's thread or once it's stopped
+void http_server_stats(struct http_server* server, struct http_stats* stats);
+// a class of deferred requests, at most max_concurrent of them under way at once. Before
+// http_server_run, returns the endpoint for http_defer or -1 if there are too many
+int http_server_endpoint(struct http_server* server, const char* name, int max_concurrent);
+// the endpoint's counters, -1 if there's no such endpoint. From the server's thread
+int http_endpoint_stats(struct http_server* server, int endpoint, struct http_endpoint_stats* stats);
+
+struct http_server* http_conn_server(struct http_conn* conn);
+
+// from the server's handler instead of answering, the request gets answered by handler on a worker
+// thread once endpoint has room. Anything it streams with http_stream is produced there too. An
+// endpoint that doesn't exist runs handler right away
+void http_defer(struct http_conn* conn, int endpoint, http_handler handler, void* ctx);
+
+// the value of a request header, NULL if it isn't there
+const char* http_header(const struct http_request* req, const char* name, size_t* len);
+
+// body is copied, or doesn't need to be if it outlives the response
+void http_respond(struct http_conn* conn, int status, const char* content_type, const void* body, size_t len);
+// body came from malloc and is freed once it's sent
+void http_respond_owned(struct http_conn* conn, int status, const char* content_type, char* body, size_t len);
+// size bytes from fd starting where it's at, fd is closed once they're sent
+void http_respond_fd(struct http_conn* conn, int status, const char* content_type, int fd, uint64_t size);
+// a regular file, or the parts of it the request's Range asks for, or a 304 if the request's
+// validators show the client already has it. fd is closed when it's done with
+void http_respond_file(struct http_conn* conn, const struct http_request* req, int fd, const char* content_type);
+
+// starts a response written a bit at a time, the headers are sent once the handler returns
+void http_begin(struct http_conn* conn, int status, const char* content_type);
+void http_write(struct http_conn* conn, const void* data, size_t len);
+void http_printf(struct http_conn* conn, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+// len bytes of fd from offset, sent with sendfile when it's their turn. fd is closed after
+void http_write_file(struct http_conn* conn, int fd, uint64_t offset, uint64_t len);
+// the whole body's size if it's known before it's written, a stream then goes with a Content-Length
+// instead of chunked. If it comes up short the connection is closed after
+void http_set_length(struct http_conn* conn, uint64_t len);
+// another header line for an http_begin response
+void http_add_header(struct http_conn* conn, const char* name, const char* value);
+
+// the one range a request's Range header asks for out of size bytes of something without
+// validators. 0 to send all of it (no Range, several ranges, or an If-Range), 1 for first..last,
+// -1 if none of it is there, a 416
+int http_range(const struct http_request* req, uint64_t size, uint64_t* first, uint64_t* last);
+// after http_begin and whatever's been written, the rest of the body comes from produce. release
+// is called with state once it's done or the connection goes away
+void http_stream(struct http_conn* conn, http_producer produce, void (*release)(void* state), void* state);
+
+#endif
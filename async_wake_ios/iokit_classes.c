@@ -0,0 +1,507 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mach-o/loader.h>
+
+#include "iokit_classes.h"
+
+struct iokit_class_table kernel_classes = {0};
+
+// OSMetaClass::alloc is the first (and only) pure virtual in OSMetaClass,
+// this is where it sits on iOS 11 if the vtable symbol is missing
+#define METACLASS_ALLOC_SLOT_IOS11 12
+
+#define MAX_VTABLE_SLOTS 0x400
+#define MAX_EXEC_RANGES 16
+
+struct range {
+  uint64_t start;
+  uint64_t end;
+};
+
+// one OSMetaClass constructor call, before we've looked for the vtable
+struct metaclass_call {
+  uint64_t metaclass;
+  uint64_t name;
+  uint64_t super;         // 0 for OSObject, ~0 if we couldn't tell
+  uint64_t size;
+  uint64_t meta_vtable;   // vtable of Class::MetaClass
+};
+
+struct indexer {
+  struct kernel_image* img;
+  struct iokit_class_table* table;
+
+  struct range exec[MAX_EXEC_RANGES];
+  int n_exec;
+
+  // the constructor and any kext stubs which jump to it, sorted
+  uint64_t* ctors;
+  uint32_t n_ctors;
+  uint32_t ctors_capacity;
+
+  struct metaclass_call* calls;
+  uint32_t n_calls;
+  uint32_t calls_capacity;
+};
+
+static int grow(void** array, uint32_t* capacity, uint32_t count, size_t elem_size, uint32_t initial) {
+  if (count < *capacity) {
+    return 0;
+  }
+  uint32_t new_capacity = *capacity ? *capacity * 2 : initial;
+  void* p = realloc(*array, new_capacity * elem_size);
+  if (p == NULL) {
+    return 1;
+  }
+  *array = p;
+  *capacity = new_capacity;
+  return 0;
+}
+
+static int is_exec(struct indexer* ix, uint64_t addr) {
+  for (int i = 0; i < ix->n_exec; i++) {
+    if (addr >= ix->exec[i].start && addr < ix->exec[i].end) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int add_exec_range(struct segment_command_64* seg, void* arg) {
+  struct indexer* ix = arg;
+  if (!(seg->initprot & VM_PROT_EXECUTE) || seg->vmsize == 0 || ix->n_exec == MAX_EXEC_RANGES) {
+    return 0;
+  }
+  // only the part which made it in to the dump
+  uint64_t start = kimg_slid(ix->img, seg->vmaddr);
+  uint64_t end = start + seg->vmsize;
+  uint64_t img_end = ix->img->base + ix->img->size;
+  if (start >= img_end || start < ix->img->base) {
+    return 0;
+  }
+  if (end > img_end) {
+    end = img_end;
+  }
+  ix->exec[ix->n_exec].start = start;
+  ix->exec[ix->n_exec].end = end;
+  ix->n_exec++;
+  return 0;
+}
+
+static int add_ctor(struct indexer* ix, uint64_t addr) {
+  if (grow((void**)&ix->ctors, &ix->ctors_capacity, ix->n_ctors, sizeof(uint64_t), 0x40)) {
+    return 1;
+  }
+  ix->ctors[ix->n_ctors++] = addr;
+  return 0;
+}
+
+static int compare_u64(const void* a, const void* b) {
+  uint64_t ua = *(const uint64_t*)a;
+  uint64_t ub = *(const uint64_t*)b;
+  return ua < ub ? -1 : (ua > ub);
+}
+
+static int is_ctor(struct indexer* ix, uint64_t addr) {
+  return bsearch(&addr, ix->ctors, ix->n_ctors, sizeof(uint64_t), compare_u64) != NULL;
+}
+
+// kexts call in to the kernel through stubs: adrp x16, GOT@PAGE; ldr x16, [x16, GOT@PAGEOFF]; br x16
+static void find_ctor_stubs(struct indexer* ix, uint64_t ctor) {
+  for (int r = 0; r < ix->n_exec; r++) {
+    for (uint64_t pc = ix->exec[r].start; pc + 12 <= ix->exec[r].end; pc += 4) {
+      uint32_t* insns = kimg_ptr(ix->img, pc, 12);
+      if (insns == NULL || insns[2] != 0xd61f0200) { // br x16
+        continue;
+      }
+      int rd;
+      uint64_t page;
+      if (!arm64_decode_adrp(insns[0], pc, &rd, &page) || rd != 16) {
+        continue;
+      }
+      if ((insns[1] & 0xffc003ff) != 0xf9400210) { // ldr x16, [x16, #imm]
+        continue;
+      }
+      uint64_t got = page + (((insns[1] >> 10) & 0xfff) << 3);
+      if (kimg_pointer(ix->img, kimg_read64(ix->img, got)) == ctor) {
+        add_ctor(ix, pc);
+      }
+    }
+  }
+}
+
+static void record_call(struct indexer* ix, struct arm64_regs* regs) {
+  struct metaclass_call call = {0};
+  if (!arm64_reg(regs, 0, &call.metaclass) || !kimg_contains(ix->img, call.metaclass)) {
+    return;
+  }
+  if (!arm64_reg(regs, 1, &call.name) || !kimg_contains(ix->img, call.name)) {
+    return;
+  }
+  if (!arm64_reg(regs, 2, &call.super)) {
+    call.super = ~0ULL;
+  }
+  if (!arm64_reg(regs, 3, &call.size)) {
+    call.size = 0;
+  }
+  if (grow((void**)&ix->calls, &ix->calls_capacity, ix->n_calls, sizeof(struct metaclass_call), 0x400)) {
+    return;
+  }
+  ix->calls[ix->n_calls++] = call;
+}
+
+// one linear pass over all the code looking for calls to the constructor
+static void find_metaclass_calls(struct indexer* ix) {
+  for (int r = 0; r < ix->n_exec; r++) {
+    struct arm64_regs regs = {0};
+    int64_t pending = -1; // index in to calls, they can move when the array grows
+    int pending_insns = 0;
+
+    for (uint64_t pc = ix->exec[r].start; pc + 4 <= ix->exec[r].end; pc += 4) {
+      uint32_t insn = kimg_insn(ix->img, pc);
+
+      // right after the constructor returns the static initializer replaces the OSMetaClass
+      // vtable with the Class::MetaClass one: str xN, [x_metaclass]
+      if (pending >= 0) {
+        uint64_t base, value;
+        if ((insn & 0xffc00000) == 0xf9000000 && ((insn >> 10) & 0xfff) == 0 &&
+            arm64_reg(&regs, (insn >> 5) & 0x1f, &base) && base == ix->calls[pending].metaclass &&
+            arm64_reg(&regs, insn & 0x1f, &value)) {
+          ix->calls[pending].meta_vtable = value;
+          pending = -1;
+        } else if (--pending_insns == 0) {
+          pending = -1;
+        }
+      }
+
+      uint64_t target;
+      if (arm64_decode_bl(insn, pc, &target) && is_ctor(ix, target)) {
+        uint32_t before = ix->n_calls;
+        record_call(ix, &regs);
+        if (ix->n_calls != before) {
+          pending = ix->n_calls - 1;
+          pending_insns = 16;
+        }
+      }
+
+      arm64_emulate(ix->img, &regs, pc, insn);
+    }
+  }
+}
+
+// MetaClass::alloc does "return new Class;" so somewhere in it, or in the constructor it calls,
+// the vtable gets stored to the start of the new object
+static uint64_t find_vtable_store(struct indexer* ix, uint64_t fn, int depth) {
+  struct arm64_regs regs = {0};
+  uint64_t callees[4];
+  int n_callees = 0;
+
+  for (int i = 0; i < 0x80; i++) {
+    uint64_t pc = fn + i*4;
+    if (!is_exec(ix, pc)) {
+      break;
+    }
+    uint32_t insn = kimg_insn(ix->img, pc);
+    if (arm64_is_ret(insn)) {
+      break;
+    }
+
+    uint64_t value, target;
+    if ((insn & 0xffc00000) == 0xf9000000 && ((insn >> 10) & 0xfff) == 0 &&
+        arm64_reg(&regs, insn & 0x1f, &value) &&
+        kimg_contains(ix->img, value) && !is_exec(ix, value) &&
+        is_exec(ix, kimg_pointer(ix->img, kimg_read64(ix->img, value)))) {
+      return value;
+    }
+
+    if (arm64_decode_bl(insn, pc, &target) && n_callees < 4) {
+      callees[n_callees++] = target;
+    }
+    // tail call to the constructor
+    if (arm64_decode_b(insn, pc, &target) && n_callees < 4) {
+      callees[n_callees++] = target;
+      arm64_emulate(ix->img, &regs, pc, insn);
+      break;
+    }
+    arm64_emulate(ix->img, &regs, pc, insn);
+  }
+
+  if (depth > 0) {
+    for (int i = 0; i < n_callees; i++) {
+      uint64_t vtable = find_vtable_store(ix, callees[i], depth - 1);
+      if (vtable) {
+        return vtable;
+      }
+    }
+  }
+  return 0;
+}
+
+static uint32_t find_alloc_slot(struct indexer* ix) {
+  uint64_t vtable = kimg_find_symbol(ix->img, "__ZTV11OSMetaClass");
+  uint64_t pure = kimg_find_symbol(ix->img, "___cxa_pure_virtual");
+  if (vtable && pure) {
+    // skip offset-to-top and the typeinfo pointer
+    for (uint32_t slot = 0; slot < 0x40; slot++) {
+      if (kimg_pointer(ix->img, kimg_read64(ix->img, vtable + 0x10 + slot*8)) == pure) {
+        return slot;
+      }
+    }
+  }
+  return METACLASS_ALLOC_SLOT_IOS11;
+}
+
+static int add_string(struct iokit_class_table* table, const char* str, uint32_t len, uint32_t* offset) {
+  if (table->strings_size + len + 1 > table->strings_capacity) {
+    uint32_t capacity = table->strings_capacity ? table->strings_capacity : 0x10000;
+    while (table->strings_size + len + 1 > capacity) {
+      capacity *= 2;
+    }
+    char* strings = realloc(table->strings, capacity);
+    if (strings == NULL) {
+      return 1;
+    }
+    table->strings = strings;
+    table->strings_capacity = capacity;
+  }
+  *offset = table->strings_size;
+  memcpy(table->strings + table->strings_size, str, len);
+  table->strings[table->strings_size + len] = 0;
+  table->strings_size += len + 1;
+  return 0;
+}
+
+// copy out the vtable until the entries stop looking like code
+static int add_vtable(struct indexer* ix, struct iokit_class* cls) {
+  struct iokit_class_table* table = ix->table;
+  cls->vtable_first = table->n_slots;
+  cls->vtable_count = 0;
+  for (uint32_t slot = 0; slot < MAX_VTABLE_SLOTS; slot++) {
+    uint64_t method = kimg_pointer(ix->img, kimg_read64(ix->img, cls->vtable + slot*8));
+    if (!is_exec(ix, method)) {
+      break;
+    }
+    if (grow((void**)&table->slots, &table->slots_capacity, table->n_slots, sizeof(uint32_t), 0x10000)) {
+      return 1;
+    }
+    table->slots[table->n_slots++] = (uint32_t)(method - table->base);
+    cls->vtable_count++;
+  }
+  return 0;
+}
+
+static int compare_classes(const void* a, const void* b) {
+  const struct iokit_class* ca = a;
+  const struct iokit_class* cb = b;
+  return ca->metaclass < cb->metaclass ? -1 : (ca->metaclass > cb->metaclass);
+}
+
+static struct iokit_class* class_for_metaclass(struct iokit_class_table* table, uint64_t metaclass) {
+  struct iokit_class key = {0};
+  key.metaclass = metaclass;
+  return bsearch(&key, table->classes, table->count, sizeof(struct iokit_class), compare_classes);
+}
+
+struct name_index {
+  const char* name;
+  uint32_t index;
+};
+
+static int compare_names(const void* a, const void* b) {
+  return strcmp(((const struct name_index*)a)->name, ((const struct name_index*)b)->name);
+}
+
+static int build_table(struct indexer* ix) {
+  struct iokit_class_table* table = ix->table;
+  uint32_t alloc_slot = find_alloc_slot(ix);
+
+  table->classes = calloc(ix->n_calls ? ix->n_calls : 1, sizeof(struct iokit_class));
+  if (table->classes == NULL) {
+    return 1;
+  }
+  table->capacity = ix->n_calls;
+
+  for (uint32_t i = 0; i < ix->n_calls; i++) {
+    struct metaclass_call* call = &ix->calls[i];
+
+    // the name has to be a sane C identifier
+    const char* name = kimg_ptr(ix->img, call->name, 1);
+    uint64_t max_len = ix->img->base + ix->img->size - call->name;
+    uint32_t len = 0;
+    while (len < max_len && len < 0x80 && name[len] != 0) {
+      char c = name[len];
+      if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == ':')) {
+        break;
+      }
+      len++;
+    }
+    if (len == 0 || len == max_len || name[len] != 0) {
+      continue;
+    }
+
+    struct iokit_class* cls = &table->classes[table->count];
+    memset(cls, 0, sizeof(*cls));
+    cls->metaclass = call->metaclass;
+    cls->size = (uint32_t)call->size;
+    cls->super = -1;
+    if (add_string(table, name, len, &cls->name)) {
+      return 1;
+    }
+
+    if (call->meta_vtable) {
+      uint64_t alloc = kimg_pointer(ix->img, kimg_read64(ix->img, call->meta_vtable + alloc_slot*8));
+      if (is_exec(ix, alloc)) {
+        cls->vtable = find_vtable_store(ix, alloc, 2);
+      }
+    }
+    if (cls->vtable && add_vtable(ix, cls)) {
+      return 1;
+    }
+    table->count++;
+  }
+
+  qsort(table->classes, table->count, sizeof(struct iokit_class), compare_classes);
+
+  // drop any class constructed twice
+  uint32_t out = 0;
+  for (uint32_t i = 0; i < table->count; i++) {
+    if (out > 0 && table->classes[out-1].metaclass == table->classes[i].metaclass) {
+      continue;
+    }
+    table->classes[out++] = table->classes[i];
+  }
+  table->count = out;
+
+  // the superclass pointers can only be resolved once everything is sorted
+  struct iokit_class* sorted = table->classes;
+  for (uint32_t i = 0; i < ix->n_calls; i++) {
+    struct metaclass_call* call = &ix->calls[i];
+    if (call->super == 0 || call->super == ~0ULL) {
+      continue;
+    }
+    struct iokit_class* cls = class_for_metaclass(table, call->metaclass);
+    struct iokit_class* super = class_for_metaclass(table, call->super);
+    if (cls != NULL && super != NULL) {
+      cls->super = (int32_t)(super - sorted);
+    }
+  }
+
+  struct name_index* names = malloc((table->count ? table->count : 1) * sizeof(struct name_index));
+  table->by_name = malloc((table->count ? table->count : 1) * sizeof(uint32_t));
+  if (names == NULL || table->by_name == NULL) {
+    free(names);
+    return 1;
+  }
+  for (uint32_t i = 0; i < table->count; i++) {
+    names[i].name = table->strings + table->classes[i].name;
+    names[i].index = i;
+  }
+  qsort(names, table->count, sizeof(struct name_index), compare_names);
+  for (uint32_t i = 0; i < table->count; i++) {
+    table->by_name[i] = names[i].index;
+  }
+  free(names);
+  return 0;
+}
+
+int iokit_classes_build(struct iokit_class_table* table, struct kernel_image* img) {
+  iokit_classes_free(table);
+
+  struct mach_header_64* hdr = kimg_header(img);
+  if (hdr == NULL) {
+    printf("[-]\tno kernel image to index the IOKit classes of\n");
+    return 1;
+  }
+
+  struct indexer ix = {0};
+  ix.img = img;
+  ix.table = table;
+  table->base = img->base;
+
+  kimg_for_each_segment(img, hdr, add_exec_range, &ix);
+
+  uint64_t ctor_c1 = kimg_find_symbol(img, "__ZN11OSMetaClassC1EPKcPKS_j");
+  uint64_t ctor_c2 = kimg_find_symbol(img, "__ZN11OSMetaClassC2EPKcPKS_j");
+  if (ctor_c1 == 0 && ctor_c2 == 0) {
+    printf("[-]\tcouldn't find the OSMetaClass constructor\n");
+    return 1;
+  }
+  if (ctor_c1) {
+    add_ctor(&ix, ctor_c1);
+    find_ctor_stubs(&ix, ctor_c1);
+  }
+  if (ctor_c2 && ctor_c2 != ctor_c1) {
+    add_ctor(&ix, ctor_c2);
+    find_ctor_stubs(&ix, ctor_c2);
+  }
+  qsort(ix.ctors, ix.n_ctors, sizeof(uint64_t), compare_u64);
+
+  find_metaclass_calls(&ix);
+
+  int err = build_table(&ix);
+  free(ix.ctors);
+  free(ix.calls);
+  if (err) {
+    printf("[-]\tran out of memory indexing the IOKit classes\n");
+    iokit_classes_free(table);
+    return 1;
+  }
+
+  uint32_t with_vtables = 0;
+  for (uint32_t i = 0; i < table->count; i++) {
+    if (table->classes[i].vtable) {
+      with_vtables++;
+    }
+  }
+  printf("[+]\tindexed %d IOKit classes, %d with vtables\n", table->count, with_vtables);
+  return 0;
+}
+
+void iokit_classes_free(struct iokit_class_table* table) {
+  free(table->classes);
+  free(table->by_name);
+  free(table->slots);
+  free(table->strings);
+  memset(table, 0, sizeof(*table));
+}
+
+struct iokit_class* iokit_class_named(struct iokit_class_table* table, const char* name) {
+  uint32_t lo = 0;
+  uint32_t hi = table->count;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    struct iokit_class* cls = &table->classes[table->by_name[mid]];
+    int cmp = strcmp(name, table->strings + cls->name);
+    if (cmp == 0) {
+      return cls;
+    }
+    if (cmp < 0) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return NULL;
+}
+
+const char* iokit_class_name(struct iokit_class_table* table, struct iokit_class* cls) {
+  return table->strings + cls->name;
+}
+
+struct iokit_class* iokit_class_super(struct iokit_class_table* table, struct iokit_class* cls) {
+  return cls->super < 0 ? NULL : &table->classes[cls->super];
+}
+
+uint64_t iokit_class_vtable_entry(struct iokit_class_table* table, struct iokit_class* cls, uint32_t slot) {
+  // inherited methods are all present in the subclass' own vtable so there's no need to walk up
+  if (cls == NULL || slot >= cls->vtable_count) {
+    return 0;
+  }
+  return table->base + table->slots[cls->vtable_first + slot];
+}
+
+uint64_t iokit_class_method(struct iokit_class_table* table, const char* class_name, uint32_t slot) {
+  return iokit_class_vtable_entry(table, iokit_class_named(table, class_name), slot);
+}
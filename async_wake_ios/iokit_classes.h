@@ -0,0 +1,61 @@
+#ifndef iokit_classes_h
+#define iokit_classes_h
+
+#include <stdint.h>
+
+#include "kernel_image.h"
+
+/*
+ Every IOKit class has a static OSMetaClass instance which gets constructed by the kernel or
+ kext's static initializers:
+
+   OSMetaClass::OSMetaClass(&IOUserClient::gMetaClass, "IOUserClient", &IOService::gMetaClass, sizeof(IOUserClient))
+
+ Finding all the calls to that constructor gives us the name, size and superclass of each class,
+ and the MetaClass::alloc() method of each metaclass leads to the vtable of the class itself.
+ */
+
+struct iokit_class {
+  uint64_t metaclass;      // slid address of Class::gMetaClass
+  uint64_t vtable;         // what an instance's vtable pointer points to, 0 for abstract classes
+  uint32_t name;           // offset into iokit_class_table.strings
+  uint32_t size;
+  int32_t super;           // index of the superclass, -1 for OSObject or if it couldn't be resolved
+  uint32_t vtable_first;   // index of slot 0 in iokit_class_table.slots
+  uint32_t vtable_count;
+};
+
+struct iokit_class_table {
+  struct iokit_class* classes;  // sorted by metaclass address
+  uint32_t count;
+  uint32_t capacity;
+
+  uint32_t* by_name;            // class indices sorted by name
+
+  // vtable entries of every class, as offsets from base so they take half the space
+  uint32_t* slots;
+  uint32_t n_slots;
+  uint32_t slots_capacity;
+  uint64_t base;
+
+  char* strings;
+  uint32_t strings_size;
+  uint32_t strings_capacity;
+};
+
+// the table built from the kernel dump by jailbreak()
+extern struct iokit_class_table kernel_classes;
+
+// one pass over the kernel and kext code, everything is copied out so the image can be unloaded
+int iokit_classes_build(struct iokit_class_table* table, struct kernel_image* img);
+void iokit_classes_free(struct iokit_class_table* table);
+
+struct iokit_class* iokit_class_named(struct iokit_class_table* table, const char* name);
+const char* iokit_class_name(struct iokit_class_table* table, struct iokit_class* cls);
+struct iokit_class* iokit_class_super(struct iokit_class_table* table, struct iokit_class* cls);
+
+// slid address of the method in the given vtable slot, 0 if unknown
+uint64_t iokit_class_vtable_entry(struct iokit_class_table* table, struct iokit_class* cls, uint32_t slot);
+uint64_t iokit_class_method(struct iokit_class_table* table, const char* class_name, uint32_t slot);
+
+#endif
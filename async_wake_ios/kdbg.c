@@ -11,6 +11,8 @@
 #include "find_port.h"
 #include "early_kalloc.h"
 #include "arm64_state.h"
+#include "symbolicator.h"
+#include "syscall_table.h"
 
 extern uint64_t kernel_leak;
 
@@ -617,7 +619,9 @@ void handle_kernel_bp_hits(mach_port_t target_thread_port, uint64_t looper_pc, u
       
       for (int i = 0; i < 40; i++) {
         uint64_t* buf = (uint64_t*)&bp_context;
-        printf("%016llx\n", buf[i]);
+        char where[0x80];
+        symbolicate(&kernel_symbols, buf[i], where, sizeof(where));
+        printf("%016llx %s\n", buf[i], where);
       }
         
       
@@ -638,7 +642,27 @@ void handle_kernel_bp_hits(mach_port_t target_thread_port, uint64_t looper_pc, u
     arm_context_t bp_context;
     kmemcpy((uint64_t)&bp_context, bp_hitting_state, sizeof(arm_context_t));
       
-      printf("ALRIGHTY, HERE'S PC: 0x%llx\n", bp_context.ss.ss_64.pc);
+      char where[0x80];
+      symbolicate(&kernel_symbols, bp_context.ss.ss_64.pc, where, sizeof(where));
+      printf("ALRIGHTY, HERE'S PC: 0x%llx %s\n", bp_context.ss.ss_64.pc, where);
+      symbolicate(&kernel_symbols, bp_context.ss.ss_64.lr, where, sizeof(where));
+      printf("LR: 0x%llx %s\n", bp_context.ss.ss_64.lr, where);
+      
+      // walk the frame pointer chain of the code which hit the bp
+      uint64_t fp = bp_context.ss.ss_64.fp;
+      for (int depth = 0; depth < 16 && fp != 0 && (fp & 0xf) == 0; depth++) {
+        uint64_t frame[2] = {0}; // saved fp, saved lr
+        kmemcpy((uint64_t)&frame[0], fp, sizeof(frame));
+        if (frame[1] == 0) {
+          break;
+        }
+        symbolicate(&kernel_symbols, frame[1], where, sizeof(where));
+        printf("  #%d 0x%llx %s\n", depth, frame[1], where);
+        if (frame[0] <= fp) {
+          break;
+        }
+        fp = frame[0];
+      }
       kernel_leak = bp_context.ss.ss_64.pc;
     
     callback(&bp_context);
@@ -812,7 +836,10 @@ void raw_syscall(uint32_t syscall_number, uint32_t n_args, ...) {
 
 char* hello_wrld_str = "hellowrld!\n";
 void test_kdbg() {
-  run_syscall_with_breakpoint(ksym(KSYMBOL_WRITE_SYSCALL_ENTRYPOINT),  // breakpoint address
+  // the hardcoded symbol is 1 instruction in to write(), do the same with the one from sysent
+  uint64_t write_entry = syscall_table_handler(&kernel_syscalls, 4);
+  uint64_t bp = write_entry ? write_entry + 4 : ksym(KSYMBOL_WRITE_SYSCALL_ENTRYPOINT);
+  run_syscall_with_breakpoint(bp,                                      // breakpoint address
                               sys_write_breakpoint_handler,            // breakpoint hit handler
                               4,                                       // SYS_write
                               3,                                       // 3 arguments
@@ -0,0 +1,598 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <mach-o/loader.h>
+#include <mach-o/nlist.h>
+
+#include "kernel_image.h"
+
+// none of this touches kernel memory, it only works on a copy of it so it's safe to
+// run from the ws/nerfbat utilities against /tmp/kernel_dump as well as from the app
+
+int kimg_init(struct kernel_image* img, void* data, uint64_t base, uint64_t size) {
+  memset(img, 0, sizeof(*img));
+  if (data == NULL || size < sizeof(struct mach_header_64)) {
+    return 1;
+  }
+  img->data = data;
+  img->base = base;
+  img->size = size;
+
+  struct mach_header_64* hdr = kimg_header(img);
+  if (hdr == NULL) {
+    printf("[-]\tkernel image doesn't start with a mach header\n");
+    return 1;
+  }
+
+  struct segment_command_64* text = kimg_segment(img, hdr, "__TEXT");
+  if (text == NULL) {
+    printf("[-]\tkernel image has no __TEXT segment\n");
+    return 1;
+  }
+  img->slide = base - text->vmaddr;
+  return 0;
+}
+
+int kimg_load_dump(struct kernel_image* img, const char* path) {
+  memset(img, 0, sizeof(*img));
+
+  char base_path[1024];
+  snprintf(base_path, sizeof(base_path), "%s.base", path);
+  char base_str[0x20] = {0};
+  int fd = open(base_path, O_RDONLY);
+  if (fd == -1) {
+    printf("[-]\tno kernel base file at [%s]\n", base_path);
+    return 1;
+  }
+  read(fd, base_str, sizeof(base_str) - 1);
+  close(fd);
+  uint64_t base = strtoull(base_str, NULL, 0);
+
+  fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    printf("[-]\tno kernel dump at [%s]\n", path);
+    return 1;
+  }
+  struct stat st = {0};
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return 1;
+  }
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    printf("[-]\tfailed to map the kernel dump\n");
+    return 1;
+  }
+
+  if (kimg_init(img, data, base, st.st_size)) {
+    munmap(data, st.st_size);
+    return 1;
+  }
+  img->mapped = 1;
+  return 0;
+}
+
+void kimg_unload(struct kernel_image* img) {
+  if (img->mapped) {
+    munmap(img->data, img->size);
+  }
+  memset(img, 0, sizeof(*img));
+}
+
+int kimg_contains(struct kernel_image* img, uint64_t addr) {
+  return img->data != NULL && addr >= img->base && addr - img->base < img->size;
+}
+
+void* kimg_ptr(struct kernel_image* img, uint64_t addr, uint64_t len) {
+  if (!kimg_contains(img, addr)) {
+    return NULL;
+  }
+  uint64_t off = addr - img->base;
+  if (len > img->size - off) {
+    return NULL;
+  }
+  return img->data + off;
+}
+
+uint32_t kimg_insn(struct kernel_image* img, uint64_t addr) {
+  uint32_t* p = kimg_ptr(img, addr, 4);
+  return p ? *p : 0;
+}
+
+uint64_t kimg_read64(struct kernel_image* img, uint64_t addr) {
+  uint64_t* p = kimg_ptr(img, addr, 8);
+  return p ? *p : 0;
+}
+
+uint64_t kimg_slid(struct kernel_image* img, uint64_t unslid) {
+  return unslid + img->slide;
+}
+
+uint64_t kimg_pointer(struct kernel_image* img, uint64_t raw) {
+  if (kimg_contains(img, raw)) {
+    return raw;
+  }
+  if (kimg_contains(img, raw + img->slide)) {
+    return raw + img->slide;
+  }
+  return 0;
+}
+
+struct mach_header_64* kimg_header(struct kernel_image* img) {
+  struct mach_header_64* hdr = (struct mach_header_64*)img->data;
+  if (hdr == NULL || hdr->magic != MH_MAGIC_64) {
+    return NULL;
+  }
+  if (sizeof(*hdr) + (uint64_t)hdr->sizeofcmds > img->size) {
+    return NULL;
+  }
+  return hdr;
+}
+
+// the header has to lie inside the image, as do all its load commands
+static int header_in_image(struct kernel_image* img, struct mach_header_64* hdr) {
+  uint8_t* p = (uint8_t*)hdr;
+  if (p < img->data || p + sizeof(*hdr) > img->data + img->size) {
+    return 0;
+  }
+  if (hdr->magic != MH_MAGIC_64) {
+    return 0;
+  }
+  return (uint64_t)(img->data + img->size - (p + sizeof(*hdr))) >= hdr->sizeofcmds;
+}
+
+struct load_command* kimg_load_command(struct kernel_image* img, struct mach_header_64* hdr, uint32_t cmd) {
+  if (!header_in_image(img, hdr)) {
+    return NULL;
+  }
+  uint8_t* commands = (uint8_t*)(hdr+1);
+  uint8_t* end = commands + hdr->sizeofcmds;
+  for (uint32_t i = 0; i < hdr->ncmds; i++) {
+    struct load_command* lc = (struct load_command*)commands;
+    if (commands + sizeof(*lc) > end || lc->cmdsize < sizeof(*lc) || commands + lc->cmdsize > end) {
+      return NULL;
+    }
+    if (lc->cmd == cmd) {
+      return lc;
+    }
+    commands += lc->cmdsize;
+  }
+  return NULL;
+}
+
+struct segment_command_64* kimg_segment(struct kernel_image* img, struct mach_header_64* hdr, const char* segname) {
+  if (!header_in_image(img, hdr)) {
+    return NULL;
+  }
+  uint8_t* commands = (uint8_t*)(hdr+1);
+  uint8_t* end = commands + hdr->sizeofcmds;
+  for (uint32_t i = 0; i < hdr->ncmds; i++) {
+    struct load_command* lc = (struct load_command*)commands;
+    if (commands + sizeof(*lc) > end || lc->cmdsize < sizeof(*lc) || commands + lc->cmdsize > end) {
+      return NULL;
+    }
+    if (lc->cmd == LC_SEGMENT_64 && lc->cmdsize >= sizeof(struct segment_command_64)) {
+      struct segment_command_64* seg = (struct segment_command_64*)lc;
+      if (strncmp(seg->segname, segname, sizeof(seg->segname)) == 0) {
+        return seg;
+      }
+    }
+    commands += lc->cmdsize;
+  }
+  return NULL;
+}
+
+struct section_64* kimg_section(struct kernel_image* img, struct mach_header_64* hdr, const char* segname, const char* sectname) {
+  struct segment_command_64* seg = kimg_segment(img, hdr, segname);
+  if (seg == NULL) {
+    return NULL;
+  }
+  struct section_64* sect = (struct section_64*)(seg+1);
+  uint32_t max_sects = (uint32_t)((seg->cmdsize - sizeof(*seg)) / sizeof(*sect));
+  for (uint32_t i = 0; i < seg->nsects && i < max_sects; i++) {
+    if (strncmp(sect[i].sectname, sectname, sizeof(sect[i].sectname)) == 0) {
+      return &sect[i];
+    }
+  }
+  return NULL;
+}
+
+void* kimg_fileoff_ptr(struct kernel_image* img, struct mach_header_64* hdr, uint64_t fileoff, uint64_t len) {
+  if (!header_in_image(img, hdr)) {
+    return NULL;
+  }
+  uint8_t* commands = (uint8_t*)(hdr+1);
+  uint8_t* end = commands + hdr->sizeofcmds;
+  for (uint32_t i = 0; i < hdr->ncmds; i++) {
+    struct load_command* lc = (struct load_command*)commands;
+    if (commands + sizeof(*lc) > end || lc->cmdsize < sizeof(*lc) || commands + lc->cmdsize > end) {
+      return NULL;
+    }
+    if (lc->cmd == LC_SEGMENT_64 && lc->cmdsize >= sizeof(struct segment_command_64)) {
+      struct segment_command_64* seg = (struct segment_command_64*)lc;
+      if (fileoff >= seg->fileoff && fileoff - seg->fileoff < seg->filesize) {
+        return kimg_ptr(img, kimg_slid(img, seg->vmaddr + (fileoff - seg->fileoff)), len);
+      }
+    }
+    commands += lc->cmdsize;
+  }
+  return NULL;
+}
+
+int kimg_for_each_segment(struct kernel_image* img, struct mach_header_64* hdr, kimg_segment_callback callback, void* ctx) {
+  if (!header_in_image(img, hdr)) {
+    return 0;
+  }
+  int count = 0;
+  uint8_t* commands = (uint8_t*)(hdr+1);
+  uint8_t* end = commands + hdr->sizeofcmds;
+  for (uint32_t i = 0; i < hdr->ncmds; i++) {
+    struct load_command* lc = (struct load_command*)commands;
+    if (commands + sizeof(*lc) > end || lc->cmdsize < sizeof(*lc) || commands + lc->cmdsize > end) {
+      break;
+    }
+    if (lc->cmd == LC_SEGMENT_64 && lc->cmdsize >= sizeof(struct segment_command_64)) {
+      count++;
+      if (callback((struct segment_command_64*)lc, ctx)) {
+        break;
+      }
+    }
+    commands += lc->cmdsize;
+  }
+  return count;
+}
+
+int kimg_for_each_symbol(struct kernel_image* img, struct mach_header_64* hdr, kimg_symbol_callback callback, void* ctx) {
+  struct symtab_command* symtab = (struct symtab_command*)kimg_load_command(img, hdr, LC_SYMTAB);
+  if (symtab == NULL || symtab->nsyms == 0) {
+    return 0;
+  }
+
+  struct nlist_64* syms = kimg_fileoff_ptr(img, hdr, symtab->symoff, (uint64_t)symtab->nsyms * sizeof(struct nlist_64));
+  char* strtab = kimg_fileoff_ptr(img, hdr, symtab->stroff, symtab->strsize);
+  if (syms == NULL || strtab == NULL) {
+    // the kernel's __LINKEDIT often isn't part of the dump
+    return 0;
+  }
+
+  int count = 0;
+  for (uint32_t i = 0; i < symtab->nsyms; i++) {
+    struct nlist_64* sym = &syms[i];
+    if ((sym->n_type & N_STAB) || (sym->n_type & N_TYPE) != N_SECT || sym->n_value == 0) {
+      continue;
+    }
+    if (sym->n_un.n_strx >= symtab->strsize) {
+      continue;
+    }
+    const char* name = strtab + sym->n_un.n_strx;
+    if (memchr(name, 0, symtab->strsize - sym->n_un.n_strx) == NULL) {
+      continue;
+    }
+    count++;
+    if (callback(name, kimg_slid(img, sym->n_value), ctx)) {
+      break;
+    }
+  }
+  return count;
+}
+
+struct find_symbol_ctx {
+  const char* name;
+  uint64_t addr;
+};
+
+static int find_symbol_callback(const char* name, uint64_t addr, void* ctx) {
+  struct find_symbol_ctx* fs = ctx;
+  if (strcmp(name, fs->name) == 0) {
+    fs->addr = addr;
+    return 1;
+  }
+  return 0;
+}
+
+uint64_t kimg_find_symbol(struct kernel_image* img, const char* name) {
+  struct find_symbol_ctx fs = {name, 0};
+  kimg_for_each_symbol(img, kimg_header(img), find_symbol_callback, &fs);
+  return fs.addr;
+}
+
+uint64_t kimg_find_string(struct kernel_image* img, const char* str) {
+  size_t len = strlen(str) + 1; // include the NUL
+  uint8_t* p = img->data;
+  uint8_t* end = img->data + img->size;
+  while (p < end) {
+    uint8_t* hit = memmem(p, end - p, str, len);
+    if (hit == NULL) {
+      return 0;
+    }
+    // want the whole string, not a suffix of a longer one
+    if (hit == img->data || hit[-1] == 0) {
+      return img->base + (hit - img->data);
+    }
+    p = hit + 1;
+  }
+  return 0;
+}
+
+uint64_t kimg_find_xref(struct kernel_image* img, uint64_t start, uint64_t end, uint64_t target) {
+  uint64_t regs[32] = {0};
+  start &= ~3ULL;
+  for (uint64_t pc = start; pc + 4 <= end; pc += 4) {
+    uint32_t* p = kimg_ptr(img, pc, 4);
+    if (p == NULL) {
+      break;
+    }
+    uint32_t insn = *p;
+    int rd, rn;
+    uint32_t imm;
+    uint64_t addr;
+    if (arm64_decode_adrp(insn, pc, &rd, &addr)) {
+      regs[rd] = addr;
+    } else if (arm64_decode_adr(insn, pc, &rd, &addr)) {
+      if (addr == target) {
+        return pc;
+      }
+      regs[rd] = addr;
+    } else if (arm64_decode_add_imm(insn, &rd, &rn, &imm)) {
+      if (regs[rn] != 0 && regs[rn] + imm == target) {
+        return pc;
+      }
+      regs[rd] = 0;
+    }
+  }
+  return 0;
+}
+
+uint64_t kimg_find_function_start(struct kernel_image* img, uint64_t addr) {
+  addr &= ~3ULL;
+  // functions are packed back to back so walk back to the previous return or tail call
+  for (int i = 0; i < 0x2000; i++) {
+    uint32_t prev = kimg_insn(img, addr - 4);
+    uint64_t target;
+    if (prev == 0 || arm64_is_ret(prev) || arm64_decode_b(prev, addr - 4, &target)) {
+      return addr;
+    }
+    addr -= 4;
+  }
+  return 0;
+}
+
+/* arm64 */
+
+static int64_t sign_extend(uint64_t val, int bits) {
+  uint64_t m = 1ULL << (bits - 1);
+  val &= (1ULL << bits) - 1;
+  return (int64_t)((val ^ m) - m);
+}
+
+int arm64_decode_ldst_imm(uint32_t insn, int* is_load, int* rt, int* rn, uint32_t* imm) {
+  // size:2 111 V:1 01 opc:2 imm12 Rn Rt
+  if ((insn & 0x3f000000) != 0x39000000) {
+    return 0;
+  }
+  uint32_t size = insn >> 30;
+  uint32_t opc = (insn >> 22) & 3;
+  if (size == 3 && opc == 2) {
+    return 0; // PRFM
+  }
+  *is_load = (opc != 0);
+  *rt = insn & 0x1f;
+  *rn = (insn >> 5) & 0x1f;
+  *imm = ((insn >> 10) & 0xfff) << size;
+  return 1;
+}
+
+int arm64_decode_add_imm(uint32_t insn, int* rd, int* rn, uint32_t* imm) {
+  // sf 0 0 100010 sh imm12 Rn Rd
+  if ((insn & 0x7f800000) != 0x11000000) {
+    return 0;
+  }
+  *rd = insn & 0x1f;
+  *rn = (insn >> 5) & 0x1f;
+  *imm = (insn >> 10) & 0xfff;
+  if (insn & (1 << 22)) {
+    *imm <<= 12;
+  }
+  return 1;
+}
+
+int arm64_decode_adrp(uint32_t insn, uint64_t pc, int* rd, uint64_t* target) {
+  if ((insn & 0x9f000000) != 0x90000000) {
+    return 0;
+  }
+  uint64_t immlo = (insn >> 29) & 3;
+  uint64_t immhi = (insn >> 5) & 0x7ffff;
+  *rd = insn & 0x1f;
+  *target = (pc & ~0xfffULL) + (sign_extend((immhi << 2) | immlo, 21) << 12);
+  return 1;
+}
+
+int arm64_decode_adr(uint32_t insn, uint64_t pc, int* rd, uint64_t* target) {
+  if ((insn & 0x9f000000) != 0x10000000) {
+    return 0;
+  }
+  uint64_t immlo = (insn >> 29) & 3;
+  uint64_t immhi = (insn >> 5) & 0x7ffff;
+  *rd = insn & 0x1f;
+  *target = pc + sign_extend((immhi << 2) | immlo, 21);
+  return 1;
+}
+
+int arm64_decode_bl(uint32_t insn, uint64_t pc, uint64_t* target) {
+  if ((insn & 0xfc000000) != 0x94000000) {
+    return 0;
+  }
+  *target = pc + (sign_extend(insn & 0x3ffffff, 26) << 2);
+  return 1;
+}
+
+int arm64_decode_b(uint32_t insn, uint64_t pc, uint64_t* target) {
+  if ((insn & 0xfc000000) != 0x14000000) {
+    return 0;
+  }
+  *target = pc + (sign_extend(insn & 0x3ffffff, 26) << 2);
+  return 1;
+}
+
+int arm64_decode_movz(uint32_t insn, int* rd, uint64_t* imm) {
+  // sf 10 100101 hw imm16 Rd
+  if ((insn & 0x7f800000) != 0x52800000) {
+    return 0;
+  }
+  *rd = insn & 0x1f;
+  *imm = (uint64_t)((insn >> 5) & 0xffff) << (((insn >> 21) & 3) * 16);
+  return 1;
+}
+
+int arm64_decode_movk(uint32_t insn, int* rd, uint64_t* imm, int* shift) {
+  // sf 11 100101 hw imm16 Rd
+  if ((insn & 0x7f800000) != 0x72800000) {
+    return 0;
+  }
+  *rd = insn & 0x1f;
+  *shift = ((insn >> 21) & 3) * 16;
+  *imm = (insn >> 5) & 0xffff;
+  return 1;
+}
+
+int arm64_decode_mov_reg(uint32_t insn, int* rd, int* rm) {
+  // ORR Xd, XZR, Xm (either width, no shift)
+  if ((insn & 0x7fe0ffe0) != 0x2a0003e0) {
+    return 0;
+  }
+  *rd = insn & 0x1f;
+  *rm = (insn >> 16) & 0x1f;
+  return 1;
+}
+
+int arm64_is_ret(uint32_t insn) {
+  return insn == 0xd65f03c0;
+}
+
+void arm64_regs_clear(struct arm64_regs* regs) {
+  regs->known = 0;
+}
+
+int arm64_reg(struct arm64_regs* regs, int reg, uint64_t* value) {
+  if (reg == 31 || !(regs->known & (1u << reg))) {
+    return 0;
+  }
+  *value = regs->x[reg];
+  return 1;
+}
+
+static void set_reg(struct arm64_regs* regs, int reg, uint64_t value) {
+  if (reg == 31) {
+    return;
+  }
+  regs->x[reg] = value;
+  regs->known |= (1u << reg);
+}
+
+static void forget_reg(struct arm64_regs* regs, int reg) {
+  regs->known &= ~(1u << reg);
+}
+
+void arm64_emulate(struct kernel_image* img, struct arm64_regs* regs, uint64_t pc, uint32_t insn) {
+  int rd, rn, rt, rm, is_load, shift;
+  uint64_t value, target;
+  uint32_t imm;
+
+  if (arm64_decode_adrp(insn, pc, &rd, &target) || arm64_decode_adr(insn, pc, &rd, &target)) {
+    set_reg(regs, rd, target);
+    return;
+  }
+
+  if (arm64_decode_add_imm(insn, &rd, &rn, &imm)) {
+    if (rn != 31 && arm64_reg(regs, rn, &value)) {
+      set_reg(regs, rd, value + imm);
+    } else {
+      forget_reg(regs, rd);
+    }
+    return;
+  }
+
+  if (arm64_decode_movz(insn, &rd, &value)) {
+    set_reg(regs, rd, value);
+    return;
+  }
+
+  if (arm64_decode_movk(insn, &rd, &value, &shift)) {
+    uint64_t old;
+    if (arm64_reg(regs, rd, &old)) {
+      set_reg(regs, rd, (old & ~(0xffffULL << shift)) | (value << shift));
+    }
+    return;
+  }
+
+  if (arm64_decode_mov_reg(insn, &rd, &rm)) {
+    if (rm == 31) {
+      set_reg(regs, rd, 0);
+    } else if (arm64_reg(regs, rm, &value)) {
+      set_reg(regs, rd, (insn & 0x80000000) ? value : (uint32_t)value);
+    } else {
+      forget_reg(regs, rd);
+    }
+    return;
+  }
+
+  // LDR Xt, [Xn, #imm] from a known address, typically a GOT entry
+  if ((insn & 0xffc00000) == 0xf9400000) {
+    rt = insn & 0x1f;
+    rn = (insn >> 5) & 0x1f;
+    uint64_t base;
+    uint64_t* p = NULL;
+    if (rn != 31 && arm64_reg(regs, rn, &base)) {
+      p = kimg_ptr(img, base + (((insn >> 10) & 0xfff) << 3), 8);
+    }
+    if (p != NULL && kimg_pointer(img, *p) != 0) {
+      set_reg(regs, rt, kimg_pointer(img, *p));
+    } else {
+      forget_reg(regs, rt);
+    }
+    return;
+  }
+
+  if (arm64_decode_bl(insn, pc, &target) || (insn & 0xfffffc1f) == 0xd63f0000 /* BLR */) {
+    regs->known &= ~ARM64_CALLER_SAVED;
+    return;
+  }
+
+  if (arm64_is_ret(insn) || arm64_decode_b(insn, pc, &target) || (insn & 0xfffffc1f) == 0xd61f0000 /* BR */) {
+    arm64_regs_clear(regs);
+    return;
+  }
+
+  if (arm64_decode_ldst_imm(insn, &is_load, &rt, &rn, &imm)) {
+    if (is_load) {
+      forget_reg(regs, rt);
+    }
+    return;
+  }
+
+  // other loads and stores: a load clobbers Rt (and Rt2 for the pair forms)
+  if ((insn & 0x0a000000) == 0x08000000) {
+    if (insn & (1 << 22)) {
+      forget_reg(regs, insn & 0x1f);
+      if ((insn & 0x3a000000) == 0x28000000) {
+        forget_reg(regs, (insn >> 10) & 0x1f);
+      }
+    }
+    // pre and post index forms write back to Rn
+    if ((insn & 0x3b200c00) == 0x38000400 || (insn & 0x3b200c00) == 0x38000c00 || (insn & 0x3a800000) == 0x28800000) {
+      forget_reg(regs, (insn >> 5) & 0x1f);
+    }
+    return;
+  }
+
+  // data processing (immediate or register) writes Rd
+  if ((insn & 0x1c000000) == 0x10000000 || (insn & 0x0e000000) == 0x0a000000) {
+    forget_reg(regs, insn & 0x1f);
+  }
+}
@@ -0,0 +1,94 @@
+#ifndef kernel_image_h
+#define kernel_image_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <mach-o/loader.h>
+
+// a userspace copy of the kernelcache (see copy_kernel_to_userspace or /tmp/kernel_dump)
+// data[0] is the kernelcache mach header which was read from base
+struct kernel_image {
+  uint8_t* data;
+  uint64_t base;    // slid address of data[0]
+  uint64_t size;
+  uint64_t slide;   // base - unslid vmaddr of the kernelcache __TEXT segment
+  int mapped;       // data was mmap'd by kimg_load_dump
+};
+
+int kimg_init(struct kernel_image* img, void* data, uint64_t base, uint64_t size);
+
+// map a dump written by copy_userspace_kernel_to_file, the base is read from <path>.base
+int kimg_load_dump(struct kernel_image* img, const char* path);
+void kimg_unload(struct kernel_image* img);
+
+// all addresses are slid kernel addresses unless noted otherwise
+void* kimg_ptr(struct kernel_image* img, uint64_t addr, uint64_t len);
+uint32_t kimg_insn(struct kernel_image* img, uint64_t addr);
+uint64_t kimg_read64(struct kernel_image* img, uint64_t addr);
+int kimg_contains(struct kernel_image* img, uint64_t addr);
+
+// mach headers, symbols and the prelink plist hold unslid addresses
+uint64_t kimg_slid(struct kernel_image* img, uint64_t unslid);
+
+// a pointer read out of the image: already slid in a live dump, unslid in a kernelcache from disk
+// returns the slid address if either interpretation lands inside the image, 0 otherwise
+uint64_t kimg_pointer(struct kernel_image* img, uint64_t raw);
+
+// walk the load commands of the kernelcache header or of an embedded (prelinked) header
+struct segment_command_64* kimg_segment(struct kernel_image* img, struct mach_header_64* hdr, const char* segname);
+struct section_64* kimg_section(struct kernel_image* img, struct mach_header_64* hdr, const char* segname, const char* sectname);
+struct load_command* kimg_load_command(struct kernel_image* img, struct mach_header_64* hdr, uint32_t cmd);
+struct mach_header_64* kimg_header(struct kernel_image* img);
+
+// return nonzero from the callback to stop
+typedef int (*kimg_segment_callback)(struct segment_command_64* seg, void* ctx);
+int kimg_for_each_segment(struct kernel_image* img, struct mach_header_64* hdr, kimg_segment_callback callback, void* ctx);
+
+// translate a file offset in the kernelcache to a pointer into the image
+void* kimg_fileoff_ptr(struct kernel_image* img, struct mach_header_64* hdr, uint64_t fileoff, uint64_t len);
+
+// LC_SYMTAB of the kernel; kernelcaches before iOS 12 still carry the kernel's exported symbols
+typedef int (*kimg_symbol_callback)(const char* name, uint64_t addr, void* ctx);
+int kimg_for_each_symbol(struct kernel_image* img, struct mach_header_64* hdr, kimg_symbol_callback callback, void* ctx);
+uint64_t kimg_find_symbol(struct kernel_image* img, const char* name);
+
+// find the address of a NUL terminated string, and code which builds a pointer to an address with adrp/add
+uint64_t kimg_find_string(struct kernel_image* img, const char* str);
+uint64_t kimg_find_xref(struct kernel_image* img, uint64_t start, uint64_t end, uint64_t target);
+uint64_t kimg_find_function_start(struct kernel_image* img, uint64_t addr);
+
+/* arm64 instruction decoding, only the handful of forms the finders need */
+
+// LDR/STR/LDRB/LDRH/STRB/STRH/LDRSW (unsigned immediate), imm is already scaled
+int arm64_decode_ldst_imm(uint32_t insn, int* is_load, int* rt, int* rn, uint32_t* imm);
+// ADD (immediate)
+int arm64_decode_add_imm(uint32_t insn, int* rd, int* rn, uint32_t* imm);
+int arm64_decode_adrp(uint32_t insn, uint64_t pc, int* rd, uint64_t* target);
+int arm64_decode_adr(uint32_t insn, uint64_t pc, int* rd, uint64_t* target);
+// BL and B
+int arm64_decode_bl(uint32_t insn, uint64_t pc, uint64_t* target);
+int arm64_decode_b(uint32_t insn, uint64_t pc, uint64_t* target);
+// MOVZ/MOVK
+int arm64_decode_movz(uint32_t insn, int* rd, uint64_t* imm);
+int arm64_decode_movk(uint32_t insn, int* rd, uint64_t* imm, int* shift);
+// ORR Xd, XZR, Xm
+int arm64_decode_mov_reg(uint32_t insn, int* rd, int* rm);
+int arm64_is_ret(uint32_t insn);
+
+
+// just enough register tracking to follow pointers being built with adrp/add/ldr and
+// constants with movz/movk, anything else which writes a register makes it unknown
+struct arm64_regs {
+  uint64_t x[32];
+  uint32_t known;  // bitmask of registers whose value is in x
+};
+
+#define ARM64_CALLER_SAVED 0x7ffff // x0-x18
+
+void arm64_regs_clear(struct arm64_regs* regs);
+int arm64_reg(struct arm64_regs* regs, int reg, uint64_t* value);
+// update regs for the instruction at pc, pointers loaded from the image are returned slid
+void arm64_emulate(struct kernel_image* img, struct arm64_regs* regs, uint64_t pc, uint32_t insn);
+
+#endif
@@ -0,0 +1,446 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mach-o/loader.h>
+
+#include "kext_map.h"
+
+struct kext_map kernel_kexts = {0};
+
+/*
+ __PRELINK_INFO,__info is an XML plist, several MB of it:
+
+ <dict>
+   <key>_PrelinkInfoDictionary</key>
+   <array>
+     <dict>
+       <key>CFBundleIdentifier</key><string ID="12">com.apple.iokit.IOSurface</string>
+       <key>_PrelinkExecutableLoadAddr</key><integer size="64" ID="13">0xfffffff006d1c000</integer>
+       <key>IOKitPersonalities</key><dict>...</dict>
+       ...
+     </dict>
+     ...
+
+ Repeated values are only written out once with an ID and are referenced after that with
+ <string IDREF="12"/>, so we have to remember where each ID'd value lives.
+
+ Rather than building a tree we walk the tags once and keep just the two values we want from
+ each of the top level kext dictionaries. The only allocation is the ID table.
+ */
+
+struct span {
+  const char* p;
+  uint32_t len;
+};
+
+static int span_is(struct span s, const char* str) {
+  size_t len = strlen(str);
+  return s.p != NULL && s.len == len && memcmp(s.p, str, len) == 0;
+}
+
+struct plist_ids {
+  struct span* spans;
+  uint32_t capacity;
+};
+
+#define MAX_PLIST_ID 0x100000
+
+static int ids_set(struct plist_ids* ids, uint32_t id, struct span value) {
+  if (id >= MAX_PLIST_ID) {
+    return 1;
+  }
+  if (id >= ids->capacity) {
+    uint32_t capacity = ids->capacity ? ids->capacity : 0x1000;
+    while (capacity <= id) {
+      capacity *= 2;
+    }
+    struct span* spans = realloc(ids->spans, capacity * sizeof(struct span));
+    if (spans == NULL) {
+      return 1;
+    }
+    memset(spans + ids->capacity, 0, (capacity - ids->capacity) * sizeof(struct span));
+    ids->spans = spans;
+    ids->capacity = capacity;
+  }
+  ids->spans[id] = value;
+  return 0;
+}
+
+static struct span ids_get(struct plist_ids* ids, uint32_t id) {
+  struct span none = {NULL, 0};
+  return id < ids->capacity ? ids->spans[id] : none;
+}
+
+struct tag {
+  struct span name;
+  struct span attrs;  // everything between the name and the closing > (or />)
+  struct span text;   // character data up to the next tag
+  int closing;        // </name>
+  int empty;          // <name/>
+};
+
+// parse the next tag at or after *pp, on return *pp points at the start of the tag after it
+static int next_tag(const char** pp, const char* end, struct tag* tag) {
+  const char* p = memchr(*pp, '<', end - *pp);
+  if (p == NULL) {
+    return 0;
+  }
+  const char* close = memchr(p, '>', end - p);
+  if (close == NULL) {
+    return 0;
+  }
+
+  memset(tag, 0, sizeof(*tag));
+  p++;
+  if (p < close && *p == '/') {
+    tag->closing = 1;
+    p++;
+  }
+
+  tag->name.p = p;
+  while (p < close && *p != ' ' && *p != '\t' && *p != '\n' && *p != '/') {
+    p++;
+  }
+  tag->name.len = (uint32_t)(p - tag->name.p);
+
+  const char* attrs_end = close;
+  if (close > p && close[-1] == '/') {
+    tag->empty = 1;
+    attrs_end = close - 1;
+  }
+  tag->attrs.p = p;
+  tag->attrs.len = (uint32_t)(attrs_end - p);
+
+  tag->text.p = close + 1;
+  const char* next = memchr(tag->text.p, '<', end - tag->text.p);
+  if (next == NULL) {
+    next = end;
+  }
+  tag->text.len = (uint32_t)(next - tag->text.p);
+
+  *pp = next;
+  return 1;
+}
+
+// attr is of the form ' ID="'
+static int tag_attr_u32(struct tag* tag, const char* attr, uint32_t* value) {
+  size_t len = strlen(attr);
+  const char* p = memmem(tag->attrs.p, tag->attrs.len, attr, len);
+  if (p == NULL) {
+    return 0;
+  }
+  p += len;
+  const char* end = tag->attrs.p + tag->attrs.len;
+  uint32_t v = 0;
+  int digits = 0;
+  while (p < end && *p >= '0' && *p <= '9' && digits < 9) {
+    v = v*10 + (*p - '0');
+    p++;
+    digits++;
+  }
+  *value = v;
+  return digits != 0;
+}
+
+static uint64_t span_to_u64(struct span s) {
+  char buf[32];
+  if (s.p == NULL || s.len == 0 || s.len >= sizeof(buf)) {
+    return 0;
+  }
+  memcpy(buf, s.p, s.len);
+  buf[s.len] = 0;
+  return strtoull(buf, NULL, 0);
+}
+
+typedef int (*prelink_kext_callback)(struct span bundle_id, uint64_t load_addr, void* ctx);
+
+static int parse_prelink_info(const char* plist, uint64_t size, prelink_kext_callback callback, void* ctx) {
+  struct plist_ids ids = {0};
+  const char* p = plist;
+  const char* end = plist + size;
+
+  int depth = 0;                // dict and array nesting
+  int kexts_depth = 0;          // depth of the _PrelinkInfoDictionary array, 0 until we're in it
+  struct span key = {NULL, 0};  // the most recent <key> at any depth
+  struct span bundle_id = {NULL, 0};
+  struct span load_addr = {NULL, 0};
+  int n_kexts = 0;
+
+  struct tag tag;
+  while (next_tag(&p, end, &tag)) {
+    if (tag.name.len == 0 || tag.name.p[0] == '?' || tag.name.p[0] == '!') {
+      continue;
+    }
+
+    int is_dict = span_is(tag.name, "dict");
+    int is_container = is_dict || span_is(tag.name, "array");
+
+    if (tag.closing) {
+      if (!is_container) {
+        continue;
+      }
+      if (kexts_depth && depth == kexts_depth + 1 && is_dict) {
+        // end of one kext's dictionary, codeless kexts have no load address
+        if (load_addr.p != NULL) {
+          if (callback(bundle_id, span_to_u64(load_addr), ctx)) {
+            break;
+          }
+          n_kexts++;
+        }
+      }
+      if (depth == kexts_depth) {
+        kexts_depth = 0;
+      }
+      depth--;
+      continue;
+    }
+
+    if (is_container) {
+      if (tag.empty) {
+        continue;
+      }
+      depth++;
+      if (depth == 2 && !is_dict && span_is(key, "_PrelinkInfoDictionary")) {
+        kexts_depth = depth;
+      }
+      if (kexts_depth && depth == kexts_depth + 1) {
+        bundle_id.p = load_addr.p = NULL;
+      }
+      continue;
+    }
+
+    struct span value = tag.text;
+    if (tag.empty) {
+      value.p = NULL;
+      value.len = 0;
+    }
+
+    uint32_t id = 0;
+    if (tag_attr_u32(&tag, " IDREF=\"", &id)) {
+      value = ids_get(&ids, id);
+    } else if (tag_attr_u32(&tag, " ID=\"", &id)) {
+      ids_set(&ids, id, value);
+    }
+
+    if (span_is(tag.name, "key")) {
+      key = value;
+      continue;
+    }
+
+    if (kexts_depth && depth == kexts_depth + 1) {
+      if (span_is(key, "CFBundleIdentifier")) {
+        bundle_id = value;
+      } else if (span_is(key, "_PrelinkExecutableLoadAddr")) {
+        load_addr = value;
+      }
+    }
+  }
+
+  free(ids.spans);
+  return n_kexts;
+}
+
+static int add_name(struct kext_map* map, const char* name, uint32_t len, uint32_t* offset) {
+  if (map->names_size + len + 1 > map->names_capacity) {
+    uint32_t capacity = map->names_capacity ? map->names_capacity : 0x4000;
+    while (map->names_size + len + 1 > capacity) {
+      capacity *= 2;
+    }
+    char* names = realloc(map->names, capacity);
+    if (names == NULL) {
+      return 1;
+    }
+    map->names = names;
+    map->names_capacity = capacity;
+  }
+  *offset = map->names_size;
+  memcpy(map->names + map->names_size, name, len);
+  map->names[map->names_size + len] = 0;
+  map->names_size += len + 1;
+  return 0;
+}
+
+static int add_segment(struct kext_map* map, uint64_t start, uint64_t end, uint32_t bundle_id, const char* segname) {
+  if (map->count == map->capacity) {
+    uint32_t capacity = map->capacity ? map->capacity * 2 : 0x400;
+    struct kext_segment* segments = realloc(map->segments, capacity * sizeof(struct kext_segment));
+    if (segments == NULL) {
+      return 1;
+    }
+    map->segments = segments;
+    map->capacity = capacity;
+  }
+  struct kext_segment* seg = &map->segments[map->count++];
+  seg->start = start;
+  seg->end = end;
+  seg->bundle_id = bundle_id;
+  strncpy(seg->segname, segname, sizeof(seg->segname));
+  return 0;
+}
+
+struct build_ctx {
+  struct kext_map* map;
+  struct kernel_image* img;
+  uint32_t bundle_id;
+  int is_kernel;
+  int failed;
+};
+
+static int add_segment_callback(struct segment_command_64* seg, void* arg) {
+  struct build_ctx* ctx = arg;
+  if (seg->vmsize == 0) {
+    return 0;
+  }
+  // the kexts all share the kernel's __LINKEDIT
+  if (strncmp(seg->segname, "__LINKEDIT", sizeof(seg->segname)) == 0) {
+    return 0;
+  }
+  // the prelink segments are covered by the kexts' own segments
+  if (ctx->is_kernel && (strncmp(seg->segname, "__PRELINK", 9) == 0 || strncmp(seg->segname, "__PLK", 5) == 0)) {
+    return 0;
+  }
+  char segname[17] = {0};
+  memcpy(segname, seg->segname, sizeof(seg->segname));
+  uint64_t start = kimg_slid(ctx->img, seg->vmaddr);
+  if (add_segment(ctx->map, start, start + seg->vmsize, ctx->bundle_id, segname)) {
+    ctx->failed = 1;
+    return 1;
+  }
+  return 0;
+}
+
+static int add_kext_callback(struct span bundle_id, uint64_t load_addr, void* arg) {
+  struct build_ctx* ctx = arg;
+  struct mach_header_64* hdr = kimg_ptr(ctx->img, kimg_slid(ctx->img, load_addr), sizeof(struct mach_header_64));
+  if (hdr == NULL || hdr->magic != MH_MAGIC_64) {
+    return 0;
+  }
+  if (bundle_id.p == NULL) {
+    bundle_id.p = "unknown";
+    bundle_id.len = 7;
+  }
+  if (add_name(ctx->map, bundle_id.p, bundle_id.len, &ctx->bundle_id)) {
+    ctx->failed = 1;
+    return 1;
+  }
+  ctx->is_kernel = 0;
+  kimg_for_each_segment(ctx->img, hdr, add_segment_callback, ctx);
+  ctx->map->n_kexts++;
+  return ctx->failed;
+}
+
+static int compare_segments(const void* a, const void* b) {
+  const struct kext_segment* sa = a;
+  const struct kext_segment* sb = b;
+  if (sa->start < sb->start) {
+    return -1;
+  }
+  return sa->start > sb->start;
+}
+
+// sort and make the ranges disjoint, the first segment to claim an address keeps it
+static int finish_map(struct kext_map* map) {
+  qsort(map->segments, map->count, sizeof(struct kext_segment), compare_segments);
+
+  uint32_t out = 0;
+  for (uint32_t i = 0; i < map->count; i++) {
+    struct kext_segment seg = map->segments[i];
+    if (out > 0 && seg.start < map->segments[out-1].end) {
+      if (seg.end <= map->segments[out-1].end) {
+        continue;
+      }
+      seg.start = map->segments[out-1].end;
+    }
+    map->segments[out++] = seg;
+  }
+  map->count = out;
+
+  map->starts = malloc((map->count ? map->count : 1) * sizeof(uint64_t));
+  if (map->starts == NULL) {
+    return 1;
+  }
+  for (uint32_t i = 0; i < map->count; i++) {
+    map->starts[i] = map->segments[i].start;
+  }
+  return 0;
+}
+
+int kext_map_build(struct kext_map* map, struct kernel_image* img) {
+  kext_map_free(map);
+
+  struct mach_header_64* hdr = kimg_header(img);
+  if (hdr == NULL) {
+    printf("[-]\tno kernel image to build the kext map from\n");
+    return 1;
+  }
+
+  struct build_ctx ctx = {map, img, 0, 1, 0};
+  if (add_name(map, "__kernel__", 10, &ctx.bundle_id)) {
+    return 1;
+  }
+  kimg_for_each_segment(img, hdr, add_segment_callback, &ctx);
+
+  struct section_64* info = kimg_section(img, hdr, "__PRELINK_INFO", "__info");
+  char* plist = NULL;
+  if (info != NULL) {
+    plist = kimg_ptr(img, kimg_slid(img, info->addr), info->size);
+  }
+  if (plist == NULL) {
+    printf("[-]\t__PRELINK_INFO isn't in the kernel image, only the kernel itself will be mapped\n");
+  } else {
+    parse_prelink_info(plist, info->size, add_kext_callback, &ctx);
+  }
+
+  if (ctx.failed || finish_map(map)) {
+    printf("[-]\tran out of memory building the kext map\n");
+    kext_map_free(map);
+    return 1;
+  }
+
+  printf("[+]\tmapped %d kexts (%d segments)\n", map->n_kexts, map->count);
+  return 0;
+}
+
+void kext_map_free(struct kext_map* map) {
+  free(map->starts);
+  free(map->segments);
+  free(map->names);
+  memset(map, 0, sizeof(*map));
+}
+
+struct kext_segment* kext_map_lookup(struct kext_map* map, uint64_t addr) {
+  // find the last segment which starts at or below addr
+  uint32_t lo = 0;
+  uint32_t hi = map->count;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (map->starts[mid] <= addr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) {
+    return NULL;
+  }
+  struct kext_segment* seg = &map->segments[lo-1];
+  return addr < seg->end ? seg : NULL;
+}
+
+const char* kext_map_bundle_id(struct kext_map* map, struct kext_segment* seg) {
+  return map->names + seg->bundle_id;
+}
+
+int kext_map_describe(struct kext_map* map, uint64_t addr, char* buf, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  buf[0] = 0;
+  struct kext_segment* seg = kext_map_lookup(map, addr);
+  if (seg == NULL) {
+    return 0;
+  }
+  snprintf(buf, len, "%s %.16s+0x%llx", kext_map_bundle_id(map, seg), seg->segname, addr - seg->start);
+  return 1;
+}
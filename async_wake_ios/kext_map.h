@@ -0,0 +1,47 @@
+#ifndef kext_map_h
+#define kext_map_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "kernel_image.h"
+
+// one segment of a prelinked kext (or of the kernel itself), addresses are slid
+struct kext_segment {
+  uint64_t start;
+  uint64_t end;
+  uint32_t bundle_id;  // offset into kext_map.names
+  char segname[16];
+};
+
+// sorted, non-overlapping address ranges
+// starts[] is kept separately from segments[] so the binary search only touches one array
+struct kext_map {
+  uint64_t* starts;
+  struct kext_segment* segments;
+  uint32_t count;
+  uint32_t capacity;
+
+  char* names;
+  uint32_t names_size;
+  uint32_t names_capacity;
+
+  uint32_t n_kexts;
+};
+
+// the map built from the kernel dump by jailbreak() or the ws utility
+extern struct kext_map kernel_kexts;
+
+// parse __PRELINK_INFO and the prelinked kexts' load commands
+// everything needed is copied out so the image can be unloaded afterwards
+int kext_map_build(struct kext_map* map, struct kernel_image* img);
+void kext_map_free(struct kext_map* map);
+
+struct kext_segment* kext_map_lookup(struct kext_map* map, uint64_t addr);
+const char* kext_map_bundle_id(struct kext_map* map, struct kext_segment* seg);
+
+// "com.apple.iokit.IOSurface __TEXT_EXEC+0x1a2c"
+// returns 0 and writes an empty string if addr isn't in any known segment
+int kext_map_describe(struct kext_map* map, uint64_t addr, char* buf, size_t len);
+
+#endif
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "proc_list.h"
+#include "kmem.h"
+#include "symbols.h"
+
+extern uint64_t get_proc_block(uint32_t target);
+
+#define PROC_READ_MAX 0x400           // enough for up to the end of p_comm
+#define PID_MAX 99999
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct proc_list* current;
+static uint64_t self_proc;            // ours doesn't move while we're running
+
+static uint64_t now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct walk {
+  mach_port_t tfp0;
+  int pid_off, task_off, ucred_off, comm_off, bsd_info_off;
+  int span;
+  uint32_t reads;
+};
+
+static int kread(struct walk* w, uint64_t addr, void* buf, uint32_t len) {
+  mach_vm_size_t out_size = 0;
+  w->reads++;
+  kern_return_t err = mach_vm_read_overwrite(w->tfp0, addr, len, (mach_vm_address_t)buf, &out_size);
+  return err == KERN_SUCCESS && out_size == len ? 0 : -1;
+}
+
+static uint64_t field64(const uint8_t* p, int off) {
+  uint64_t v;
+  memcpy(&v, p + off, sizeof(v));
+  return v;
+}
+
+// the proc at addr and its list links, one read for the lot
+static int read_proc(struct walk* w, uint64_t addr, struct proc_info* info, uint64_t* next, uint64_t* prev) {
+  uint8_t p[PROC_READ_MAX];
+  if (kread(w, addr, p, w->span) != 0) {
+    return -1;
+  }
+  uint32_t pid;
+  memcpy(&pid, p + w->pid_off, sizeof(pid));
+  if (pid > PID_MAX) {
+    return -1;
+  }
+  info->pid = pid;
+  info->proc = addr;
+  info->task = field64(p, w->task_off);
+  info->ucred = field64(p, w->ucred_off);
+  memcpy(info->name, p + w->comm_off, sizeof(info->name) - 1);
+  info->name[sizeof(info->name) - 1] = 0;
+  *next = field64(p, 0);              // p_list.le_next
+  *prev = field64(p, 8);              // p_list.le_prev, the previous proc's le_next so the proc itself
+  return 0;
+}
+
+static int by_pid(const void* a, const void* b) {
+  const struct proc_info* x = a;
+  const struct proc_info* y = b;
+  return x->pid < y->pid ? -1 : x->pid > y->pid;
+}
+
+static int walk_procs(struct walk* w, struct proc_list* list) {
+  struct proc_info info;
+  uint64_t next, prev, back;
+  if (read_proc(w, self_proc, &info, &next, &back) != 0) {
+    return -1;
+  }
+  list->procs[list->count++] = info;
+
+  // forwards to the end, which is kernproc
+  while (next && list->count < PROC_LIST_MAX) {
+    if (read_proc(w, next, &list->procs[list->count], &next, &prev) != 0) {
+      break;
+    }
+    list->count++;
+  }
+
+  // and back to the head, the newer ones. The head's le_prev is &allproc, which reads just as well,
+  // so each one has to have a task that points back at it to count
+  uint64_t from = self_proc;
+  while (back && list->count < PROC_LIST_MAX) {
+    uint64_t bsd_info = 0;
+    if (read_proc(w, back, &info, &next, &prev) != 0 || next != from || info.task == 0 ||
+        kread(w, info.task + w->bsd_info_off, &bsd_info, sizeof(bsd_info)) != 0 || bsd_info != back) {
+      break;
+    }
+    list->procs[list->count++] = info;
+    from = back;
+    back = prev;
+  }
+  qsort(list->procs, list->count, sizeof(list->procs[0]), by_pid);
+  return 0;
+}
+
+// a growing string
+struct out {
+  char* p;
+  size_t len;
+  size_t size;
+  int failed;
+};
+
+static void out_printf(struct out* o, const char* fmt, ...) {
+  for (;;) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = o->failed ? 0 : vsnprintf(o->p + o->len, o->size - o->len, fmt, ap);
+    va_end(ap);
+    if (o->failed || o->len + n < o->size) {
+      o->len += o->failed ? 0 : n;
+      return;
+    }
+    char* bigger = realloc(o->p, o->size * 2 + n);
+    if (bigger == NULL) {
+      o->failed = 1;
+      return;
+    }
+    o->p = bigger;
+    o->size = o->size * 2 + n;
+  }
+}
+
+// p_comm is whatever the process was exec'd as, so it's escaped
+static void out_escaped(struct out* o, const char* s, int json) {
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (json && (c == '"' || c == '\\')) {
+      out_printf(o, "\\%c", c);
+    } else if (json && c < 0x20) {
+      out_printf(o, "\\u%04x", c);
+    } else if (!json && strchr("&<>\"", c)) {
+      out_printf(o, "&#%d;", c);
+    } else {
+      out_printf(o, "%c", c);
+    }
+  }
+}
+
+static int render(struct proc_list* list) {
+  struct out html = {malloc(0x4000), 0, 0x4000, 0};
+  struct out json = {malloc(0x4000), 0, 0x4000, 0};
+  html.failed = html.p == NULL;
+  json.failed = json.p == NULL;
+
+  out_printf(&html, "<html>\n<br>%zu processes, walked in %u us with %u kernel reads</ br>\n", list->count,
+             list->walk_us, list->reads);
+  out_printf(&json, "{\"count\":%zu,\"walk_us\":%u,\"reads\":%u,\"procs\":[", list->count, list->walk_us,
+             list->reads);
+  for (size_t i = 0; i < list->count; i++) {
+    struct proc_info* p = &list->procs[i];
+    unsigned long long proc = p->proc, task = p->task, ucred = p->ucred;
+    out_printf(&html, "<br>%u -- ", p->pid);
+    out_escaped(&html, p->name, 0);
+    out_printf(&html,
+               " (<a href=/dump_ptr=0x%llx>0x%llx</a>) task <a href=/dump_ptr=0x%llx>0x%llx</a>"
+               " ucred <a href=/dump_ptr=0x%llx>0x%llx</a></ br>\n",
+               proc, proc, task, task, ucred, ucred);
+    out_printf(&json, "%s{\"pid\":%u,\"name\":\"", i ? "," : "", p->pid);
+    out_escaped(&json, p->name, 1);
+    out_printf(&json, "\",\"proc\":\"0x%llx\",\"task\":\"0x%llx\",\"ucred\":\"0x%llx\"}", proc, task, ucred);
+  }
+  out_printf(&html, "</html>\n");
+  out_printf(&json, "]}\n");
+
+  if (html.failed || json.failed) {
+    free(html.p);
+    free(json.p);
+    return -1;
+  }
+  list->html = html.p;
+  list->html_len = html.len;
+  list->json = json.p;
+  list->json_len = json.len;
+  return 0;
+}
+
+static void list_free(struct proc_list* list) {
+  free(list->procs);
+  free(list->html);
+  free(list->json);
+  free(list);
+}
+
+static struct proc_list* take_snapshot(mach_port_t tfp0) {
+  if (self_proc == 0 || self_proc == (uint64_t)-1) {
+    self_proc = get_proc_block(getpid());
+    if (self_proc == (uint64_t)-1) {
+      return NULL;
+    }
+  }
+
+  struct walk w = {0};
+  w.tfp0 = tfp0;
+  w.pid_off = koffset(KSTRUCT_OFFSET_PROC_PID);
+  w.task_off = koffset(KSTRUCT_OFFSET_PROC_TASK);
+  w.ucred_off = koffset(KSTRUCT_OFFSET_PROC_UCRED);
+  w.comm_off = koffset(KSTRUCT_OFFSET_PROC_P_COMM);
+  w.bsd_info_off = koffset(KSTRUCT_OFFSET_TASK_BSD_INFO);
+  int ends[] = {16, w.pid_off + 4, w.task_off + 8, w.ucred_off + 8, w.comm_off + 16};
+  for (size_t i = 0; i < sizeof(ends) / sizeof(ends[0]); i++) {
+    w.span = ends[i] > w.span ? ends[i] : w.span;
+  }
+  if (w.span > PROC_READ_MAX) {
+    printf("[-]\tstruct proc offsets don't look right, p_comm at 0x%x\n", w.comm_off);
+    return NULL;
+  }
+
+  struct proc_list* list = calloc(1, sizeof(*list));
+  if (list == NULL || (list->procs = malloc(PROC_LIST_MAX * sizeof(list->procs[0]))) == NULL) {
+    free(list);
+    return NULL;
+  }
+  uint64_t start = now_us();
+  if (walk_procs(&w, list) != 0) {
+    printf("[-]\tcouldn't read our own proc at 0x%llx\n", (unsigned long long)self_proc);
+    list_free(list);
+    return NULL;
+  }
+  uint64_t end = now_us();
+  list->taken = end / 1000;
+  list->walk_us = (uint32_t)(end - start);
+  list->reads = w.reads;
+  if (render(list) != 0) {
+    list_free(list);
+    return NULL;
+  }
+  list->refs = 1;
+  return list;
+}
+
+struct proc_list* proc_list_get(mach_port_t tfp0, uint32_t max_age) {
+  pthread_mutex_lock(&lock);
+  // walked while holding the lock so a burst of requests does one walk between them
+  if (current == NULL || max_age == 0 || proc_list_age(current) >= max_age) {
+    struct proc_list* fresh = take_snapshot(tfp0);
+    if (fresh) {
+      if (current && --current->refs == 0) {
+        list_free(current);
+      }
+      current = fresh;
+    }
+  }
+  struct proc_list* list = current;
+  if (list) {
+    list->refs++;
+  }
+  pthread_mutex_unlock(&lock);
+  return list;
+}
+
+void proc_list_release(struct proc_list* list) {
+  pthread_mutex_lock(&lock);
+  if (--list->refs == 0) {
+    list_free(list);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+uint64_t proc_list_age(const struct proc_list* list) {
+  return now_us() / 1000 - list->taken;
+}
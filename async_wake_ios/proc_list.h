@@ -0,0 +1,55 @@
+#ifndef proc_list_h
+#define proc_list_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <mach/mach.h>
+
+/*
+ A snapshot of the kernel's process list for /info. The list is walked straight through the
+ struct procs, out from our own in both directions, with one kernel read per proc for the fields
+ that are wanted (one more going backwards, to be sure it's still a proc and not the list head).
+ That's instead of asking proc_name about all 65536 pids and then walking the list again from the
+ start for each one that answered.
+
+ The snapshot is kept and handed out again until it's max_age ms old, and its HTML and JSON are
+ rendered once when it's taken, so serving /info is copying out a buffer.
+ */
+
+#define PROC_LIST_MAX_AGE_MS 1000
+#define PROC_LIST_MAX 4096            // in case a bad read has us going round in circles
+
+struct proc_info {
+  uint32_t pid;
+  char name[17];                      // p_comm, MAXCOMLEN + 1
+  uint64_t proc;
+  uint64_t task;
+  uint64_t ucred;
+};
+
+struct proc_list {
+  struct proc_info* procs;            // by pid
+  size_t count;
+  uint64_t taken;                     // ms, CLOCK_MONOTONIC
+  uint32_t walk_us;
+  uint32_t reads;                     // kernel reads the walk took
+
+  char* html;
+  size_t html_len;
+  char* json;
+  size_t json_len;
+
+  int refs;
+};
+
+// the current snapshot, or a new one if it's older than max_age ms (0 always walks again). If the
+// walk fails it's the old one regardless, or NULL when there isn't one. Hand it back with
+// proc_list_release
+struct proc_list* proc_list_get(mach_port_t tfp0, uint32_t max_age);
+void proc_list_release(struct proc_list* list);
+
+// ms since it was taken
+uint64_t proc_list_age(const struct proc_list* list);
+
+#endif
@@ -6,6 +6,9 @@
 extern void* kernel_global;
 extern uint64_t kernel_size_global;
 
+// host special port 4, unused by the system so it's free to hold the kernel task port
+#define HSP4 4
+
 // Reversed / Inspired by QiLin
 // by recommendation for userspace hsp4 by stek29
 int remap_tfp0_to_hsp4(mach_port_t tfp0, uint64_t kernel_base)
@@ -18,29 +21,31 @@ int remap_tfp0_to_hsp4(mach_port_t tfp0, uint64_t kernel_base)
     port = mach_host_self();
     printf("[+]\t[remap_tfp0_to_hsp4]\ttfp0 = 0x%x\n", tfp0);
     printf("[+]\t[remap_tfp0_to_hsp4]\tHost_priv is 0x%x\n", port);
-    uint64_t proc_data = rk64(my_proc + 0x18);
-    uint64_t ipc_space = rk64(proc_data + 0x308);
+    uint64_t proc_data = rk64(my_proc + koffset(KSTRUCT_OFFSET_PROC_TASK));
+    uint64_t ipc_space = rk64(proc_data + koffset(KSTRUCT_OFFSET_TASK_ITK_SPACE));
     printf("[+]\t[remap_tfp0_to_hsp4]\tMy process IPC space is here: 0x%llx\n", ipc_space);
-    uint64_t itks = rk64(ipc_space + 0x28);
-    uint64_t itkproc = rk64(my_proc + 0x18);
+    uint64_t itks = rk64(ipc_space + koffset(KSTRUCT_OFFSET_IPC_SPACE_IS_TASK));
+    uint64_t itkproc = rk64(my_proc + koffset(KSTRUCT_OFFSET_PROC_TASK));
     uint64_t real_host = 0, tfp0_ptr = 0, guess;
     if (itks == itkproc)
     {
-        uint32_t num_count = rk32(ipc_space + 0x14);
-        uint64_t ipc_structure_base = rk64(ipc_space + 0x20);
+        uint32_t num_count = rk32(ipc_space + koffset(KSTRUCT_OFFSET_IPC_SPACE_IS_TABLE_SIZE));
+        uint64_t ipc_structure_base = rk64(ipc_space + koffset(KSTRUCT_OFFSET_IPC_SPACE_IS_TABLE));
         for (index=0; index < num_count; index++)
         {
-            if ( !rk32(ipc_structure_base + 0x18 * index + 0x10) && rk64(ipc_structure_base + 0x18 * index))
+            uint64_t entry = ipc_structure_base + index * koffset(KSTRUCT_SIZE_IPC_ENTRY);
+            if ( !rk32(entry + koffset(KSTRUCT_OFFSET_IPC_ENTRY_IE_REQUEST)) && rk64(entry))
             {
-                guess = (index << 8) + (uint64_t)((rk64(ipc_structure_base + 0x18LL * (signed int)index + 8) & 0xFF000000) >> 0x18);
+                // the name is the table index with the generation from the top byte of ie_bits
+                guess = (index << 8) + (rk32(entry + koffset(KSTRUCT_OFFSET_IPC_ENTRY_IE_BITS)) >> 24);
                 if (port == guess)
                 {
-                    real_host = rk64(ipc_structure_base + 0x18 * (signed int)index);
+                    real_host = rk64(entry);
                     printf("[i]\t[remap_tfp0_to_hsp4]\tGot Real Host @0x%llx\n", real_host);
                 }
                 if (guess == tfp0)
                 {
-                    tfp0_ptr = rk64(ipc_structure_base + 0x18 * (signed int)index);
+                    tfp0_ptr = rk64(entry);
                     printf("[i]\t[remap_tfp0_to_hsp4]\tGot TFP0 @0x%llx\n", tfp0_ptr);
                 }
             }
@@ -48,7 +53,8 @@ int remap_tfp0_to_hsp4(mach_port_t tfp0, uint64_t kernel_base)
         if (tfp0_ptr && real_host)
         {
             printf("[+]\t[remap_tfp0_to_hsp4]\tWoop woop, writing hsp4 to tfp0\n");
-            wk64(rk64(real_host + 0x68)+0x30, (uint64_t)tfp0_ptr);
+            uint64_t host = rk64(real_host + koffset(KSTRUCT_OFFSET_IPC_PORT_IP_KOBJECT));
+            wk64(host + koffset(KSTRUCT_OFFSET_HOST_SPECIAL) + HSP4 * sizeof(uint64_t), (uint64_t)tfp0_ptr);
         } else {
             printf("[-]\t[remap_tfp0_to_hsp4]\tWelp, we fail at finding the refs....\n");
         }
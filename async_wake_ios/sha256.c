@@ -1,158 +1,654 @@
-/*********************************************************************
-* Filename:   sha256.c
-* Author:     Brad Conte (brad AT bradconte.com)
-* Copyright:
-* Disclaimer: This code is presented "as is" without any guarantees.
-* Details:    Implementation of the SHA-256 hashing algorithm.
-              SHA-256 is one of the three algorithms in the SHA2
-              specification. The others, SHA-384 and SHA-512, are not
-              offered in this implementation.
-              Algorithm specification can be found here:
-               * http://csrc.nist.gov/publications/fips/fips180-2/fips180-2withchangenotice.pdf
-              This implementation uses little endian byte order.
-*********************************************************************/
-
-/*************************** HEADER FILES ***************************/
-#include <stdlib.h>
-#include <memory.h>
-#include "sha256.h"
-
-/****************************** MACROS ******************************/
-#define ROTLEFT(a,b) (((a) << (b)) | ((a) >> (32-(b))))
-#define ROTRIGHT(a,b) (((a) >> (b)) | ((a) << (32-(b))))
-
-#define CH(x,y,z) (((x) & (y)) ^ (~(x) & (z)))
-#define MAJ(x,y,z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
-#define EP0(x) (ROTRIGHT(x,2) ^ ROTRIGHT(x,13) ^ ROTRIGHT(x,22))
-#define EP1(x) (ROTRIGHT(x,6) ^ ROTRIGHT(x,11) ^ ROTRIGHT(x,25))
-#define SIG0(x) (ROTRIGHT(x,7) ^ ROTRIGHT(x,18) ^ ((x) >> 3))
-#define SIG1(x) (ROTRIGHT(x,17) ^ ROTRIGHT(x,19) ^ ((x) >> 10))
-
-/**************************** VARIABLES *****************************/
-static const WORD k[64] = {
-	0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
-	0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
-	0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
-	0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
-	0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
-	0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
-	0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
-	0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
-};
-
-/*********************** FUNCTION DEFINITIONS ***********************/
-void sha256_transform(SHA256_CTX *ctx, const BYTE data[])
-{
-	WORD a, b, c, d, e, f, g, h, i, j, t1, t2, m[64];
-
-	for (i = 0, j = 0; i < 16; ++i, j += 4)
-		m[i] = (data[j] << 24) | (data[j + 1] << 16) | (data[j + 2] << 8) | (data[j + 3]);
-	for ( ; i < 64; ++i)
-		m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
-
-	a = ctx->state[0];
-	b = ctx->state[1];
-	c = ctx->state[2];
-	d = ctx->state[3];
-	e = ctx->state[4];
-	f = ctx->state[5];
-	g = ctx->state[6];
-	h = ctx->state[7];
-
-	for (i = 0; i < 64; ++i) {
-		t1 = h + EP1(e) + CH(e,f,g) + k[i] + m[i];
-		t2 = EP0(a) + MAJ(a,b,c);
-		h = g;
-		g = f;
-		f = e;
-		e = d + t1;
-		d = c;
-		c = b;
-		b = a;
-		a = t1 + t2;
-	}
-
-	ctx->state[0] += a;
-	ctx->state[1] += b;
-	ctx->state[2] += c;
-	ctx->state[3] += d;
-	ctx->state[4] += e;
-	ctx->state[5] += f;
-	ctx->state[6] += g;
-	ctx->state[7] += h;
-}
-
-void sha256_init(SHA256_CTX *ctx)
-{
-	ctx->datalen = 0;
-	ctx->bitlen = 0;
-	ctx->state[0] = 0x6a09e667;
-	ctx->state[1] = 0xbb67ae85;
-	ctx->state[2] = 0x3c6ef372;
-	ctx->state[3] = 0xa54ff53a;
-	ctx->state[4] = 0x510e527f;
-	ctx->state[5] = 0x9b05688c;
-	ctx->state[6] = 0x1f83d9ab;
-	ctx->state[7] = 0x5be0cd19;
-}
-
-void sha256_update(SHA256_CTX *ctx, const BYTE data[], size_t len)
-{
-	WORD i;
-
-	for (i = 0; i < len; ++i) {
-		ctx->data[ctx->datalen] = data[i];
-		ctx->datalen++;
-		if (ctx->datalen == 64) {
-			sha256_transform(ctx, ctx->data);
-			ctx->bitlen += 512;
-			ctx->datalen = 0;
-		}
-	}
-}
-
-void sha256_final(SHA256_CTX *ctx, BYTE hash[])
-{
-	WORD i;
-
-	i = ctx->datalen;
-
-	// Pad whatever data is left in the buffer.
-	if (ctx->datalen < 56) {
-		ctx->data[i++] = 0x80;
-		while (i < 56)
-			ctx->data[i++] = 0x00;
-	}
-	else {
-		ctx->data[i++] = 0x80;
-		while (i < 64)
-			ctx->data[i++] = 0x00;
-		sha256_transform(ctx, ctx->data);
-		memset(ctx->data, 0, 56);
-	}
-
-	// Append to the padding the total message's length in bits and transform.
-	ctx->bitlen += ctx->datalen * 8;
-	ctx->data[63] = ctx->bitlen;
-	ctx->data[62] = ctx->bitlen >> 8;
-	ctx->data[61] = ctx->bitlen >> 16;
-	ctx->data[60] = ctx->bitlen >> 24;
-	ctx->data[59] = ctx->bitlen >> 32;
-	ctx->data[58] = ctx->bitlen >> 40;
-	ctx->data[57] = ctx->bitlen >> 48;
-	ctx->data[56] = ctx->bitlen >> 56;
-	sha256_transform(ctx, ctx->data);
-
-	// Since this implementation uses little endian byte ordering and SHA uses big endian,
-	// reverse all the bytes when copying the final state to the output hash.
-	for (i = 0; i < 4; ++i) {
-		hash[i]      = (ctx->state[0] >> (24 - i * 8)) & 0x000000ff;
-		hash[i + 4]  = (ctx->state[1] >> (24 - i * 8)) & 0x000000ff;
-		hash[i + 8]  = (ctx->state[2] >> (24 - i * 8)) & 0x000000ff;
-		hash[i + 12] = (ctx->state[3] >> (24 - i * 8)) & 0x000000ff;
-		hash[i + 16] = (ctx->state[4] >> (24 - i * 8)) & 0x000000ff;
-		hash[i + 20] = (ctx->state[5] >> (24 - i * 8)) & 0x000000ff;
-		hash[i + 24] = (ctx->state[6] >> (24 - i * 8)) & 0x000000ff;
-		hash[i + 28] = (ctx->state[7] >> (24 - i * 8)) & 0x000000ff;
-	}
-}
\ No newline at end of file
+/*********************************************************************
+* Filename:   sha256.c
+* Author:     Brad Conte (brad AT bradconte.com)
+* Copyright:
+* Disclaimer: This code is presented "as is" without any guarantees.
+* Details:    Implementation of the SHA-256 hashing algorithm.
+              SHA-256 is one of the three algorithms in the SHA2
+              specification. The others, SHA-384 and SHA-512, are not
+              offered in this implementation.
+              Algorithm specification can be found here:
+               * http://csrc.nist.gov/publications/fips/fips180-2/fips180-2withchangenotice.pdf
+              This implementation uses little endian byte order.
+*********************************************************************/
+
+/*************************** HEADER FILES ***************************/
+#include <stdlib.h>
+#include <memory.h>
+#include <string.h>
+#include "sha256.h"
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2))
+#define SHA256_HAVE_ARMV8 1
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SHA256_HAVE_SHANI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+/****************************** MACROS ******************************/
+#define ROTLEFT(a,b) (((a) << (b)) | ((a) >> (32-(b))))
+#define ROTRIGHT(a,b) (((a) >> (b)) | ((a) << (32-(b))))
+
+#define CH(x,y,z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x,y,z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define EP0(x) (ROTRIGHT(x,2) ^ ROTRIGHT(x,13) ^ ROTRIGHT(x,22))
+#define EP1(x) (ROTRIGHT(x,6) ^ ROTRIGHT(x,11) ^ ROTRIGHT(x,25))
+#define SIG0(x) (ROTRIGHT(x,7) ^ ROTRIGHT(x,18) ^ ((x) >> 3))
+#define SIG1(x) (ROTRIGHT(x,17) ^ ROTRIGHT(x,19) ^ ((x) >> 10))
+
+#define LOAD_BE32(p) (((WORD)(p)[0] << 24) | ((WORD)(p)[1] << 16) | ((WORD)(p)[2] << 8) | (WORD)(p)[3])
+
+/**************************** DATA TYPES ****************************/
+// compresses blocks*64 bytes of data into state
+typedef void (*sha256_blocks_fn)(WORD state[8], const BYTE data[], size_t blocks);
+
+struct sha256_impl {
+	const char *name;
+	sha256_blocks_fn blocks;
+	int (*supported)(void);
+};
+
+/**************************** VARIABLES *****************************/
+static const WORD k[64] = {
+	0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+	0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+	0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+	0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+	0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+	0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+	0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+	0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
+};
+
+static const WORD sha256_iv[8] = {
+	0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19
+};
+
+/*********************** FUNCTION DEFINITIONS ***********************/
+
+/*
+ * reference: the original implementation, one block at a time with the whole schedule up front
+ */
+static void sha256_blocks_reference(WORD state[8], const BYTE data[], size_t blocks)
+{
+	WORD a, b, c, d, e, f, g, h, i, j, t1, t2, m[64];
+
+	for ( ; blocks > 0; --blocks, data += 64) {
+		for (i = 0, j = 0; i < 16; ++i, j += 4)
+			m[i] = (data[j] << 24) | (data[j + 1] << 16) | (data[j + 2] << 8) | (data[j + 3]);
+		for ( ; i < 64; ++i)
+			m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
+
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+		f = state[5];
+		g = state[6];
+		h = state[7];
+
+		for (i = 0; i < 64; ++i) {
+			t1 = h + EP1(e) + CH(e,f,g) + k[i] + m[i];
+			t2 = EP0(a) + MAJ(a,b,c);
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+/*
+ * scalar: fully unrolled, the working variables rotate by renaming instead of moving and the
+ * schedule is a 16 word ring computed as it's needed
+ */
+#define SCALAR_ROUND(a,b,c,d,e,f,g,h,i,w) do { \
+		WORD t1 = (h) + EP1(e) + CH(e,f,g) + k[i] + (w); \
+		(d) += t1; \
+		(h) = t1 + EP0(a) + MAJ(a,b,c); \
+	} while (0)
+
+#define SCALAR_W(i) (m[(i) & 15] += SIG1(m[((i) - 2) & 15]) + m[((i) - 7) & 15] + SIG0(m[((i) - 15) & 15]))
+
+#define SCALAR_ROUNDS8(i, W) \
+	SCALAR_ROUND(a,b,c,d,e,f,g,h,(i)+0,W((i)+0)); \
+	SCALAR_ROUND(h,a,b,c,d,e,f,g,(i)+1,W((i)+1)); \
+	SCALAR_ROUND(g,h,a,b,c,d,e,f,(i)+2,W((i)+2)); \
+	SCALAR_ROUND(f,g,h,a,b,c,d,e,(i)+3,W((i)+3)); \
+	SCALAR_ROUND(e,f,g,h,a,b,c,d,(i)+4,W((i)+4)); \
+	SCALAR_ROUND(d,e,f,g,h,a,b,c,(i)+5,W((i)+5)); \
+	SCALAR_ROUND(c,d,e,f,g,h,a,b,(i)+6,W((i)+6)); \
+	SCALAR_ROUND(b,c,d,e,f,g,h,a,(i)+7,W((i)+7))
+
+#define SCALAR_M(i) (m[i])
+
+static void sha256_blocks_scalar(WORD state[8], const BYTE data[], size_t blocks)
+{
+	WORD a, b, c, d, e, f, g, h, i, m[16];
+
+	for ( ; blocks > 0; --blocks, data += 64) {
+		for (i = 0; i < 16; ++i)
+			m[i] = LOAD_BE32(data + i * 4);
+
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+		f = state[5];
+		g = state[6];
+		h = state[7];
+
+		SCALAR_ROUNDS8(0, SCALAR_M);
+		SCALAR_ROUNDS8(8, SCALAR_M);
+		SCALAR_ROUNDS8(16, SCALAR_W);
+		SCALAR_ROUNDS8(24, SCALAR_W);
+		SCALAR_ROUNDS8(32, SCALAR_W);
+		SCALAR_ROUNDS8(40, SCALAR_W);
+		SCALAR_ROUNDS8(48, SCALAR_W);
+		SCALAR_ROUNDS8(56, SCALAR_W);
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+static int sha256_always_supported(void)
+{
+	return 1;
+}
+
+/*
+ * armv8: SHA256H/SHA256H2 do four rounds each, SHA256SU0/SU1 extend the schedule four words at a time
+ */
+#ifdef SHA256_HAVE_ARMV8
+#define ARMV8_ROUNDS(m, i) do { \
+		uint32x4_t wk = vaddq_u32(m, vld1q_u32(&k[(i) * 4])); \
+		uint32x4_t abcd = state0; \
+		state0 = vsha256hq_u32(state0, state1, wk); \
+		state1 = vsha256h2q_u32(state1, abcd, wk); \
+	} while (0)
+
+#define ARMV8_SCHEDULE(m0, m1, m2, m3) (m0 = vsha256su1q_u32(vsha256su0q_u32(m0, m1), m2, m3))
+
+static void sha256_blocks_armv8(WORD state[8], const BYTE data[], size_t blocks)
+{
+	uint32x4_t state0 = vld1q_u32(&state[0]);
+	uint32x4_t state1 = vld1q_u32(&state[4]);
+
+	for ( ; blocks > 0; --blocks, data += 64) {
+		uint32x4_t save0 = state0, save1 = state1;
+		uint32x4_t m0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 0)));
+		uint32x4_t m1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+		uint32x4_t m2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+		uint32x4_t m3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+
+		ARMV8_ROUNDS(m0, 0);
+		ARMV8_ROUNDS(m1, 1);
+		ARMV8_ROUNDS(m2, 2);
+		ARMV8_ROUNDS(m3, 3);
+		for (int i = 4; i < 16; i += 4) {
+			ARMV8_SCHEDULE(m0, m1, m2, m3);
+			ARMV8_ROUNDS(m0, i + 0);
+			ARMV8_SCHEDULE(m1, m2, m3, m0);
+			ARMV8_ROUNDS(m1, i + 1);
+			ARMV8_SCHEDULE(m2, m3, m0, m1);
+			ARMV8_ROUNDS(m2, i + 2);
+			ARMV8_SCHEDULE(m3, m0, m1, m2);
+			ARMV8_ROUNDS(m3, i + 3);
+		}
+
+		state0 = vaddq_u32(state0, save0);
+		state1 = vaddq_u32(state1, save1);
+	}
+
+	vst1q_u32(&state[0], state0);
+	vst1q_u32(&state[4], state1);
+}
+
+static int sha256_armv8_supported(void)
+{
+#if defined(__linux__)
+	return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#else
+	// every arm64 Apple CPU has the crypto extensions
+	return 1;
+#endif
+}
+#endif
+
+/*
+ * sha-ni: SHA256RNDS2 does two rounds on the state split as ABEF/CDGH, SHA256MSG1/MSG2 extend the
+ * schedule four words at a time
+ */
+#ifdef SHA256_HAVE_SHANI
+#define SHANI_TARGET __attribute__((target("sha,sse4.1")))
+
+#define SHANI_ROUNDS(m, i) do { \
+		__m128i wk = _mm_add_epi32(m, _mm_loadu_si128((const __m128i *)&k[(i) * 4])); \
+		state1 = _mm_sha256rnds2_epu32(state1, state0, wk); \
+		state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(wk, 0x0e)); \
+	} while (0)
+
+#define SHANI_SCHEDULE(m0, m1, m2, m3) \
+	(m0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1), _mm_alignr_epi8(m3, m2, 4)), m3))
+
+SHANI_TARGET static void sha256_blocks_shani(WORD state[8], const BYTE data[], size_t blocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i tmp, state0, state1;
+
+	// DCBA/HGFE -> ABEF/CDGH
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xb1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1b);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+	for ( ; blocks > 0; --blocks, data += 64) {
+		__m128i save0 = state0, save1 = state1;
+		__m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 0)), bswap);
+		__m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), bswap);
+		__m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), bswap);
+		__m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), bswap);
+
+		SHANI_ROUNDS(m0, 0);
+		SHANI_ROUNDS(m1, 1);
+		SHANI_ROUNDS(m2, 2);
+		SHANI_ROUNDS(m3, 3);
+		for (int i = 4; i < 16; i += 4) {
+			SHANI_SCHEDULE(m0, m1, m2, m3);
+			SHANI_ROUNDS(m0, i + 0);
+			SHANI_SCHEDULE(m1, m2, m3, m0);
+			SHANI_ROUNDS(m1, i + 1);
+			SHANI_SCHEDULE(m2, m3, m0, m1);
+			SHANI_ROUNDS(m2, i + 2);
+			SHANI_SCHEDULE(m3, m0, m1, m2);
+			SHANI_ROUNDS(m3, i + 3);
+		}
+
+		state0 = _mm_add_epi32(state0, save0);
+		state1 = _mm_add_epi32(state1, save1);
+	}
+
+	// ABEF/CDGH -> DCBA/HGFE
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+	_mm_storeu_si128((__m128i *)&state[0], state0);
+	_mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+static int sha256_shani_supported(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1) || !(ecx & bit_SSSE3))
+		return 0;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return 0;
+	return (ebx & (1 << 29)) != 0;   // SHA
+}
+#endif
+
+/*
+ * dispatch
+ */
+static const struct sha256_impl impls[] = {
+#ifdef SHA256_HAVE_ARMV8
+	{ "armv8", sha256_blocks_armv8, sha256_armv8_supported },
+#endif
+#ifdef SHA256_HAVE_SHANI
+	{ "sha-ni", sha256_blocks_shani, sha256_shani_supported },
+#endif
+	{ "scalar", sha256_blocks_scalar, sha256_always_supported },
+	{ "reference", sha256_blocks_reference, sha256_always_supported },
+};
+
+#define N_IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+// picked once, racing threads all pick the same one so there's no need for a lock
+static const struct sha256_impl *impl;
+
+static const struct sha256_impl *sha256_impl(void)
+{
+	if (impl == NULL) {
+		size_t i;
+		for (i = 0; i < N_IMPLS - 1; ++i) {
+			if (impls[i].supported())
+				break;
+		}
+		impl = &impls[i];
+	}
+	return impl;
+}
+
+const char *sha256_backend(void)
+{
+	return sha256_impl()->name;
+}
+
+const char *sha256_backend_name(int i)
+{
+	if (i < 0 || (size_t)i >= N_IMPLS)
+		return NULL;
+	return impls[i].name;
+}
+
+int sha256_set_backend(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < N_IMPLS; ++i) {
+		if (strcmp(impls[i].name, name) == 0 && impls[i].supported()) {
+			impl = &impls[i];
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void sha256_transform(SHA256_CTX *ctx, const BYTE data[])
+{
+	sha256_impl()->blocks(ctx->state, data, 1);
+}
+
+void sha256_init(SHA256_CTX *ctx)
+{
+	ctx->datalen = 0;
+	ctx->bitlen = 0;
+	memcpy(ctx->state, sha256_iv, sizeof(ctx->state));
+}
+
+void sha256_update(SHA256_CTX *ctx, const BYTE data[], size_t len)
+{
+	sha256_blocks_fn blocks = sha256_impl()->blocks;
+	size_t n;
+
+	// top up a partial block first
+	if (ctx->datalen > 0) {
+		n = 64 - ctx->datalen;
+		if (n > len)
+			n = len;
+		memcpy(ctx->data + ctx->datalen, data, n);
+		ctx->datalen += n;
+		data += n;
+		len -= n;
+		if (ctx->datalen < 64)
+			return;
+		blocks(ctx->state, ctx->data, 1);
+		ctx->bitlen += 512;
+		ctx->datalen = 0;
+	}
+
+	// then hash whole blocks straight out of the caller's buffer
+	n = len / 64;
+	if (n > 0) {
+		blocks(ctx->state, data, n);
+		ctx->bitlen += (unsigned long long)n * 512;
+		data += n * 64;
+		len -= n * 64;
+	}
+
+	if (len > 0) {
+		memcpy(ctx->data, data, len);
+		ctx->datalen = len;
+	}
+}
+
+void sha256_final(SHA256_CTX *ctx, BYTE hash[])
+{
+	WORD i;
+
+	i = ctx->datalen;
+
+	// Pad whatever data is left in the buffer.
+	if (ctx->datalen < 56) {
+		ctx->data[i++] = 0x80;
+		while (i < 56)
+			ctx->data[i++] = 0x00;
+	}
+	else {
+		ctx->data[i++] = 0x80;
+		while (i < 64)
+			ctx->data[i++] = 0x00;
+		sha256_transform(ctx, ctx->data);
+		memset(ctx->data, 0, 56);
+	}
+
+	// Append to the padding the total message's length in bits and transform.
+	ctx->bitlen += ctx->datalen * 8;
+	ctx->data[63] = ctx->bitlen;
+	ctx->data[62] = ctx->bitlen >> 8;
+	ctx->data[61] = ctx->bitlen >> 16;
+	ctx->data[60] = ctx->bitlen >> 24;
+	ctx->data[59] = ctx->bitlen >> 32;
+	ctx->data[58] = ctx->bitlen >> 40;
+	ctx->data[57] = ctx->bitlen >> 48;
+	ctx->data[56] = ctx->bitlen >> 56;
+	sha256_transform(ctx, ctx->data);
+
+	// Since this implementation uses little endian byte ordering and SHA uses big endian,
+	// reverse all the bytes when copying the final state to the output hash.
+	for (i = 0; i < 4; ++i) {
+		hash[i]      = (ctx->state[0] >> (24 - i * 8)) & 0x000000ff;
+		hash[i + 4]  = (ctx->state[1] >> (24 - i * 8)) & 0x000000ff;
+		hash[i + 8]  = (ctx->state[2] >> (24 - i * 8)) & 0x000000ff;
+		hash[i + 12] = (ctx->state[3] >> (24 - i * 8)) & 0x000000ff;
+		hash[i + 16] = (ctx->state[4] >> (24 - i * 8)) & 0x000000ff;
+		hash[i + 20] = (ctx->state[5] >> (24 - i * 8)) & 0x000000ff;
+		hash[i + 24] = (ctx->state[6] >> (24 - i * 8)) & 0x000000ff;
+		hash[i + 28] = (ctx->state[7] >> (24 - i * 8)) & 0x000000ff;
+	}
+}
+
+/*
+ * multi-buffer: independent messages hashed side by side, one per SIMD lane. Each lane walks the
+ * whole blocks of its message in place and then one or two padded blocks built in tail, when it's
+ * done it moves on to the next message that hasn't been started.
+ */
+#define SHA256_LANE_IDLE ((size_t)-1)
+
+struct sha256_lane {
+	size_t msg;               // index into msgs, SHA256_LANE_IDLE once there's nothing left
+	const BYTE *data;
+	size_t full;              // whole blocks in data
+	size_t blocks;            // full plus the padding blocks
+	size_t block;             // next one to hash
+	BYTE tail[128];
+};
+
+static int sha256_lane_start(struct sha256_lane *lane, const struct sha256_message msgs[], size_t n, size_t *next)
+{
+	unsigned long long bitlen;
+	size_t rem, tail_len;
+	int i;
+
+	if (*next >= n) {
+		lane->msg = SHA256_LANE_IDLE;
+		return 0;
+	}
+	lane->msg = (*next)++;
+	lane->data = msgs[lane->msg].data;
+	lane->full = msgs[lane->msg].len / 64;
+	lane->block = 0;
+
+	rem = msgs[lane->msg].len % 64;
+	tail_len = rem + 9 > 64 ? 128 : 64;
+	memset(lane->tail, 0, tail_len);
+	if (rem > 0)
+		memcpy(lane->tail, lane->data + lane->full * 64, rem);
+	lane->tail[rem] = 0x80;
+	bitlen = (unsigned long long)msgs[lane->msg].len * 8;
+	for (i = 0; i < 8; ++i)
+		lane->tail[tail_len - 1 - i] = bitlen >> (i * 8);
+	lane->blocks = lane->full + tail_len / 64;
+	return 1;
+}
+
+static const BYTE *sha256_lane_block(struct sha256_lane *lane)
+{
+	if (lane->block < lane->full)
+		return lane->data + lane->block * 64;
+	return lane->tail + (lane->block - lane->full) * 64;
+}
+
+static void sha256_store_be32(BYTE *p, WORD v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA256_HAVE_AVX2 1
+#define SHA256_LANES 8
+#define SHA256_LANES_FN sha256_lanes_avx2
+#define SHA256_LANES_TARGET __attribute__((target("avx2")))
+#include "sha256_lanes.h"
+#undef SHA256_LANES
+#undef SHA256_LANES_FN
+#undef SHA256_LANES_TARGET
+
+static int sha256_avx2_supported(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#define SHA256_HAVE_SSE2 1
+#define SHA256_LANES 4
+#define SHA256_LANES_FN sha256_lanes_sse2
+#define SHA256_LANES_TARGET __attribute__((target("sse2")))
+#include "sha256_lanes.h"
+#undef SHA256_LANES
+#undef SHA256_LANES_FN
+#undef SHA256_LANES_TARGET
+#endif
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#define SHA256_HAVE_NEON 1
+#define SHA256_LANES 4
+#define SHA256_LANES_FN sha256_lanes_neon
+#define SHA256_LANES_TARGET
+#include "sha256_lanes.h"
+#undef SHA256_LANES
+#undef SHA256_LANES_FN
+#undef SHA256_LANES_TARGET
+#endif
+#endif
+
+// one message after another through the single stream back end
+static void sha256_multi_serial(const struct sha256_message msgs[], size_t n, BYTE hashes[][SHA256_BLOCK_SIZE])
+{
+	SHA256_CTX ctx;
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		sha256_init(&ctx);
+		sha256_update(&ctx, msgs[i].data, msgs[i].len);
+		sha256_final(&ctx, hashes[i]);
+	}
+}
+
+struct sha256_multi_impl {
+	const char *name;
+	void (*hash)(const struct sha256_message msgs[], size_t n, BYTE hashes[][SHA256_BLOCK_SIZE]);
+	int (*supported)(void);
+};
+
+static const struct sha256_multi_impl multi_impls[] = {
+#ifdef SHA256_HAVE_AVX2
+	{ "avx2", sha256_lanes_avx2, sha256_avx2_supported },
+#endif
+#ifdef SHA256_HAVE_SSE2
+	{ "sse2", sha256_lanes_sse2, sha256_always_supported },
+#endif
+#ifdef SHA256_HAVE_NEON
+	{ "neon", sha256_lanes_neon, sha256_always_supported },
+#endif
+	{ "serial", sha256_multi_serial, sha256_always_supported },
+};
+
+#define N_MULTI_IMPLS (sizeof(multi_impls) / sizeof(multi_impls[0]))
+
+static const struct sha256_multi_impl *multi_impl;
+
+static const struct sha256_multi_impl *sha256_multi_impl(void)
+{
+	if (multi_impl == NULL) {
+		size_t i;
+		// the SHA instructions do a single stream faster than the generic SIMD code does several
+		if (strcmp(sha256_backend(), "sha-ni") == 0 || strcmp(sha256_backend(), "armv8") == 0) {
+			multi_impl = &multi_impls[N_MULTI_IMPLS - 1];
+		} else {
+			for (i = 0; i < N_MULTI_IMPLS - 1; ++i) {
+				if (multi_impls[i].supported())
+					break;
+			}
+			multi_impl = &multi_impls[i];
+		}
+	}
+	return multi_impl;
+}
+
+void sha256_multi(const struct sha256_message msgs[], size_t n, BYTE hashes[][SHA256_BLOCK_SIZE])
+{
+	sha256_multi_impl()->hash(msgs, n, hashes);
+}
+
+const char *sha256_multi_backend(void)
+{
+	return sha256_multi_impl()->name;
+}
+
+const char *sha256_multi_backend_name(int i)
+{
+	if (i < 0 || (size_t)i >= N_MULTI_IMPLS)
+		return NULL;
+	return multi_impls[i].name;
+}
+
+int sha256_set_multi_backend(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < N_MULTI_IMPLS; ++i) {
+		if (strcmp(multi_impls[i].name, name) == 0 && multi_impls[i].supported()) {
+			multi_impl = &multi_impls[i];
+			return 0;
+		}
+	}
+	return 1;
+}
@@ -1,34 +1,55 @@
-/*********************************************************************
-* Filename:   sha256.h
-* Author:     Brad Conte (brad AT bradconte.com)
-* Copyright:
-* Disclaimer: This code is presented "as is" without any guarantees.
-* Details:    Defines the API for the corresponding SHA1 implementation.
-*********************************************************************/
-
-#ifndef SHA256_H
-#define SHA256_H
-
-/*************************** HEADER FILES ***************************/
-#include <stddef.h>
-
-/****************************** MACROS ******************************/
-#define SHA256_BLOCK_SIZE 32            // SHA256 outputs a 32 byte digest
-
-/**************************** DATA TYPES ****************************/
-typedef unsigned char BYTE;             // 8-bit byte
-typedef unsigned int  WORD;             // 32-bit word, change to "long" for 16-bit machines
-
-typedef struct {
-	BYTE data[64];
-	WORD datalen;
-	unsigned long long bitlen;
-	WORD state[8];
-} SHA256_CTX;
-
-/*********************** FUNCTION DECLARATIONS **********************/
-void sha256_init(SHA256_CTX *ctx);
-void sha256_update(SHA256_CTX *ctx, const BYTE data[], size_t len);
-void sha256_final(SHA256_CTX *ctx, BYTE hash[]);
-
+/*********************************************************************
+* Filename:   sha256.h
+* Author:     Brad Conte (brad AT bradconte.com)
+* Copyright:
+* Disclaimer: This code is presented "as is" without any guarantees.
+* Details:    Defines the API for the corresponding SHA1 implementation.
+*********************************************************************/
+
+#ifndef SHA256_H
+#define SHA256_H
+
+/*************************** HEADER FILES ***************************/
+#include <stddef.h>
+
+/****************************** MACROS ******************************/
+#define SHA256_BLOCK_SIZE 32            // SHA256 outputs a 32 byte digest
+
+/**************************** DATA TYPES ****************************/
+typedef unsigned char BYTE;             // 8-bit byte
+typedef unsigned int  WORD;             // 32-bit word, change to "long" for 16-bit machines
+
+typedef struct {
+	BYTE data[64];
+	WORD datalen;
+	unsigned long long bitlen;
+	WORD state[8];
+} SHA256_CTX;
+
+// one of the independent messages given to sha256_multi
+struct sha256_message {
+	const BYTE *data;
+	size_t len;
+};
+
+/*********************** FUNCTION DECLARATIONS **********************/
+void sha256_init(SHA256_CTX *ctx);
+void sha256_update(SHA256_CTX *ctx, const BYTE data[], size_t len);
+void sha256_final(SHA256_CTX *ctx, BYTE hash[]);
+
+// The compression function has several back ends: "armv8" (crypto extensions), "sha-ni" (x86 SHA
+// extensions), "scalar" (unrolled C) and "reference" (the original loop). The first one this CPU
+// supports is picked on first use, the others are there for benchmarking and cross checking.
+const char *sha256_backend(void);
+const char *sha256_backend_name(int i);          // NULL once i is past the last back end
+int sha256_set_backend(const char *name);        // 0 on success, 1 if unknown or unsupported here
+
+// Hashes n independent messages (code pages, say) into hashes[0..n-1]. "avx2", "sse2" and "neon"
+// run one message per SIMD lane, "serial" loops over the single stream back end. Where the CPU has
+// SHA instructions serial is the default because it's faster.
+void sha256_multi(const struct sha256_message msgs[], size_t n, BYTE hashes[][SHA256_BLOCK_SIZE]);
+const char *sha256_multi_backend(void);
+const char *sha256_multi_backend_name(int i);
+int sha256_set_multi_backend(const char *name);
+
 #endif   // SHA256_H
\ No newline at end of file
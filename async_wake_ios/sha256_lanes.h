@@ -0,0 +1,97 @@
+/*********************************************************************
+* Filename:   sha256_lanes.h
+* Details:    Multi-buffer SHA-256 template, hashes one message per SIMD
+              lane in lockstep. Included by sha256.c once per lane width
+              with these defined:
+               * SHA256_LANES         number of 32-bit lanes in a vector
+               * SHA256_LANES_FN      name of the function to generate
+               * SHA256_LANES_TARGET  function attribute enabling the ISA
+              Uses the compiler's generic vector extensions so the same
+              code becomes AVX2, SSE2 or NEON.
+*********************************************************************/
+
+#define LANES_CAT2(a, b) a##b
+#define LANES_CAT(a, b) LANES_CAT2(a, b)
+#define LANES_V LANES_CAT(SHA256_LANES_FN, _vec)
+
+typedef WORD LANES_V __attribute__((vector_size(SHA256_LANES * sizeof(WORD))));
+
+SHA256_LANES_TARGET static void SHA256_LANES_FN(const struct sha256_message msgs[], size_t n, BYTE hashes[][SHA256_BLOCK_SIZE])
+{
+	static const BYTE idle_block[64];
+	struct sha256_lane lane[SHA256_LANES];
+	WORD words[16][SHA256_LANES];
+	LANES_V s[8], w[16], a, b, c, d, e, f, g, h, t1, t2;
+	size_t next = 0;
+	int active = 0;
+	int i, j, r;
+
+	for (i = 0; i < SHA256_LANES; ++i) {
+		if (sha256_lane_start(&lane[i], msgs, n, &next)) {
+			for (j = 0; j < 8; ++j)
+				s[j][i] = sha256_iv[j];
+			++active;
+		}
+	}
+
+	while (active > 0) {
+		// transpose one block from each lane into word-major order, byte swapping on the way
+		for (i = 0; i < SHA256_LANES; ++i) {
+			const BYTE *block = lane[i].msg == SHA256_LANE_IDLE ? idle_block : sha256_lane_block(&lane[i]);
+			for (j = 0; j < 16; ++j)
+				words[j][i] = LOAD_BE32(block + j * 4);
+		}
+		memcpy(w, words, sizeof(w));
+
+		a = s[0];
+		b = s[1];
+		c = s[2];
+		d = s[3];
+		e = s[4];
+		f = s[5];
+		g = s[6];
+		h = s[7];
+
+		for (r = 0; r < 64; ++r) {
+			if (r >= 16)
+				w[r & 15] += SIG1(w[(r - 2) & 15]) + w[(r - 7) & 15] + SIG0(w[(r - 15) & 15]);
+			t1 = h + EP1(e) + CH(e,f,g) + k[r] + w[r & 15];
+			t2 = EP0(a) + MAJ(a,b,c);
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		s[0] += a;
+		s[1] += b;
+		s[2] += c;
+		s[3] += d;
+		s[4] += e;
+		s[5] += f;
+		s[6] += g;
+		s[7] += h;
+
+		// finished lanes hand their digest back and pick up the next message
+		for (i = 0; i < SHA256_LANES; ++i) {
+			if (lane[i].msg == SHA256_LANE_IDLE || ++lane[i].block < lane[i].blocks)
+				continue;
+			for (j = 0; j < 8; ++j)
+				sha256_store_be32(hashes[lane[i].msg] + j * 4, s[j][i]);
+			if (sha256_lane_start(&lane[i], msgs, n, &next)) {
+				for (j = 0; j < 8; ++j)
+					s[j][i] = sha256_iv[j];
+			} else {
+				--active;
+			}
+		}
+	}
+}
+
+#undef LANES_V
+#undef LANES_CAT
+#undef LANES_CAT2
@@ -0,0 +1,176 @@
+/*********************************************************************
+* Filename:   sha512.c
+* Copyright:
+* Disclaimer: This code is presented "as is" without any guarantees.
+* Details:    Implementation of SHA-384, the SHA-512 compression
+              function with its own initial values and a 48 byte
+              digest. It's only here for CodeDirectories whose hash
+              type is SHA-384, so there's no SHA-512 entry point and
+              none of sha256.c's hardware back ends.
+              Algorithm specification can be found here:
+               * http://csrc.nist.gov/publications/fips/fips180-2/fips180-2withchangenotice.pdf
+*********************************************************************/
+
+/*************************** HEADER FILES ***************************/
+#include <stdlib.h>
+#include <string.h>
+#include "sha512.h"
+
+/****************************** MACROS ******************************/
+#define ROTRIGHT(a,b) (((a) >> (b)) | ((a) << (64-(b))))
+
+#define CH(x,y,z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x,y,z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define EP0(x) (ROTRIGHT(x,28) ^ ROTRIGHT(x,34) ^ ROTRIGHT(x,39))
+#define EP1(x) (ROTRIGHT(x,14) ^ ROTRIGHT(x,18) ^ ROTRIGHT(x,41))
+#define SIG0(x) (ROTRIGHT(x,1) ^ ROTRIGHT(x,8) ^ ((x) >> 7))
+#define SIG1(x) (ROTRIGHT(x,19) ^ ROTRIGHT(x,61) ^ ((x) >> 6))
+
+/**************************** VARIABLES *****************************/
+static const unsigned long long k[80] = {
+	0x428a2f98d728ae22ULL,0x7137449123ef65cdULL,0xb5c0fbcfec4d3b2fULL,0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL,0x59f111f1b605d019ULL,0x923f82a4af194f9bULL,0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL,0x12835b0145706fbeULL,0x243185be4ee4b28cULL,0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL,0x80deb1fe3b1696b1ULL,0x9bdc06a725c71235ULL,0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL,0xefbe4786384f25e3ULL,0x0fc19dc68b8cd5b5ULL,0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL,0x4a7484aa6ea6e483ULL,0x5cb0a9dcbd41fbd4ULL,0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL,0xa831c66d2db43210ULL,0xb00327c898fb213fULL,0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL,0xd5a79147930aa725ULL,0x06ca6351e003826fULL,0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL,0x2e1b21385c26c926ULL,0x4d2c6dfc5ac42aedULL,0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL,0x766a0abb3c77b2a8ULL,0x81c2c92e47edaee6ULL,0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL,0xa81a664bbc423001ULL,0xc24b8b70d0f89791ULL,0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL,0xd69906245565a910ULL,0xf40e35855771202aULL,0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL,0x1e376c085141ab53ULL,0x2748774cdf8eeb99ULL,0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL,0x4ed8aa4ae3418acbULL,0x5b9cca4f7763e373ULL,0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL,0x78a5636f43172f60ULL,0x84c87814a1f0ab72ULL,0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL,0xa4506cebde82bde9ULL,0xbef9a3f7b2c67915ULL,0xc67178f2e372532bULL,
+	0xca273eceea26619cULL,0xd186b8c721c0c207ULL,0xeada7dd6cde0eb1eULL,0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL,0x0a637dc5a2c898a6ULL,0x113f9804bef90daeULL,0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL,0x32caab7b40c72493ULL,0x3c9ebe0a15c9bebcULL,0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL,0x597f299cfc657e2aULL,0x5fcb6fab3ad6faecULL,0x6c44198c4a475817ULL
+};
+
+static const unsigned long long sha384_iv[8] = {
+	0xcbbb9d5dc1059ed8ULL,0x629a292a367cd507ULL,0x9159015a3070dd17ULL,0x152fecd8f70e5939ULL,
+	0x67332667ffc00b31ULL,0x8eb44a8768581511ULL,0xdb0c2e0d64f98fa7ULL,0x47b5481dbefa4fa4ULL
+};
+
+/*********************** FUNCTION DEFINITIONS ***********************/
+static void sha512_transform(SHA512_CTX *ctx, const BYTE data[])
+{
+	unsigned long long a, b, c, d, e, f, g, h, i, t1, t2, m[80];
+
+	for (i = 0; i < 16; ++i) {
+		const BYTE *p = data + i * 8;
+		m[i] = ((unsigned long long)p[0] << 56) | ((unsigned long long)p[1] << 48) |
+		       ((unsigned long long)p[2] << 40) | ((unsigned long long)p[3] << 32) |
+		       ((unsigned long long)p[4] << 24) | ((unsigned long long)p[5] << 16) |
+		       ((unsigned long long)p[6] << 8) | p[7];
+	}
+	for ( ; i < 80; ++i)
+		m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
+
+	a = ctx->state[0];
+	b = ctx->state[1];
+	c = ctx->state[2];
+	d = ctx->state[3];
+	e = ctx->state[4];
+	f = ctx->state[5];
+	g = ctx->state[6];
+	h = ctx->state[7];
+
+	for (i = 0; i < 80; ++i) {
+		t1 = h + EP1(e) + CH(e,f,g) + k[i] + m[i];
+		t2 = EP0(a) + MAJ(a,b,c);
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	ctx->state[0] += a;
+	ctx->state[1] += b;
+	ctx->state[2] += c;
+	ctx->state[3] += d;
+	ctx->state[4] += e;
+	ctx->state[5] += f;
+	ctx->state[6] += g;
+	ctx->state[7] += h;
+}
+
+void sha384_init(SHA512_CTX *ctx)
+{
+	ctx->datalen = 0;
+	ctx->bitlen = 0;
+	memcpy(ctx->state, sha384_iv, sizeof(ctx->state));
+}
+
+void sha384_update(SHA512_CTX *ctx, const BYTE data[], size_t len)
+{
+	size_t n;
+
+	// top up a partial block first
+	if (ctx->datalen > 0) {
+		n = 128 - ctx->datalen;
+		if (n > len)
+			n = len;
+		memcpy(ctx->data + ctx->datalen, data, n);
+		ctx->datalen += n;
+		data += n;
+		len -= n;
+		if (ctx->datalen < 128)
+			return;
+		sha512_transform(ctx, ctx->data);
+		ctx->bitlen += 1024;
+		ctx->datalen = 0;
+	}
+
+	// then hash whole blocks straight out of the caller's buffer
+	while (len >= 128) {
+		sha512_transform(ctx, data);
+		ctx->bitlen += 1024;
+		data += 128;
+		len -= 128;
+	}
+
+	if (len > 0) {
+		memcpy(ctx->data, data, len);
+		ctx->datalen = len;
+	}
+}
+
+void sha384_final(SHA512_CTX *ctx, BYTE hash[])
+{
+	unsigned int i;
+
+	i = ctx->datalen;
+
+	// Pad whatever data is left in the buffer, the length takes the last 16 bytes.
+	if (ctx->datalen < 112) {
+		ctx->data[i++] = 0x80;
+		while (i < 112)
+			ctx->data[i++] = 0x00;
+	}
+	else {
+		ctx->data[i++] = 0x80;
+		while (i < 128)
+			ctx->data[i++] = 0x00;
+		sha512_transform(ctx, ctx->data);
+		memset(ctx->data, 0, 112);
+	}
+
+	// The top 64 bits of the 128 bit length are always zero here.
+	ctx->bitlen += ctx->datalen * 8;
+	memset(ctx->data + 112, 0, 8);
+	for (i = 0; i < 8; ++i)
+		ctx->data[127 - i] = ctx->bitlen >> (i * 8);
+	sha512_transform(ctx, ctx->data);
+
+	// Big endian out, and only the first six words for SHA-384.
+	for (i = 0; i < SHA384_BLOCK_SIZE; ++i)
+		hash[i] = ctx->state[i / 8] >> (56 - (i % 8) * 8);
+}
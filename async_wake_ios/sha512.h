@@ -0,0 +1,34 @@
+/*********************************************************************
+* Filename:   sha512.h
+* Copyright:
+* Disclaimer: This code is presented "as is" without any guarantees.
+* Details:    Defines the API for the corresponding SHA-384 implementation,
+              laid out like sha256.h.
+*********************************************************************/
+
+#ifndef SHA512_H
+#define SHA512_H
+
+/*************************** HEADER FILES ***************************/
+#include <stddef.h>
+
+/****************************** MACROS ******************************/
+#define SHA384_BLOCK_SIZE 48            // SHA384 outputs a 48 byte digest
+
+/**************************** DATA TYPES ****************************/
+typedef unsigned char BYTE;             // 8-bit byte
+
+typedef struct {
+	BYTE data[128];
+	unsigned int datalen;
+	unsigned long long bitlen;      // messages past 2^64 bits aren't something a CodeDirectory covers
+	unsigned long long state[8];
+} SHA512_CTX;
+
+/*********************** FUNCTION DECLARATIONS **********************/
+// SHA-384 is SHA-512 started from different initial values with the digest cut to six words
+void sha384_init(SHA512_CTX *ctx);
+void sha384_update(SHA512_CTX *ctx, const BYTE data[], size_t len);
+void sha384_final(SHA512_CTX *ctx, BYTE hash[]);
+
+#endif   // SHA512_H
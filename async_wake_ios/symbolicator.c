@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "symbolicator.h"
+#include "symbols.h"
+
+struct symbolicator kernel_symbols = {0};
+
+static int add_string(struct symbolicator* sym, const char* str, uint32_t* offset) {
+  uint32_t len = (uint32_t)strlen(str);
+  if (sym->strings_size + len + 1 > sym->strings_capacity) {
+    uint32_t capacity = sym->strings_capacity ? sym->strings_capacity : 0x10000;
+    while (sym->strings_size + len + 1 > capacity) {
+      capacity *= 2;
+    }
+    char* strings = realloc(sym->strings, capacity);
+    if (strings == NULL) {
+      return 1;
+    }
+    sym->strings = strings;
+    sym->strings_capacity = capacity;
+  }
+  *offset = sym->strings_size;
+  memcpy(sym->strings + sym->strings_size, str, len + 1);
+  sym->strings_size += len + 1;
+  return 0;
+}
+
+int symbolicator_add(struct symbolicator* sym, uint64_t addr, const char* name, enum symbol_source source) {
+  if (addr == 0 || name == NULL) {
+    return 1;
+  }
+  if (sym->count == sym->capacity) {
+    uint32_t capacity = sym->capacity ? sym->capacity * 2 : 0x1000;
+    struct symbol_entry* entries = realloc(sym->entries, capacity * sizeof(struct symbol_entry));
+    if (entries == NULL) {
+      return 1;
+    }
+    sym->entries = entries;
+    sym->capacity = capacity;
+  }
+  struct symbol_entry* e = &sym->entries[sym->count];
+  if (add_string(sym, name, &e->name)) {
+    return 1;
+  }
+  e->addr = addr;
+  e->source = source;
+  sym->count++;
+  return 0;
+}
+
+int symbolicator_add_ksymbols(struct symbolicator* sym) {
+  if (!probably_have_correct_symbols()) {
+    return 0;
+  }
+  int count = 0;
+  for (int i = 0; i < KSYMBOL_MAX; i++) {
+    if (!symbolicator_add(sym, ksym(i), ksymbol_name(i), SYMBOL_SOURCE_KSYMBOLS)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+static int add_symtab_callback(const char* name, uint64_t addr, void* ctx) {
+  struct symbolicator* sym = ctx;
+  // a failure here is out of memory, no point carrying on
+  return symbolicator_add(sym, addr, name, SYMBOL_SOURCE_SYMTAB);
+}
+
+int symbolicator_add_symtab(struct symbolicator* sym, struct kernel_image* img) {
+  return kimg_for_each_symbol(img, kimg_header(img), add_symtab_callback, sym);
+}
+
+int symbolicator_add_kexts(struct symbolicator* sym, struct kext_map* kexts) {
+  char name[0x100];
+  for (uint32_t i = 0; i < kexts->count; i++) {
+    struct kext_segment* seg = &kexts->segments[i];
+    snprintf(name, sizeof(name), "%s:%.16s", kext_map_bundle_id(kexts, seg), seg->segname);
+    symbolicator_add(sym, seg->start, name, SYMBOL_SOURCE_SEGMENT);
+    symbolicator_add(sym, seg->end, "", SYMBOL_SOURCE_END);
+  }
+  return kexts->count;
+}
+
+// nosys and friends sit behind a lot of entries, naming them after any one of those would mislead
+static int shared_handler(struct syscall_entry* entries, uint32_t count, uint64_t handler) {
+  int seen = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    seen += entries[i].handler == handler;
+  }
+  return seen > 1;
+}
+
+static int add_handlers(struct symbolicator* sym, struct syscall_entry* entries, uint32_t count, const char* prefix) {
+  char name[0x20];
+  int added = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    uint64_t handler = entries[i].handler;
+    if (handler == 0 || shared_handler(entries, count, handler)) {
+      continue;
+    }
+    snprintf(name, sizeof(name), "%s_%u", prefix, i);
+    added += !symbolicator_add(sym, handler, name, SYMBOL_SOURCE_FINDER);
+  }
+  return added;
+}
+
+int symbolicator_add_syscalls(struct symbolicator* sym, struct syscall_table* table) {
+  int added = 0;
+  if (table->sysent) {
+    added += !symbolicator_add(sym, table->sysent, "_sysent", SYMBOL_SOURCE_FINDER);
+    added += add_handlers(sym, table->syscalls, table->n_syscalls, "syscall");
+  }
+  if (table->mach_trap_table) {
+    added += !symbolicator_add(sym, table->mach_trap_table, "_mach_trap_table", SYMBOL_SOURCE_FINDER);
+    added += add_handlers(sym, table->mach_traps, table->n_mach_traps, "mach_trap");
+  }
+  return added;
+}
+
+static int compare_entries(const void* a, const void* b) {
+  const struct symbol_entry* ea = a;
+  const struct symbol_entry* eb = b;
+  if (ea->addr != eb->addr) {
+    return ea->addr < eb->addr ? -1 : 1;
+  }
+  // best source first so the dedup below keeps it
+  return (int)eb->source - (int)ea->source;
+}
+
+// in-order walk of the implicit tree assigns the sorted entries to their BFS slots
+static uint32_t eytzinger_fill(struct symbolicator* sym, uint32_t i, uint32_t k) {
+  if (k <= sym->count) {
+    i = eytzinger_fill(sym, i, 2*k);
+    sym->eytz[k] = sym->entries[i].addr;
+    sym->eytz_rank[k] = i;
+    i++;
+    i = eytzinger_fill(sym, i, 2*k + 1);
+  }
+  return i;
+}
+
+int symbolicator_finalize(struct symbolicator* sym) {
+  free(sym->eytz);
+  free(sym->eytz_rank);
+  sym->eytz = NULL;
+  sym->eytz_rank = NULL;
+
+  qsort(sym->entries, sym->count, sizeof(struct symbol_entry), compare_entries);
+
+  uint32_t out = 0;
+  for (uint32_t i = 0; i < sym->count; i++) {
+    if (out > 0 && sym->entries[out-1].addr == sym->entries[i].addr) {
+      continue;
+    }
+    sym->entries[out++] = sym->entries[i];
+  }
+  sym->count = out;
+
+  sym->eytz = malloc((sym->count + 1) * sizeof(uint64_t));
+  sym->eytz_rank = malloc((sym->count + 1) * sizeof(uint32_t));
+  if (sym->eytz == NULL || sym->eytz_rank == NULL) {
+    free(sym->eytz);
+    free(sym->eytz_rank);
+    sym->eytz = NULL;
+    sym->eytz_rank = NULL;
+    return 1;
+  }
+  sym->eytz[0] = 0;
+  sym->eytz_rank[0] = 0;
+  eytzinger_fill(sym, 0, 1);
+  return 0;
+}
+
+void symbolicator_free(struct symbolicator* sym) {
+  free(sym->entries);
+  free(sym->strings);
+  free(sym->eytz);
+  free(sym->eytz_rank);
+  memset(sym, 0, sizeof(*sym));
+}
+
+int symbolicator_build_kernel(struct symbolicator* sym, struct kernel_image* img, struct kext_map* kexts,
+                              struct syscall_table* syscalls) {
+  symbolicator_free(sym);
+
+  int n_symtab = symbolicator_add_symtab(sym, img);
+  int n_ksymbols = symbolicator_add_ksymbols(sym);
+  int n_segments = symbolicator_add_kexts(sym, kexts);
+  int n_finder = syscalls ? symbolicator_add_syscalls(sym, syscalls) : 0;
+
+  if (symbolicator_finalize(sym)) {
+    printf("[-]\tran out of memory building the symbol table\n");
+    symbolicator_free(sym);
+    return 1;
+  }
+  printf("[+]\t%d symbols (%d symtab, %d ksymbols, %d segments, %d found)\n", sym->count, n_symtab, n_ksymbols,
+         n_segments, n_finder);
+  return 0;
+}
+
+const char* symbolicator_lookup(struct symbolicator* sym, uint64_t addr, uint64_t* offset) {
+  uint32_t n = sym->count;
+  if (sym->eytz == NULL || n == 0) {
+    return NULL;
+  }
+
+  // descend to the first entry greater than addr, the turns taken are recorded in the bits of k
+  uint32_t k = 1;
+  while (k <= n) {
+    __builtin_prefetch(&sym->eytz[k * 8]);
+    k = 2*k + (sym->eytz[k] <= addr);
+  }
+  // undo the trailing right turns (and the last left one) to get back to that entry
+  k >>= __builtin_ffs(~k);
+
+  // the entry we want is the one before it in sorted order
+  uint32_t rank = (k == 0) ? n : sym->eytz_rank[k];
+  if (rank == 0) {
+    return NULL;
+  }
+  struct symbol_entry* e = &sym->entries[rank - 1];
+  if (e->source == SYMBOL_SOURCE_END || addr - e->addr > SYMBOLICATOR_MAX_OFFSET) {
+    return NULL;
+  }
+  if (offset) {
+    *offset = addr - e->addr;
+  }
+  return sym->strings + e->name;
+}
+
+int symbolicate(struct symbolicator* sym, uint64_t addr, char* buf, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  buf[0] = 0;
+  uint64_t offset = 0;
+  const char* name = symbolicator_lookup(sym, addr, &offset);
+  if (name == NULL) {
+    return 0;
+  }
+  if (offset) {
+    snprintf(buf, len, "%s+0x%llx", name, offset);
+  } else {
+    snprintf(buf, len, "%s", name);
+  }
+  return 1;
+}
@@ -0,0 +1,75 @@
+#ifndef symbolicator_h
+#define symbolicator_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "kernel_image.h"
+#include "kext_map.h"
+#include "syscall_table.h"
+
+// where a name came from, when two sources name the same address the higher one wins
+enum symbol_source {
+  SYMBOL_SOURCE_END,       // end of a segment, addresses from here on have no symbol
+  SYMBOL_SOURCE_SEGMENT,   // start of a kext or kernel segment
+  SYMBOL_SOURCE_FINDER,    // something found by one of the finders, see symbolicator_add_syscalls
+  SYMBOL_SOURCE_KSYMBOLS,  // the hand-found ksymbols_* tables
+  SYMBOL_SOURCE_SYMTAB,    // LC_SYMTAB
+};
+
+struct symbol_entry {
+  uint64_t addr;
+  uint32_t name;  // offset into symbolicator.strings
+  uint32_t source;
+};
+
+/*
+ Symbols are collected with symbolicator_add and friends then symbolicator_finalize sorts them
+ and lays the addresses out in Eytzinger (BFS) order: the children of eytz[k] are eytz[2k] and
+ eytz[2k+1]. The first levels of the tree share cache lines and the search is branch free so
+ there's no mispredict on every level like with bsearch.
+ */
+struct symbolicator {
+  // filled in by symbolicator_add, sorted by symbolicator_finalize
+  struct symbol_entry* entries;
+  uint32_t count;
+  uint32_t capacity;
+
+  char* strings;
+  uint32_t strings_size;
+  uint32_t strings_capacity;
+
+  // built by symbolicator_finalize, both 1-based
+  uint64_t* eytz;
+  uint32_t* eytz_rank;  // index into entries of eytz[k]
+};
+
+// the kernel's symbols, built from the kernel dump by jailbreak() or the ws utility
+extern struct symbolicator kernel_symbols;
+
+int symbolicator_add(struct symbolicator* sym, uint64_t addr, const char* name, enum symbol_source source);
+
+// the ksymbols_* table for this device, needs kernel read to work out the slide
+int symbolicator_add_ksymbols(struct symbolicator* sym);
+// LC_SYMTAB of the kernel, the prelinked kexts are stripped
+int symbolicator_add_symtab(struct symbolicator* sym, struct kernel_image* img);
+// "com.apple.iokit.IOSurface:__TEXT_EXEC" at the start of each segment and an end marker after it
+int symbolicator_add_kexts(struct symbolicator* sym, struct kext_map* kexts);
+// _sysent, _mach_trap_table and "syscall_4" style names for the handlers the symtab doesn't have
+int symbolicator_add_syscalls(struct symbolicator* sym, struct syscall_table* table);
+
+int symbolicator_finalize(struct symbolicator* sym);
+void symbolicator_free(struct symbolicator* sym);
+
+// all of the above for the kernel image, the image can be unloaded afterwards. syscalls can be NULL
+int symbolicator_build_kernel(struct symbolicator* sym, struct kernel_image* img, struct kext_map* kexts,
+                              struct syscall_table* syscalls);
+
+// nearest symbol at or below addr, NULL if there isn't one within SYMBOLICATOR_MAX_OFFSET
+#define SYMBOLICATOR_MAX_OFFSET 0x100000
+const char* symbolicator_lookup(struct symbolicator* sym, uint64_t addr, uint64_t* offset);
+
+// "_proc_ucred+0x8", returns 0 and writes an empty string if there's no symbol
+int symbolicate(struct symbolicator* sym, uint64_t addr, char* buf, size_t len);
+
+#endif
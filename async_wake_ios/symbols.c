@@ -1,11 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/sysctl.h>
 #include <sys/utsname.h>
 
 #include "symbols.h"
 #include "kmem.h"
 #include "kutils.h"
+#include "kernel_image.h"
+#include "find_offsets.h"
 
 // the offsets are unlikely to change between similar models and builds, but the symbol addresses will
 // the offsets are required to get the kernel r/w but the symbols aren't
@@ -24,6 +27,7 @@ int kstruct_offsets_15B202[] = {
   0x30,  // KSTRUCT_OFFSET_TASK_PREV,
   0x308, // KSTRUCT_OFFSET_TASK_ITK_SPACE
   0x368, // KSTRUCT_OFFSET_TASK_BSD_INFO,
+  0x3a0, // KSTRUCT_OFFSET_TASK_T_FLAGS
   
   0x0,   // KSTRUCT_OFFSET_IPC_PORT_IO_BITS,
   0x4,   // KSTRUCT_OFFSET_IPC_PORT_IO_REFERENCES,
@@ -35,8 +39,39 @@ int kstruct_offsets_15B202[] = {
   0xa0,  // KSTRUCT_OFFSET_IPC_PORT_IP_SRIGHTS,
   
   0x10,  // KSTRUCT_OFFSET_PROC_PID,
+  0x18,  // KSTRUCT_OFFSET_PROC_TASK
+  0x98,  // KSTRUCT_OFFSET_PROC_P_UTHLIST
+  0x100, // KSTRUCT_OFFSET_PROC_UCRED
+  0x248, // KSTRUCT_OFFSET_PROC_TEXTVP
+  0x26c, // KSTRUCT_OFFSET_PROC_P_COMM
+  0x2a8, // KSTRUCT_OFFSET_PROC_P_CSFLAGS
+  0x8,   // KSTRUCT_OFFSET_PROC_P_LIST_PREV
   
+  0x168, // KSTRUCT_OFFSET_UTHREAD_UU_UCRED
+  0x170, // KSTRUCT_OFFSET_UTHREAD_UU_LIST
+  
+  0x10,  // KSTRUCT_OFFSET_UCRED_CR_REF
+  0x18,  // KSTRUCT_OFFSET_UCRED_CR_UID
+  
+  0x78,  // KSTRUCT_OFFSET_VNODE_V_UBCINFO
+  0xd8,  // KSTRUCT_OFFSET_VNODE_V_MOUNT
+  
+  0x70,  // KSTRUCT_OFFSET_MOUNT_MNT_FLAG
+  
+  0x50,  // KSTRUCT_OFFSET_UBC_INFO_CS_BLOBS
+  
+  0x80,  // KSTRUCT_OFFSET_CS_BLOB_CSB_CD
+  0x90,  // KSTRUCT_OFFSET_CS_BLOB_CSB_ENTITLEMENTS_BLOB
+  
+  0x14,  // KSTRUCT_OFFSET_IPC_SPACE_IS_TABLE_SIZE
   0x20,  // KSTRUCT_OFFSET_IPC_SPACE_IS_TABLE
+  0x28,  // KSTRUCT_OFFSET_IPC_SPACE_IS_TASK
+  
+  0x8,   // KSTRUCT_OFFSET_IPC_ENTRY_IE_BITS
+  0x10,  // KSTRUCT_OFFSET_IPC_ENTRY_IE_REQUEST
+  0x18,  // KSTRUCT_SIZE_IPC_ENTRY
+  
+  0x10,  // KSTRUCT_OFFSET_HOST_SPECIAL
   
   0x180, // KSTRUCT_OFFSET_THREAD_BOUND_PROCESSOR
   0x188, // KSTRUCT_OFFSET_THREAD_LAST_PROCESSOR
@@ -60,6 +95,22 @@ int koffset(enum kstruct_offset offset) {
   return offsets[offset];
 }
 
+// the hand-maintained table above is the starting point, whatever can be recovered from
+// accessor functions in the kernel itself (see find_offsets.c) replaces it
+int kstruct_offsets_derived[KSTRUCT_OFFSET_MAX];
+
+int offsets_init_from_kernel(struct kernel_image* img) {
+  memcpy(kstruct_offsets_derived,
+         offsets != NULL ? offsets : kstruct_offsets_15B202,
+         sizeof(kstruct_offsets_derived));
+  
+  int found = find_struct_offsets(img, kstruct_offsets_derived);
+  printf("derived %d struct offsets from the kernel\n", found);
+  
+  offsets = kstruct_offsets_derived;
+  return found;
+}
+
 // this is the base of the kernel, not the kernelcache
 uint64_t kernel_base = 0;
 uint64_t* symbols = NULL;
@@ -132,6 +183,36 @@ uint64_t ksymbols_iphone_6s_15b202[] = {
   0xFFFFFFF007194BBC, // KSYMBOL_SLEH_SYNC_EPILOG         // look for xrefs to "Unsupported Class %u event code."
 };
 
+// names for the entries above, used when symbolicating addresses
+const char* ksymbol_names[] = {
+  "OSArray::getMetaClass",                        // KSYMBOL_OSARRAY_GET_META_CLASS,
+  "IOUserClient::getMetaClass",                   // KSYMBOL_IOUSERCLIENT_GET_META_CLASS
+  "IOUserClient::getTargetAndTrapForIndex",       // KSYMBOL_IOUSERCLIENT_GET_TARGET_AND_TRAP_FOR_INDEX
+  "csblob_get_cdhash",                            // KSYMBOL_CSBLOB_GET_CD_HASH
+  "kalloc_external",                              // KSYMBOL_KALLOC_EXTERNAL
+  "kfree",                                        // KSYMBOL_KFREE
+  "ret_gadget",                                   // KYSMBOL_RET
+  "OSSerializer::serialize",                      // KSYMBOL_OSSERIALIZER_SERIALIZE,
+  "kprintf",                                      // KSYMBOL_KPRINTF
+  "uuid_copy",                                    // KSYMBOL_UUID_COPY
+  "CpuDataEntries",                               // KSYMBOL_CPU_DATA_ENTRIES
+  "valid_link_register",                          // KSYMBOL_VALID_LINK_REGISTER
+  "x21_jop_gadget",                               // KSYMBOL_X21_JOP_GADGET
+  "exception_return",                             // KSYMBOL_EXCEPTION_RETURN
+  "thread_exception_return",                      // KSYMBOL_THREAD_EXCEPTION_RETURN
+  "set_mdscr_el1_gadget",                         // KSYMBOL_SET_MDSCR_EL1_GADGET
+  "write_syscall_entrypoint",                     // KSYMBOL_WRITE_SYSCALL_ENTRYPOINT
+  "el1_hw_bp_infinite_loop",                      // KSYMBOL_EL1_HW_BP_INFINITE_LOOP
+  "sleh_synchronous_epilog",                      // KSYMBOL_SLEH_SYNC_EPILOG
+};
+
+const char* ksymbol_name(enum ksymbol sym) {
+  if (sym >= KSYMBOL_MAX) {
+    return NULL;
+  }
+  return ksymbol_names[sym];
+}
+
 uint64_t ksym(enum ksymbol sym) {
   if (kernel_base == 0) {
     if (!have_kmem_read()) {
@@ -13,6 +13,7 @@ enum kstruct_offset {
   KSTRUCT_OFFSET_TASK_PREV,
   KSTRUCT_OFFSET_TASK_ITK_SPACE,
   KSTRUCT_OFFSET_TASK_BSD_INFO,
+  KSTRUCT_OFFSET_TASK_T_FLAGS,
   
   /* struct ipc_port */
   KSTRUCT_OFFSET_IPC_PORT_IO_BITS,
@@ -26,9 +27,48 @@ enum kstruct_offset {
   
   /* struct proc */
   KSTRUCT_OFFSET_PROC_PID,
+  KSTRUCT_OFFSET_PROC_TASK,
+  KSTRUCT_OFFSET_PROC_P_UTHLIST,
+  KSTRUCT_OFFSET_PROC_UCRED,
+  KSTRUCT_OFFSET_PROC_TEXTVP,
+  KSTRUCT_OFFSET_PROC_P_COMM,
+  KSTRUCT_OFFSET_PROC_P_CSFLAGS,
+  KSTRUCT_OFFSET_PROC_P_LIST_PREV,        // p_list.le_prev, le_next is at 0
+  
+  /* struct uthread */
+  KSTRUCT_OFFSET_UTHREAD_UU_UCRED,
+  KSTRUCT_OFFSET_UTHREAD_UU_LIST,
+  
+  /* struct ucred */
+  KSTRUCT_OFFSET_UCRED_CR_REF,
+  KSTRUCT_OFFSET_UCRED_CR_UID,            // start of cr_posix: cr_uid, cr_ruid, cr_svuid
+  
+  /* struct vnode */
+  KSTRUCT_OFFSET_VNODE_V_UBCINFO,
+  KSTRUCT_OFFSET_VNODE_V_MOUNT,
+  
+  /* struct mount */
+  KSTRUCT_OFFSET_MOUNT_MNT_FLAG,
+  
+  /* struct ubc_info */
+  KSTRUCT_OFFSET_UBC_INFO_CS_BLOBS,
+  
+  /* struct cs_blob */
+  KSTRUCT_OFFSET_CS_BLOB_CSB_CD,
+  KSTRUCT_OFFSET_CS_BLOB_CSB_ENTITLEMENTS_BLOB,
   
   /* struct ipc_space */
+  KSTRUCT_OFFSET_IPC_SPACE_IS_TABLE_SIZE,
   KSTRUCT_OFFSET_IPC_SPACE_IS_TABLE,
+  KSTRUCT_OFFSET_IPC_SPACE_IS_TASK,
+  
+  /* struct ipc_entry */
+  KSTRUCT_OFFSET_IPC_ENTRY_IE_BITS,       // ie_object is at 0
+  KSTRUCT_OFFSET_IPC_ENTRY_IE_REQUEST,
+  KSTRUCT_SIZE_IPC_ENTRY,                 // stride of is_table
+  
+  /* struct host */
+  KSTRUCT_OFFSET_HOST_SPECIAL,            // special[HOST_MAX_SPECIAL_PORT + 1], a port pointer each
   
   /* struct thread */
   KSTRUCT_OFFSET_THREAD_BOUND_PROCESSOR,
@@ -45,6 +85,8 @@ enum kstruct_offset {
   /* struct cpu_data */
   KSTRUCT_OFFSET_CPU_DATA_EXCEPSTACKPTR,  // despite the name this actually points to the top of the stack, not the bottom
   KSTRUCT_OFFSET_CPU_DATA_CPU_PROCESSOR,
+  
+  KSTRUCT_OFFSET_MAX
 };
 
 
@@ -70,14 +112,19 @@ enum ksymbol {
   KSYMBOL_SET_MDSCR_EL1_GADGET,
   KSYMBOL_WRITE_SYSCALL_ENTRYPOINT,
   KSYMBOL_EL1_HW_BP_INFINITE_LOOP,
-  KSYMBOL_SLEH_SYNC_EPILOG
+  KSYMBOL_SLEH_SYNC_EPILOG,
+  
+  KSYMBOL_MAX
 };
 
 int koffset(enum kstruct_offset);
 
 uint64_t ksym(enum ksymbol);
+const char* ksymbol_name(enum ksymbol);
 
 void offsets_init(void);
+struct kernel_image;
+int offsets_init_from_kernel(struct kernel_image* img);
 void symbols_init(void);
 int probably_have_correct_symbols(void);
 
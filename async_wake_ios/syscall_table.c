@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mach-o/loader.h>
+
+#include "syscall_table.h"
+
+struct syscall_table kernel_syscalls = {0};
+
+/*
+ On iOS 11 arm64 the two tables look like this:
+
+ struct sysent {                  // 0x18 bytes
+   sy_call_t* sy_call;
+   sy_munge_t* sy_arg_munge32;
+   int32_t sy_return_type;
+   int16_t sy_narg;
+   uint16_t sy_arg_bytes;
+ };
+
+ typedef struct {                 // 0x20 bytes
+   unsigned char mach_trap_arg_count;
+   kern_return_t (*mach_trap_function)(void*);
+   mach_munge_t* mach_trap_arg_munge32;
+   int mach_trap_u32_words;
+ } mach_trap_t;
+
+ Neither symbol is exported so we look for them in the kernel's data segments: sysent starts
+ with nosys, exit, fork, read and write (0, 1, 0, 3 and 3 args) and mach_trap_table starts with
+ ten kern_invalid entries followed by _kernelrpc_mach_vm_allocate_trap.
+ */
+
+#define SYSENT_SIZE 0x18
+#define MACH_TRAP_SIZE 0x20
+#define MAX_SYSCALL_RETURN_TYPE 7 // _SYSCALL_RET_SIZE_T
+#define MAX_DATA_RANGES 16
+
+struct range {
+  uint64_t start;
+  uint64_t end;
+};
+
+struct finder {
+  struct kernel_image* img;
+  struct range exec[MAX_DATA_RANGES];
+  int n_exec;
+  struct range data[MAX_DATA_RANGES];
+  int n_data;
+
+  // _munge_* symbols, only a few dozen of them
+  struct {
+    uint64_t addr;
+    char name[24];
+  } mungers[64];
+  int n_mungers;
+};
+
+static int add_range(struct segment_command_64* seg, void* arg) {
+  struct finder* f = arg;
+  struct kernel_image* img = f->img;
+  if (seg->vmsize == 0 || strncmp(seg->segname, "__LINKEDIT", sizeof(seg->segname)) == 0 ||
+      strncmp(seg->segname, "__PRELINK_INFO", sizeof(seg->segname)) == 0) {
+    return 0;
+  }
+  uint64_t start = kimg_slid(img, seg->vmaddr);
+  uint64_t end = start + seg->vmsize;
+  if (start < img->base || start >= img->base + img->size) {
+    return 0;
+  }
+  if (end > img->base + img->size) {
+    end = img->base + img->size;
+  }
+  struct range* ranges = (seg->initprot & VM_PROT_EXECUTE) ? f->exec : f->data;
+  int* n = (seg->initprot & VM_PROT_EXECUTE) ? &f->n_exec : &f->n_data;
+  if (*n < MAX_DATA_RANGES) {
+    ranges[*n].start = start;
+    ranges[*n].end = end;
+    (*n)++;
+  }
+  return 0;
+}
+
+static int is_exec(struct finder* f, uint64_t addr) {
+  for (int i = 0; i < f->n_exec; i++) {
+    if (addr >= f->exec[i].start && addr < f->exec[i].end) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static uint64_t code_pointer(struct finder* f, uint64_t raw) {
+  uint64_t addr = kimg_pointer(f->img, raw);
+  return is_exec(f, addr) ? addr : 0;
+}
+
+static int add_munger_symbol(const char* name, uint64_t addr, void* arg) {
+  struct finder* f = arg;
+  if (strncmp(name, "_munge_", 7) != 0 || f->n_mungers == 64) {
+    return 0;
+  }
+  f->mungers[f->n_mungers].addr = addr;
+  strncpy(f->mungers[f->n_mungers].name, name + 1, sizeof(f->mungers[0].name) - 1);
+  f->mungers[f->n_mungers].name[sizeof(f->mungers[0].name) - 1] = 0;
+  f->n_mungers++;
+  return 0;
+}
+
+static void name_munger(struct finder* f, struct syscall_entry* e) {
+  e->munger_name[0] = 0;
+  for (int i = 0; i < f->n_mungers; i++) {
+    if (f->mungers[i].addr == e->munger) {
+      strcpy(e->munger_name, f->mungers[i].name);
+      return;
+    }
+  }
+}
+
+static int decode_sysent(struct finder* f, uint64_t addr, struct syscall_entry* e) {
+  uint8_t* p = kimg_ptr(f->img, addr, SYSENT_SIZE);
+  if (p == NULL) {
+    return 0;
+  }
+  uint64_t munge_raw = *(uint64_t*)(p + 8);
+  int32_t return_type = *(int32_t*)(p + 0x10);
+  int16_t narg = *(int16_t*)(p + 0x14);
+  uint16_t arg_bytes = *(uint16_t*)(p + 0x16);
+
+  uint64_t handler = code_pointer(f, *(uint64_t*)p);
+  uint64_t munger = munge_raw ? code_pointer(f, munge_raw) : 0;
+  if (handler == 0 || (munge_raw != 0 && munger == 0)) {
+    return 0;
+  }
+  if (return_type < 0 || return_type > MAX_SYSCALL_RETURN_TYPE || narg < 0 || narg > 8 || arg_bytes > 8*8 || (arg_bytes & 3)) {
+    return 0;
+  }
+  e->handler = handler;
+  e->munger = munger;
+  e->n_args = narg;
+  e->arg_bytes = arg_bytes;
+  e->return_type = return_type;
+  return 1;
+}
+
+static int decode_mach_trap(struct finder* f, uint64_t addr, struct syscall_entry* e) {
+  uint8_t* p = kimg_ptr(f->img, addr, MACH_TRAP_SIZE);
+  if (p == NULL) {
+    return 0;
+  }
+  // arg count is a single byte, the rest of the first qword is padding
+  uint64_t first = *(uint64_t*)p;
+  uint64_t munge_raw = *(uint64_t*)(p + 0x10);
+  uint32_t u32_words = *(uint32_t*)(p + 0x18);
+
+  uint64_t handler = code_pointer(f, *(uint64_t*)(p + 8));
+  uint64_t munger = munge_raw ? code_pointer(f, munge_raw) : 0;
+  if (first > 9 || handler == 0 || (munge_raw != 0 && munger == 0) || u32_words > 16) {
+    return 0;
+  }
+  e->handler = handler;
+  e->munger = munger;
+  e->n_args = (uint16_t)first;
+  e->arg_bytes = (uint16_t)(u32_words * 4);
+  e->return_type = 0;
+  return 1;
+}
+
+static int looks_like_sysent(struct finder* f, uint64_t addr) {
+  static const int16_t expected_args[] = {0, 1, 0, 3, 3}; // nosys, exit, fork, read, write
+  struct syscall_entry e;
+  for (int i = 0; i < 5; i++) {
+    if (!decode_sysent(f, addr + i*SYSENT_SIZE, &e) || e.n_args != expected_args[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int looks_like_mach_trap_table(struct finder* f, uint64_t addr) {
+  struct syscall_entry e;
+  if (!decode_mach_trap(f, addr, &e) || e.n_args != 0) {
+    return 0;
+  }
+  uint64_t kern_invalid = e.handler;
+  for (int i = 1; i < 10; i++) {
+    if (!decode_mach_trap(f, addr + i*MACH_TRAP_SIZE, &e) || e.handler != kern_invalid || e.n_args != 0) {
+      return 0;
+    }
+  }
+  // _kernelrpc_mach_vm_allocate_trap(target, addr, size, flags)
+  if (!decode_mach_trap(f, addr + 10*MACH_TRAP_SIZE, &e) || e.handler == kern_invalid || e.n_args != 4) {
+    return 0;
+  }
+  for (int i = 11; i < MACH_TRAP_TABLE_COUNT; i++) {
+    if (!decode_mach_trap(f, addr + i*MACH_TRAP_SIZE, &e)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static uint64_t scan_data(struct finder* f, int (*matches)(struct finder*, uint64_t)) {
+  for (int r = 0; r < f->n_data; r++) {
+    for (uint64_t addr = (f->data[r].start + 7) & ~7ULL; addr + 8 <= f->data[r].end; addr += 8) {
+      if (matches(f, addr)) {
+        return addr;
+      }
+    }
+  }
+  return 0;
+}
+
+int syscall_table_build(struct syscall_table* table, struct kernel_image* img) {
+  memset(table, 0, sizeof(*table));
+
+  struct mach_header_64* hdr = kimg_header(img);
+  if (hdr == NULL) {
+    printf("[-]\tno kernel image to find the syscall tables in\n");
+    return 1;
+  }
+
+  struct finder* f = calloc(1, sizeof(struct finder));
+  if (f == NULL) {
+    return 1;
+  }
+  f->img = img;
+  kimg_for_each_segment(img, hdr, add_range, f);
+  kimg_for_each_symbol(img, hdr, add_munger_symbol, f);
+
+  table->sysent = scan_data(f, looks_like_sysent);
+  if (table->sysent) {
+    while (table->n_syscalls < MAX_BSD_SYSCALLS &&
+           decode_sysent(f, table->sysent + table->n_syscalls*SYSENT_SIZE, &table->syscalls[table->n_syscalls])) {
+      name_munger(f, &table->syscalls[table->n_syscalls]);
+      table->n_syscalls++;
+    }
+    printf("[+]\tsysent at 0x%llx, %d syscalls\n", table->sysent, table->n_syscalls);
+  } else {
+    printf("[-]\tcouldn't find sysent\n");
+  }
+
+  table->mach_trap_table = scan_data(f, looks_like_mach_trap_table);
+  if (table->mach_trap_table) {
+    for (int i = 0; i < MACH_TRAP_TABLE_COUNT; i++) {
+      decode_mach_trap(f, table->mach_trap_table + i*MACH_TRAP_SIZE, &table->mach_traps[i]);
+      name_munger(f, &table->mach_traps[i]);
+    }
+    table->n_mach_traps = MACH_TRAP_TABLE_COUNT;
+    printf("[+]\tmach_trap_table at 0x%llx\n", table->mach_trap_table);
+  } else {
+    printf("[-]\tcouldn't find mach_trap_table\n");
+  }
+
+  free(f);
+  return (table->sysent && table->mach_trap_table) ? 0 : 1;
+}
+
+struct syscall_entry* syscall_table_lookup(struct syscall_table* table, int number) {
+  if (number >= 0) {
+    return (uint32_t)number < table->n_syscalls ? &table->syscalls[number] : NULL;
+  }
+  return (uint32_t)-number < table->n_mach_traps ? &table->mach_traps[-number] : NULL;
+}
+
+uint64_t syscall_table_handler(struct syscall_table* table, int number) {
+  struct syscall_entry* e = syscall_table_lookup(table, number);
+  return e ? e->handler : 0;
+}
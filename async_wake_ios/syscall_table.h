@@ -0,0 +1,40 @@
+#ifndef syscall_table_h
+#define syscall_table_h
+
+#include <stdint.h>
+
+#include "kernel_image.h"
+
+#define MAX_BSD_SYSCALLS 0x400
+#define MACH_TRAP_TABLE_COUNT 128
+
+// one decoded sysent or mach_trap_table entry, addresses are slid
+struct syscall_entry {
+  uint64_t handler;
+  uint64_t munger;       // sy_arg_munge32 / mach_trap_arg_munge32, 0 if there isn't one
+  uint16_t n_args;       // sy_narg / mach_trap_arg_count
+  uint16_t arg_bytes;    // sy_arg_bytes / mach_trap_u32_words*4
+  int32_t return_type;   // sy_return_type, 0 for mach traps
+  char munger_name[24];  // from the kernel's symbols if it has them
+};
+
+struct syscall_table {
+  uint64_t sysent;           // slid address of sysent, 0 if it wasn't found
+  uint64_t mach_trap_table;  // slid address of mach_trap_table, 0 if it wasn't found
+  uint32_t n_syscalls;
+  uint32_t n_mach_traps;
+  struct syscall_entry syscalls[MAX_BSD_SYSCALLS];
+  struct syscall_entry mach_traps[MACH_TRAP_TABLE_COUNT];
+};
+
+// the table built from the kernel dump by jailbreak()
+extern struct syscall_table kernel_syscalls;
+
+// find sysent and mach_trap_table in the image and decode every entry
+int syscall_table_build(struct syscall_table* table, struct kernel_image* img);
+
+// numbered like userspace does it: BSD syscalls are positive, mach traps negative
+struct syscall_entry* syscall_table_lookup(struct syscall_table* table, int number);
+uint64_t syscall_table_handler(struct syscall_table* table, int number);
+
+#endif
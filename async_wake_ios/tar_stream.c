@@ -0,0 +1,434 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tar_stream.h"
+
+#define BLOCK 512
+// the most a 12 byte ustar number field holds, anything past it goes in a pax record
+#define USTAR_MAX_NUMBER 077777777777ULL
+
+struct tar_entry {
+  char* name;               // in the archive, without a trailing / for directories
+  char* link;               // what a symlink points to
+  struct stat st;
+  int fd;                   // a regular file, opened by the walker
+};
+
+// a directory found but not walked yet
+struct tar_dir {
+  struct tar_dir* next;
+  char* path;
+  char* name;
+};
+
+struct tar_walk {
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond;   // a directory to walk, or a walker finished one
+  pthread_cond_t space_cond;  // room in the queue
+  pthread_cond_t item_cond;   // something in the queue, or the walk's over
+  struct tar_dir* dirs;
+  int busy;                   // walkers in the middle of a directory
+  int walkers_left;
+  int cancel;
+  struct tar_entry queue[TAR_QUEUE];
+  int head;
+  int count;
+  pthread_t threads[TAR_WALKERS];
+  int n_threads;
+};
+
+static char* join(const char* dir, const char* name) {
+  size_t dir_len = strlen(dir);
+  char* path = malloc(dir_len + strlen(name) + 2);
+  if (path) {
+    sprintf(path, "%s%s%s", dir, dir_len && dir[dir_len - 1] != '/' ? "/" : "", name);
+  }
+  return path;
+}
+
+static void free_entry(struct tar_entry* e) {
+  if (e->fd != -1) {
+    close(e->fd);
+  }
+  free(e->name);
+  free(e->link);
+}
+
+// the start of the file is probably on its way by the time it's sent
+static void prefetch(int fd, off_t size) {
+  off_t len = size < TAR_PREFETCH ? size : TAR_PREFETCH;
+#ifdef F_RDADVISE
+  struct radvisory ra = {0, (int)len};
+  fcntl(fd, F_RDADVISE, &ra);
+#elif defined(POSIX_FADV_WILLNEED)
+  posix_fadvise(fd, 0, len, POSIX_FADV_WILLNEED);
+#endif
+}
+
+// -1 if the response went away, e is freed
+static int queue_push(struct tar_walk* walk, struct tar_entry* e) {
+  pthread_mutex_lock(&walk->lock);
+  while (walk->count == TAR_QUEUE && !walk->cancel) {
+    pthread_cond_wait(&walk->space_cond, &walk->lock);
+  }
+  if (walk->cancel) {
+    pthread_mutex_unlock(&walk->lock);
+    free_entry(e);
+    return -1;
+  }
+  walk->queue[(walk->head + walk->count) % TAR_QUEUE] = *e;
+  walk->count++;
+  pthread_cond_signal(&walk->item_cond);
+  pthread_mutex_unlock(&walk->lock);
+  return 0;
+}
+
+// 0 once everything's been walked and taken
+static int queue_pop(struct tar_walk* walk, struct tar_entry* e) {
+  pthread_mutex_lock(&walk->lock);
+  while (walk->count == 0 && walk->walkers_left > 0) {
+    pthread_cond_wait(&walk->item_cond, &walk->lock);
+  }
+  int got = walk->count > 0;
+  if (got) {
+    *e = walk->queue[walk->head];
+    walk->head = (walk->head + 1) % TAR_QUEUE;
+    walk->count--;
+    pthread_cond_signal(&walk->space_cond);
+  }
+  pthread_mutex_unlock(&walk->lock);
+  return got;
+}
+
+static void push_dir(struct tar_walk* walk, char* path, char* name) {
+  struct tar_dir* dir = path && name ? malloc(sizeof(*dir)) : NULL;
+  if (dir == NULL) {
+    free(path);
+    free(name);
+    return;
+  }
+  dir->path = path;
+  dir->name = name;
+  pthread_mutex_lock(&walk->lock);
+  dir->next = walk->dirs;
+  walk->dirs = dir;
+  pthread_cond_signal(&walk->work_cond);
+  pthread_mutex_unlock(&walk->lock);
+}
+
+// queues everything in dir, subdirectories after their own entry so they come first in the archive
+static void walk_dir(struct tar_walk* walk, struct tar_dir* dir) {
+  int fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  DIR* d = fd == -1 ? NULL : fdopendir(fd);
+  if (d == NULL) {
+    printf("[-]\ttar: can't open %s\n", dir->path);
+    if (fd != -1) {
+      close(fd);
+    }
+    return;
+  }
+  struct dirent* ent;
+  while ((ent = readdir(d)) != NULL) {
+    if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+      continue;
+    }
+    struct tar_entry e = {0};
+    e.fd = -1;
+    if (fstatat(dirfd(d), ent->d_name, &e.st, AT_SYMLINK_NOFOLLOW)) {
+      continue;
+    }
+    if (S_ISREG(e.st.st_mode)) {
+      // the size in the header has to be the size of what's sent, so it's this fd's
+      e.fd = openat(dirfd(d), ent->d_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+      if (e.fd == -1 || fstat(e.fd, &e.st)) {
+        free_entry(&e);
+        continue;
+      }
+      prefetch(e.fd, e.st.st_size);
+    } else if (S_ISLNK(e.st.st_mode)) {
+      char target[PATH_MAX];
+      ssize_t len = readlinkat(dirfd(d), ent->d_name, target, sizeof(target) - 1);
+      if (len < 0) {
+        continue;
+      }
+      target[len] = 0;
+      e.link = strdup(target);
+    } else if (!S_ISDIR(e.st.st_mode)) {
+      continue;
+    }
+    int is_dir = S_ISDIR(e.st.st_mode);
+    e.name = join(dir->name, ent->d_name);
+    if (e.name == NULL || (S_ISLNK(e.st.st_mode) && e.link == NULL)) {
+      free_entry(&e);
+      continue;
+    }
+    char* sub_name = is_dir ? strdup(e.name) : NULL;
+    if (queue_push(walk, &e)) {
+      free(sub_name);
+      break;
+    }
+    if (sub_name) {
+      push_dir(walk, join(dir->path, ent->d_name), sub_name);
+    }
+  }
+  closedir(d);
+}
+
+static void* walker(void* arg) {
+  struct tar_walk* walk = arg;
+  pthread_mutex_lock(&walk->lock);
+  for (;;) {
+    // nothing to do but another walker might still find more
+    while (!walk->cancel && walk->dirs == NULL && walk->busy > 0) {
+      pthread_cond_wait(&walk->work_cond, &walk->lock);
+    }
+    if (walk->cancel || walk->dirs == NULL) {
+      break;
+    }
+    struct tar_dir* dir = walk->dirs;
+    walk->dirs = dir->next;
+    walk->busy++;
+    pthread_mutex_unlock(&walk->lock);
+
+    walk_dir(walk, dir);
+    free(dir->path);
+    free(dir->name);
+    free(dir);
+
+    pthread_mutex_lock(&walk->lock);
+    walk->busy--;
+    pthread_cond_broadcast(&walk->work_cond);
+  }
+  if (--walk->walkers_left == 0) {
+    pthread_cond_signal(&walk->item_cond);
+  }
+  pthread_cond_broadcast(&walk->work_cond);
+  pthread_mutex_unlock(&walk->lock);
+  return NULL;
+}
+
+static void octal(char* field, int width, uint64_t value) {
+  snprintf(field, width, "%0*llo", width - 1, (unsigned long long)value);
+}
+
+// a "len key=value\n" pax record, len counting its own digits
+static size_t pax_record(char* out, size_t size, const char* key, const char* value) {
+  size_t base = strlen(key) + strlen(value) + 3;
+  size_t len = base + 1;
+  for (;;) {
+    char digits[24];
+    size_t with = base + snprintf(digits, sizeof(digits), "%zu", len);
+    if (with == len) {
+      break;
+    }
+    len = with;
+  }
+  if (out && len < size) {
+    snprintf(out, size, "%zu %s=%s\n", len, key, value);
+  }
+  return len;
+}
+
+static void write_header(struct http_conn* conn, const char* name, const char* link, const struct stat* st,
+                         char type, uint64_t size) {
+  char h[BLOCK];
+  memset(h, 0, sizeof(h));
+  size_t name_len = strlen(name);
+  int long_name = 0;
+  if (name_len <= 100) {
+    memcpy(h, name, name_len);
+  } else {
+    // ustar can split a path into a 155 byte prefix and a 100 byte name at a /
+    const char* split = NULL;
+    for (const char* p = name; (p = strchr(p, '/')) != NULL; p++) {
+      if (p - name <= 155 && name_len - (p - name) - 1 <= 100 && p[1]) {
+        split = p;
+        break;
+      }
+    }
+    if (split) {
+      memcpy(h + 345, name, split - name);
+      memcpy(h, split + 1, name_len - (split - name) - 1);
+    } else {
+      long_name = 1;
+      memcpy(h, name, 99);
+    }
+  }
+  int long_link = link && strlen(link) > 100;
+  int big = size > USTAR_MAX_NUMBER;
+  int odd_mtime = st->st_mtime < 0 || (uint64_t)st->st_mtime > USTAR_MAX_NUMBER;
+
+  if (long_name || long_link || big || odd_mtime) {
+    char records[3 * (PATH_MAX + 64)];
+    size_t len = 0;
+    char num[24];
+    if (long_name) {
+      len += pax_record(records + len, sizeof(records) - len, "path", name);
+    }
+    if (long_link) {
+      len += pax_record(records + len, sizeof(records) - len, "linkpath", link);
+    }
+    if (big) {
+      snprintf(num, sizeof(num), "%llu", (unsigned long long)size);
+      len += pax_record(records + len, sizeof(records) - len, "size", num);
+    }
+    if (odd_mtime) {
+      snprintf(num, sizeof(num), "%lld", (long long)st->st_mtime);
+      len += pax_record(records + len, sizeof(records) - len, "mtime", num);
+    }
+    if (len < sizeof(records)) {
+      struct stat pax_st = *st;
+      pax_st.st_mode = 0644;
+      pax_st.st_mtime = odd_mtime ? 0 : st->st_mtime;
+      write_header(conn, "././@PaxHeader", NULL, &pax_st, 'x', len);
+      char zeros[BLOCK] = {0};
+      http_write(conn, records, len);
+      http_write(conn, zeros, (BLOCK - len % BLOCK) % BLOCK);
+    }
+  }
+
+  octal(h + 100, 8, st->st_mode & 07777);
+  octal(h + 108, 8, st->st_uid & 07777777);
+  octal(h + 116, 8, st->st_gid & 07777777);
+  octal(h + 124, 12, big ? 0 : size);
+  octal(h + 136, 12, odd_mtime ? 0 : st->st_mtime);
+  h[156] = type;
+  if (link) {
+    memcpy(h + 157, link, long_link ? 99 : strlen(link));
+  }
+  memcpy(h + 257, "ustar", 6);
+  memcpy(h + 263, "00", 2);
+  memset(h + 148, ' ', 8);
+  unsigned sum = 0;
+  for (int i = 0; i < BLOCK; i++) {
+    sum += (unsigned char)h[i];
+  }
+  snprintf(h + 148, 7, "%06o", sum);
+  http_write(conn, h, sizeof(h));
+}
+
+static void write_entry(struct http_conn* conn, struct tar_entry* e) {
+  if (S_ISDIR(e->st.st_mode)) {
+    char* name = join(e->name, "");
+    if (name) {
+      write_header(conn, name, NULL, &e->st, '5', 0);
+      free(name);
+    }
+  } else if (S_ISLNK(e->st.st_mode)) {
+    write_header(conn, e->name, e->link, &e->st, '2', 0);
+  } else {
+    uint64_t size = e->st.st_size;
+    char zeros[BLOCK] = {0};
+    write_header(conn, e->name, NULL, &e->st, '0', size);
+    http_write_file(conn, e->fd, 0, size);
+    e->fd = -1;
+    http_write(conn, zeros, (BLOCK - size % BLOCK) % BLOCK);
+  }
+}
+
+// ws defers /tar= (http_defer), so this runs on a worker thread and waiting here for the walkers to
+// catch up only holds that worker and the tar endpoint's slot, not the event loop
+static int produce(struct http_conn* conn, void* state) {
+  struct tar_walk* walk = state;
+  for (int n = 0; n < TAR_BATCH; n++) {
+    struct tar_entry e;
+    if (!queue_pop(walk, &e)) {
+      char end[2 * BLOCK] = {0};
+      http_write(conn, end, sizeof(end));
+      return 1;
+    }
+    write_entry(conn, &e);
+    free_entry(&e);
+  }
+  return 0;
+}
+
+static void release(void* state) {
+  struct tar_walk* walk = state;
+  pthread_mutex_lock(&walk->lock);
+  walk->cancel = 1;
+  pthread_cond_broadcast(&walk->work_cond);
+  pthread_cond_broadcast(&walk->space_cond);
+  pthread_mutex_unlock(&walk->lock);
+  for (int i = 0; i < walk->n_threads; i++) {
+    pthread_join(walk->threads[i], NULL);
+  }
+  for (; walk->count > 0; walk->count--) {
+    free_entry(&walk->queue[walk->head]);
+    walk->head = (walk->head + 1) % TAR_QUEUE;
+  }
+  while (walk->dirs) {
+    struct tar_dir* next = walk->dirs->next;
+    free(walk->dirs->path);
+    free(walk->dirs->name);
+    free(walk->dirs);
+    walk->dirs = next;
+  }
+  pthread_mutex_destroy(&walk->lock);
+  pthread_cond_destroy(&walk->work_cond);
+  pthread_cond_destroy(&walk->space_cond);
+  pthread_cond_destroy(&walk->item_cond);
+  free(walk);
+}
+
+int tar_stream(struct http_conn* conn, const char* path) {
+  struct tar_entry root = {0};
+  root.fd = -1;
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) {
+    return -1;
+  }
+  int bad = fstat(fd, &root.st);
+  close(fd);
+  struct tar_walk* walk = bad ? NULL : calloc(1, sizeof(*walk));
+  if (walk == NULL) {
+    return -1;
+  }
+  pthread_mutex_init(&walk->lock, NULL);
+  pthread_cond_init(&walk->work_cond, NULL);
+  pthread_cond_init(&walk->space_cond, NULL);
+  pthread_cond_init(&walk->item_cond, NULL);
+
+  // everything's under the directory's own name, or straight in the archive for /
+  char* base = strdup(path);
+  size_t len = base ? strlen(base) : 0;
+  while (len > 0 && base[len - 1] == '/') {
+    base[--len] = 0;
+  }
+  char* slash = base ? strrchr(base, '/') : NULL;
+  root.name = base ? strdup(slash ? slash + 1 : base) : NULL;
+  free(base);
+  if (root.name && root.name[0]) {
+    char* name = strdup(root.name);
+    queue_push(walk, &root);
+    push_dir(walk, strdup(path), name);
+  } else {
+    push_dir(walk, strdup(path), strdup(""));
+    free_entry(&root);
+  }
+
+  walk->walkers_left = TAR_WALKERS;
+  for (int i = 0; i < TAR_WALKERS; i++) {
+    if (pthread_create(&walk->threads[walk->n_threads], NULL, walker, walk) == 0) {
+      walk->n_threads++;
+      continue;
+    }
+    printf("[-]\ttar: couldn't start a walker\n");
+    pthread_mutex_lock(&walk->lock);
+    if (--walk->walkers_left == 0) {
+      // nobody to walk it, which still makes a valid (if short) archive
+      pthread_cond_signal(&walk->item_cond);
+    }
+    pthread_mutex_unlock(&walk->lock);
+  }
+  http_stream(conn, produce, release, walk);
+  return 0;
+}
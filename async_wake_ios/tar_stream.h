@@ -0,0 +1,29 @@
+#ifndef tar_stream_h
+#define tar_stream_h
+
+#include "http_server.h"
+
+/*
+ A whole directory tree as one tar, so pulling /jailbreak or an app's container off the device is a
+ single download instead of a recursive wget of every listing and file.
+
+ ustar headers are made up as entries come along, with pax records for what ustar can't hold (long
+ paths and link targets, files over 8G). Directories are walked by TAR_WALKERS threads ahead of the
+ response, they stat and open each file and tell the kernel to start reading it, so by the time
+ its turn comes the header's ready and the contents go straight out with sendfile. At most
+ TAR_QUEUE entries (and so open files) are waiting at once.
+
+ Symlinks are archived as links and never followed. Sockets, fifos and devices are left out, and so
+ is anything that can't be read.
+ */
+
+#define TAR_WALKERS 2
+#define TAR_QUEUE 64
+#define TAR_BATCH 32                // entries written per producer call
+#define TAR_PREFETCH 0x100000       // how much of each file to ask to be read ahead
+
+// streams everything under path out of conn, which http_begin has been called on. Entries are
+// named from path's last component down. -1 without writing anything if path isn't a directory
+int tar_stream(struct http_conn* conn, const char* path);
+
+#endif
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trust_cache.h"
+#include "sha256.h"
+
+static int compare_hashes(const void* a, const void* b) {
+  return memcmp(a, b, TRUST_CACHE_HASH_LEN);
+}
+
+uint32_t trust_cache_sort(uint8_t (*hashes)[TRUST_CACHE_HASH_LEN], uint32_t count) {
+  if (count == 0) {
+    return 0;
+  }
+  qsort(hashes, count, TRUST_CACHE_HASH_LEN, compare_hashes);
+  uint32_t n = 1;
+  for (uint32_t i = 1; i < count; i++) {
+    if (memcmp(hashes[i], hashes[n - 1], TRUST_CACHE_HASH_LEN) != 0) {
+      memcpy(hashes[n++], hashes[i], TRUST_CACHE_HASH_LEN);
+    }
+  }
+  return n;
+}
+
+int trust_cache_write(const char* path, uint8_t (*hashes)[TRUST_CACHE_HASH_LEN], uint32_t* count) {
+  *count = trust_cache_sort(hashes, *count);
+
+  struct trust_cache_header hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.version = TRUST_CACHE_VERSION;
+  hdr.num_entries = *count;
+
+  uint8_t digest[32];
+  SHA256_CTX ctx;
+  sha256_init(&ctx);
+  sha256_update(&ctx, (const BYTE*)hashes, (size_t)*count * TRUST_CACHE_HASH_LEN);
+  sha256_final(&ctx, digest);
+  memcpy(hdr.uuid, digest, sizeof(hdr.uuid));
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    printf("[-]\tcan't create %s\n", path);
+    return 1;
+  }
+  size_t len = (size_t)*count * TRUST_CACHE_HASH_LEN;
+  int err = write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || write(fd, hashes, len) != (ssize_t)len;
+  close(fd);
+  if (err) {
+    printf("[-]\tcouldn't write %s\n", path);
+    unlink(path);
+    return 1;
+  }
+  return 0;
+}
+
+int trust_cache_parse(struct trust_cache* tc, const uint8_t* buf, size_t size) {
+  memset(tc, 0, sizeof(*tc));
+  struct trust_cache_header hdr;
+  if (size < sizeof(hdr)) {
+    return 1;
+  }
+  memcpy(&hdr, buf, sizeof(hdr));
+  if (hdr.version != TRUST_CACHE_VERSION || hdr.num_entries > (size - sizeof(hdr)) / TRUST_CACHE_HASH_LEN) {
+    return 1;
+  }
+  const uint8_t (*hashes)[TRUST_CACHE_HASH_LEN] = (const void*)(buf + sizeof(hdr));
+  // the lookup relies on this, the kernel would just miss entries
+  for (uint32_t i = 1; i < hdr.num_entries; i++) {
+    if (memcmp(hashes[i - 1], hashes[i], TRUST_CACHE_HASH_LEN) >= 0) {
+      return 1;
+    }
+  }
+  tc->version = hdr.version;
+  tc->uuid = buf + offsetof(struct trust_cache_header, uuid);
+  tc->count = hdr.num_entries;
+  tc->hashes = hashes;
+  return 0;
+}
+
+int trust_cache_open(struct trust_cache* tc, const char* path) {
+  memset(tc, 0, sizeof(*tc));
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    printf("[-]\tcan't open %s\n", path);
+    return 1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct trust_cache_header)) {
+    printf("[-]\t%s is too small to be a trust cache\n", path);
+    close(fd);
+    return 1;
+  }
+  void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    printf("[-]\tcan't map %s\n", path);
+    return 1;
+  }
+  if (trust_cache_parse(tc, map, st.st_size)) {
+    printf("[-]\t%s isn't a valid trust cache\n", path);
+    munmap(map, st.st_size);
+    return 1;
+  }
+  tc->map = map;
+  tc->map_size = st.st_size;
+  return 0;
+}
+
+void trust_cache_close(struct trust_cache* tc) {
+  if (tc->map != NULL) {
+    munmap(tc->map, tc->map_size);
+  }
+  memset(tc, 0, sizeof(*tc));
+}
+
+int trust_cache_lookup(const struct trust_cache* tc, const uint8_t* cdhash) {
+  uint32_t lo = 0;
+  uint32_t hi = tc->count;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    int cmp = memcmp(tc->hashes[mid], cdhash, TRUST_CACHE_HASH_LEN);
+    if (cmp == 0) {
+      return 1;
+    }
+    if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef trust_cache_h
+#define trust_cache_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ Binary trust caches, the same layout as the version 0 caches the kernel loads: a header followed by
+ the cdhashes sorted in memcmp order with no duplicates, so a lookup is a binary search.
+
+ A whole tree of binaries can be hashed ahead of time (utilities/tcbuild.c) instead of each one going
+ through the amfid exception handler the first time it's exec'd. Portable, builds on Linux too.
+ */
+
+#define TRUST_CACHE_VERSION 0
+#define TRUST_CACHE_HASH_LEN 20
+
+struct trust_cache_header {
+  uint32_t version;
+  uint8_t uuid[16];
+  uint32_t num_entries;
+  // followed by num_entries hashes
+};
+
+struct trust_cache {
+  uint32_t version;
+  const uint8_t* uuid;
+  uint32_t count;
+  const uint8_t (*hashes)[TRUST_CACHE_HASH_LEN];
+
+  void* map;  // set by trust_cache_open
+  size_t map_size;
+};
+
+// sorts and removes duplicates in place, returns how many are left
+uint32_t trust_cache_sort(uint8_t (*hashes)[TRUST_CACHE_HASH_LEN], uint32_t count);
+
+// sorts hashes then writes them out, the uuid is derived from the contents so the same set of
+// binaries always gives the same file
+int trust_cache_write(const char* path, uint8_t (*hashes)[TRUST_CACHE_HASH_LEN], uint32_t* count);
+
+// checks the header and that the hashes really are sorted, buf has to outlive tc
+int trust_cache_parse(struct trust_cache* tc, const uint8_t* buf, size_t size);
+
+int trust_cache_open(struct trust_cache* tc, const char* path);
+void trust_cache_close(struct trust_cache* tc);
+
+// 1 if cdhash is in the cache
+int trust_cache_lookup(const struct trust_cache* tc, const uint8_t* cdhash);
+
+#endif
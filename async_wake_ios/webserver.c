@@ -15,311 +15,354 @@
 #include<netdb.h>
 #include<signal.h>
 #include<fcntl.h>
+#include<errno.h>
+#include <mach/mach.h>
 #include <mach/vm_types.h>
+#include "kmem.h"
 #include "webserver.h"
+#include "http_server.h"
+#include "dir_listing.h"
+#include "tar_stream.h"
+#include "proc_list.h"
 
 //haxx to avoid including the .h which will break shit because FML C
 extern char* dump_pointer_html(mach_port_t tfp0, addr64_t addr, uint64_t max_size);
-extern char* ps_html(int sfd);
 
 
-#define CONNMAX 1000
-#define BYTES 1024
-#define DATA_SIZE 0x2000
-
 char *ROOT = "/";
-int listenfd, clients[CONNMAX];
 int urlmode = 1;
 mach_port_t ws_tfp0;
 uint64_t ws_kernel_base;
 
+// what the workers run, and how many of each at once
+static int ep_kmem = -1;     // /dump_ptr, /kmem and /info
+static int ep_ls = -1;
+static int ep_files = -1;
+static int ep_tar = -1;
+
 
-#include <dirent.h>
-char* http_ls(char *cwd, uint32_t* sz)
+// streamed a batch of entries at a time, ?format=json, ?sort=, ?offset= and ?limit= are in dir_listing.h
+static void http_ls(struct http_conn* conn, struct http_request* req)
 {
-    struct stat st_buf;
-    char *tmp2 = malloc(0x1000);
-    char *data = malloc(DATA_SIZE);
-    uint32_t l = 0;
+    char *cwd = req->path;
+    struct dir_list_options opts;
+    dir_list_parse_query(req->query, &opts);
+    printf("About to search directory [%s] for files...\n", cwd);
+    struct dir_list *list = dir_list_open(cwd, &opts);
+    if (list == NULL)
+    {
+        int status = errno == EACCES || errno == EPERM ? 403 : errno == ENOMEM ? 500 : 404;
+        printf("[-]\tcouldn't open directory [%s]: %s\n", cwd, strerror(errno));
+        if (opts.format == DIR_LIST_JSON)
+        {
+            http_respond(conn, status, "application/json", "{\"error\":\"couldn't open directory\"}", 35);
+        } else {
+            http_respond(conn, status, "text/html", "<html>Couldn't open directory\n</html>", 37);
+        }
+        return;
+    }
+    if (opts.format == DIR_LIST_JSON)
+    {
+        http_begin(conn, 200, "application/json");
+        dir_list_stream(conn, list);
+        return;
+    }
+    http_begin(conn, 200, "text/html");
     if (urlmode)
     {
-        sprintf(data,
+        http_printf(conn,
                 "<html><h1>\tListing [%s]</h1><br>\n"
                 "<br><h5>\tOther HTTP Options: "
                 "<a href=/dump_ptr=0x0011223344556677>/dump_ptr=0x0011223344556677</a> - dump kernel memory | "
+                "/kmem=&lt;addr&gt;,&lt;len&gt; - raw kernel memory | "
                 "<a href=/info>/info</a> - list processes | "
+                "<a href=/stats>/stats</a> - worker queues | "
                 "<a href=/urlmode>/urlmode</a> - disable/enable urls for recursive wget | "
+                "<a href=\"/tar=%s\">/tar=%s</a> - this folder as a tar | "
                 "<a href=/exit>exit</a> - exit HTTP server</h5> "
                 "</ br><h5>kernel_base = <a href=/dump_ptr=0x%llx>0x%llx</a></h5><br></ br>\n",
-                cwd, ws_kernel_base, ws_kernel_base);
+                cwd, cwd, cwd, ws_kernel_base, ws_kernel_base);
     } else {
-        sprintf(data,
+        http_printf(conn,
                 "<html><h1>\tListing [%s]</h1><br>\n"
                 "<br><h5>\tOther HTTP Options: "
                 "/dump_ptr=0x0011223344556677 - dump kernel memory | "
+                "/kmem=<addr>,<len> - raw kernel memory | "
                 "/info - list processes | "
+                "/stats - worker queues | "
                 "/urlmode - disable/enable urls for recursive wget | "
+                "/tar=%s - this folder as a tar | "
                 "/exit - exit HTTP server</h5> "
                 "</ br><h5>kernel_base = /dump_ptr=0x%llx</h5><br></ br>\n",
-                cwd, ws_kernel_base);
+                cwd, cwd, ws_kernel_base);
     }
-    l += strlen(data);
-    printf("About to search directory [%s] for files...\n", cwd);
-    DIR *dir = opendir(cwd);
-    struct dirent *ent;
-    if (dir != NULL)
+    dir_list_stream(conn, list);
+}
+
+// /kmem=addr,len as raw bytes, read KMEM_CHUNK aligned at a time and sent as each one comes in
+#define KMEM_CHUNK 0x40000
+#define KMEM_DEFAULT_LEN 0x4000
+
+struct kmem_stream
+{
+    mach_port_t tfp0;
+    uint64_t next;
+    uint64_t end;
+    char buf[KMEM_CHUNK];
+};
+
+// up to the next chunk boundary, 0 if the kernel wouldn't give it to us
+static uint64_t kmem_read_chunk(struct kmem_stream *ks)
+{
+    uint64_t chunk_end = (ks->next & ~(uint64_t)(KMEM_CHUNK - 1)) + KMEM_CHUNK;
+    uint64_t len = (chunk_end < ks->end ? chunk_end : ks->end) - ks->next;
+    mach_vm_size_t out_size = 0;
+    kern_return_t err = mach_vm_read_overwrite(ks->tfp0, ks->next, len, (mach_vm_address_t)ks->buf, &out_size);
+    if (err != KERN_SUCCESS || out_size != len)
     {
-        /* print all the files and directories within directory */
-        while ((ent = readdir(dir)) != NULL)
-        {
-            char *tmp = malloc(0x1000);
-            bzero(tmp2, 0x1000);
-            char *name = malloc(0x1000);
-            strcpy(name, ent->d_name);
-            strcpy(tmp2, cwd);
-            strcat(tmp2, ent->d_name);
-            printf("Found file [%s] in directory [%s]\n", name, cwd);
-            stat(tmp2, &st_buf);
-            if (S_ISDIR (st_buf.st_mode))
-                strcat(name, "/");
-            sprintf(tmp, "<a href=\"%s%s\">%s</a><br>\n", cwd, name, name);
-            l += strlen(tmp);
-            if (strlen(data) + strlen(tmp) < DATA_SIZE)
-                strcat(data, tmp);
-            free(name);
-            free(tmp);
-        }
-        closedir(dir);
-    } else {
-        /* could not open directory */
-        strcat(data, "Couldn't open directory\n");
-        l = (uint32_t)strlen(data);
+        printf("[-]\tkmem read of 0x%llx bytes at 0x%llx failed: %x %s\n", (unsigned long long)len,
+               (unsigned long long)ks->next, err, mach_error_string(err));
+        return 0;
     }
-    strcat(data, "<html>");
-    *sz = l + 6;
-    free(tmp2);
-    return data;
+    return len;
 }
 
-void init_ws(mach_port_t tfp0, uint64_t kernel_base)
+static int kmem_produce(struct http_conn* conn, void* state)
 {
-    ws_tfp0 = tfp0;
-    ws_kernel_base = kernel_base;
+    struct kmem_stream *ks = state;
+    uint64_t len = kmem_read_chunk(ks);
+    if (len == 0)
+    {
+        // too late for an error page, hanging up short of the Content-Length is all that's left
+        return 1;
+    }
+    http_write(conn, ks->buf, len);
+    ks->next += len;
+    return ks->next == ks->end;
 }
 
-void* wsmain(void* not_used_damn_you_pthread)
+static void kmem_respond(struct http_conn* conn, struct http_request* req, const char* arg)
 {
-    not_used_damn_you_pthread = not_used_damn_you_pthread;
-    mach_port_t tfp0 = ws_tfp0;
-    struct sockaddr_in clientaddr;
-    socklen_t addrlen;
-    
-    //Default Values PATH = ~/ and PORT=10000
-    char *PORT = "80";
-    int slot=0;
-    
-    
-    printf("Server started at port no. %s with root directory as %s\n",PORT,ROOT);
-    // Setting all elements to -1: signifies there is no client connected
-    int i;
-    for (i=0; i<CONNMAX; i++)
-        clients[i]=-1;
-    startServer(PORT);
-    
-    // ACCEPT connections
-    int flag = 1;
-    while (flag)
+    char *end;
+    char value[96];
+    uint64_t addr = strtoull(arg, &end, 0x10);
+    uint64_t len = *end == ',' ? strtoull(end + 1, NULL, 0x10) : KMEM_DEFAULT_LEN;
+    if (len == 0 || addr + len < addr)
     {
-        addrlen = sizeof(clientaddr);
-        clients[slot] = accept (listenfd, (struct sockaddr *) &clientaddr, &addrlen);
-        
-        if (clients[slot]<0)
-            printf("accept() error");
-        else
-        {
-
-            flag = respond(slot, tfp0);
+        http_begin(conn, 400, "text/plain");
+        http_printf(conn, "usage: /kmem=<hex address>,<hex length>\n");
+        return;
+    }
 
-        }
-        
-        while (clients[slot]!=-1) slot = (slot+1)%CONNMAX;
+    uint64_t first = 0, last = len - 1;
+    int range = http_range(req, len, &first, &last);
+    if (range < 0)
+    {
+        http_begin(conn, 416, "text/plain");
+        snprintf(value, sizeof(value), "bytes */%llu", (unsigned long long)len);
+        http_add_header(conn, "Content-Range", value);
+        return;
     }
-    
-    return not_used_damn_you_pthread;
-}
 
-//start server
-void startServer(char *port)
-{
-    struct addrinfo hints, *res, *p;
-    
-    // getaddrinfo for host
-    memset (&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = AI_PASSIVE;
-    if (getaddrinfo( NULL, port, &hints, &res) != 0)
+    struct kmem_stream *ks = malloc(sizeof(*ks));
+    if (ks == NULL)
     {
-        printf("getaddrinfo() error");
-        exit(1);
+        http_begin(conn, 500, "text/plain");
+        http_printf(conn, "out of memory\n");
+        return;
     }
-    // socket and bind
-    for (p = res; p!=NULL; p=p->ai_next)
+    ks->tfp0 = ws_tfp0;
+    ks->next = addr + first;
+    ks->end = addr + last + 1;
+    // the first chunk before any headers, so a bad address gets a real error
+    uint64_t got = kmem_read_chunk(ks);
+    if (got == 0)
     {
-        listenfd = socket (p->ai_family, p->ai_socktype, 0);
-        if (listenfd == -1) continue;
-        if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0) break;
+        free(ks);
+        http_begin(conn, 500, "text/plain");
+        http_printf(conn, "couldn't read kernel memory at 0x%llx\n", (unsigned long long)(addr + first));
+        return;
     }
-    if (p==NULL)
+    http_begin(conn, range ? 206 : 200, "application/octet-stream");
+    if (range)
     {
-        printf ("socket() or bind()");
-        exit(1);
+        snprintf(value, sizeof(value), "bytes %llu-%llu/%llu", (unsigned long long)first, (unsigned long long)last,
+                 (unsigned long long)len);
+        http_add_header(conn, "Content-Range", value);
     }
-    
-    freeaddrinfo(res);
-    
-    if ( listen (listenfd, 1000000) != 0 )
+    http_add_header(conn, "Accept-Ranges", "bytes");
+    http_set_length(conn, last - first + 1);
+    http_write(conn, ks->buf, got);
+    ks->next += got;
+    if (ks->next == ks->end)
+        free(ks);
+    else
+        http_stream(conn, kmem_produce, free, ks);
+}
+
+// the process list out of the snapshot in proc_list.c, ?format=json and ?max_age=<ms> (0 for a fresh one)
+static void info_respond(struct http_conn* conn, struct http_request* req)
+{
+    const char *q = req->query;
+    int json = strstr(q, "format=json") != NULL;
+    const char *age = strstr(q, "max_age=");
+    uint32_t max_age = age ? (uint32_t)strtoul(age + 8, NULL, 10) : PROC_LIST_MAX_AGE_MS;
+    struct proc_list *list = proc_list_get(ws_tfp0, max_age);
+    if (list == NULL)
     {
-        printf("listen() error");
-        exit(1);
+        http_begin(conn, 500, "text/plain");
+        http_printf(conn, "couldn't walk the process list\n");
+        return;
     }
+    char value[32];
+    snprintf(value, sizeof(value), "%llu", (unsigned long long)proc_list_age(list));
+    http_begin(conn, 200, json ? "application/json" : "text/html");
+    http_add_header(conn, "X-Snapshot-Age", value);
+    if (json)
+        http_write(conn, list->json, list->json_len);
+    else
+        http_write(conn, list->html, list->html_len);
+    proc_list_release(list);
 }
 
-//client connection
+void init_ws(mach_port_t tfp0, uint64_t kernel_base)
+{
+    ws_tfp0 = tfp0;
+    ws_kernel_base = kernel_base;
+}
 
-int respond(int n, mach_port_t tfp0)
+// the server's counters and each endpoint's queue, as JSON
+static void stats_respond(struct http_conn* conn)
+{
+    struct http_server *server = http_conn_server(conn);
+    struct http_stats st;
+    struct http_endpoint_stats ep;
+    http_server_stats(server, &st);
+    http_begin(conn, 200, "application/json");
+    http_printf(conn, "{\"responses\":%llu,\"bytes\":%llu,\"syscalls\":%llu,\"deferred\":%llu,"
+                "\"queue_depth\":%u,\"max_queue_depth\":%u,\"endpoints\":[",
+                (unsigned long long)st.responses, (unsigned long long)st.bytes, (unsigned long long)st.syscalls,
+                (unsigned long long)st.deferred, st.queue_depth, st.max_queue_depth);
+    for (int i = 0; http_endpoint_stats(server, i, &ep) == 0; i++)
+    {
+        http_printf(conn, "%s{\"name\":\"%s\",\"limit\":%d,\"active\":%d,\"waiting\":%d,\"max_waiting\":%d,"
+                    "\"requests\":%llu,\"worker_us\":%llu}", i ? "," : "", ep.name, ep.limit, ep.active,
+                    ep.waiting, ep.max_waiting, (unsigned long long)ep.requests, (unsigned long long)ep.worker_us);
+    }
+    http_printf(conn, "]}\n");
+}
 
+// on a worker thread, everything that can block on the filesystem or kernel memory
+static void respond_blocking(struct http_conn* conn, struct http_request* req, void* ctx)
 {
-    char mesg[99999], *reqline[3], data_to_send[BYTES], path[99999];
-    ssize_t rcvd, bytes_read;
-    int fd;
-    int reclaim = 0;
-    
-    memset( (void*)mesg, (int)'\0', 99999 );
-    
-    rcvd=recv(clients[n], mesg, 99999, 0);
-    
-    if (rcvd<0)    // receive error
-        fprintf(stderr,("recv() error\n"));
-    else if (rcvd==0)    // receive socket closed
-        fprintf(stderr,"Client disconnected upexpectedly.\n");
-    else    // message received
+    mach_port_t tfp0 = ws_tfp0;
+    char *path = req->path;
+    (void)ctx;
+
+    if (strncmp(path, "/dump_ptr=", 0xa) == 0)
+    {
+        // convert the argument to ull
+        uint64_t addr = strtoull(path + 0xa, (char **)NULL, 0x10);
+        printf("Dumping pointer 0x%llx\n", addr);
+        char *html = dump_pointer_html(tfp0, addr, 0x200);
+        http_begin(conn, 200, "text/html");
+        http_write(conn, html, strlen(html));
+        free(html);
+    } else if (strncmp(path, "/kmem=", 6) == 0)
+    {
+        // raw, for pulling megabytes of heap: curl -o heap.bin http://device/kmem=fffffff007004000,100000
+        kmem_respond(conn, req, path + 6);
+    } else if (strncmp(path, "/tar=", 5) == 0)
+    {
+        // the whole tree in one go, wget -O jailbreak.tar http://device/tar=/jailbreak
+        printf("tar of %s\n", path + 5);
+        http_begin(conn, 200, "application/x-tar");
+        if (tar_stream(conn, path + 5) != 0)
+        {
+            http_begin(conn, 404, "text/plain");
+            http_write(conn, "Not Found\n", 10);
+        }
+    } else if (strncmp(path, "/info", 5) == 0)
     {
-        printf("%s", mesg);
-        reqline[0] = strtok (mesg, " \t\n");
-        if (strncmp(reqline[0], "GET\0", 4) == 0)
+        info_respond(conn, req);
+    } else if (path[0] && path[strlen(path)-1] == '/') // if it ends with a slash
+    {
+        printf("get a directory listing\n");
+        http_ls(conn, req);
+    } else {
+        char file[0x1000];
+        struct stat st;
+        int fd = -1;
+        if (snprintf(file, sizeof(file), "%s%s", ROOT, path) < (int)sizeof(file))
+            fd = open(file, O_RDONLY);
+        printf("file: %s\n", file);
+        if (fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode))    //FILE FOUND
         {
-            reqline[1] = strtok (NULL, " \t");
-            if (strstr(reqline[1], "%20"))
-            {
-                // let's strip out %20's
-                char *tmp = malloc(0x2000);
-                char *f = reqline[1];
-                int i, cont = 0, j=0;
-                for (i=0; i < strlen(f); i++)
-                {
-                    //printf("cont=%d\n", cont);
-                    if (!cont)
-                    {
-                        if (f[i] == '%')
-                        {
-                            tmp[j++] = ' ';
-                            cont = 2;
-                        } else {
-                            tmp[j++] = f[i];
-                        }
-                    } else {
-                        cont--;
-                    }
-                    
-                }
-                tmp[j] = 0;
-                //printf("I've stripped all the spaces from [%s] and now it is [%s]\n", f, tmp);
-                reqline[1] = tmp;
-                reclaim = 1;
-            }
-            reqline[2] = strtok (NULL, " \t\n");
-            if ((strncmp(reqline[2], "HTTP/1.0", 8) != 0) && (strncmp(reqline[2], "HTTP/1.1", 8) != 0))
-            {
-                write(clients[n], "HTTP/1.0 400 Bad Request\n", 25);
-            }
-            else
-            {
-                if (strncmp(reqline[1], "/urlmode\0", 7) == 0)
-                {
-                    char *redirect = "<html><script>window.location = document.referrer;</script></html>";
-                    urlmode ^= 1;
-                    send(clients[n], "HTTP/1.0 200 OK\n\n", 17, 0);
-                    send(clients[n], redirect, strlen(redirect), 0);
-                }
-                if (strncmp(reqline[1], "/exit\0", 6) == 0)
-                {
-                    printf("Get exit, shutting down\n");
-                    //free(reqline[1]); // it's ok to leak
-                    return 0;
-                }
-                if (strncmp(reqline[1], "/dump_ptr=", 0xa) == 0)
-                {
-                    uint32_t sz;
-                    uint64_t index = 0;
-                    // convert the argument to ull
-                    uint64_t addr = strtoull((char *)(reqline[1] + 0xa), (char **)NULL, 0x10);
-                    printf("Dumping pointer 0x%llx\n", addr);
-                    char *html = 0;
-                    html = dump_pointer_html(tfp0, addr, 0x200);
-                    sz = (uint32_t)strlen(html);
-                    send(clients[n], "HTTP/1.0 200 OK\n\n", 17, 0);
-                    while ( index < (sz - 1))
-                    {
-                        write(clients[n], &html[index], 1);
-                        index++;
-                    }
-                    if (html)
-                        free(html);
-                } else if (strncmp(reqline[1], "/info", 5) == 0)
-                {
-                    send(clients[n], "HTTP/1.0 200 OK\n\n", 17, 0);
-                    ps_html(clients[n]);
-                } else {
-                    printf("GOT THE FOLLOWING REQUEST: [%s]\n", &reqline[1][strlen(reqline[1])-1]);
-                    if (strncmp(&reqline[1][strlen(reqline[1])-1], "/\0", 2) == 0) // if it ends with a slash
-                    {
-                        printf("get a directory listing\n");
-                        uint32_t sz;
-                        uint64_t index;
-                        char *data;
-                        data = http_ls(reqline[1], &sz);
-                        send(clients[n], "HTTP/1.0 200 OK\n\n", 17, 0);
-                        index = 0;
-                        while ( index < (sz - 1))
-                        {
-                            write(clients[n], &data[index], 1);
-                            index++;
-                        }
-                        if (data)
-                            free(data);
-                    } else {
-                        strcpy(path, ROOT);
-                        strcpy(&path[strlen(ROOT)], reqline[1]);
-                        printf("file: %s\n", path);
-                        if ((fd=open(path, O_RDONLY)) !=- 1)    //FILE FOUND
-                        {
-                            send(clients[n], "HTTP/1.0 200 OK\n\n", 17, 0);
-                            while ( (bytes_read=read(fd, data_to_send, BYTES)) > 0 )
-                                write (clients[n], data_to_send, bytes_read);
-                            close(fd);
-                        } else {
-                            write(clients[n], "HTTP/1.0 404 Not Found\n", 23);
-                        }
-                    }
-                }
-            }
+            // sendfile, with Range, ETag and If-Modified-Since so big dumps can be resumed
+            http_respond_file(conn, req, fd, "application/octet-stream");
+        } else {
+            if (fd != -1)
+                close(fd);
+            http_begin(conn, 404, "text/plain");
+            http_write(conn, "Not Found\n", 10);
         }
     }
-    if (reclaim)
-        free(reqline[1]);
-    shutdown(clients[n], SHUT_RDWR);
-    close(clients[n]);
-    clients[n]=-1;
-    return 1;
+}
+
+//client connection, on the event loop so anything slow gets deferred to the workers
+static void respond(struct http_conn* conn, struct http_request* req, void* ctx)
+{
+    char *path = req->path;
+    (void)ctx;
+
+    if (strcmp(path, "/urlmode") == 0)
+    {
+        char *redirect = "<html><script>window.location = document.referrer;</script></html>";
+        urlmode ^= 1;
+        http_begin(conn, 200, "text/html");
+        http_write(conn, redirect, strlen(redirect));
+    } else if (strcmp(path, "/exit") == 0)
+    {
+        printf("Get exit, shutting down\n");
+        http_begin(conn, 200, "text/plain");
+        http_write(conn, "bye\n", 4);
+        http_server_stop(http_conn_server(conn));
+    } else if (strcmp(path, "/stats") == 0)
+    {
+        stats_respond(conn);
+    } else if (strncmp(path, "/dump_ptr=", 0xa) == 0 || strncmp(path, "/kmem=", 6) == 0 || strncmp(path, "/info", 5) == 0)
+    {
+        http_defer(conn, ep_kmem, respond_blocking, NULL);
+    } else if (strncmp(path, "/tar=", 5) == 0)
+    {
+        http_defer(conn, ep_tar, respond_blocking, NULL);
+    } else if (path[0] && path[strlen(path)-1] == '/')
+    {
+        http_defer(conn, ep_ls, respond_blocking, NULL);
+    } else {
+        http_defer(conn, ep_files, respond_blocking, NULL);
+    }
+}
+
+void* wsmain(void* not_used_damn_you_pthread)
+{
+    //Default Values PATH = / and PORT=80
+    char *PORT = "80";
+    struct http_server_options opts = {0};
+    opts.port = PORT;
+    opts.handler = respond;
+    
+    // one thread, every client is multiplexed on the event loop so a slow one doesn't hold up the rest.
+    // What blocks goes to the workers, the tar walkers are threads of their own so two of those is plenty
+    struct http_server *server = http_server_create(&opts);
+    if (server == NULL)
+        exit(1);
+    ep_kmem = http_server_endpoint(server, "kmem", 2);
+    ep_ls = http_server_endpoint(server, "ls", 4);
+    ep_files = http_server_endpoint(server, "files", 4);
+    ep_tar = http_server_endpoint(server, "tar", 2);
+    printf("Server started at port no. %s with root directory as %s\n",PORT,ROOT);
+    http_server_run(server);
+    http_server_free(server);
+    return not_used_damn_you_pthread;
 }
@@ -1,7 +1,7 @@
 #!/bin/bash
 `xcrun -sdk iphoneos -find clang` -Os -isysroot `xcrun -sdk iphoneos -show-sdk-path` -F`xcrun -sdk iphoneos -show-sdk-path`/System/Library/Frameworks -arch arm64 helloworld.c -o helloworld
-jtool --sign --inplace --ent ent.xml helloworld
+../utilities/adhocsign -e ent.xml helloworld
 
 
-`xcrun -sdk iphoneos -find clang` -Os -isysroot `xcrun -sdk iphoneos -show-sdk-path` -F`xcrun -sdk iphoneos -show-sdk-path`/System/Library/Frameworks -arch arm64 -I../async_wake_ios ../async_wake_ios/find_port.c ../async_wake_ios/symbols.c ../async_wake_ios/kmem.c ../async_wake_ios/kutils.c ../async_wake_ios/sha256.c ../async_wake_ios/code_hiding_for_sanity.c  tfp0.c -o tfp0
-jtool --sign --inplace --ent ent.xml tfp0
\ No newline at end of file
+`xcrun -sdk iphoneos -find clang` -Os -isysroot `xcrun -sdk iphoneos -show-sdk-path` -F`xcrun -sdk iphoneos -show-sdk-path`/System/Library/Frameworks -arch arm64 -I../async_wake_ios ../async_wake_ios/find_port.c ../async_wake_ios/symbols.c ../async_wake_ios/kernel_image.c ../async_wake_ios/find_offsets.c ../async_wake_ios/kext_map.c ../async_wake_ios/symbolicator.c ../async_wake_ios/kmem.c ../async_wake_ios/kutils.c ../async_wake_ios/sha1.c ../async_wake_ios/sha256.c ../async_wake_ios/sha512.c ../async_wake_ios/codesign.c ../async_wake_ios/cdhash_cache.c ../async_wake_ios/entitlements.c ../async_wake_ios/hexdump.c ../async_wake_ios/code_hiding_for_sanity.c  tfp0.c -o tfp0
+../utilities/adhocsign -e ent.xml tfp0
\ No newline at end of file
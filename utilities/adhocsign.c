@@ -0,0 +1,130 @@
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "adhoc_sign.h"
+#include "codesign.h"
+
+/*
+
+Ad-hoc signs binaries in place with entitlements, instead of `jtool --sign --inplace --ent`.
+Runs on Linux or macOS, from the utilities folder:
+cc -O2 -pthread -I../async_wake_ios ../async_wake_ios/sha1.c ../async_wake_ios/sha256.c ../async_wake_ios/sha512.c ../async_wake_ios/codesign.c ../async_wake_ios/adhoc_sign.c adhocsign.c -o adhocsign
+./adhocsign [-i identifier] [-e entitlements.xml] [-j threads] binary...
+
+The identifier defaults to the binary's file name.
+
+*/
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t* read_entitlements(const char* path, size_t* len)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        printf("[-]\tcan't open %s\n", path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* buf = size > 0 ? malloc(size) : NULL;
+    if (buf == NULL || fread(buf, 1, size, f) != (size_t)size)
+    {
+        printf("[-]\tcan't read %s\n", path);
+        free(buf);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    *len = size;
+    return buf;
+}
+
+int main(int argc, char** argv)
+{
+    struct adhoc_sign_options opts = {0};
+    const char* identifier = NULL;
+    uint8_t* entitlements = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:e:j:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'i':
+                identifier = optarg;
+                break;
+            case 'e':
+                entitlements = read_entitlements(optarg, &opts.entitlements_len);
+                if (entitlements == NULL)
+                {
+                    return 1;
+                }
+                opts.entitlements = entitlements;
+                break;
+            case 'j':
+                opts.threads = atoi(optarg);
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+    if (optind >= argc)
+    {
+        printf("usage: %s [-i identifier] [-e entitlements.xml] [-j threads] binary...\n", argv[0]);
+        return 1;
+    }
+
+    int failed = 0;
+    for (int i = optind; i < argc; i++)
+    {
+        const char* name = strrchr(argv[i], '/');
+        opts.identifier = identifier ? identifier : name ? name + 1 : argv[i];
+
+        double start = now();
+        if (adhoc_sign_file(argv[i], &opts))
+        {
+            failed = 1;
+            continue;
+        }
+        double elapsed = now() - start;
+
+        // read it back with the same parser amfid's handler uses
+        struct cs_file cs;
+        struct cs_code_directory cd;
+        uint8_t cdhash[CS_CDHASH_LEN];
+        if (cs_file_open(&cs, argv[i]))
+        {
+            failed = 1;
+            continue;
+        }
+        if (cs_best_code_directory(cs.sig, cs.sig_size, &cd) || cs_cdhash(&cd, cdhash))
+        {
+            printf("[-]\tcan't parse the signature written to %s\n", argv[i]);
+            cs_file_close(&cs);
+            failed = 1;
+            continue;
+        }
+        printf("[+]\tsigned %s as %s, %u pages in %.3fs (%.0f MB/s), cdhash ", argv[i], cd.identifier,
+               cd.n_code_slots, elapsed, cd.code_limit / elapsed / 1e6);
+        for (int j = 0; j < CS_CDHASH_LEN; j++)
+        {
+            printf("%02x", cdhash[j]);
+        }
+        printf("\n");
+        cs_file_close(&cs);
+    }
+    free(entitlements);
+    return failed;
+}
@@ -0,0 +1,921 @@
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "codesign.h"
+#include "cdhash_cache.h"
+#include "adhoc_sign.h"
+#include "sha256.h"
+
+/*
+
+Code signing hot paths over a corpus of Mach-O files, e.g. a directory of binaries pulled out of an
+IPSW. Doesn't need a device, from the utilities folder on Linux or macOS:
+cc -O2 -pthread -I../async_wake_ios ../async_wake_ios/sha1.c ../async_wake_ios/sha256.c ../async_wake_ios/sha512.c ../async_wake_ios/codesign.c ../async_wake_ios/cdhash_cache.c ../async_wake_ios/adhoc_sign.c codesign_bench.c -o codesign_bench
+./codesign_bench -g directory                      generates a corpus of thin and FAT binaries, 32K to 16M
+./codesign_bench [-n iterations] file-or-directory...
+
+locate: reading the whole binary (what get_binary_hash used to do) against cs_file_open
+verify: reading the whole binary then hashing every page against cs_verify_file streaming it, then
+the early exit on a copy of the biggest binary with a page corrupted
+sha256: sha256_update on code page and CodeDirectory sized inputs
+parse: finding and parsing the CodeDirectories of signatures already in memory (what cdhash.c calls)
+amfid: get_binary_hash end to end (cdhash_cache_hash_file) on a miss split into I/O, parse and hash,
+then a miss that persists the cache and a hit
+cache: lookup and insert on their own, no stat and no file
+
+Latencies are per call. Allocations are counted on glibc by wrapping malloc, elsewhere they show as -.
+
+*/
+
+static FILE* out;
+static char** corpus;
+static size_t corpus_count;
+static size_t corpus_capacity;
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* p, size_t size);
+static unsigned long allocations;
+
+void* malloc(size_t size)
+{
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+    allocations++;
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size)
+{
+    allocations++;
+    return __libc_realloc(p, size);
+}
+#define COUNTS_ALLOCATIONS 1
+#else
+static unsigned long allocations;
+#define COUNTS_ALLOCATIONS 0
+#endif
+
+struct samples
+{
+    double* us;
+    size_t n;
+    size_t capacity;
+    unsigned long long calls;
+    double total_us;
+    unsigned long long bytes;       // over all the calls, like allocations
+    unsigned long allocations;
+};
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long max_rss_kb()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024;
+#else
+    return ru.ru_maxrss;
+#endif
+}
+
+// calls is how many calls start to end covered, short ones are timed in batches so the clock isn't
+// most of what's measured
+static void sample(struct samples* s, double start, double end, int calls)
+{
+    if (s->n == s->capacity)
+    {
+        s->capacity = s->capacity ? s->capacity * 2 : 1024;
+        s->us = realloc(s->us, s->capacity * sizeof(double));
+    }
+    s->us[s->n++] = (end - start) * 1e6 / calls;
+    s->calls += calls;
+    s->total_us += (end - start) * 1e6;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void report_header(const char* section)
+{
+    fprintf(out, "\n%-24s%10s%10s%10s%10s%10s%11s\n", section, "p50 us", "p90 us", "p99 us", "max us", "MB/s", "allocs/op");
+}
+
+// the distribution of what's in s, then empties it
+static void report(const char* name, struct samples* s)
+{
+    if (s->n == 0)
+    {
+        return;
+    }
+    qsort(s->us, s->n, sizeof(double), compare_doubles);
+    fprintf(out, "%-24s%10.2f%10.2f%10.2f%10.2f", name, s->us[s->n / 2], s->us[s->n * 9 / 10], s->us[s->n * 99 / 100], s->us[s->n - 1]);
+    if (s->bytes)
+    {
+        fprintf(out, "%10.0f", s->bytes / s->total_us);
+    } else {
+        fprintf(out, "%10s", "-");
+    }
+    if (COUNTS_ALLOCATIONS)
+    {
+        fprintf(out, "%11.2f\n", (double)s->allocations / s->calls);
+    } else {
+        fprintf(out, "%11s\n", "-");
+    }
+    s->n = 0;
+    s->calls = 0;
+    s->total_us = 0;
+    s->bytes = 0;
+    s->allocations = 0;
+}
+
+static int add_file(const char* path, const struct stat* st, int type, struct FTW* ftw)
+{
+    (void)ftw;
+    if (type != FTW_F || st->st_size < 0x20)
+    {
+        return 0;
+    }
+    uint32_t magic = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return 0;
+    }
+    ssize_t n = read(fd, &magic, sizeof(magic));
+    close(fd);
+    // thin arm64, or universal which is big endian on disk
+    if (n != sizeof(magic) || (magic != 0xfeedfacf && magic != 0xbebafeca && magic != 0xbfbafeca))
+    {
+        return 0;
+    }
+    if (corpus_count == corpus_capacity)
+    {
+        corpus_capacity = corpus_capacity ? corpus_capacity * 2 : 64;
+        corpus = realloc(corpus, corpus_capacity * sizeof(char*));
+    }
+    corpus[corpus_count++] = strdup(path);
+    return 0;
+}
+
+// the old way, the whole binary into a heap buffer and a walk of the load commands
+static int locate_by_reading(const char* path, unsigned long long* bytes)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return 1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    uint8_t* buf = malloc(st.st_size);
+    ssize_t n = buf ? read(fd, buf, st.st_size) : -1;
+    close(fd);
+    if (n != st.st_size)
+    {
+        free(buf);
+        return 1;
+    }
+    *bytes += st.st_size;
+
+    uint32_t ncmds = *(uint32_t*)(buf + 0x10);
+    uint8_t* cmd = buf + 0x20;
+    int found = 0;
+    for (uint32_t i = 0; i < ncmds && cmd + 8 <= buf + st.st_size; i++)
+    {
+        if (*(uint32_t*)cmd == 0x1d)
+        {
+            found = 1;
+            break;
+        }
+        cmd += *(uint32_t*)(cmd + 4);
+    }
+    free(buf);
+    return !found;
+}
+
+static int locate_by_mapping(const char* path, unsigned long long* bytes)
+{
+    struct cs_file cs;
+    if (cs_file_open(&cs, path))
+    {
+        return 1;
+    }
+    *bytes += cs.map_size;
+    cs_file_close(&cs);
+    return 0;
+}
+
+static void bench_locate(int iterations)
+{
+    struct {
+        const char* name;
+        int (*locate)(const char*, unsigned long long*);
+    } methods[] = {
+        {"read", locate_by_reading},
+        {"mmap", locate_by_mapping},
+    };
+
+    fprintf(out, "%-8s%12s%12s%16s%14s\n", "locate", "files/s", "us/file", "bytes touched", "max rss KB");
+    for (int m = 0; m < 2; m++)
+    {
+        // each method in its own process so max rss is its own
+        fflush(out);
+        pid_t pid = fork();
+        if (pid != 0)
+        {
+            waitpid(pid, NULL, 0);
+            continue;
+        }
+        unsigned long long bytes = 0;
+        int failures = 0;
+        double start = now();
+        for (int it = 0; it < iterations; it++)
+        {
+            for (size_t i = 0; i < corpus_count; i++)
+            {
+                failures += methods[m].locate(corpus[i], &bytes);
+            }
+        }
+        double elapsed = now() - start;
+        double files = (double)iterations * corpus_count;
+        fprintf(out, "%-8s%12.0f%12.2f%16llu%14ld", methods[m].name, files / elapsed, elapsed / files * 1e6,
+                bytes / iterations, max_rss_kb());
+        if (failures)
+        {
+            fprintf(out, "  (%d unsigned)", failures / iterations);
+        }
+        fprintf(out, "\n");
+        fflush(out);
+        _exit(0);
+    }
+}
+
+// the obvious way, the whole slice into memory and then every page hashed
+static int verify_by_reading(const char* path, unsigned long long* bytes)
+{
+    struct cs_file cs;
+    struct cs_code_directory cd;
+    if (cs_file_open(&cs, path) || cs_best_code_directory(cs.sig, cs.sig_size, &cd) || cd.page_shift == 0)
+    {
+        cs_file_close(&cs);
+        return 1;
+    }
+    uint8_t* buf = malloc(cd.code_limit);
+    int fd = open(path, O_RDONLY);
+    ssize_t n = buf && fd != -1 ? pread(fd, buf, cd.code_limit, cs.slice_offset) : -1;
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    int bad = n != (ssize_t)cd.code_limit;
+    uint64_t page_size = 1ULL << cd.page_shift;
+    for (uint32_t i = 0; !bad && i < cd.n_code_slots; i++)
+    {
+        uint8_t hash[CS_HASH_MAX_SIZE];
+        uint64_t offset = (uint64_t)i << cd.page_shift;
+        uint64_t len = cd.code_limit - offset < page_size ? cd.code_limit - offset : page_size;
+        cs_hash(cd.hash_type, buf + offset, len, hash);
+        bad = memcmp(hash, cd.blob + cd.hash_offset + i * cd.hash_size, cd.hash_size) != 0;
+    }
+    *bytes += cd.code_limit;
+    free(buf);
+    cs_file_close(&cs);
+    return bad;
+}
+
+static int verify_by_streaming(const char* path, unsigned long long* bytes)
+{
+    struct cs_verify_result result;
+    int err = cs_verify_file(path, 0, &result);
+    *bytes += result.bytes_read;
+    return err;
+}
+
+// a copy of path with one byte flipped in the given code page, counted from the start of the slice
+static char* corrupt_copy(const char* path, uint64_t slice_offset, uint64_t page_size, uint32_t page)
+{
+    static char copy[sizeof("/tmp/codesign_bench.XXXXXX")];
+    strcpy(copy, "/tmp/codesign_bench.XXXXXX");
+    int out_fd = mkstemp(copy);
+    int in_fd = open(path, O_RDONLY);
+    if (out_fd == -1 || in_fd == -1)
+    {
+        return NULL;
+    }
+    char buf[0x10000];
+    ssize_t n;
+    while ((n = read(in_fd, buf, sizeof(buf))) > 0)
+    {
+        write(out_fd, buf, n);
+    }
+    off_t offset = slice_offset + page * page_size + 0x80;
+    uint8_t byte = 0;
+    pread(out_fd, &byte, 1, offset);
+    byte ^= 0xff;
+    pwrite(out_fd, &byte, 1, offset);
+    close(in_fd);
+    close(out_fd);
+    return copy;
+}
+
+static double time_verify(const char* path, int iterations)
+{
+    double start = now();
+    for (int it = 0; it < iterations; it++)
+    {
+        struct cs_verify_result result;
+        cs_verify_file(path, 0, &result);
+    }
+    return (now() - start) / iterations;
+}
+
+static void bench_verify(int iterations)
+{
+    struct {
+        const char* name;
+        int (*verify)(const char*, unsigned long long*);
+    } methods[] = {
+        {"read", verify_by_reading},
+        {"stream", verify_by_streaming},
+    };
+
+    fprintf(out, "\n%-8s%12s%12s%16s%14s\n", "verify", "MB/s", "ms/file", "bytes hashed", "max rss KB");
+    for (int m = 0; m < 2; m++)
+    {
+        fflush(out);
+        pid_t pid = fork();
+        if (pid != 0)
+        {
+            waitpid(pid, NULL, 0);
+            continue;
+        }
+        unsigned long long bytes = 0;
+        int failures = 0;
+        double start = now();
+        for (int it = 0; it < iterations; it++)
+        {
+            for (size_t i = 0; i < corpus_count; i++)
+            {
+                failures += methods[m].verify(corpus[i], &bytes);
+            }
+        }
+        double elapsed = now() - start;
+        double files = (double)iterations * corpus_count;
+        fprintf(out, "%-8s%12.0f%12.3f%16llu%14ld", methods[m].name, bytes / elapsed / 1e6, elapsed / files * 1e3,
+                bytes / iterations, max_rss_kb());
+        if (failures)
+        {
+            fprintf(out, "  (%d failed)", failures / iterations);
+        }
+        fprintf(out, "\n");
+        fflush(out);
+        _exit(0);
+    }
+
+    // the early exit on the biggest binary, a bad page near the start costs next to nothing
+    const char* largest = NULL;
+    off_t largest_size = 0;
+    for (size_t i = 0; i < corpus_count; i++)
+    {
+        struct stat st;
+        if (!stat(corpus[i], &st) && st.st_size > largest_size)
+        {
+            largest = corpus[i];
+            largest_size = st.st_size;
+        }
+    }
+    // pages are counted from the arm64 slice, which in a FAT file is a way in
+    struct cs_file cs;
+    struct cs_code_directory cd;
+    if (largest == NULL || cs_file_open(&cs, largest))
+    {
+        return;
+    }
+    uint64_t slice_offset = cs.slice_offset;
+    int err = cs_best_code_directory(cs.sig, cs.sig_size, &cd);
+    cs_file_close(&cs);
+    if (err)
+    {
+        return;
+    }
+    fprintf(out, "\n%s, %.1f MB\n", largest, largest_size / 1e6);
+    fprintf(out, "%-24s%10.3f ms\n", "intact", time_verify(largest, iterations) * 1e3);
+    uint32_t pages[] = {1, cd.n_code_slots / 2};
+    const char* names[] = {"bad page 1", "bad page in the middle"};
+    for (int i = 0; i < 2; i++)
+    {
+        char* copy = corrupt_copy(largest, slice_offset, (uint64_t)1 << cd.page_shift, pages[i]);
+        if (copy == NULL)
+        {
+            continue;
+        }
+        // make sure it's the page that got flipped being timed, not padding nobody hashes
+        struct cs_verify_result result;
+        if (cs_verify_file(copy, 0, &result) == 0 || result.n_bad == 0 || result.bad_pages[0] != pages[i])
+        {
+            fprintf(out, "%-24s  [-] page %u was flipped but verify didn't stop there\n", names[i], pages[i]);
+        } else {
+            fprintf(out, "%-24s%10.3f ms  (%u of %u pages checked)\n", names[i], time_verify(copy, iterations) * 1e3,
+                    result.pages_checked, result.n_pages);
+        }
+        unlink(copy);
+    }
+}
+
+static void put_le32(uint8_t* p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void put_le64(uint8_t* p, uint64_t v)
+{
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static void put_be32(uint8_t* p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void put_segment(uint8_t* cmd, const char* name, uint64_t fileoff, uint64_t filesize)
+{
+    put_le32(cmd, 0x19);    // LC_SEGMENT_64
+    put_le32(cmd + 4, 72);
+    strncpy((char*)cmd + 8, name, 16);
+    put_le64(cmd + 24, 0x100000000ULL + fileoff);
+    put_le64(cmd + 32, filesize);
+    put_le64(cmd + 40, fileoff);
+    put_le64(cmd + 48, filesize);
+    put_le32(cmd + 56, 5);
+    put_le32(cmd + 60, 5);
+}
+
+// an unsigned arm64 executable, a header then __TEXT full of noise then __LINKEDIT
+static uint8_t* skeleton(size_t size, uint64_t* seed)
+{
+    uint8_t* macho = calloc(1, size);
+    if (macho == NULL)
+    {
+        return NULL;
+    }
+    put_le32(macho, 0xfeedfacf);
+    put_le32(macho + 4, 0x0100000c);    // CPU_TYPE_ARM64
+    put_le32(macho + 0xc, 2);           // MH_EXECUTE
+    put_le32(macho + 0x10, 2);
+    put_le32(macho + 0x14, 2 * 72);
+    put_segment(macho + 0x20, "__TEXT", 0, size - 0x4000);
+    put_segment(macho + 0x20 + 72, "__LINKEDIT", size - 0x4000, 0x4000);
+    for (size_t i = 0x1000; i + 8 <= size; i += 8)
+    {
+        *seed ^= *seed << 13;
+        *seed ^= *seed >> 7;
+        *seed ^= *seed << 17;
+        memcpy(macho + i, seed, 8);
+    }
+    return macho;
+}
+
+static int write_file(const char* dir, const char* kind, size_t size, const uint8_t* a, size_t a_size,
+                      const uint8_t* b, size_t b_size, uint64_t b_offset)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s_%zuk", dir, kind, size >> 10);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+    if (fd == -1)
+    {
+        printf("[-]\tcan't create %s\n", path);
+        return 1;
+    }
+    int err = pwrite(fd, a, a_size, 0) != (ssize_t)a_size;
+    if (b != NULL && !err)
+    {
+        err = pwrite(fd, b, b_size, b_offset) != (ssize_t)b_size;
+    }
+    close(fd);
+    if (err)
+    {
+        printf("[-]\tcan't write %s\n", path);
+    }
+    return err;
+}
+
+// thin, thin with entitlements and universal versions of binaries from 32K to 16M, signed in tree
+static int generate(const char* dir)
+{
+    static const char entitlements[] =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<plist version=\"1.0\">\n<dict>\n"
+        "\t<key>platform-application</key>\n\t<true/>\n"
+        "\t<key>com.apple.private.security.no-container</key>\n\t<true/>\n"
+        "</dict>\n</plist>\n";
+    mkdir(dir, 0755);
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    int files = 0;
+    for (size_t size = 0x4000 * 2; size <= 0x1000000; size *= 2)
+    {
+        uint8_t* macho = skeleton(size, &seed);
+        if (macho == NULL)
+        {
+            return 1;
+        }
+        for (int ents = 0; ents < 2; ents++)
+        {
+            struct adhoc_sign_options opts = {0};
+            opts.identifier = ents ? "com.example.bench-ents" : "com.example.bench";
+            opts.entitlements = ents ? (const uint8_t*)entitlements : NULL;
+            opts.entitlements_len = ents ? sizeof(entitlements) - 1 : 0;
+            size_t signed_size = adhoc_sign_size(macho, size, &opts);
+            uint8_t* signed_macho = signed_size ? malloc(signed_size) : NULL;
+            if (signed_macho == NULL || adhoc_sign(macho, size, &opts, signed_macho, signed_size))
+            {
+                printf("[-]\tcan't sign the %zuK skeleton\n", size >> 10);
+                free(signed_macho);
+                free(macho);
+                return 1;
+            }
+            int err = write_file(dir, ents ? "thin_ents" : "thin", size, signed_macho, signed_size, NULL, 0, 0);
+            if (!ents && !err)
+            {
+                // an armv7 slice that's only a header, then the arm64 one page aligned after it
+                uint8_t fat[0x4000 + 0x1c] = {0};
+                put_be32(fat, 0xcafebabe);
+                put_be32(fat + 4, 2);
+                put_be32(fat + 8, 12);          // CPU_TYPE_ARM
+                put_be32(fat + 12, 9);
+                put_be32(fat + 16, 0x4000);
+                put_be32(fat + 20, 0x1c);
+                put_be32(fat + 24, 14);
+                put_be32(fat + 28, 0x0100000c);
+                put_be32(fat + 32, 0);
+                put_be32(fat + 36, 0x8000);
+                put_be32(fat + 40, (uint32_t)signed_size);
+                put_be32(fat + 44, 14);
+                put_le32(fat + 0x4000, 0xfeedface);
+                put_le32(fat + 0x4004, 12);
+                err = write_file(dir, "fat", size, fat, sizeof(fat), signed_macho, signed_size, 0x8000);
+            }
+            free(signed_macho);
+            if (err)
+            {
+                free(macho);
+                return 1;
+            }
+            files += ents ? 1 : 2;
+        }
+        free(macho);
+    }
+    printf("[+]\t%d signed binaries in %s\n", files, dir);
+    return 0;
+}
+
+static void bench_sha256(int iterations)
+{
+    size_t sizes[] = {64, 1024, 4096, 65536};
+    const char* names[] = {"update 64", "update 1K", "update 4K", "update 64K"};
+    uint8_t* buf = malloc(65536);
+    for (int i = 0; i < 65536; i++)
+    {
+        buf[i] = (uint8_t)(i * 31);
+    }
+    struct samples s = {0};
+    char section[64];
+    snprintf(section, sizeof(section), "sha256 (%s)", sha256_backend());
+    report_header(section);
+    for (int i = 0; i < 4; i++)
+    {
+        // at least 64K a sample and 4M a pass
+        int batch = (int)(65536 / sizes[i]);
+        for (int it = 0; it < iterations; it++)
+        {
+            SHA256_CTX ctx;
+            sha256_init(&ctx);
+            for (int j = 0; j < 64; j++)
+            {
+                unsigned long a = allocations;
+                double start = now();
+                for (int k = 0; k < batch; k++)
+                {
+                    sha256_update(&ctx, buf, sizes[i]);
+                }
+                double end = now();
+                s.allocations += allocations - a;
+                s.bytes += batch * sizes[i];
+                sample(&s, start, end, batch);
+            }
+        }
+        report(names[i], &s);
+    }
+    free(s.us);
+    free(buf);
+}
+
+// the signatures copied out of the corpus, so nothing but parsing and hashing is measured
+static void bench_parse(int iterations)
+{
+    uint8_t** sigs = calloc(corpus_count, sizeof(uint8_t*));
+    uint32_t* sig_sizes = calloc(corpus_count, sizeof(uint32_t));
+    for (size_t i = 0; i < corpus_count; i++)
+    {
+        struct cs_file cs;
+        if (cs_file_open(&cs, corpus[i]))
+        {
+            continue;
+        }
+        sigs[i] = malloc(cs.sig_size);
+        memcpy(sigs[i], cs.sig, cs.sig_size);
+        sig_sizes[i] = cs.sig_size;
+        cs_file_close(&cs);
+    }
+
+    struct samples parse = {0};
+    struct samples hash = {0};
+    for (int it = 0; it < iterations; it++)
+    {
+        for (size_t i = 0; i < corpus_count; i++)
+        {
+            if (sigs[i] == NULL)
+            {
+                continue;
+            }
+            struct cs_code_directory cd;
+            uint8_t cdhash[CS_CDHASH_LEN];
+            int batch = 16;
+            int err = 0;
+            unsigned long a = allocations;
+            double start = now();
+            for (int k = 0; k < batch; k++)
+            {
+                err |= cs_best_code_directory(sigs[i], sig_sizes[i], &cd);
+            }
+            double end = now();
+            parse.allocations += allocations - a;
+            sample(&parse, start, end, batch);
+            if (err)
+            {
+                continue;
+            }
+
+            a = allocations;
+            start = now();
+            for (int k = 0; k < batch; k++)
+            {
+                cs_cdhash(&cd, cdhash);
+            }
+            end = now();
+            hash.allocations += allocations - a;
+            hash.bytes += (unsigned long long)batch * cd.length;
+            sample(&hash, start, end, batch);
+        }
+    }
+    report_header("parse");
+    report("best code directory", &parse);
+    report("cdhash", &hash);
+    free(parse.us);
+    free(hash.us);
+    for (size_t i = 0; i < corpus_count; i++)
+    {
+        free(sigs[i]);
+    }
+    free(sigs);
+    free(sig_sizes);
+}
+
+static void bench_amfid(int iterations)
+{
+    struct samples io = {0};
+    struct samples parse = {0};
+    struct samples hash = {0};
+    struct samples total = {0};
+    report_header("amfid");
+
+    // a miss taken apart, the same steps cdhash_cache_hash_file goes through
+    for (int it = 0; it < iterations; it++)
+    {
+        for (size_t i = 0; i < corpus_count; i++)
+        {
+            struct cs_file cs;
+            struct cs_code_directory cd;
+            uint8_t cdhash[CS_CDHASH_LEN];
+            unsigned long a = allocations;
+            double t0 = now();
+            int err = cs_file_open(&cs, corpus[i]);
+            double t1 = now();
+            io.allocations += allocations - a;
+            sample(&io, t0, t1, 1);
+            if (err)
+            {
+                continue;
+            }
+            a = allocations;
+            t1 = now();
+            err = cs_best_code_directory(cs.sig, cs.sig_size, &cd);
+            double t2 = now();
+            parse.allocations += allocations - a;
+            sample(&parse, t1, t2, 1);
+            if (!err)
+            {
+                a = allocations;
+                t2 = now();
+                cs_cdhash(&cd, cdhash);
+                double t3 = now();
+                hash.allocations += allocations - a;
+                hash.bytes += cd.length;
+                sample(&hash, t2, t3, 1);
+            }
+            cs_file_close(&cs);
+        }
+    }
+    report("miss: open and map", &io);
+    report("miss: parse", &parse);
+    report("miss: hash", &hash);
+
+    // then whole, with a cold cache each pass, with one that's being saved as it goes, and warm
+    const char* names[] = {"miss", "miss, persisted", "hit"};
+    const char* cache_path = "/tmp/codesign_bench.cache";
+    for (int kind = 0; kind < 3; kind++)
+    {
+        struct cdhash_cache cache = CDHASH_CACHE_INITIALIZER;
+        for (int it = 0; it < iterations; it++)
+        {
+            if (kind < 2 || it == 0)
+            {
+                // freeing saves it, so that goes first
+                cdhash_cache_free(&cache);
+                unlink(cache_path);
+                cdhash_cache_init(&cache, CDHASH_CACHE_DEFAULT_CAPACITY, kind == 1 ? cache_path : NULL);
+            }
+            if (kind == 2 && it == 0)
+            {
+                for (size_t i = 0; i < corpus_count; i++)
+                {
+                    uint8_t cdhash[CDHASH_CACHE_HASH_SIZE];
+                    int cached;
+                    cdhash_cache_hash_file(&cache, corpus[i], cdhash, &cached);
+                }
+            }
+            for (size_t i = 0; i < corpus_count; i++)
+            {
+                uint8_t cdhash[CDHASH_CACHE_HASH_SIZE];
+                int cached;
+                unsigned long a = allocations;
+                double start = now();
+                cdhash_cache_hash_file(&cache, corpus[i], cdhash, &cached);
+                double end = now();
+                total.allocations += allocations - a;
+                sample(&total, start, end, 1);
+            }
+        }
+        report(names[kind], &total);
+        cdhash_cache_free(&cache);
+    }
+    unlink(cache_path);
+    free(io.us);
+    free(parse.us);
+    free(hash.us);
+    free(total.us);
+}
+
+// the cache by itself with made up files, a full one so inserts evict
+static void bench_cache(int iterations)
+{
+    struct cdhash_cache cache = CDHASH_CACHE_INITIALIZER;
+    uint32_t capacity = CDHASH_CACHE_DEFAULT_CAPACITY;
+    cdhash_cache_init(&cache, capacity, NULL);
+    uint8_t hash[CDHASH_CACHE_HASH_SIZE] = {0};
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_dev = 1;
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        st.st_ino = i;
+        st.st_size = i * 0x1000;
+        cdhash_cache_insert(&cache, &st, hash);
+    }
+
+    struct samples s = {0};
+    report_header("cache");
+    const char* names[] = {"lookup hit", "lookup miss", "insert, evicting"};
+    int batch = 64;
+    for (int kind = 0; kind < 3; kind++)
+    {
+        uint32_t next = capacity;
+        for (int it = 0; it < iterations; it++)
+        {
+            for (uint32_t base = 0; base < capacity; base += batch)
+            {
+                unsigned long a = allocations;
+                double start = now();
+                for (int k = 0; k < batch; k++)
+                {
+                    if (kind == 2)
+                    {
+                        st.st_ino = next++;
+                        st.st_size = st.st_ino * 0x1000;
+                        cdhash_cache_insert(&cache, &st, hash);
+                        continue;
+                    }
+                    // the misses have the right inode but a new size, a rebuilt binary
+                    st.st_ino = base + k;
+                    st.st_size = st.st_ino * 0x1000 + (kind == 1);
+                    cdhash_cache_lookup(&cache, &st, hash);
+                }
+                double end = now();
+                s.allocations += allocations - a;
+                sample(&s, start, end, batch);
+            }
+        }
+        report(names[kind], &s);
+    }
+    free(s.us);
+    cdhash_cache_free(&cache);
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = 10;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:g:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            case 'g':
+                return generate(optarg);
+            default:
+                iterations = 0;
+                break;
+        }
+    }
+    if (optind >= argc || iterations <= 0)
+    {
+        printf("Usage\n\t%s -g directory\n\t%s [-n iterations] file-or-directory...\n", argv[0], argv[0]);
+        return -1;
+    }
+
+    // picked lazily, do it before anything's timed
+    sha256_backend();
+    sha256_multi_backend();
+
+    for (int i = optind; i < argc; i++)
+    {
+        nftw(argv[i], add_file, 16, FTW_PHYS);
+    }
+    if (corpus_count == 0)
+    {
+        printf("no 64-bit Mach-O files found\n");
+        return -1;
+    }
+    printf("%zu Mach-O files, %d iterations\n\n", corpus_count, iterations);
+
+    // cs_file_open complains about unsigned files on stdout, keep that out of the results
+    fflush(stdout);
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    if (out == NULL || freopen("/dev/null", "w", stdout) == NULL)
+    {
+        return -1;
+    }
+
+    bench_locate(iterations);
+    bench_verify(iterations);
+    bench_sha256(iterations);
+    bench_parse(iterations);
+    bench_amfid(iterations);
+    bench_cache(iterations);
+
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,240 @@
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hexdump.h"
+
+/*
+
+Throughput of the hex formatting behind dump_pointer, dump_pointer_html and cat, against the printf
+and sprintf+strcat code they used to have. Doesn't need a device, from the utilities folder:
+cc -O2 -I../async_wake_ios ../async_wake_ios/hexdump.c hexdump_bench.c -o hexdump_bench
+./hexdump_bench [-n iterations]
+
+Each output is checked against what the old code printed before it's timed. MB/s is of the bytes
+being dumped, not of the text they turn into. The strcat versions are quadratic so they stop at 64K.
+
+*/
+
+#define MAX_SIZE 0x100000
+#define STRCAT_MAX 0x10000
+
+static FILE* devnull;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char* note_for(uint64_t value)
+{
+    return (value & 0xff) < 0x40 ? "com.apple.kernel:__TEXT_EXEC+0x1234" : "";
+}
+
+static void annotate(void* ctx, uint64_t value, char* note, size_t size)
+{
+    (void)ctx;
+    snprintf(note, size, "%s", note_for(value));
+}
+
+static void devnull_sink(void* ctx, const char* data, size_t len)
+{
+    (void)ctx;
+    fwrite(data, 1, len, devnull);
+}
+
+struct buffer_sink
+{
+    char* p;
+};
+
+static void buffer_sink(void* ctx, const char* data, size_t len)
+{
+    struct buffer_sink* b = ctx;
+    memcpy(b->p, data, len);
+    b->p += len;
+}
+
+// what cat and dump_pointer did, a printf a byte
+static void old_escaped_printf(const uint8_t* data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        fprintf(devnull, "\\x%02x", data[i]);
+    }
+}
+
+// what dump_pointer_html did, sprintf then strcat for every byte and every qword line
+static char* old_html(const uint8_t* data, size_t len, uint64_t addr)
+{
+    char* html = malloc(0x1000 + (len / 8) * 0x100 + len * 4);
+    strcpy(html, "<html>\n");
+    for (size_t i = 0; i + 8 <= len; i += 8)
+    {
+        char* tmp = malloc(0x2000);
+        uint64_t value;
+        memcpy(&value, data + i, 8);
+        sprintf(tmp, "<br>[<a href=/dump_ptr=0x%llx>0x%llx + 0x%02x</a>]\t<a href=/dump_ptr=0x%llx>0x%016llx</a>\t%s</ br>\n",
+                (unsigned long long)(addr + i), (unsigned long long)addr, (unsigned)i, (unsigned long long)value,
+                (unsigned long long)value, note_for(value));
+        strcat(html, tmp);
+        free(tmp);
+    }
+    strcat(html, "<br>");
+    for (size_t i = 0; i < len; i++)
+    {
+        char tmp[5];
+        sprintf(tmp, "\\x%02x", data[i]);
+        strcat(html, tmp);
+    }
+    strcat(html, "</ br></html>\n");
+    return html;
+}
+
+static char* new_html(const uint8_t* data, size_t len, uint64_t addr)
+{
+    const char* link = "/dump_ptr=";
+    char* html = malloc(0x40 + (len / 8) * (HEXDUMP_LINE_MAX + 2 * strlen(link) + 0x100) + HEXDUMP_ESCAPED_SIZE(len));
+    struct buffer_sink b = {html};
+    buffer_sink(&b, "<html>\n", 7);
+    struct hexdump_options opts = {HEXDUMP_HTML, addr, link, annotate, NULL};
+    hexdump_stream(&opts, data, len, buffer_sink, &b);
+    buffer_sink(&b, "<br>", 4);
+    b.p += hexdump_escaped(b.p, data, len);
+    buffer_sink(&b, "</ br></html>\n", 14);
+    *b.p = 0;
+    return html;
+}
+
+static int check(const uint8_t* data, size_t len, uint64_t addr)
+{
+    char* a = old_html(data, len, addr);
+    char* b = new_html(data, len, addr);
+    int same = strcmp(a, b) == 0;
+    free(a);
+    free(b);
+
+    char* hex = malloc(HEXDUMP_HEX_SIZE(len) + 1);
+    hex[hexdump_hex(hex, data, len)] = 0;
+    for (size_t i = 0; same && i < len; i++)
+    {
+        char pair[3];
+        snprintf(pair, sizeof(pair), "%02x", data[i]);
+        same = memcmp(hex + 2 * i, pair, 2) == 0;
+    }
+    free(hex);
+
+    char line[HEXDUMP_LINE_MAX + 0x100];
+    char expect[HEXDUMP_LINE_MAX + 0x100];
+    for (size_t i = 0; same && i + 8 <= len; i += 8)
+    {
+        uint64_t value;
+        memcpy(&value, data + i, 8);
+        line[hexdump_line(line, HEXDUMP_TEXT, NULL, addr, i, value, note_for(value))] = 0;
+        snprintf(expect, sizeof(expect), "[0x%llx + 0x%02x]\t0x%016llx\t%s\n", (unsigned long long)addr, (unsigned)i,
+                 (unsigned long long)value, note_for(value));
+        same = strcmp(line, expect) == 0;
+    }
+    return same;
+}
+
+static void report(const char* name, size_t len, int iterations, double seconds)
+{
+    printf("%-26s%10zx%12.1f%12.2f\n", name, len, (double)len * iterations / seconds / 1e6, seconds / iterations * 1e6);
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = 20;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        if (opt == 'n')
+        {
+            iterations = atoi(optarg);
+        } else {
+            printf("Usage\n\t%s [-n iterations]\n", argv[0]);
+            return -1;
+        }
+    }
+    devnull = fopen("/dev/null", "w");
+    uint8_t* data = malloc(MAX_SIZE);
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i < MAX_SIZE; i++)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        data[i] = seed >> 56;
+    }
+    uint64_t addr = 0xfffffff007004000ULL;
+    if (!check(data, STRCAT_MAX, addr) || !check(data + 3, 0x200 - 5, addr + 3))
+    {
+        printf("[-]\toutput doesn't match the old formatting\n");
+        return 1;
+    }
+
+    char* out = malloc(HEXDUMP_ESCAPED_SIZE(MAX_SIZE));
+    size_t sizes[] = {0x200, 0x4000, STRCAT_MAX, MAX_SIZE};
+    printf("%-26s%10s%12s%12s\n", "", "bytes", "MB/s", "us/call");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        size_t len = sizes[s];
+        // the slow ones get fewer goes at the big sizes
+        int slow = len > 0x4000 ? 1 + iterations / 10 : iterations;
+        double start = now();
+        for (int i = 0; i < slow; i++)
+        {
+            old_escaped_printf(data, len);
+        }
+        report("escaped, printf a byte", len, slow, now() - start);
+
+        start = now();
+        for (int i = 0; i < iterations; i++)
+        {
+            fwrite(out, 1, hexdump_escaped(out, data, len), devnull);
+        }
+        report("escaped, hexdump", len, iterations, now() - start);
+
+        start = now();
+        for (int i = 0; i < iterations; i++)
+        {
+            hexdump_hex(out, data, len);
+        }
+        report("hex, hexdump", len, iterations, now() - start);
+
+        if (len <= STRCAT_MAX)
+        {
+            start = now();
+            for (int i = 0; i < slow; i++)
+            {
+                free(old_html(data, len, addr));
+            }
+            report("html, sprintf+strcat", len, slow, now() - start);
+        }
+
+        start = now();
+        for (int i = 0; i < iterations; i++)
+        {
+            free(new_html(data, len, addr));
+        }
+        report("html, hexdump", len, iterations, now() - start);
+
+        struct hexdump_options text = {HEXDUMP_TEXT, addr, NULL, annotate, NULL};
+        start = now();
+        for (int i = 0; i < iterations; i++)
+        {
+            hexdump_stream(&text, data, len, devnull_sink, NULL);
+        }
+        report("text lines, hexdump", len, iterations, now() - start);
+        printf("\n");
+    }
+    free(out);
+    free(data);
+    fclose(devnull);
+    return 0;
+}
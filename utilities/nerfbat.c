@@ -7,9 +7,11 @@
 #include "mach_vm.h"
 #include "jailbreak.h"
 #include "symbols.h"
+#include "kernel_image.h"
 #include "kutils.h"
 #include "kmem.h"
 #include "code_hiding_for_sanity.h"
+#include "cdhash_cache.h"
 
 
 uint64_t leaked_proc;
@@ -23,8 +25,8 @@ extern uint64_t old_amfid_MISVSACI;
 
 /*
 Place inside of the async_wake_ios folder and compile via:
-`xcrun -sdk iphoneos -find clang` -Os -isysroot `xcrun -sdk iphoneos -show-sdk-path` -F`xcrun -sdk iphoneos -show-sdk-path`/System/Library/Frameworks -arch arm64 find_port.c symbols.c kmem.c kutils.c sha256.c code_hiding_for_sanity.c nerfbat.c -o nerfbat
-jtool --sign --inplace --ent ../examples/ent.xml nerfbat
+`xcrun -sdk iphoneos -find clang` -Os -isysroot `xcrun -sdk iphoneos -show-sdk-path` -F`xcrun -sdk iphoneos -show-sdk-path`/System/Library/Frameworks -arch arm64 find_port.c symbols.c kernel_image.c find_offsets.c kext_map.c symbolicator.c kmem.c kutils.c sha1.c sha256.c sha512.c codesign.c cdhash_cache.c entitlements.c hexdump.c code_hiding_for_sanity.c nerfbat.c -o nerfbat
+../utilities/adhocsign -e ../examples/ent.xml nerfbat
 
 */
 
@@ -36,6 +38,13 @@ int main(int argc, char** argv)
 {
     // THIS IS BOILERPLATE TO PROPERLY GAIN TFP0 AND INITIALIZE INTERNALS
     offsets_init();
+    // the jailbreak app leaves a copy of the kernel behind, use it to check the struct offsets
+    struct kernel_image img;
+    if (!kimg_load_dump(&img, "/tmp/kernel_dump"))
+    {
+        offsets_init_from_kernel(&img);
+        kimg_unload(&img);
+    }
     task_t kernel_task;
     host_get_special_port(mach_host_self(), HOST_LOCAL_NODE, 4, &kernel_task);
     task_self_addr();
@@ -56,6 +65,9 @@ int main(int argc, char** argv)
 
     set_platform_attribs(get_proc_block(getpid()), tfp0);
 
+    // keep the cdhashes we work out across restarts
+    cdhash_cache_init(&amfid_cdhash_cache, CDHASH_CACHE_DEFAULT_CAPACITY, "/tmp/nerfbat.cdhashes");
+
 
 
     uint32_t amfid_pid = 0;
@@ -101,11 +113,11 @@ int main(int argc, char** argv)
             fprintf(stderr, "[NERFBAT]\t[i]\tAMFID pid == %d\n", amfid_pid);
             uint64_t amfid_task = get_proc_block(amfid_pid);
             fprintf(stderr, "[NERFBAT]\t[i]\tGot amfid pid at 0x%llx\n", amfid_task);
-            uint64_t vnode_info = rk64(amfid_task+0x248);
+            uint64_t vnode_info = rk64(amfid_task+koffset(KSTRUCT_OFFSET_PROC_TEXTVP));
             fprintf(stderr, "[NERFBAT]\t[i]\tVNODE INFO : 0x%llx\n", vnode_info);
-            uint64_t ubc_info = rk64(vnode_info+0xf*sizeof(uint64_t));
+            uint64_t ubc_info = rk64(vnode_info+koffset(KSTRUCT_OFFSET_VNODE_V_UBCINFO));
             fprintf(stderr, "[NERFBAT]\t[i]\tMy UBC INFO is 0x%llx\n", ubc_info);
-            uint64_t blob = rk64(ubc_info+0xa*sizeof(uint64_t));
+            uint64_t blob = rk64(ubc_info+koffset(KSTRUCT_OFFSET_UBC_INFO_CS_BLOBS));
             char *csb = malloc(0xa8);
             mach_vm_address_t sz = 0;
             mach_vm_read_overwrite(tfp0, (mach_vm_address_t)blob, 0xa8, (mach_vm_address_t)csb, &sz);
@@ -131,6 +143,8 @@ int main(int argc, char** argv)
             unpatch_amfid(amfid_port, old_amfid_MISVSACI_local);
             patch_amfid(amfid_port);
         }
+        // whatever amfid asked about since last time, in case we get killed
+        cdhash_cache_flush(&amfid_cdhash_cache);
         fprintf(stderr, "[NERFBAT]\t[i]\tSleeping for 10 seconds...\n");
         sleep(10);
     }
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sha256.h"
+
+/*
+
+SHA-256 throughput of every back end this CPU supports, in MB/s across message sizes, then
+sha256_multi over a batch of code pages against looping sha256_update over them.
+Doesn't need a device, from the utilities folder on Linux or macOS:
+cc -O2 -I../async_wake_ios ../async_wake_ios/sha256.c sha256_bench.c -o sha256_bench
+./sha256_bench [seconds per measurement]
+
+*/
+
+static const size_t sizes[] = {64, 256, 1024, 4096, 16384, 65536, 1 << 20};
+#define N_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double measure(const BYTE* buf, size_t len, double seconds)
+{
+    SHA256_CTX ctx;
+    BYTE hash[SHA256_BLOCK_SIZE];
+    unsigned long long bytes = 0;
+    double start = now();
+    double elapsed = 0;
+    // check the clock every batch rather than every message, the small sizes would measure clock_gettime
+    size_t batch = (1 << 20) / len + 1;
+    do
+    {
+        for (size_t i = 0; i < batch; i++)
+        {
+            sha256_init(&ctx);
+            sha256_update(&ctx, buf, len);
+            sha256_final(&ctx, hash);
+        }
+        bytes += (unsigned long long)batch * len;
+        elapsed = now() - start;
+    } while (elapsed < seconds);
+    return bytes / elapsed / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 0.5;
+    BYTE* buf = malloc(sizes[N_SIZES - 1]);
+    if (buf == NULL)
+    {
+        return 1;
+    }
+    for (size_t i = 0; i < sizes[N_SIZES - 1]; i++)
+    {
+        buf[i] = (BYTE)(i * 2654435761u >> 24);
+    }
+
+    const char* default_backend = sha256_backend();
+    printf("default back end: %s\n\n", default_backend);
+    printf("%-10s", "MB/s");
+    for (size_t s = 0; s < N_SIZES; s++)
+    {
+        printf("%10zu", sizes[s]);
+    }
+    printf("\n");
+
+    const char* name;
+    for (int b = 0; (name = sha256_backend_name(b)) != NULL; b++)
+    {
+        if (sha256_set_backend(name))
+        {
+            printf("%-10s  not supported on this CPU\n", name);
+            continue;
+        }
+        printf("%-10s", name);
+        for (size_t s = 0; s < N_SIZES; s++)
+        {
+            printf("%10.1f", measure(buf, sizes[s], seconds));
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+
+    // a signature's worth of pages, hashed as a batch
+    size_t page_sizes[] = {4096, 16384};
+    size_t n_pages = sizes[N_SIZES - 1] / page_sizes[0];
+    struct sha256_message* pages = malloc(n_pages * sizeof(struct sha256_message));
+    BYTE (*hashes)[SHA256_BLOCK_SIZE] = malloc(n_pages * SHA256_BLOCK_SIZE);
+    if (pages == NULL || hashes == NULL)
+    {
+        return 1;
+    }
+
+    sha256_set_backend(default_backend);
+    printf("\ndefault multi-buffer back end: %s\n\n", sha256_multi_backend());
+    printf("%-18s%10s%10s\n", "MB/s", "4K pages", "16K pages");
+
+    printf("%-18s", "sha256_update loop");
+    for (int p = 0; p < 2; p++)
+    {
+        size_t n = sizes[N_SIZES - 1] / page_sizes[p];
+        unsigned long long bytes = 0;
+        double start = now();
+        double elapsed = 0;
+        do
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                SHA256_CTX ctx;
+                sha256_init(&ctx);
+                sha256_update(&ctx, buf + i * page_sizes[p], page_sizes[p]);
+                sha256_final(&ctx, hashes[i]);
+            }
+            bytes += n * page_sizes[p];
+            elapsed = now() - start;
+        } while (elapsed < seconds);
+        printf("%10.1f", bytes / elapsed / 1e6);
+    }
+    printf("\n");
+
+    for (int b = 0; (name = sha256_multi_backend_name(b)) != NULL; b++)
+    {
+        if (sha256_set_multi_backend(name))
+        {
+            printf("%-18s  not supported on this CPU\n", name);
+            continue;
+        }
+        printf("%-18s", name);
+        for (int p = 0; p < 2; p++)
+        {
+            size_t n = sizes[N_SIZES - 1] / page_sizes[p];
+            for (size_t i = 0; i < n; i++)
+            {
+                pages[i].data = buf + i * page_sizes[p];
+                pages[i].len = page_sizes[p];
+            }
+            unsigned long long bytes = 0;
+            double start = now();
+            double elapsed = 0;
+            do
+            {
+                sha256_multi(pages, n, hashes);
+                bytes += n * page_sizes[p];
+                elapsed = now() - start;
+            } while (elapsed < seconds);
+            printf("%10.1f", bytes / elapsed / 1e6);
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+
+    free(hashes);
+    free(pages);
+    free(buf);
+    return 0;
+}
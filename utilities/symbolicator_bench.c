@@ -0,0 +1,208 @@
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "symbolicator.h"
+#include "symbols.h"
+
+/*
+
+symbolicator_lookup's Eytzinger search against bsearch over the same sorted entries, a million
+random kernel addresses a go. Doesn't need a device or a kernel, the tables are made up. From the
+utilities folder on macOS (kernel_image.h wants <mach-o/loader.h>):
+cc -O2 -I../async_wake_ios ../async_wake_ios/symbolicator.c symbolicator_bench.c -o symbolicator_bench
+./symbolicator_bench [-n lookups]
+
+Both searches are checked against each other for every address before anything is timed. 15B202 has
+around 40K symbols once the kexts' segments are in, the other sizes are there to show where the
+tree stops fitting in cache.
+
+*/
+
+#define KERNEL_BASE 0xfffffff007004000ULL
+
+// symbolicator.c only uses these when it's building from a real kernel
+int probably_have_correct_symbols(void)
+{
+    return 0;
+}
+
+uint64_t ksym(enum ksymbol sym)
+{
+    (void)sym;
+    return 0;
+}
+
+const char* ksymbol_name(enum ksymbol sym)
+{
+    (void)sym;
+    return "";
+}
+
+int kimg_for_each_symbol(struct kernel_image* img, struct mach_header_64* hdr, kimg_symbol_callback callback, void* ctx)
+{
+    (void)img;
+    (void)hdr;
+    (void)callback;
+    (void)ctx;
+    return 0;
+}
+
+struct mach_header_64* kimg_header(struct kernel_image* img)
+{
+    (void)img;
+    return NULL;
+}
+
+const char* kext_map_bundle_id(struct kext_map* map, struct kext_segment* seg)
+{
+    (void)map;
+    (void)seg;
+    return "";
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t random64()
+{
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return seed ^ (seed >> 29);
+}
+
+// the entry an address falls in is the one whose range up to the next entry holds it
+static struct symbol_entry* bsearch_end;
+
+static int compare_range(const void* key, const void* element)
+{
+    uint64_t addr = *(const uint64_t*)key;
+    const struct symbol_entry* e = element;
+    if (addr < e->addr)
+    {
+        return -1;
+    }
+    return (e + 1 == bsearch_end || addr < e[1].addr) ? 0 : 1;
+}
+
+// what symbolicator_lookup would be without the Eytzinger layout
+static const char* bsearch_lookup(struct symbolicator* sym, uint64_t addr, uint64_t* offset)
+{
+    bsearch_end = sym->entries + sym->count;
+    struct symbol_entry* e = bsearch(&addr, sym->entries, sym->count, sizeof(struct symbol_entry), compare_range);
+    if (e == NULL || e->source == SYMBOL_SOURCE_END || addr - e->addr > SYMBOLICATOR_MAX_OFFSET)
+    {
+        return NULL;
+    }
+    *offset = addr - e->addr;
+    return sym->strings + e->name;
+}
+
+// functions a few hundred bytes apart with the odd gap between kexts
+static uint64_t build(struct symbolicator* sym, uint32_t count)
+{
+    char name[0x20];
+    uint64_t addr = KERNEL_BASE;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        snprintf(name, sizeof(name), "_function_%u", i);
+        int end = random64() % 500 == 0;
+        if (symbolicator_add(sym, addr, end ? "" : name, end ? SYMBOL_SOURCE_END : SYMBOL_SOURCE_SYMTAB))
+        {
+            return 0;
+        }
+        addr += end ? 0x200000 : 4 * (1 + random64() % 0x100);
+    }
+    return symbolicator_finalize(sym) ? 0 : addr;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t lookups = 1000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        if (opt == 'n')
+        {
+            lookups = atoi(optarg);
+        } else {
+            printf("Usage\n\t%s [-n lookups]\n", argv[0]);
+            return -1;
+        }
+    }
+    uint64_t* addrs = malloc(lookups * sizeof(uint64_t));
+    if (addrs == NULL)
+    {
+        return 1;
+    }
+
+    uint32_t sizes[] = {1000, 40000, 1000000};
+    printf("%10s%12s%12s%12s\n", "symbols", "bsearch ns", "eytz ns", "found");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        struct symbolicator sym = {0};
+        uint64_t end = build(&sym, sizes[s]);
+        if (end == 0)
+        {
+            printf("[-]\tran out of memory building %u symbols\n", sizes[s]);
+            return 1;
+        }
+        for (uint32_t i = 0; i < lookups; i++)
+        {
+            addrs[i] = KERNEL_BASE - 0x1000 + random64() % (end - KERNEL_BASE + 0x2000);
+        }
+
+        uint32_t found = 0;
+        for (uint32_t i = 0; i < lookups; i++)
+        {
+            uint64_t a = 0, b = 0;
+            const char* x = bsearch_lookup(&sym, addrs[i], &a);
+            const char* y = symbolicator_lookup(&sym, addrs[i], &b);
+            if (x != y || a != b)
+            {
+                printf("[-]\tthe searches disagree about 0x%llx: %s+0x%llx against %s+0x%llx\n",
+                       (unsigned long long)addrs[i], x ? x : "(none)", (unsigned long long)a, y ? y : "(none)",
+                       (unsigned long long)b);
+                return 1;
+            }
+            found += x != NULL;
+        }
+
+        // summed so neither loop gets thrown away
+        uint64_t sum = 0;
+        double start = now();
+        for (uint32_t i = 0; i < lookups; i++)
+        {
+            uint64_t offset = 0;
+            sum += bsearch_lookup(&sym, addrs[i], &offset) != NULL ? offset : 1;
+        }
+        double bsearch_s = now() - start;
+
+        start = now();
+        for (uint32_t i = 0; i < lookups; i++)
+        {
+            uint64_t offset = 0;
+            sum -= symbolicator_lookup(&sym, addrs[i], &offset) != NULL ? offset : 1;
+        }
+        double eytz_s = now() - start;
+
+        if (sum != 0)
+        {
+            printf("[-]\tthe searches disagree\n");
+            return 1;
+        }
+        printf("%10u%12.1f%12.1f%12u\n", sym.count, bsearch_s / lookups * 1e9, eytz_s / lookups * 1e9, found);
+        symbolicator_free(&sym);
+    }
+    free(addrs);
+    return 0;
+}
@@ -0,0 +1,434 @@
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "codesign.h"
+#include "sha256.h"
+#include "trust_cache.h"
+
+/*
+
+Builds a trust cache for a tree of binaries, e.g. /jailbreak once bins.tar is unpacked, so the whole
+lot can be trusted in one go rather than each binary going through amfid on its first exec.
+Doesn't need a device, from the utilities folder on Linux or macOS:
+cc -O2 -pthread -I../async_wake_ios ../async_wake_ios/sha1.c ../async_wake_ios/sha256.c ../async_wake_ios/sha512.c ../async_wake_ios/codesign.c ../async_wake_ios/trust_cache.c tcbuild.c -o tcbuild
+./tcbuild [-j threads] [-v] -o out.tc directory...
+./tcbuild [-j threads] -c in.tc directory...      lists the Mach-Os that aren't in in.tc
+
+Only the paths (-c) and hashes (-v) go to stdout, everything else including what codesign.c has to
+say about a file goes to stderr, so the output can be piped straight into something else.
+
+Directories and files are both tasks. Each worker keeps its own deque, pushes what it finds onto the
+back and takes work from the back, so it walks depth first through files it just listed. An idle
+worker steals from the front of someone else's deque, which is where the oldest and usually biggest
+pieces of work (whole directories) are.
+
+*/
+
+enum task_kind
+{
+    TASK_DIRECTORY,
+    TASK_FILE,
+};
+
+struct task
+{
+    enum task_kind kind;
+    char* path;
+};
+
+// a ring buffer, the owner uses the tail and thieves the head
+struct deque
+{
+    pthread_mutex_t lock;
+    struct task* tasks;
+    size_t head;
+    size_t count;
+    size_t capacity;
+};
+
+struct worker
+{
+    pthread_t thread;
+    int id;
+    struct deque dq;
+    unsigned int seed;
+
+    uint8_t (*hashes)[TRUST_CACHE_HASH_LEN];
+    uint32_t n_hashes;
+    uint32_t hashes_capacity;
+
+    unsigned long directories;
+    unsigned long files;
+    unsigned long machos;
+    unsigned long unsigned_machos;
+    unsigned long unsupported;
+    unsigned long steals;
+};
+
+static struct worker* workers;
+static int n_workers;
+static atomic_long pending;     // tasks pushed but not finished yet
+static int verbose;
+static const struct trust_cache* check_against;
+static FILE* results;           // the real stdout, stdout itself is pointed at stderr
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// a trust cache with some of the tree quietly missing is worse than none
+static void* checked(void* p)
+{
+    if (p == NULL)
+    {
+        fprintf(stderr, "[-]\tout of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void push(struct worker* w, enum task_kind kind, char* path)
+{
+    atomic_fetch_add(&pending, 1);
+    struct deque* dq = &w->dq;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count == dq->capacity)
+    {
+        size_t capacity = dq->capacity ? dq->capacity * 2 : 256;
+        struct task* tasks = checked(malloc(capacity * sizeof(struct task)));
+        for (size_t i = 0; i < dq->count; i++)
+        {
+            tasks[i] = dq->tasks[(dq->head + i) % dq->capacity];
+        }
+        free(dq->tasks);
+        dq->tasks = tasks;
+        dq->head = 0;
+        dq->capacity = capacity;
+    }
+    struct task* t = &dq->tasks[(dq->head + dq->count) % dq->capacity];
+    t->kind = kind;
+    t->path = path;
+    dq->count++;
+    pthread_mutex_unlock(&dq->lock);
+}
+
+static int pop(struct worker* w, struct task* t)
+{
+    struct deque* dq = &w->dq;
+    pthread_mutex_lock(&dq->lock);
+    int found = dq->count != 0;
+    if (found)
+    {
+        dq->count--;
+        *t = dq->tasks[(dq->head + dq->count) % dq->capacity];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static int steal(struct worker* w, struct task* t)
+{
+    // start somewhere random so the thieves don't all pile onto the same victim
+    int start = rand_r(&w->seed) % n_workers;
+    for (int i = 0; i < n_workers; i++)
+    {
+        struct worker* victim = &workers[(start + i) % n_workers];
+        if (victim == w)
+        {
+            continue;
+        }
+        struct deque* dq = &victim->dq;
+        pthread_mutex_lock(&dq->lock);
+        int found = dq->count != 0;
+        if (found)
+        {
+            *t = dq->tasks[dq->head];
+            dq->head = (dq->head + 1) % dq->capacity;
+            dq->count--;
+        }
+        pthread_mutex_unlock(&dq->lock);
+        if (found)
+        {
+            w->steals++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void list_directory(struct worker* w, const char* path)
+{
+    DIR* dir = opendir(path);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "[-]\tcan't open directory %s\n", path);
+        return;
+    }
+    w->directories++;
+    struct dirent* de;
+    while ((de = readdir(dir)) != NULL)
+    {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+        {
+            continue;
+        }
+        size_t len = strlen(path) + 1 + strlen(de->d_name) + 1;
+        char* child = checked(malloc(len));
+        snprintf(child, len, "%s/%s", path, de->d_name);
+
+        // symlinks aren't followed, whatever they point at is either in the tree already or isn't ours
+        unsigned char type = de->d_type;
+        if (type == DT_UNKNOWN)
+        {
+            struct stat st;
+            type = lstat(child, &st) ? DT_UNKNOWN : S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type == DT_DIR)
+        {
+            push(w, TASK_DIRECTORY, child);
+        } else if (type == DT_REG) {
+            push(w, TASK_FILE, child);
+        } else {
+            free(child);
+        }
+    }
+    closedir(dir);
+}
+
+static int is_macho(const char* path)
+{
+    uint8_t magic[4];
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return 0;
+    }
+    ssize_t n = read(fd, magic, sizeof(magic));
+    close(fd);
+    if (n != sizeof(magic))
+    {
+        return 0;
+    }
+    // thin arm64 is little endian, universal headers are big endian
+    return !memcmp(magic, "\xcf\xfa\xed\xfe", 4) || !memcmp(magic, "\xca\xfe\xba\xbe", 4) || !memcmp(magic, "\xca\xfe\xba\xbf", 4);
+}
+
+static void hash_file(struct worker* w, const char* path)
+{
+    w->files++;
+    if (!is_macho(path))
+    {
+        return;
+    }
+    w->machos++;
+
+    struct cs_file cs;
+    if (cs_file_open(&cs, path))
+    {
+        w->unsigned_machos++;
+        return;
+    }
+    struct cs_code_directory cd;
+    uint8_t cdhash[CS_CDHASH_LEN];
+    int err = cs_best_code_directory(cs.sig, cs.sig_size, &cd) || cs_cdhash(&cd, cdhash);
+    cs_file_close(&cs);
+    if (err)
+    {
+        fprintf(stderr, "[-]\tcan't compute the cdhash of %s\n", path);
+        w->unsupported++;
+        return;
+    }
+
+    if (check_against)
+    {
+        if (!trust_cache_lookup(check_against, cdhash))
+        {
+            fprintf(results, "%s\n", path);
+        }
+        return;
+    }
+    if (verbose)
+    {
+        char hex[CS_CDHASH_LEN * 2 + 1];
+        for (int i = 0; i < CS_CDHASH_LEN; i++)
+        {
+            sprintf(hex + i * 2, "%02x", cdhash[i]);
+        }
+        fprintf(results, "%s %s\n", hex, path);
+    }
+    if (w->n_hashes == w->hashes_capacity)
+    {
+        w->hashes_capacity = w->hashes_capacity ? w->hashes_capacity * 2 : 256;
+        w->hashes = checked(realloc(w->hashes, w->hashes_capacity * (size_t)TRUST_CACHE_HASH_LEN));
+    }
+    memcpy(w->hashes[w->n_hashes++], cdhash, TRUST_CACHE_HASH_LEN);
+}
+
+static void* worker_thread(void* arg)
+{
+    struct worker* w = arg;
+    struct task t;
+    for (;;)
+    {
+        if (pop(w, &t) || steal(w, &t))
+        {
+            if (t.kind == TASK_DIRECTORY)
+            {
+                list_directory(w, t.path);
+            } else {
+                hash_file(w, t.path);
+            }
+            free(t.path);
+            // children were counted before this is, so pending can't hit zero early
+            atomic_fetch_sub(&pending, 1);
+            continue;
+        }
+        if (atomic_load(&pending) == 0)
+        {
+            break;
+        }
+        sched_yield();
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    const char* output = NULL;
+    const char* check = NULL;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    n_workers = ncpu > 0 ? (int)ncpu : 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:o:c:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 'j':
+                n_workers = atoi(optarg);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'c':
+                check = optarg;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-j threads] [-v] -o out.tc directory...\n", argv[0]);
+                fprintf(stderr, "       %s [-j threads] -c in.tc directory...\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc || n_workers < 1 || (output == NULL) == (check == NULL))
+    {
+        fprintf(stderr, "usage: %s [-j threads] [-v] -o out.tc directory...\n", argv[0]);
+        fprintf(stderr, "       %s [-j threads] -c in.tc directory...\n", argv[0]);
+        return 1;
+    }
+
+    // codesign.c and trust_cache.c printf their complaints, those mustn't end up in with the results
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    if (results == NULL || dup2(STDERR_FILENO, STDOUT_FILENO) == -1)
+    {
+        fprintf(stderr, "[-]\tcan't set up stdout\n");
+        return 1;
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    struct trust_cache tc;
+    if (check)
+    {
+        if (trust_cache_open(&tc, check))
+        {
+            return 1;
+        }
+        check_against = &tc;
+    }
+
+    // pick the SHA-256 back end before there are threads to race over it
+    sha256_backend();
+
+    workers = checked(calloc(n_workers, sizeof(struct worker)));
+    for (int i = 0; i < n_workers; i++)
+    {
+        workers[i].id = i;
+        workers[i].seed = i + 1;
+        pthread_mutex_init(&workers[i].dq.lock, NULL);
+    }
+    for (int i = optind; i < argc; i++)
+    {
+        struct stat st;
+        if (stat(argv[i], &st))
+        {
+            fprintf(stderr, "[-]\tcan't stat %s\n", argv[i]);
+            continue;
+        }
+        push(&workers[0], S_ISDIR(st.st_mode) ? TASK_DIRECTORY : TASK_FILE, checked(strdup(argv[i])));
+    }
+
+    double start = now();
+    for (int i = 0; i < n_workers; i++)
+    {
+        pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]);
+    }
+    for (int i = 0; i < n_workers; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+    }
+    double elapsed = now() - start;
+
+    unsigned long directories = 0, files = 0, machos = 0, unsigned_machos = 0, unsupported = 0;
+    uint32_t total = 0;
+    for (int i = 0; i < n_workers; i++)
+    {
+        struct worker* w = &workers[i];
+        fprintf(stderr, "worker %2d: %6lu files %5lu directories %5lu steals\n", i, w->files, w->directories, w->steals);
+        directories += w->directories;
+        files += w->files;
+        machos += w->machos;
+        unsigned_machos += w->unsigned_machos;
+        unsupported += w->unsupported;
+        total += w->n_hashes;
+    }
+    fprintf(stderr, "%lu files in %lu directories, %lu Mach-Os (%lu unsigned, %lu unsupported hash types) in %.3fs with %d threads\n",
+            files, directories, machos, unsigned_machos, unsupported, elapsed, n_workers);
+
+    if (check)
+    {
+        trust_cache_close(&tc);
+        return fclose(results) != 0;
+    }
+
+    uint8_t (*hashes)[TRUST_CACHE_HASH_LEN] = checked(malloc((total + 1) * (size_t)TRUST_CACHE_HASH_LEN));
+    uint32_t n = 0;
+    for (int i = 0; i < n_workers; i++)
+    {
+        if (workers[i].n_hashes)
+        {
+            memcpy(hashes[n], workers[i].hashes, workers[i].n_hashes * (size_t)TRUST_CACHE_HASH_LEN);
+            n += workers[i].n_hashes;
+        }
+    }
+    if (trust_cache_write(output, hashes, &n))
+    {
+        return 1;
+    }
+    fprintf(stderr, "wrote %u cdhashes (%u duplicates dropped) to %s\n", n, total - n, output);
+    return fclose(results) != 0;
+}
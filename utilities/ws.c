@@ -6,6 +6,9 @@
 #include "mach_vm.h"
 #include "webserver.h"
 #include "symbols.h"
+#include "kernel_image.h"
+#include "kext_map.h"
+#include "symbolicator.h"
 #include "kutils.h"
 #include "code_hiding_for_sanity.h"
 
@@ -20,8 +23,8 @@ extern uint64_t rk64(uint64_t kaddr);
 /*
 
 Place inside of the async_wake_ios folder and compile via:
-`xcrun -sdk iphoneos -find clang` -Os -isysroot `xcrun -sdk iphoneos -show-sdk-path` -F`xcrun -sdk iphoneos -show-sdk-path`/System/Library/Frameworks -arch arm64 find_port.c symbols.c kmem.c kutils.c sha256.c code_hiding_for_sanity.c webserver.c ws.c -o ws
-jtool --sign --inplace --ent ../examples/ent.xml ws
+`xcrun -sdk iphoneos -find clang` -Os -isysroot `xcrun -sdk iphoneos -show-sdk-path` -F`xcrun -sdk iphoneos -show-sdk-path`/System/Library/Frameworks -arch arm64 find_port.c symbols.c kernel_image.c find_offsets.c kext_map.c symbolicator.c kmem.c kutils.c sha1.c sha256.c sha512.c codesign.c cdhash_cache.c entitlements.c hexdump.c code_hiding_for_sanity.c http_server.c http_parser.c dir_listing.c tar_stream.c proc_list.c webserver.c ws.c -o ws
+../utilities/adhocsign -e ../examples/ent.xml ws
 
 */
 extern mach_port_t tfp0;
@@ -38,6 +41,15 @@ int main(int argc, char** argv)
 
     // THIS IS BOILERPLATE TO PROPERLY GAIN TFP0 AND INITIALIZE INTERNALS
     offsets_init();
+    // the jailbreak app leaves a copy of the kernel behind, use it to check the struct offsets
+    struct kernel_image img;
+    if (!kimg_load_dump(&img, "/tmp/kernel_dump"))
+    {
+        offsets_init_from_kernel(&img);
+        kext_map_build(&kernel_kexts, &img);
+        symbolicator_build_kernel(&kernel_symbols, &img, &kernel_kexts, NULL);
+        kimg_unload(&img);
+    }
     task_t kernel_task;
     host_get_special_port(mach_host_self(), HOST_LOCAL_NODE, 4, &kernel_task);
     task_self_addr();
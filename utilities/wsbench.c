@@ -0,0 +1,564 @@
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "http_server.h"
+
+/*
+
+Load test for ws. Without a host it runs the same event loop ws uses in process, serving a small
+in memory page at /small, a file at /file, a listing built up with http_printf at /list, the file
+again through a producer, chunked, at /stream and at /slow a page that takes 20ms on a worker
+thread like a blocking handler would, so it works on Linux. In process it also prints how
+many syscalls each response took. From the utilities folder:
+cc -O2 -pthread -I../async_wake_ios ../async_wake_ios/http_server.c ../async_wake_ios/http_parser.c wsbench.c -o wsbench
+./wsbench [-c connections] [-n requests] [-s file size] [-k] [-b] [-S stalled] [-p pieces] [-B busy] [-a aborted] [-r range] [-u path] [host port]
+
+-c clients at once, each on its own thread (default 64)
+-n requests in total (default 20000)
+-k a new connection for every request instead of keep-alive
+-b files go through a buffer instead of sendfile
+-r a Range header to send, like bytes=0-1023 or bytes=0-99,-100
+-S connections that send half a request and then sit there, they shouldn't slow anyone else down
+-p send each request in this many separate writes, for the parser picking up where it left off
+-B clients fetching /slow the whole time, they shouldn't slow anyone else down either
+-a downloads of /file (or -u's path against a host) abandoned partway through first, the
+   server should shrug those off and not die of a SIGPIPE from sendfile
+-u what to fetch, /small by default
+
+Point it at a device with `./wsbench -u /info 192.168.1.10 80`.
+
+*/
+
+struct client
+{
+    pthread_t thread;
+    const char* path;
+    int busy;                   // keeps going until the others are done
+    int requests;
+    double* us;
+    int done;
+    int errors;
+    unsigned long long bytes;
+};
+
+static const char* host = "127.0.0.1";
+static const char* port;
+static const char* path = "/small";
+static int keep_alive = 1;
+static const char* range;
+static int pieces = 1;
+static atomic_int busy_stop;
+static int slow_endpoint = -1;
+static char small_page[128];
+static char file_path[] = "/tmp/wsbench.XXXXXX";
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// /stream, a buffer's worth of the file each call
+static int produce_file(struct http_conn* conn, void* state)
+{
+    char buf[0x4000];
+    ssize_t n = read((int)(long)state, buf, sizeof(buf));
+    if (n <= 0)
+    {
+        return 1;
+    }
+    http_write(conn, buf, n);
+    return 0;
+}
+
+static void release_file(void* state)
+{
+    close((int)(long)state);
+}
+
+static void serve_slow(struct http_conn* conn, struct http_request* req, void* ctx)
+{
+    (void)req;
+    (void)ctx;
+    struct timespec ts = {0, 20 * 1000 * 1000};
+    nanosleep(&ts, NULL);
+    http_respond(conn, 200, "text/html", small_page, sizeof(small_page));
+}
+
+static void serve(struct http_conn* conn, struct http_request* req, void* ctx)
+{
+    (void)ctx;
+    if (strcmp(req->path, "/slow") == 0)
+    {
+        http_defer(conn, slow_endpoint, serve_slow, NULL);
+        return;
+    }
+    if (strcmp(req->path, "/small") == 0)
+    {
+        http_respond(conn, 200, "text/html", small_page, sizeof(small_page));
+        return;
+    }
+    if (strcmp(req->path, "/list") == 0)
+    {
+        // about what ws's directory listing looks like for a folder of 200 files
+        http_begin(conn, 200, "text/html");
+        http_printf(conn, "<html><h1>\tListing [%s]</h1><br>\n", "/tmp/");
+        for (int i = 0; i < 200; i++)
+        {
+            http_printf(conn, "<a href=\"/tmp/file%d\">file%d</a><br>\n", i, i);
+        }
+        http_printf(conn, "<html>");
+        return;
+    }
+    if (strcmp(req->path, "/stream") == 0)
+    {
+        int fd = open(file_path, O_RDONLY);
+        http_begin(conn, 200, "application/octet-stream");
+        if (fd != -1)
+        {
+            http_stream(conn, produce_file, release_file, (void*)(long)fd);
+        }
+        return;
+    }
+    int fd = strcmp(req->path, "/file") == 0 ? open(file_path, O_RDONLY) : -1;
+    if (fd == -1)
+    {
+        http_respond(conn, 404, "text/plain", "Not Found\n", 10);
+        return;
+    }
+    http_respond_file(conn, req, fd, "application/octet-stream");
+}
+
+static void* run_server(void* server)
+{
+    http_server_run(server);
+    return NULL;
+}
+
+static int connect_to_server()
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+    {
+        return -1;
+    }
+    int fd = socket(res->ai_family, res->ai_socktype, 0);
+    if (fd != -1 && connect(fd, res->ai_addr, res->ai_addrlen) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd != -1)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+// asks for a big response, takes the first bit and then hangs up while the server's still sending. Returns how many got as far as a response
+static int abort_downloads(int n, const char* what)
+{
+    int started = 0;
+    for (int i = 0; i < n; i++)
+    {
+        int fd = connect_to_server();
+        if (fd == -1)
+        {
+            continue;
+        }
+        char request[1024];
+        int len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n", what, host);
+        char buf[0x1000];
+        if (send(fd, request, len, 0) == len && recv(fd, buf, sizeof(buf), 0) > 0)
+        {
+            started++;
+        }
+        // unread data makes this a reset, and the server's next write after that an EPIPE
+        close(fd);
+    }
+    return started;
+}
+
+// a chunked body, have bytes of which are already at start. Returns its length, -1 on error
+static long long read_chunked(int fd, char* buf, size_t size, char* start, size_t have)
+{
+    long long body = 0;
+    memmove(buf, start, have);
+    for (;;)
+    {
+        buf[have] = 0;
+        char* line_end = strstr(buf, "\r\n");
+        if (line_end == NULL)
+        {
+            if (have == size - 1)
+            {
+                return -1;
+            }
+            ssize_t n = recv(fd, buf + have, size - 1 - have, 0);
+            if (n <= 0)
+            {
+                return -1;
+            }
+            have += n;
+            continue;
+        }
+        long long chunk = strtoll(buf, NULL, 16);
+        // the size line, the data and the CRLF after it, the last one is just 0 and two CRLFs
+        long long skip = line_end + 2 - buf + chunk + 2;
+        if ((long long)have < skip)
+        {
+            for (skip -= have, have = 0; skip > 0; )
+            {
+                ssize_t n = recv(fd, buf, skip < (long long)size ? (size_t)skip : size, 0);
+                if (n <= 0)
+                {
+                    return -1;
+                }
+                skip -= n;
+            }
+        } else {
+            memmove(buf, buf + skip, have - skip);
+            have -= skip;
+        }
+        body += chunk;
+        if (chunk == 0)
+        {
+            return body;
+        }
+    }
+}
+
+// one response, the head and then a Content-Length or chunked body. Returns the body length, -1 on error
+static long long read_response(int fd, char* buf, size_t size)
+{
+    size_t len = 0;
+    char* end = NULL;
+    while (end == NULL)
+    {
+        if (len == size - 1)
+        {
+            return -1;
+        }
+        ssize_t n = recv(fd, buf + len, size - 1 - len, 0);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        len += n;
+        buf[len] = 0;
+        end = strstr(buf, "\r\n\r\n");
+    }
+    if (strncmp(buf, "HTTP/1.1 200", 12) != 0 && strncmp(buf, "HTTP/1.1 206", 12) != 0)
+    {
+        return -1;
+    }
+    char* cl = NULL;
+    for (char* line = strstr(buf, "\r\n"); line != NULL && line < end; line = strstr(line + 2, "\r\n"))
+    {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0)
+        {
+            cl = line + 17;
+            break;
+        }
+    }
+    if (cl == NULL)
+    {
+        return read_chunked(fd, buf, size, end + 4, len - (end + 4 - buf));
+    }
+    long long body = strtoll(cl, NULL, 10);
+    long long have = len - (end + 4 - buf);
+    // nothing is pipelined so anything past the head is this body
+    while (have < body)
+    {
+        ssize_t n = recv(fd, buf, size, 0);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        have += n;
+    }
+    return body;
+}
+
+static void* run_client(void* arg)
+{
+    struct client* c = arg;
+    char request[512];
+    int request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n%s%s%s\r\n",
+                               c->path, host, keep_alive ? "keep-alive" : "close", range ? "Range: " : "",
+                               range ? range : "", range ? "\r\n" : "");
+    char* buf = malloc(0x10000);
+    int fd = -1;
+    while (c->busy ? !atomic_load(&busy_stop) : c->done + c->errors < c->requests)
+    {
+        double start = now();
+        if (fd == -1)
+        {
+            fd = connect_to_server();
+        }
+        long long body = -1;
+        int sent = 0;
+        for (int i = 0; fd != -1 && i < pieces; i++)
+        {
+            int len = request_len * (i + 1) / pieces - sent;
+            if (send(fd, request + sent, len, 0) != len)
+            {
+                break;
+            }
+            sent += len;
+        }
+        if (fd != -1 && sent == request_len)
+        {
+            body = read_response(fd, buf, 0x10000);
+        }
+        if (body < 0)
+        {
+            c->errors++;
+        } else {
+            if (!c->busy)
+            {
+                c->us[c->done] = (now() - start) * 1e6;
+            }
+            c->done++;
+            c->bytes += body;
+        }
+        if (body < 0 || !keep_alive)
+        {
+            if (fd != -1)
+            {
+                close(fd);
+            }
+            fd = -1;
+        }
+    }
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    free(buf);
+    return NULL;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv)
+{
+    int connections = 64;
+    int requests = 20000;
+    long file_size = 0x100000;
+    int stalled = 0;
+    int busy = 0;
+    int aborted = 0;
+    int no_sendfile = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:s:kbS:p:B:a:r:u:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                connections = atoi(optarg);
+                break;
+            case 'n':
+                requests = atoi(optarg);
+                break;
+            case 's':
+                file_size = atol(optarg);
+                break;
+            case 'k':
+                keep_alive = 0;
+                break;
+            case 'b':
+                no_sendfile = 1;
+                break;
+            case 'p':
+                pieces = atoi(optarg);
+                break;
+            case 'B':
+                busy = atoi(optarg);
+                break;
+            case 'a':
+                aborted = atoi(optarg);
+                break;
+            case 'r':
+                range = optarg;
+                break;
+            case 'S':
+                stalled = atoi(optarg);
+                break;
+            case 'u':
+                path = optarg;
+                break;
+            default:
+                connections = 0;
+                break;
+        }
+    }
+    if (connections <= 0 || requests < connections || pieces <= 0 || (argc - optind != 0 && argc - optind != 2))
+    {
+        printf("Usage\n\t%s [-c connections] [-n requests] [-s file size] [-k] [-b] [-S stalled] [-p pieces] [-B busy] [-a aborted] [-r range] [-u path] [host port]\n", argv[0]);
+        return -1;
+    }
+
+    struct http_server* server = NULL;
+    pthread_t server_thread;
+    char port_str[16];
+    if (argc - optind == 2)
+    {
+        host = argv[optind];
+        port = argv[optind + 1];
+    } else {
+        memset(small_page, 'x', sizeof(small_page));
+        int fd = mkstemp(file_path);
+        char chunk[0x10000];
+        memset(chunk, 'y', sizeof(chunk));
+        for (long left = file_size; fd != -1 && left > 0; left -= sizeof(chunk))
+        {
+            write(fd, chunk, left < (long)sizeof(chunk) ? (size_t)left : sizeof(chunk));
+        }
+        if (fd != -1)
+        {
+            close(fd);
+        }
+
+        struct http_server_options opts = {0};
+        opts.port = "0";
+        opts.handler = serve;
+        opts.quiet = 1;
+        opts.no_sendfile = no_sendfile;
+        opts.max_connections = connections + stalled + busy + 16;
+        server = http_server_create(&opts);
+        if (server == NULL)
+        {
+            return -1;
+        }
+        slow_endpoint = http_server_endpoint(server, "slow", 4);
+        snprintf(port_str, sizeof(port_str), "%d", http_server_port(server));
+        port = port_str;
+        pthread_create(&server_thread, NULL, run_server, server);
+    }
+
+    int aborted_started = abort_downloads(aborted, server ? "/file" : path);
+
+    // half a request each, the server has to keep them around without waiting on them
+    int* stalled_fds = calloc(stalled + 1, sizeof(int));
+    for (int i = 0; i < stalled; i++)
+    {
+        stalled_fds[i] = connect_to_server();
+        if (stalled_fds[i] != -1)
+        {
+            send(stalled_fds[i], "GET /small HT", 13, 0);
+        }
+    }
+
+    struct client* busy_clients = calloc(busy + 1, sizeof(struct client));
+    for (int i = 0; i < busy; i++)
+    {
+        busy_clients[i].path = "/slow";
+        busy_clients[i].busy = 1;
+        pthread_create(&busy_clients[i].thread, NULL, run_client, &busy_clients[i]);
+    }
+
+    struct client* clients = calloc(connections, sizeof(struct client));
+    double start = now();
+    for (int i = 0; i < connections; i++)
+    {
+        clients[i].path = path;
+        clients[i].requests = requests / connections + (i < requests % connections);
+        clients[i].us = malloc(clients[i].requests * sizeof(double));
+        pthread_create(&clients[i].thread, NULL, run_client, &clients[i]);
+    }
+    double* us = malloc(requests * sizeof(double));
+    int done = 0;
+    int errors = 0;
+    unsigned long long bytes = 0;
+    for (int i = 0; i < connections; i++)
+    {
+        pthread_join(clients[i].thread, NULL);
+        memcpy(us + done, clients[i].us, clients[i].done * sizeof(double));
+        done += clients[i].done;
+        errors += clients[i].errors;
+        bytes += clients[i].bytes;
+        free(clients[i].us);
+    }
+    double elapsed = now() - start;
+    atomic_store(&busy_stop, 1);
+    int busy_done = 0;
+    for (int i = 0; i < busy; i++)
+    {
+        pthread_join(busy_clients[i].thread, NULL);
+        busy_done += busy_clients[i].done;
+    }
+
+    printf("%s:%s%s, %d clients, %s, %d stalled, %d busy%s%s\n", host, port, path, connections,
+           keep_alive ? "keep-alive" : "a connection per request", stalled, busy, range ? ", " : "", range ? range : "");
+    if (aborted)
+    {
+        printf("%d downloads abandoned partway through (%d had started) before that\n", aborted, aborted_started);
+    }
+    printf("%12s%12s%10s%10s%10s%10s%10s\n", "requests/s", "MB/s", "p50 us", "p90 us", "p99 us", "max us", "errors");
+    if (done > 0)
+    {
+        qsort(us, done, sizeof(double), compare_doubles);
+        printf("%12.0f%12.1f%10.0f%10.0f%10.0f%10.0f%10d\n", done / elapsed, bytes / elapsed / 1e6, us[done / 2],
+               us[done * 9 / 10], us[done * 99 / 100], us[done - 1], errors);
+    } else {
+        printf("%12s%12s%10s%10s%10s%10s%10d\n", "-", "-", "-", "-", "-", "-", errors);
+    }
+
+    for (int i = 0; i < stalled; i++)
+    {
+        if (stalled_fds[i] != -1)
+        {
+            close(stalled_fds[i]);
+        }
+    }
+    if (server)
+    {
+        http_server_stop(server);
+        pthread_join(server_thread, NULL);
+        struct http_stats stats;
+        http_server_stats(server, &stats);
+        if (stats.responses > 0)
+        {
+            printf("server: %llu responses, %.1f syscalls and %.0f bytes each\n", (unsigned long long)stats.responses,
+                   (double)stats.syscalls / stats.responses, (double)stats.bytes / stats.responses);
+        }
+        struct http_endpoint_stats slow;
+        if (stats.deferred > 0 && http_endpoint_stats(server, slow_endpoint, &slow) == 0)
+        {
+            printf("workers: %llu deferred (%d of them from the busy clients), queue depth up to %u, up to %d waiting for /slow\n",
+                   (unsigned long long)stats.deferred, busy_done, stats.max_queue_depth, slow.max_waiting);
+        }
+        http_server_free(server);
+        unlink(file_path);
+    }
+    free(stalled_fds);
+    free(busy_clients);
+    free(clients);
+    free(us);
+    return errors != 0;
+}